@@ -21,7 +21,7 @@ public:
     bool hello(const std::shared_ptr<Request>& req, const std::shared_ptr<Response>& res)
     {
         std::string body;
-        body = "Hello " + req->getVariable("name", "... what's your name ?\n");
+        body = "Hello " + req->getVariable("name", req->username() + "\n");
         res->send(body);
         return true;
     }
@@ -51,6 +51,7 @@ int main()
     Server server("8080");
     server.setBasicAuthUsername("admin");
     server.setBasicAuthPassword("admin");
+    server.addBasicAuthUser("guest", "guest");
     server.registerController(&myController);
 
     signal(SIGINT, handle_signal);
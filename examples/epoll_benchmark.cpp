@@ -0,0 +1,285 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "Controller.h"
+#include "Request.h"
+#include "Response.h"
+#include "Server.h"
+
+using namespace std;
+using namespace Mongoose;
+
+/**
+ * Shows how the event backends scale with idle connections: from 1k to 100k connections that never send
+ * anything are kept open by a child process, while this one times how long a poll takes and how long
+ * requests on other connections take meanwhile. select is only measured with as many idle connections as
+ * FD_SETSIZE allows, past that it can't wait for the sockets.
+ *
+ * 100k connections need as many file descriptors on each side (see ulimit -n) and, on the loopback interface,
+ * several source addresses: the child spreads them over 127.0.0.1, 127.0.0.2...
+ */
+
+static const int PORT = 18091;
+static const int POLLS = 1000;
+static const int REQUESTS = 2000;
+//Connections per source address, under the ephemeral port range
+static const int CONNECTIONS_PER_ADDRESS = 20000;
+
+class PingController : public Controller
+{
+public:
+    bool ping(const std::shared_ptr<Request>& request, const std::shared_ptr<Response>& response)
+    {
+        response->send("pong\n");
+        return true;
+    }
+
+    void setup()
+    {
+        addRoute("GET", "/ping", PingController, ping);
+    }
+};
+
+static bool raiseFileLimit(rlim_t files)
+{
+    struct rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+
+    if (limit.rlim_cur >= files)
+    {
+        return true;
+    }
+
+    limit.rlim_cur = std::min(files, limit.rlim_max);
+    return setrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur >= files;
+}
+
+static int connectTo(uint32_t source)
+{
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (s < 0)
+    {
+        return -1;
+    }
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(source);
+
+#ifdef IP_BIND_ADDRESS_NO_PORT
+    int on = 1;
+    setsockopt(s, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &on, sizeof(on));
+#endif
+
+    if (source != INADDR_LOOPBACK && bind(s, (struct sockaddr *) &address, sizeof(address)) != 0)
+    {
+        close(s);
+        return -1;
+    }
+
+    address.sin_port = htons(PORT);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (connect(s, (struct sockaddr *) &address, sizeof(address)) != 0)
+    {
+        close(s);
+        return -1;
+    }
+
+    return s;
+}
+
+/**
+ * Forks a process opening count idle connections, it keeps them until the pipe closes
+ * @return the write end of the pipe, or -1
+ */
+static int openIdleConnections(int count, pid_t *child)
+{
+    int fds[2];
+
+    if (pipe(fds) != 0)
+    {
+        return -1;
+    }
+
+    *child = fork();
+
+    if (*child == 0)
+    {
+        close(fds[1]);
+        std::vector<int> connections;
+
+        for (int i = 0; i < count; i++)
+        {
+            //connect() returns once the kernel completed the handshake, the server accepts them as it polls
+            int s = connectTo(INADDR_LOOPBACK + i / CONNECTIONS_PER_ADDRESS);
+
+            if (s < 0)
+            {
+                cerr << "Error, only " << i << " idle connections could be opened: " << strerror(errno) << endl;
+                break;
+            }
+
+            connections.push_back(s);
+        }
+
+        char byte;
+        while (read(fds[0], &byte, 1) > 0)
+        {
+        }
+
+        _exit(EXIT_SUCCESS);
+    }
+
+    close(fds[0]);
+    return *child > 0 ? fds[1] : -1;
+}
+
+static bool roundTrip()
+{
+    static const char request[] = "GET /ping HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    char buffer[1024];
+    size_t received = 0;
+    int s = connectTo(INADDR_LOOPBACK);
+
+    if (s < 0)
+    {
+        return false;
+    }
+
+    int on = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    if (write(s, request, sizeof(request) - 1) != (ssize_t) sizeof(request) - 1)
+    {
+        close(s);
+        return false;
+    }
+
+    ssize_t length;
+    while ((length = read(s, buffer, sizeof(buffer))) > 0)
+    {
+        received += length;
+    }
+
+    close(s);
+    return received > 0;
+}
+
+static void measure(const char *name, Server::EventBackend backend, int idle)
+{
+    PingController controller;
+    Server server(("127.0.0.1:" + std::to_string(PORT)).c_str());
+    server.setEventBackend(backend);
+    server.registerController(&controller);
+
+    if (!server.start())
+    {
+        cerr << "Error, unable to start the server" << endl;
+        return;
+    }
+
+    pid_t child;
+    int idleProcess = openIdleConnections(idle, &child);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(60);
+
+    //Accept them all first
+    while (idleProcess >= 0 && server.connectionCount() < (size_t) idle && std::chrono::steady_clock::now() < deadline)
+    {
+        server.poll(10);
+    }
+
+    size_t connections = server.connectionCount();
+
+    //What every turn of the event loop costs with nothing to do
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < POLLS; i++)
+    {
+        server.poll(0);
+    }
+    double pollTime = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+    //Requests on other connections, the poll loop runs on this thread as the connections are only its to use
+    std::atomic_bool done(false);
+    std::atomic<int> failures(0);
+    double requestTime = 0;
+
+    std::thread client([&]() {
+        auto start = std::chrono::steady_clock::now();
+
+        for (int i = 0; i < REQUESTS; i++)
+        {
+            if (!roundTrip())
+            {
+                failures++;
+            }
+        }
+
+        requestTime = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        done = true;
+    });
+
+    while (!done)
+    {
+        server.poll(1);
+    }
+
+    client.join();
+
+    cout << name << ", " << connections << " idle connections: " << pollTime / POLLS << " us/poll, "
+         << requestTime / REQUESTS << " us/request";
+
+    if (failures > 0)
+    {
+        cout << " (" << failures << " failed)";
+    }
+
+    cout << endl;
+
+    if (idleProcess >= 0)
+    {
+        close(idleProcess);
+        waitpid(child, NULL, 0);
+    }
+
+    server.stop();
+}
+
+int main()
+{
+    //A request failing while the child is gone shouldn't kill the benchmark
+    signal(SIGPIPE, SIG_IGN);
+
+    //The idle connections, the listener and a request's connection all have to fit under FD_SETSIZE
+    measure("select", Server::SelectBackend, FD_SETSIZE - 64);
+
+    for (int idle: {1000, 10000, 100000})
+    {
+        if (!raiseFileLimit(idle + 1024))
+        {
+            cout << "epoll, " << idle << " idle connections: skipped, raise the open files limit (ulimit -n)" << endl;
+            continue;
+        }
+
+        measure("epoll", Server::EpollBackend, idle);
+    }
+
+    return EXIT_SUCCESS;
+}
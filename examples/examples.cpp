@@ -15,12 +15,20 @@
 #include "Sessions.h"
 #include "Controller.h"
 #include "Utils.h"
+#include "WebSocketHub.h"
+#include "EventSourceHub.h"
+#include "HttpClient.h"
+#include "JsonWriter.h"
+#include "ProxyController.h"
 
 using namespace Mongoose;
 
 class MyController : public Controller
 {
     Sessions mSessions;
+    WebSocketHub mChat;
+    EventSourceHub mChatEvents;
+    std::map<const Request*, size_t> mReceivedBytes;
 
     public: 
         bool hello(const std::shared_ptr<Request>& req, const std::shared_ptr<Response>& res)
@@ -93,7 +101,7 @@ class MyController : public Controller
         {
             std::stringstream responseBody;
             responseBody << "<html>";
-            responseBody << "<h1>File upload demo (don't forget to create a tmp/ directory)</h1>";
+            responseBody << "<h1>File upload demo</h1>";
             responseBody << "<form enctype=\"multipart/form-data\" method=\"post\">";
             responseBody << "Choose a file to upload: <input name=\"file\" type=\"file\" /><br />";
             responseBody << "<input type=\"hidden\" name=\"my fancy variable name\" value=\"my fancy variable value\" />";
@@ -148,6 +156,117 @@ class MyController : public Controller
                 return true;
             });
 
+            //Conditional requests: the version is known up front, the page is only built for clients without it
+            registerRoute("GET", "/cached", [=](const std::shared_ptr<Request>& req, const std::shared_ptr<Response>& res)
+            {
+                if (res->notModified("v1"))
+                {
+                    return true;
+                }
+
+                return res->sendHtml("<h1>Version 1</h1>");
+            });
+
+            //Websocket demo: every message is broadcast to everyone connected to /chat
+            WebSocketHandler chat;
+            chat.onOpen = [=](const std::shared_ptr<WebSocket>& socket)
+            {
+                mChat.subscribe(socket, "chat");
+            };
+            chat.onMessage = [=](const std::shared_ptr<WebSocket>& socket, const std::string& message, bool binary)
+            {
+                mChat.publish("chat", message, binary);
+
+                if (!binary)
+                {
+                    mChatEvents.publish("chat", message);
+                }
+            };
+            chat.onClose = [=](const std::shared_ptr<WebSocket>& socket)
+            {
+                mChat.unsubscribe(socket, "chat");
+            };
+            registerWebSocketRoute("/chat", chat);
+
+            //Server sent events demo: the same chat, read only, for an EventSource
+            registerRoute("GET", "/chat/events", [=](const std::shared_ptr<Request>& req, const std::shared_ptr<Response>& res)
+            {
+                return mChatEvents.subscribe(req, res, "chat");
+            });
+
+            //Streamed json: serialized straight to the connection, never held in memory as a whole
+            registerRoute("GET", "/numbers", [=](const std::shared_ptr<Request>& req, const std::shared_ptr<Response>& res)
+            {
+                int count = std::stoi(req->getVariable("count", "1000"));
+                JsonWriter json(res);
+                json.beginArray();
+
+                for (int i = 0; i < count && json.isValid(); i++)
+                {
+                    json.beginObject().key("number").value(i).key("square").value((long long)i * i).endObject();
+                }
+
+                json.endArray();
+                return json.end();
+            });
+
+            //Backpressure: lines are only generated as fast as the client reads them
+            registerRoute("GET", "/lines", [=](const std::shared_ptr<Request>& req, const std::shared_ptr<Response>& res)
+            {
+                auto remaining = std::make_shared<int>(std::stoi(req->getVariable("count", "1000000")));
+                Response *response = res.get();
+
+                res->sendHeaders();
+                res->onWritable([=]
+                {
+                    while (*remaining > 0 && response->isWritable())
+                    {
+                        response->write("Line " + std::to_string((*remaining)--) + "\n");
+                    }
+
+                    if (*remaining == 0)
+                    {
+                        response->end();
+                    }
+                });
+
+                return true;
+            });
+
+            //Streamed request bodies: counted as they arrive, however large, without ever being held in memory
+            registerRoute("PUT", "/count", [=](const std::shared_ptr<Request>& req, const std::shared_ptr<Response>& res)
+            {
+                size_t received = mReceivedBytes[req.get()];
+                mReceivedBytes.erase(req.get());
+                return res->send("Received " + std::to_string(received) + " bytes\n");
+            },
+            [=](const std::shared_ptr<Request>& req, const std::shared_ptr<Response>& res, const char *data, size_t size)
+            {
+                mReceivedBytes[req.get()] += size;
+                return true;
+            });
+            setBodySizeLimit("PUT", "/count", 0);
+
+            //Json request bodies: only the members read are decoded
+            registerRoute("POST", "/sum", [=](const std::shared_ptr<Request>& req, const std::shared_ptr<Response>& res)
+            {
+                JsonView numbers = req->json()["numbers"];
+                if (!numbers.isArray())
+                {
+                    return res->send(400, "Expected {\"numbers\": [...]}\n");
+                }
+
+                double sum = 0;
+                for (const auto& number: numbers.elements())
+                {
+                    sum += number.asDouble();
+                }
+
+                JsonWriter json(res);
+                json.beginObject().key("sum").value(sum).endObject();
+                return json.end();
+            });
+
 #ifdef HAS_JSON11
             //Generic register route
             registerRoute("GET", "/json", [=](const std::shared_ptr<Request>& req, const std::shared_ptr<Response>& res)
@@ -180,9 +299,19 @@ int main()
     signal(SIGINT, handle_signal);
 
     MyController myController;
+    AccessLog accessLog("access.log");
     Server server("8080");
+    server.setAccessLog(&accessLog);
     server.registerController(&myController);
     server.setDirectoryListingEnabled(false);
+    server.setBodySizeLimit(1024*1024);
+    server.setAutomaticETags(true);
+
+    //Proxies /loopback/... back to this very server, eg. /loopback/lines?count=100000
+    HttpClient client(&server);
+    ProxyController proxy(&client);
+    proxy.addUpstream("/loopback/", "127.0.0.1:8080", true);
+    server.registerController(&proxy);
 
     if (server.start())
     {
@@ -0,0 +1,117 @@
+#include <stdlib.h>
+#include <chrono>
+#include <iostream>
+
+#include "AbstractRequestCoprocessor.h"
+#include "Controller.h"
+#include "Pipeline.h"
+
+using namespace std;
+using namespace Mongoose;
+
+/**
+ * Compares the cost of running requests through four coprocessors registered on a controller (virtual calls
+ * over a vector) with the same four stages composed in a Pipeline. The stages only count, so what is measured
+ * is the chain itself.
+ */
+
+static const int ITERATIONS = 10000000;
+
+class CountingCoprocessor: public AbstractRequestCoprocessor
+{
+public:
+    bool preProcess(const std::shared_ptr<Request>& request, const std::shared_ptr<Response>& response) override
+    {
+        count++;
+        return true;
+    }
+
+    bool postProcess(const std::shared_ptr<Request>& request, const std::shared_ptr<Response>& response) override
+    {
+        count++;
+        return true;
+    }
+
+    long count{0};
+};
+
+struct CountingStage
+{
+    bool preProcess(const std::shared_ptr<Request>& request, const std::shared_ptr<Response>& response)
+    {
+        count++;
+        return true;
+    }
+
+    void postProcess(const std::shared_ptr<Request>& request, const std::shared_ptr<Response>& response)
+    {
+        count++;
+    }
+
+    long count{0};
+};
+
+class BenchmarkController: public Controller
+{
+public:
+    bool process(const std::shared_ptr<Request>& request, const std::shared_ptr<Response>& response) override
+    {
+        handled++;
+        return true;
+    }
+
+    long handled{0};
+};
+
+template<typename Function>
+static void measure(const char *name, Function function)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        function();
+    }
+
+    double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    cout << name << ": " << elapsed / ITERATIONS << " ns/request" << endl;
+}
+
+int main()
+{
+    //The stages don't look at the request, there is no connection to build one from anyway
+    std::shared_ptr<Request> request;
+    std::shared_ptr<Response> response;
+
+    BenchmarkController virtualController;
+    CountingCoprocessor coprocessors[4];
+    for (auto& coprocessor: coprocessors)
+    {
+        virtualController.registerCoprocessor(&coprocessor);
+    }
+
+    measure("Controller coprocessors", [&]() {
+        virtualController.handleRequest(request, response);
+    });
+
+    BenchmarkController controller;
+    auto pipeline = makePipeline(CountingStage(), CountingStage(), CountingStage(), CountingStage());
+
+    //The way Server::handleRequest goes through it
+    AbstractPipeline *serverPipeline = &pipeline;
+    measure("Pipeline around a controller", [&]() {
+        serverPipeline->handle(request, response, &controller);
+    });
+
+    measure("Pipeline around a lambda", [&]() {
+        pipeline.run(request, response, [&controller](const std::shared_ptr<Request>&, const std::shared_ptr<Response>&) {
+            controller.handled++;
+            return true;
+        });
+    });
+
+    long counted = pipeline.stage<0>().count + coprocessors[0].count;
+    cout << "(" << virtualController.handled + controller.handled + counted << " calls)" << endl;
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,39 @@
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "Controller.h"
+#include "Prefork.h"
+#include "Request.h"
+#include "Response.h"
+#include "Server.h"
+
+using namespace std;
+using namespace Mongoose;
+
+class MyController : public Controller
+{
+public:
+    bool hello(const std::shared_ptr<Request>& req, const std::shared_ptr<Response>& res)
+    {
+        res->send("Hello from worker " + std::to_string(getpid()) + "\n");
+        return true;
+    }
+
+    void setup()
+    {
+        addRoute("GET", "/hello", MyController, hello);
+        addRoute("GET", "/", MyController, hello);
+    }
+};
+
+int main()
+{
+    MyController myController;
+    Server server("8080");
+    server.registerController(&myController);
+
+    //kill -HUP <master pid> to replace the workers without dropping connections
+    Prefork prefork(&server, 4);
+    std::cout << "Master " << getpid() << " starting 4 workers" << std::endl;
+    return prefork.run();
+}
@@ -0,0 +1,91 @@
+#include <stdlib.h>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Controller.h"
+
+using namespace std;
+using namespace Mongoose;
+
+/**
+ * Compares matching urls against exact routes with matching them against regex routes (ENABLE_REGEX_URL),
+ * ROUTES of each, the way Server asks every controller whether it handles a request. The urls change on
+ * every call: the last regex match is remembered, repeating a url would only measure that.
+ */
+
+static const int ITERATIONS = 1000000;
+static const int ROUTES = 20;
+static const int IDS = 1000;
+
+template<typename Function>
+static void measure(const char *name, Function function)
+{
+    long handled = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        handled += function(i) ? 1 : 0;
+    }
+
+    double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    cout << name << ": " << elapsed / ITERATIONS << " ns/request (" << handled << " handled)" << endl;
+}
+
+int main()
+{
+    RequestHandler handler = [](const std::shared_ptr<Request>&, const std::shared_ptr<Response>&) {
+        return true;
+    };
+
+    //Exact routes, /users0 ... /users19
+    Controller exactController;
+    std::vector<std::string> exactUrls;
+
+    for (int route = 0; route < ROUTES; route++)
+    {
+        exactUrls.push_back("/users" + std::to_string(route));
+        exactController.registerRoute("GET", exactUrls.back(), handler);
+    }
+
+    measure("Exact routes", [&](int i) {
+        return exactController.handles("GET", exactUrls[i % ROUTES]);
+    });
+
+#ifdef ENABLE_REGEX_URL
+    //As many patterns, /users0/([0-9]+) ... /users19/([0-9]+)
+    Controller regexController;
+    std::vector<std::string> regexUrls;
+    std::vector<std::string> lastUrls;
+
+    for (int route = 0; route < ROUTES; route++)
+    {
+        regexController.registerRoute("GET", exactUrls[route] + "/([0-9]+)", handler);
+    }
+
+    for (int id = 0; id < IDS; id++)
+    {
+        regexUrls.push_back(exactUrls[id % ROUTES] + "/" + std::to_string(id));
+        lastUrls.push_back(exactUrls[ROUTES - 1] + "/" + std::to_string(id));
+    }
+
+    measure("Regex routes", [&](int i) {
+        return regexController.handles("GET", regexUrls[i % IDS]);
+    });
+
+    //Only the last pattern matches, the regex goes through all the alternatives first
+    measure("Regex routes, last one matching", [&](int i) {
+        return regexController.handles("GET", lastUrls[i % IDS]);
+    });
+
+    measure("Regex routes, none matching", [&](int i) {
+        return regexController.handles("GET", "/groups/" + std::to_string(i % IDS));
+    });
+#else
+    cout << "Regex routes: not measured, build with ENABLE_REGEX_URL" << endl;
+#endif
+
+    return EXIT_SUCCESS;
+}
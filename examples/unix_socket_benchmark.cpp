@@ -0,0 +1,162 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+#include "Controller.h"
+#include "Request.h"
+#include "Response.h"
+#include "Server.h"
+
+using namespace std;
+using namespace Mongoose;
+
+/**
+ * Compares serving the same requests over TCP on the loopback interface and over a unix domain socket,
+ * the way a reverse proxy on the same host would reach the server. Every request is a connection of its own,
+ * as responses close their connection: what is measured is the whole round trip, connection included.
+ */
+
+static const int ITERATIONS = 10000;
+static const int PORT = 18090;
+static const char *SOCKET_PATH = "/tmp/mongoose-benchmark.sock";
+
+class PingController : public Controller
+{
+public:
+    bool ping(const std::shared_ptr<Request>& request, const std::shared_ptr<Response>& response)
+    {
+        response->send("pong\n");
+        return true;
+    }
+
+    void setup()
+    {
+        addRoute("GET", "/ping", PingController, ping);
+    }
+};
+
+static int connectTcp()
+{
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(PORT);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    int on = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    if (connect(s, (struct sockaddr *) &address, sizeof(address)) != 0)
+    {
+        close(s);
+        return -1;
+    }
+
+    return s;
+}
+
+static int connectUnix()
+{
+    int s = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, SOCKET_PATH, sizeof(address.sun_path) - 1);
+
+    if (connect(s, (struct sockaddr *) &address, sizeof(address)) != 0)
+    {
+        close(s);
+        return -1;
+    }
+
+    return s;
+}
+
+//Sends a request and reads its response, up to the server closing the connection
+static bool roundTrip(int s)
+{
+    static const char request[] = "GET /ping HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    char buffer[1024];
+    size_t received = 0;
+
+    if (s < 0 || write(s, request, sizeof(request) - 1) != (ssize_t) sizeof(request) - 1)
+    {
+        return false;
+    }
+
+    ssize_t length;
+    while ((length = read(s, buffer, sizeof(buffer))) > 0)
+    {
+        received += length;
+    }
+
+    close(s);
+    return received > 0;
+}
+
+template<typename Function>
+static void measure(const char *name, Function connectFunction)
+{
+    int failures = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        if (!roundTrip(connectFunction()))
+        {
+            failures++;
+        }
+    }
+
+    double elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    cout << name << ": " << elapsed / ITERATIONS << " us/request, " << ITERATIONS * 1000000.0 / elapsed
+         << " requests/s";
+
+    if (failures > 0)
+    {
+        cout << " (" << failures << " failed)";
+    }
+
+    cout << endl;
+}
+
+int main()
+{
+    PingController controller;
+    Server server(("127.0.0.1:" + std::to_string(PORT)).c_str());
+    server.addBindAddress(std::string("unix:") + SOCKET_PATH);
+    server.registerController(&controller);
+
+    if (!server.start())
+    {
+        cerr << "Error, unable to start the server" << endl;
+        return EXIT_FAILURE;
+    }
+
+    std::atomic_bool running(true);
+    std::thread loop([&server, &running]() {
+        while (running)
+        {
+            server.poll(10);
+        }
+    });
+
+    measure("TCP (127.0.0.1)", connectTcp);
+    measure("Unix domain socket", connectUnix);
+
+    running = false;
+    loop.join();
+    server.stop();
+
+    return EXIT_SUCCESS;
+}
@@ -25,6 +25,16 @@ namespace Mongoose
             Server* server() const { return mServer; }
             void setServer(Server *server) { mServer = server; }
 
+            /**
+             * @brief preRequest - Called by the Server (see Server::registerCoprocessor) for every incoming
+             * http message, before any Request/Response pair is allocated for it.
+             * @param connection - the raw client connection
+             * @param message - the parsed http message, only valid for the duration of this call
+             * @return false if the coprocessor rejected the request. The coprocessor is then responsible
+             * for writing the reply to the connection.
+             */
+            virtual bool preRequest(struct mg_connection *connection, struct http_message *message) { return true; }
+
             virtual bool preProcess(const std::shared_ptr<Request>& request, const std::shared_ptr<Response>& response) { return true; }
             virtual bool postProcess(const std::shared_ptr<Request>& request, const std::shared_ptr<Response>& response) { return true; }
 
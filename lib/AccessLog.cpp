@@ -0,0 +1,441 @@
+#include <chrono>
+#include <ctime>
+
+#ifndef WIN32
+#include <sys/file.h>
+#include <sys/stat.h>
+#endif
+
+#include "AccessLog.h"
+
+//Records are written out in batches of about this size
+static const size_t BATCH_SIZE = 64*1024;
+
+static std::atomic<uint64_t> sNextId(1);
+
+namespace Mongoose
+{
+AccessLog::Ring::Ring(size_t size):
+    head(0),
+    tail(0)
+{
+    //A power of two, so that positions wrap with a mask
+    size_t capacity = 1;
+    while (capacity < size)
+    {
+        capacity <<= 1;
+    }
+
+    records.reset(new Record[capacity]);
+    mask = capacity - 1;
+}
+
+AccessLog::AccessLog(const std::string &path, size_t ringSize):
+    mPath(path),
+    mRingSize(ringSize > 0 ? ringSize : 1),
+    mId(sNextId++),
+    mFile(nullptr),
+    mFileSize(0),
+    mFormat("%h - - %t \"%m %U\" %s %b %D"),
+    mIsBinary(false),
+    mRotateSize(0),
+    mRotateFiles(5),
+    mFlushInterval(200),
+    mIsStarted(false),
+    mIsReopenPending(false),
+    mWrittenRecords(0),
+    mDroppedRecords(0),
+    mIsStopping(false)
+{
+}
+
+AccessLog::~AccessLog()
+{
+    {
+        std::lock_guard<std::mutex> lock(mThreadMutex);
+        mIsStopping = true;
+    }
+
+    mCondition.notify_all();
+
+    if (mThread.joinable())
+    {
+        mThread.join();
+    }
+
+    flush();
+
+    if (mFile)
+    {
+        fclose(mFile);
+    }
+}
+
+bool AccessLog::log(const Record &record)
+{
+    if (!mIsStarted)
+    {
+        start();
+    }
+
+    Ring *ring = this->ring();
+    size_t head = ring->head.load(std::memory_order_relaxed);
+
+    if (head - ring->tail.load(std::memory_order_acquire) > ring->mask)
+    {
+        //Never wait for the disk: under overload records are lost, not requests slowed down
+        mDroppedRecords++;
+        return false;
+    }
+
+    ring->records[head & ring->mask] = record;
+    ring->head.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+AccessLog::Ring *AccessLog::ring()
+{
+    //The ring of the last log the thread wrote to, so that the common case takes no lock
+    static thread_local uint64_t cachedId = 0;
+    static thread_local Ring *cachedRing = nullptr;
+
+    if (cachedId != mId)
+    {
+        std::lock_guard<std::mutex> lock(mRingsMutex);
+        std::unique_ptr<Ring>& ring = mRings[std::this_thread::get_id()];
+
+        if (!ring)
+        {
+            ring.reset(new Ring(mRingSize));
+        }
+
+        cachedId = mId;
+        cachedRing = ring.get();
+    }
+
+    return cachedRing;
+}
+
+void AccessLog::start()
+{
+    std::lock_guard<std::mutex> lock(mThreadMutex);
+
+    if (!mIsStarted && !mIsStopping)
+    {
+        mThread = std::thread(&AccessLog::run, this);
+        mIsStarted = true;
+    }
+}
+
+void AccessLog::run()
+{
+    std::unique_lock<std::mutex> lock(mThreadMutex);
+
+    while (!mIsStopping)
+    {
+        mCondition.wait_for(lock, std::chrono::milliseconds(flushInterval()), [this] { return mIsStopping; });
+
+        lock.unlock();
+        flush();
+        lock.lock();
+    }
+}
+
+void AccessLog::flush()
+{
+    std::lock_guard<std::mutex> lock(mFlushMutex);
+
+    std::string format;
+    bool isBinary;
+    size_t rotateSize;
+    int rotateFiles;
+    {
+        std::lock_guard<std::mutex> settingsLock(mSettingsMutex);
+        format = mFormat;
+        isBinary = mIsBinary;
+        rotateSize = mRotateSize;
+        rotateFiles = mRotateFiles;
+    }
+
+    std::vector<Ring *> rings;
+    {
+        std::lock_guard<std::mutex> ringsLock(mRingsMutex);
+        for (const auto& ring: mRings)
+        {
+            rings.push_back(ring.second.get());
+        }
+    }
+
+    if (mIsReopenPending.exchange(false) && mFile)
+    {
+        fclose(mFile);
+        mFile = nullptr;
+    }
+
+    if (!mFile)
+    {
+        openFile();
+    }
+
+    std::string buffer;
+    buffer.reserve(BATCH_SIZE + 1024);
+
+    for (auto ring: rings)
+    {
+        size_t tail = ring->tail.load(std::memory_order_relaxed);
+        size_t head = ring->head.load(std::memory_order_acquire);
+
+        for (; tail != head; tail++)
+        {
+            const Record& record = ring->records[tail & ring->mask];
+
+            if (isBinary)
+            {
+                buffer.append((const char *) &record, sizeof(record));
+            }
+            else
+            {
+                formatRecord(record, format, buffer);
+            }
+
+            mWrittenRecords++;
+
+            if (buffer.size() >= BATCH_SIZE)
+            {
+                //Give the slots back before the (slow) write
+                ring->tail.store(tail + 1, std::memory_order_release);
+                writeBatch(buffer, rotateSize, rotateFiles);
+            }
+        }
+
+        ring->tail.store(tail, std::memory_order_release);
+    }
+
+    writeBatch(buffer, rotateSize, rotateFiles);
+
+    if (mFile)
+    {
+        fflush(mFile);
+    }
+}
+
+void AccessLog::formatRecord(const Record &record, const std::string &format, std::string &buffer)
+{
+    for (size_t i = 0; i < format.size(); i++)
+    {
+        if (format[i] != '%' || i + 1 == format.size())
+        {
+            buffer += format[i];
+            continue;
+        }
+
+        switch (format[++i])
+        {
+        case 'h':
+            buffer += record.remote[0] ? record.remote : "-";
+            break;
+        case 't':
+        {
+            time_t seconds = (time_t) (record.timestamp / 1000000);
+            struct tm time;
+#ifdef WIN32
+            gmtime_s(&time, &seconds);
+#else
+            gmtime_r(&seconds, &time);
+#endif
+            char date[64];
+            strftime(date, sizeof(date), "[%d/%b/%Y:%H:%M:%S +0000]", &time);
+            buffer += date;
+            break;
+        }
+        case 'm':
+            buffer += record.method;
+            break;
+        case 'U':
+            buffer += record.url;
+            break;
+        case 's':
+            buffer += record.code > 0 ? std::to_string(record.code) : "-";
+            break;
+        case 'b':
+            buffer += std::to_string(record.bytesSent);
+            break;
+        case 'D':
+            buffer += std::to_string(record.duration);
+            break;
+        case '%':
+            buffer += '%';
+            break;
+        default:
+            buffer += '%';
+            buffer += format[i];
+            break;
+        }
+    }
+
+    buffer += '\n';
+}
+
+void AccessLog::writeBatch(std::string &buffer, size_t rotateSize, int rotateFiles)
+{
+    if (buffer.empty())
+    {
+        return;
+    }
+
+    if (mFile)
+    {
+        mFileSize += fwrite(buffer.data(), 1, buffer.size(), mFile);
+    }
+
+    buffer.clear();
+
+    if (mFile && rotateSize > 0)
+    {
+#ifndef WIN32
+        //Prefork workers all append to the same file, and any of them may rotate it
+        struct stat status;
+        fflush(mFile);
+
+        if (isMovedAway())
+        {
+            fclose(mFile);
+            openFile();
+            return;
+        }
+
+        if (fstat(fileno(mFile), &status) == 0)
+        {
+            mFileSize = (size_t) status.st_size;
+        }
+#endif
+
+        if (mFileSize >= rotateSize)
+        {
+            rotate(rotateFiles);
+        }
+    }
+}
+
+bool AccessLog::isMovedAway() const
+{
+#ifndef WIN32
+    struct stat opened;
+    struct stat current;
+
+    return fstat(fileno(mFile), &opened) == 0
+           && (stat(mPath.c_str(), &current) != 0 || current.st_ino != opened.st_ino || current.st_dev != opened.st_dev);
+#else
+    return false;
+#endif
+}
+
+void AccessLog::openFile()
+{
+    mFile = fopen(mPath.c_str(), "ab");
+    mFileSize = 0;
+
+    if (mFile && fseek(mFile, 0, SEEK_END) == 0)
+    {
+        long size = ftell(mFile);
+        mFileSize = size > 0 ? (size_t) size : 0;
+    }
+}
+
+void AccessLog::rotate(int files)
+{
+#ifndef WIN32
+    //One process rotates at a time. Those waiting find the file moved away by then, and only reopen it
+    flock(fileno(mFile), LOCK_EX);
+
+    if (isMovedAway())
+    {
+        fclose(mFile);
+        openFile();
+        return;
+    }
+#endif
+
+    //Closing releases the lock, once the file was renamed
+    std::string first = mPath + ".1";
+    FILE *rotated = mFile;
+    mFile = nullptr;
+
+    //path.N-1 becomes path.N, ..., path becomes path.1. The oldest one is overwritten.
+    for (int i = files - 1; i >= 1; i--)
+    {
+        std::string to = mPath + "." + std::to_string(i + 1);
+        remove(to.c_str());
+        rename((mPath + "." + std::to_string(i)).c_str(), to.c_str());
+    }
+
+    remove(first.c_str());
+    rename(mPath.c_str(), first.c_str());
+    fclose(rotated);
+
+    openFile();
+}
+
+std::string AccessLog::format() const
+{
+    std::lock_guard<std::mutex> lock(mSettingsMutex);
+    return mFormat;
+}
+
+void AccessLog::setFormat(const std::string &format)
+{
+    std::lock_guard<std::mutex> lock(mSettingsMutex);
+    mFormat = format;
+}
+
+bool AccessLog::isBinary() const
+{
+    std::lock_guard<std::mutex> lock(mSettingsMutex);
+    return mIsBinary;
+}
+
+void AccessLog::setBinary(bool binary)
+{
+    std::lock_guard<std::mutex> lock(mSettingsMutex);
+    mIsBinary = binary;
+}
+
+void AccessLog::setRotation(size_t maxBytes, int files)
+{
+    std::lock_guard<std::mutex> lock(mSettingsMutex);
+    mRotateSize = maxBytes;
+    mRotateFiles = files > 0 ? files : 1;
+}
+
+int AccessLog::flushInterval() const
+{
+    std::lock_guard<std::mutex> lock(mSettingsMutex);
+    return mFlushInterval;
+}
+
+void AccessLog::setFlushInterval(int milliseconds)
+{
+    std::lock_guard<std::mutex> lock(mSettingsMutex);
+    mFlushInterval = milliseconds > 0 ? milliseconds : 1;
+}
+
+void AccessLog::reopen()
+{
+    mIsReopenPending = true;
+}
+
+std::string AccessLog::path() const
+{
+    return mPath;
+}
+
+uint64_t AccessLog::writtenRecords() const
+{
+    return mWrittenRecords;
+}
+
+uint64_t AccessLog::droppedRecords() const
+{
+    return mDroppedRecords;
+}
+}
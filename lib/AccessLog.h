@@ -0,0 +1,170 @@
+#ifndef _MONGOOSE_ACCESS_LOG_H
+#define _MONGOOSE_ACCESS_LOG_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * An access log that never blocks the threads serving requests.
+ *
+ * Every thread logging gets a ring of fixed size records of its own, which it fills without taking any lock.
+ * A background thread drains the rings, formats the records and writes them to the file in large batches,
+ * rotating it when it grows too big. When a ring is full, the record is dropped and counted, see droppedRecords().
+ *
+ * The background thread starts with the first record logged: with Prefork, every worker gets its own once
+ * it starts serving. The workers append to the same file, whichever of them sees it reach the rotation size
+ * rotates it for all, and the others reopen the new file as soon as they notice.
+ */
+namespace Mongoose
+{
+class AccessLog
+{
+public:
+    /**
+     * What is known about a request once it is answered. Written as is in binary mode.
+     */
+    struct Record
+    {
+        int64_t timestamp;      //Microseconds since the epoch, when the request arrived
+        int64_t bytesSent;
+        uint32_t duration;      //Microseconds
+        uint16_t code;          //0 if the request wasn't answered
+        uint16_t urlLength;     //Of the whole url, which may be longer than what fits in url
+        char method[8];
+        char remote[48];
+        char url[176];
+    };
+
+    /**
+     * @param path - the file records are appended to
+     * @param ringSize - how many records each logging thread may have waiting to be written
+     */
+    explicit AccessLog(const std::string& path, size_t ringSize = 4096);
+
+    /**
+     * Writes what is left in the rings out and stops the background thread
+     */
+    virtual ~AccessLog();
+
+    /**
+     * @brief log - queues a record, without locking nor blocking
+     * @return false if the record was dropped because the calling thread's ring is full
+     */
+    bool log(const Record& record);
+
+    /**
+     * @brief format / setFormat - how records are written in text mode, one line each. Escapes:
+     * %h remote address, %t time, %m method, %U url, %s status code, %b bytes sent, %D duration in microseconds,
+     * %% a '%'. The default, "%h - - %t \"%m %U\" %s %b %D", is the common log format plus the duration.
+     */
+    std::string format() const;
+    void setFormat(const std::string& format);
+
+    /**
+     * @brief isBinary / setBinary - writes the records as they are (see Record) instead of formatting them
+     */
+    bool isBinary() const;
+    void setBinary(bool binary);
+
+    /**
+     * @brief setRotation - once the file reaches maxBytes, it is renamed to path.1 (path.1 to path.2 etc.)
+     * and a new one is started. Only the last files are kept.
+     * @param maxBytes - 0, the default, never rotates
+     */
+    void setRotation(size_t maxBytes, int files = 5);
+
+    /**
+     * @brief flushInterval / setFlushInterval - how often (in milliseconds) the rings are drained
+     */
+    int flushInterval() const;
+    void setFlushInterval(int milliseconds);
+
+    /**
+     * @brief reopen - closes and reopens the file on the next flush, eg. after logrotate moved it away.
+     * Can be called from any thread, or from a signal handler.
+     */
+    void reopen();
+
+    /**
+     * @brief flush - drains the rings and writes their records out, on the calling thread
+     */
+    void flush();
+
+    std::string path() const;
+    uint64_t writtenRecords() const;
+    uint64_t droppedRecords() const;
+
+    /**
+     * @brief copy - copies a string into a record's field, truncating it if needed
+     */
+    template<size_t size>
+    static void copy(char (&field)[size], const char *data, size_t length)
+    {
+        length = length < size - 1 ? length : size - 1;
+        memcpy(field, data, length);
+        field[length] = '\0';
+    }
+
+private:
+    //A single producer, single consumer ring
+    struct Ring
+    {
+        explicit Ring(size_t size);
+
+        std::unique_ptr<Record[]> records;
+        size_t mask;
+        std::atomic<size_t> head;   //Written by the logging thread
+        char padding[64];           //Keeps head and tail off the same cache line
+        std::atomic<size_t> tail;   //Written by the flushing thread
+    };
+
+    Ring *ring();
+    void start();
+    void run();
+    static void formatRecord(const Record& record, const std::string& format, std::string& buffer);
+    void writeBatch(std::string& buffer, size_t rotateSize, int rotateFiles);
+    void openFile();
+    void rotate(int files);
+    bool isMovedAway() const;
+
+    std::string mPath;
+    size_t mRingSize;
+    uint64_t mId;
+
+    std::mutex mRingsMutex;
+    std::map<std::thread::id, std::unique_ptr<Ring>> mRings;
+
+    //Only touched by whoever holds mFlushMutex, usually the background thread
+    std::mutex mFlushMutex;
+    FILE *mFile;
+    size_t mFileSize;
+
+    mutable std::mutex mSettingsMutex;
+    std::string mFormat;
+    bool mIsBinary;
+    size_t mRotateSize;
+    int mRotateFiles;
+    int mFlushInterval;
+
+    std::atomic_bool mIsStarted;
+    std::atomic_bool mIsReopenPending;
+    std::atomic<uint64_t> mWrittenRecords;
+    std::atomic<uint64_t> mDroppedRecords;
+
+    std::mutex mThreadMutex;
+    std::condition_variable mCondition;
+    bool mIsStopping;
+    std::thread mThread;
+};
+}
+
+#endif
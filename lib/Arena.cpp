@@ -0,0 +1,102 @@
+#include <cstdlib>
+#include <cstring>
+
+#include "Arena.h"
+
+static inline char *alignUp(char *pointer, size_t alignment)
+{
+    uintptr_t value = reinterpret_cast<uintptr_t>(pointer);
+    return reinterpret_cast<char *>((value + alignment - 1) & ~(uintptr_t)(alignment - 1));
+}
+
+namespace Mongoose
+{
+Arena::Arena(void *buffer, size_t size, size_t blockSize):
+    mBuffer(static_cast<char *>(buffer)),
+    mBufferSize(buffer ? size : 0),
+    mBlockSize(blockSize > 0 ? blockSize : 4096),
+    mCurrent(mBuffer),
+    mEnd(mBuffer + mBufferSize),
+    mBlocks(nullptr),
+    mBytesUsed(0)
+{
+}
+
+Arena::~Arena()
+{
+    reset();
+}
+
+void *Arena::allocate(size_t size, size_t alignment)
+{
+    char *result = alignUp(mCurrent, alignment);
+
+    if (mCurrent == nullptr || result + size > mEnd)
+    {
+        return allocateBlock(size, alignment);
+    }
+
+    mCurrent = result + size;
+    mBytesUsed += size;
+    return result;
+}
+
+void *Arena::allocateBlock(size_t size, size_t alignment)
+{
+    //Big allocations get a block of their own, so the rest of the current block isn't wasted
+    bool isOversized = size + alignment > mBlockSize / 2;
+    size_t blockSize = sizeof(Block) + alignment + (isOversized ? size : mBlockSize);
+
+    Block *block = static_cast<Block *>(malloc(blockSize));
+    if (block == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+
+    block->next = mBlocks;
+    mBlocks = block;
+
+    char *begin = reinterpret_cast<char *>(block + 1);
+    char *end = reinterpret_cast<char *>(block) + blockSize;
+    char *result = alignUp(begin, alignment);
+
+    if (!isOversized)
+    {
+        mCurrent = result + size;
+        mEnd = end;
+    }
+
+    mBytesUsed += size;
+    return result;
+}
+
+char *Arena::copy(const char *data, size_t size)
+{
+    char *result = static_cast<char *>(allocate(size + 1, 1));
+    if (size > 0)
+    {
+        memcpy(result, data, size);
+    }
+    result[size] = '\0';
+    return result;
+}
+
+void Arena::reset()
+{
+    while (mBlocks)
+    {
+        Block *next = mBlocks->next;
+        free(mBlocks);
+        mBlocks = next;
+    }
+
+    mCurrent = mBuffer;
+    mEnd = mBuffer + mBufferSize;
+    mBytesUsed = 0;
+}
+
+size_t Arena::bytesUsed() const
+{
+    return mBytesUsed;
+}
+}
@@ -0,0 +1,113 @@
+#ifndef _MONGOOSE_ARENA_H
+#define _MONGOOSE_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+
+/**
+ * A monotonic (bump) allocator: allocations are carved out of big blocks and never freed one by one,
+ * everything goes away at once with the arena. Allocating is a pointer increment, and nothing is
+ * allocated at all while the inline buffer the arena was given suffices.
+ *
+ * Not thread safe.
+ */
+namespace Mongoose
+{
+class Arena
+{
+public:
+    /**
+     * @param buffer - storage to use before allocating any block, may be null
+     * @param size - the size of buffer
+     * @param blockSize - the size of the blocks allocated once buffer is full
+     */
+    Arena(void *buffer = nullptr, size_t size = 0, size_t blockSize = 4096);
+    ~Arena();
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void *allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+    /**
+     * @brief copy - copies data into the arena
+     * @return the copy, nul terminated
+     */
+    char *copy(const char *data, size_t size);
+
+    template <typename T, typename... Args>
+    T *create(Args&&... args)
+    {
+        //The destructor never runs: only use this for trivially destructible types
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    /**
+     * @brief reset - frees the blocks and starts over from the inline buffer
+     */
+    void reset();
+
+    /**
+     * @brief bytesUsed
+     * @return the number of bytes handed out since the last reset
+     */
+    size_t bytesUsed() const;
+
+private:
+    struct Block
+    {
+        Block *next;
+    };
+
+    void *allocateBlock(size_t size, size_t alignment);
+
+    char *mBuffer;
+    size_t mBufferSize;
+    size_t mBlockSize;
+
+    char *mCurrent;
+    char *mEnd;
+    Block *mBlocks;
+    size_t mBytesUsed;
+};
+
+/**
+ * An STL allocator drawing from an Arena, e.g. std::vector<int, ArenaAllocator<int>> numbers(request->arena())
+ */
+template <typename T>
+class ArenaAllocator
+{
+public:
+    typedef T value_type;
+
+    ArenaAllocator(Arena& arena): mArena(&arena) {}
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other): mArena(other.arena()) {}
+
+    T *allocate(size_t count)
+    {
+        return static_cast<T *>(mArena->allocate(count * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *, size_t)
+    {
+        //Freed along with the arena
+    }
+
+    Arena *arena() const { return mArena; }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>& other) const { return mArena == other.arena(); }
+
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const { return mArena != other.arena(); }
+
+private:
+    Arena *mArena;
+};
+}
+
+#endif
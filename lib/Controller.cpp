@@ -11,6 +11,9 @@ namespace Mongoose
     Controller::Controller(Server *server):
         mServer(server),
         mPrefix("")
+#ifdef ENABLE_REGEX_URL
+        , mRoutesGeneration(0)
+#endif
     {
     }
 
@@ -39,24 +42,26 @@ namespace Mongoose
     {
         bool result = false;
 
+        std::string key = request->method() + ":" + request->url();
+        auto route = mRoutes.find(key);
+
 #ifdef ENABLE_REGEX_URL
-        std::map<std::string, RequestHandler *>::iterator it;
-        for (it=routes.begin(); it!=routes.end(); it++)
+        if (route == mRoutes.end())
         {
-            if (request->match(it->first))
+            int index = matchRoute(key, request.get());
+
+            if (index >= 0)
             {
-              result = it->second->process(request, response);
-              break;
-            }   
+                route = mRoutes.find(mRegexRoutes[index].key);
+            }
         }
-#else
-        std::string key = request->method() + ":" + request->url();
-        if (mRoutes.find(key) != mRoutes.end())
+#endif
+
+        if (route != mRoutes.end())
         {
-            result = mRoutes[key](request, response);
+            result = route->second(request, response);
         }
-#endif
-        
+
         return result;
     }
 
@@ -76,13 +81,104 @@ namespace Mongoose
     bool Controller::handles(const std::string &method, const std::string &url) const
     {
         std::string key = method + ":" + url;
+
+#ifdef ENABLE_REGEX_URL
+        return mRoutes.find(key) != mRoutes.end() || matchRoute(key) >= 0;
+#else
         return (mRoutes.find(key) != mRoutes.end());
+#endif
     }
 
+#ifdef ENABLE_REGEX_URL
+    int Controller::matchRoute(const std::string &key, Request *request) const
+    {
+        //A request is matched by handles() and then by process(), back to back on the same thread.
+        //Remember the last match, its captures as offsets, so the regex only runs once per request.
+        static thread_local const Controller *lastController = nullptr;
+        static thread_local unsigned int lastGeneration = 0;
+        static thread_local std::string lastKey;
+        static thread_local int lastRoute = -1;
+        static thread_local std::vector<std::pair<size_t, size_t>> lastGroups;
+
+        if (lastController != this || lastGeneration != mRoutesGeneration || lastKey != key)
+        {
+            static thread_local std::smatch match;
+            lastController = this;
+            lastGeneration = mRoutesGeneration;
+            lastKey = key;
+            lastRoute = -1;
+            lastGroups.clear();
+
+            if (!mRegexRoutes.empty() && std::regex_match(key, match, mRouteRegex))
+            {
+                for (size_t i = 0; i < mRegexRoutes.size(); i++)
+                {
+                    const RegexRoute& route = mRegexRoutes[i];
+
+                    if (match[route.group].matched)
+                    {
+                        lastRoute = (int)i;
+                        lastGroups.push_back(std::make_pair((size_t)0, key.size()));
+
+                        for (size_t group = route.group + 1; group <= route.group + route.groupCount; group++)
+                        {
+                            lastGroups.push_back(std::make_pair((size_t)match.position(group), (size_t)match.length(group)));
+                        }
+                        break;
+                    }
+                }
+            }
+        }
+
+        if (request && lastRoute >= 0)
+        {
+            request->setMatchCount(lastGroups.size());
+
+            for (size_t i = 0; i < lastGroups.size(); i++)
+            {
+                request->setMatch(i, lastGroups[i].first, lastGroups[i].second);
+            }
+        }
+
+        return lastRoute;
+    }
+
+    void Controller::compileRoutes()
+    {
+        std::string combined;
+        size_t group = 1;
+
+        for (auto& route : mRegexRoutes)
+        {
+            route.group = group;
+            group += route.groupCount + 1;
+
+            combined += (combined.empty() ? "(" : "|(") + route.key + ")";
+        }
+
+        mRouteRegex = std::regex(combined, std::regex::ECMAScript | std::regex::optimize);
+        mRoutesGeneration++;
+    }
+#endif
+
     bool Controller::handleRequest(const std::shared_ptr<Request> &request, const std::shared_ptr<Response> &response)
     {
-        return preProcess(request, response)
-               && process(request, response);
+        bool result = false;
+
+        try
+        {
+            result = preProcess(request, response)
+                     && process(request, response);
+        }
+        catch(...)
+        {
+            //Post processing runs whatever happened, then the server answers with an error
+            postProcess(request, response);
+            throw;
+        }
+
+        postProcess(request, response);
+        return result;
     }
 
     Server *Controller::server() const
@@ -126,16 +222,48 @@ namespace Mongoose
     void Controller::registerRoute(std::string httpMethod, std::string httpRoute, RequestHandler handler)
     {
         std::string key = httpMethod + ":" + mPrefix + httpRoute;
+#ifdef ENABLE_REGEX_URL
+        if (mRoutes.find(key) == mRoutes.end())
+        {
+            //Throws std::regex_error right away if the pattern is invalid
+            std::regex pattern(key);
+            RegexRoute route = {key, 0, pattern.mark_count()};
+            mRegexRoutes.push_back(route);
+            compileRoutes();
+        }
+#endif
+
         mRoutes[key] = handler;
         mUrls.push_back(mPrefix + httpRoute);
     }
 
+    void Controller::registerRoute(std::string httpMethod, std::string httpRoute, RequestHandler handler, BodyChunkHandler onBodyChunk)
+    {
+        registerRoute(httpMethod, httpRoute, handler);
+        mBodyChunkHandlers[httpMethod + ":" + mPrefix + httpRoute] = onBodyChunk;
+    }
+
     void Controller::deregisterRoute(std::string httpMethod, std::string httpRoute)
     {
         std::string key = httpMethod + ":" + mPrefix + httpRoute;
         if (mRoutes.find(key) != mRoutes.end())
         {
             mRoutes.erase(key);
+            mBodyChunkHandlers.erase(key);
+            mBodySizeLimits.erase(key);
+
+#ifdef ENABLE_REGEX_URL
+            for (auto route = mRegexRoutes.begin(); route != mRegexRoutes.end(); ++route)
+            {
+                if (route->key == key)
+                {
+                    mRegexRoutes.erase(route);
+                    break;
+                }
+            }
+
+            compileRoutes();
+#endif
         }
 
         std::string url = mPrefix + httpRoute;
@@ -147,6 +275,93 @@ namespace Mongoose
         }
     }
 
+    void Controller::registerWebSocketRoute(std::string httpRoute, WebSocketHandler handler)
+    {
+        mWebSocketRoutes[mPrefix + httpRoute] = handler;
+    }
+
+    void Controller::deregisterWebSocketRoute(std::string httpRoute)
+    {
+        mWebSocketRoutes.erase(mPrefix + httpRoute);
+    }
+
+    bool Controller::handlesWebSocket(const std::string &url, WebSocketHandler *handler) const
+    {
+        auto it = mWebSocketRoutes.find(url);
+
+        if (it == mWebSocketRoutes.end())
+        {
+            return false;
+        }
+
+        if (handler)
+        {
+            *handler = it->second;
+        }
+
+        return true;
+    }
+
+    std::string Controller::routeKey(const std::string &method, const std::string &url) const
+    {
+        std::string key = method + ":" + url;
+
+#ifdef ENABLE_REGEX_URL
+        if (mRoutes.find(key) == mRoutes.end())
+        {
+            int index = matchRoute(key);
+            return index >= 0 ? mRegexRoutes[index].key : std::string();
+        }
+#endif
+
+        return key;
+    }
+
+    bool Controller::handlesBodyChunks(const std::string &method, const std::string &url, BodyChunkHandler *handler) const
+    {
+        if (mBodyChunkHandlers.empty())
+        {
+            return false;
+        }
+
+        auto it = mBodyChunkHandlers.find(routeKey(method, url));
+
+        if (it == mBodyChunkHandlers.end())
+        {
+            return false;
+        }
+
+        if (handler)
+        {
+            *handler = it->second;
+        }
+
+        return true;
+    }
+
+    void Controller::setBodySizeLimit(std::string httpMethod, std::string httpRoute, size_t bytes)
+    {
+        mBodySizeLimits[httpMethod + ":" + mPrefix + httpRoute] = bytes;
+    }
+
+    bool Controller::bodySizeLimit(const std::string &method, const std::string &url, size_t *limit) const
+    {
+        if (mBodySizeLimits.empty())
+        {
+            return false;
+        }
+
+        auto it = mBodySizeLimits.find(routeKey(method, url));
+
+        if (it == mBodySizeLimits.end())
+        {
+            return false;
+        }
+
+        *limit = it->second;
+        return true;
+    }
+
     void Controller::dumpRoutes() const
     {
         std::cout << "Routes:" << std::endl;
@@ -155,6 +370,11 @@ namespace Mongoose
             std::cout << "    " << route.first << std::endl;
         }
 
+        for (const auto &route : mWebSocketRoutes)
+        {
+            std::cout << "    WEBSOCKET:" << route.first << std::endl;
+        }
+
     }
 
     std::vector<std::string> Controller::urls() const
@@ -6,6 +6,11 @@
 #include <memory>
 #include <vector>
 #include <string>
+#ifdef ENABLE_REGEX_URL
+#include <regex>
+#endif
+
+#include "WebSocket.h"
 
 //Helper define for binding class methods
 #define addRoute(httpMethod, httpRoute, className, methodName) \
@@ -26,6 +31,12 @@ namespace Mongoose
 
     typedef std::function<bool(const std::shared_ptr<Request>&, const std::shared_ptr<Response>&)> RequestHandler;
 
+    /**
+     * Receives a request body piece by piece, as it arrives. Returning false aborts the request:
+     * it is answered with an error unless the handler already responded, and the rest of the body is dropped.
+     */
+    typedef std::function<bool(const std::shared_ptr<Request>&, const std::shared_ptr<Response>&, const char *data, size_t size)> BodyChunkHandler;
+
     class Controller
     {
         public:
@@ -70,7 +81,8 @@ namespace Mongoose
 
             /**
              * @brief handleRequest - Handle a request, this will try to match the request, if this
-             * controller handles it, it will preProcess, process then postProcess it
+             * controller handles it, it will preProcess, process then postProcess it. postProcess is called
+             * even if preProcess stopped the request or an exception was thrown.
              * @param Request the incoming request
              * @return Response the created response, or NULL if the controller
              *         does not handle this request
@@ -118,9 +130,22 @@ namespace Mongoose
              * @brief registerRoute
              * @param httpMethod - GET, POST etc..
              * @param httpRoute - http endpoint pat . like /users
+             * With ENABLE_REGEX_URL, "httpMethod:httpRoute" is a regex matched against "METHOD:url",
+             * like "GET:/users/([0-9]+)". The captured groups are available through Request::getMatch.
+             * All the patterns are compiled once, here, into a single regex. Exact matches are looked up first.
+             * Patterns must not use backreferences, their numbering changes in the combined regex.
              */
             void registerRoute(std::string httpMethod, std::string httpRoute, RequestHandler handler);
 
+            /**
+             * @brief registerRoute - a route that receives its request body as it arrives instead of buffered in
+             * memory, for large uploads. onBodyChunk is called on the event loop thread with each piece of the body,
+             * then handler is called as usual, with an empty Request::body(), once the whole body is received.
+             * Server wide coprocessors and basic authentication run before the first piece, the controller's
+             * coprocessors only before handler.
+             */
+            void registerRoute(std::string httpMethod, std::string httpRoute, RequestHandler handler, BodyChunkHandler onBodyChunk);
+
             /**
              * @brief deregisterRoute
              * @param httpMethod - GET, POST etc..
@@ -128,6 +153,50 @@ namespace Mongoose
              */
             void deregisterRoute(std::string httpMethod, std::string httpRoute);
 
+            /**
+             * @brief registerWebSocketRoute
+             * @param httpRoute - the endpoint clients open websockets on, like /chat
+             * @param handler - the callbacks for the websockets opened on that route
+             */
+            void registerWebSocketRoute(std::string httpRoute, WebSocketHandler handler);
+
+            /**
+             * @brief deregisterWebSocketRoute
+             * @param httpRoute - the endpoint clients open websockets on, like /chat
+             */
+            void deregisterWebSocketRoute(std::string httpRoute);
+
+            /**
+             * @brief handlesWebSocket - check if this controller accepts websockets on url
+             * @param url
+             * @param handler - if not null, set to the callbacks for the websockets opened on url
+             * @return true if this controller accepts websockets on url
+             */
+            virtual bool handlesWebSocket(const std::string& url, WebSocketHandler *handler = nullptr) const;
+
+            /**
+             * @brief handlesBodyChunks - check if this controller streams the request bodies of a http method + url
+             * @param handler - if not null, set to the route's body chunk handler
+             * @return true if the route was registered with an onBodyChunk handler
+             */
+            virtual bool handlesBodyChunks(const std::string& method, const std::string& url, BodyChunkHandler *handler = nullptr) const;
+
+            /**
+             * @brief setBodySizeLimit - the largest request body a route accepts, in place of Server::bodySizeLimit.
+             * Requests announcing a larger Content-Length are answered with 413 before their body is read.
+             * @param httpMethod - GET, POST etc..
+             * @param httpRoute - http endpoint pat . like /users, as given to registerRoute
+             * @param bytes - 0 for no limit
+             */
+            void setBodySizeLimit(std::string httpMethod, std::string httpRoute, size_t bytes);
+
+            /**
+             * @brief bodySizeLimit
+             * @param limit - set to the body size limit of the route matching method + url, if it has one
+             * @return true if the route has its own limit
+             */
+            virtual bool bodySizeLimit(const std::string& method, const std::string& url, size_t *limit) const;
+
 
             /**
              * @brief dumpRoutes - prints all http routes registered
@@ -144,8 +213,38 @@ namespace Mongoose
             Server *mServer;
             std::string mPrefix;
             std::map<std::string, RequestHandler> mRoutes;
+            std::map<std::string, WebSocketHandler> mWebSocketRoutes;
+            std::map<std::string, BodyChunkHandler> mBodyChunkHandlers;
+            std::map<std::string, size_t> mBodySizeLimits;
+
+            /**
+             * @brief routeKey
+             * @return the "METHOD:route" key method + url was registered under, empty if no route matches
+             */
+            std::string routeKey(const std::string& method, const std::string& url) const;
             std::vector<std::string> mUrls;
             std::vector<AbstractRequestCoprocessor*> mCoprocessors;
+
+#ifdef ENABLE_REGEX_URL
+            struct RegexRoute
+            {
+                std::string key;
+                size_t group;       //The group of the combined regex wrapping this route's pattern
+                size_t groupCount;  //The groups of the route's own pattern, right after that one
+            };
+
+            /**
+             * @brief matchRoute - finds the regex route matching "METHOD:url"
+             * @param request - if not null, gets the groups captured by the route
+             * @return the index of the route in mRegexRoutes, or -1
+             */
+            int matchRoute(const std::string& key, Request *request = nullptr) const;
+            void compileRoutes();
+
+            std::vector<RegexRoute> mRegexRoutes;
+            std::regex mRouteRegex;
+            unsigned int mRoutesGeneration;
+#endif
     };
 }
 
@@ -0,0 +1,104 @@
+#include <random>
+#include <mongoose.h>
+
+#include "Credentials.h"
+
+namespace Mongoose
+{
+    Credentials::Credentials():
+        mGeneration(0)
+    {
+        std::random_device random;
+        mSalt.reserve(32);
+
+        for (int i = 0; i < 32; i++)
+        {
+            mSalt.push_back((char)(random() & 0xff));
+        }
+    }
+
+    void Credentials::addUser(const std::string &username, const std::string &password)
+    {
+        Digest hash = digest(username, password);
+        std::lock_guard<std::mutex> lock(mMutex);
+        mUsers[username] = hash;
+        mGeneration++;
+    }
+
+    void Credentials::removeUser(const std::string &username)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mUsers.erase(username) > 0)
+        {
+            mGeneration++;
+        }
+    }
+
+    uint64_t Credentials::generation() const
+    {
+        return mGeneration;
+    }
+
+    bool Credentials::hasUser(const std::string &username) const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mUsers.find(username) != mUsers.end();
+    }
+
+    bool Credentials::isEmpty() const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mUsers.empty();
+    }
+
+    size_t Credentials::size() const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mUsers.size();
+    }
+
+    bool Credentials::verify(const std::string &username, const std::string &password) const
+    {
+        Digest given = digest(username, password);
+        Digest expected;
+        bool found = false;
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            auto it = mUsers.find(username);
+
+            if (it != mUsers.end())
+            {
+                expected = it->second;
+                found = true;
+            }
+            else
+            {
+                //Compare against something anyway, so unknown users take as long as known ones
+                expected = given;
+                expected[0] ^= 0xff;
+            }
+        }
+
+        unsigned char difference = 0;
+        for (size_t i = 0; i < given.size(); i++)
+        {
+            difference |= given[i] ^ expected[i];
+        }
+
+        return found && difference == 0;
+    }
+
+    Credentials::Digest Credentials::digest(const std::string &username, const std::string &password) const
+    {
+        Digest result;
+        cs_sha1_ctx context;
+        cs_sha1_init(&context);
+        cs_sha1_update(&context, (const unsigned char*) mSalt.data(), mSalt.size());
+        cs_sha1_update(&context, (const unsigned char*) username.data(), username.size());
+        cs_sha1_update(&context, (const unsigned char*) ":", 1);
+        cs_sha1_update(&context, (const unsigned char*) password.data(), password.size());
+        cs_sha1_final(result.data(), &context);
+        return result;
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef _MONGOOSE_CREDENTIALS_H
+#define _MONGOOSE_CREDENTIALS_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/**
+ * A table of username/password pairs used for http basic authentication.
+ * Passwords are only kept as salted hashes and are compared in constant time.
+ */
+namespace Mongoose
+{
+    class Credentials
+    {
+        public:
+            Credentials();
+
+            /**
+             * @brief addUser - adds a user, or changes the password of an existing one
+             */
+            void addUser(const std::string& username, const std::string& password);
+
+            /**
+             * @brief removeUser - removes a user from the table
+             */
+            void removeUser(const std::string& username);
+
+            /**
+             * @brief generation - changes whenever a user is added, removed or gets a new password,
+             * so that what was verified against an older table can be told apart
+             */
+            uint64_t generation() const;
+
+            bool hasUser(const std::string& username) const;
+            bool isEmpty() const;
+            size_t size() const;
+
+            /**
+             * @brief verify - checks a username/password pair against the table.
+             * The time taken does not depend on where the password differs, or on whether the user exists.
+             * @return true if the user exists and the password matches
+             */
+            bool verify(const std::string& username, const std::string& password) const;
+
+        private:
+            typedef std::array<unsigned char, 20> Digest;
+
+            Digest digest(const std::string& username, const std::string& password) const;
+
+            mutable std::mutex mMutex;
+            std::unordered_map<std::string, Digest> mUsers;
+            std::string mSalt;
+            std::atomic<uint64_t> mGeneration;
+    };
+}
+
+#endif
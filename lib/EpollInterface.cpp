@@ -0,0 +1,487 @@
+#ifdef __linux__
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+#include <errno.h>
+#include <stddef.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <mongoose.h>
+
+#include "EpollInterface.h"
+
+#ifndef MG_CTL_MSG_MESSAGE_SIZE
+#define MG_CTL_MSG_MESSAGE_SIZE 8192
+#endif
+
+//How often connections without any activity get their MG_EV_POLL, timers and epoll interest refreshed
+static const double SWEEP_INTERVAL = 1.0;
+static const int MAX_EVENTS = 1024;
+static const int MAX_ACCEPTS = 256;
+
+//Tags the two internal descriptors in epoll_event::data.ptr, connections use their mg_connection*
+static char sControlTag;
+static char sWakeupTag;
+
+struct EpollData
+{
+    int epollFd{-1};
+    int wakeupFd{-1};
+    bool isControlRegistered{false};
+    bool isPolling{false};
+    struct mg_connection *current{NULL};    //The connection whose handlers are running
+    double nextSweep{0};
+
+    //The events each connection is currently registered for
+    std::unordered_map<struct mg_connection *, uint32_t> interests;
+    std::vector<struct epoll_event> events;
+
+    //Connections refreshed from the handlers, possibly of other connections: sent from, and registered
+    //for EPOLLOUT, once the handlers of this pass returned
+    std::vector<struct mg_connection *> pendingSends;
+};
+
+//Same layout as mongoose's own broadcast message
+struct ControlMessage
+{
+    mg_event_handler_t callback;
+    char message[MG_CTL_MSG_MESSAGE_SIZE];
+};
+
+static const struct mg_iface_vtable *sVtable = NULL;
+
+static EpollData *epollData(struct mg_connection *nc)
+{
+    return static_cast<EpollData *>(nc->iface->data);
+}
+
+/**
+ * What select would be asked about this connection: the same rules as mongoose's socket interface
+ */
+static uint32_t wantedEvents(struct mg_connection *nc)
+{
+    if (nc->flags & MG_F_LISTENING)
+    {
+        return EPOLLIN;
+    }
+
+    uint32_t events = 0;
+
+    if (nc->flags & MG_F_CONNECTING)
+    {
+        return EPOLLOUT;
+    }
+
+    if (nc->recv_mbuf.len < nc->recv_mbuf_limit)
+    {
+        events |= EPOLLIN;
+    }
+
+    if (nc->send_mbuf.len > 0)
+    {
+        events |= EPOLLOUT;
+    }
+
+    return events;
+}
+
+static void updateInterest(struct mg_connection *nc)
+{
+    EpollData *data = epollData(nc);
+
+    if (nc->sock == INVALID_SOCKET || data == NULL)
+    {
+        return;
+    }
+
+    uint32_t wanted = wantedEvents(nc);
+    auto registered = data->interests.find(nc);
+
+    if (registered != data->interests.end() && registered->second == wanted)
+    {
+        return;
+    }
+
+    struct epoll_event event;
+    event.events = wanted;
+    event.data.ptr = nc;
+
+    if (registered == data->interests.end())
+    {
+#ifdef EPOLLEXCLUSIVE
+        //Prefork workers share listeners, only wake one of them up per connection
+        if (nc->flags & MG_F_LISTENING)
+        {
+            event.events |= EPOLLEXCLUSIVE;
+        }
+#endif
+        if (epoll_ctl(data->epollFd, EPOLL_CTL_ADD, nc->sock, &event) == 0)
+        {
+            data->interests[nc] = wanted;
+        }
+    }
+    else if (!(nc->flags & MG_F_LISTENING) && epoll_ctl(data->epollFd, EPOLL_CTL_MOD, nc->sock, &event) == 0)
+    {
+        registered->second = wanted;
+    }
+}
+
+static void forget(struct mg_connection *nc)
+{
+    EpollData *data = epollData(nc);
+
+    if (data && data->interests.erase(nc) > 0 && nc->sock != INVALID_SOCKET)
+    {
+        epoll_ctl(data->epollFd, EPOLL_CTL_DEL, nc->sock, NULL);
+    }
+}
+
+static void forgetPendingSend(struct mg_connection *nc)
+{
+    EpollData *data = epollData(nc);
+
+    if (data)
+    {
+        auto& pending = data->pendingSends;
+        pending.erase(std::remove(pending.begin(), pending.end(), nc), pending.end());
+    }
+}
+
+static void sendQueued(struct mg_connection *nc)
+{
+    EpollData *data = epollData(nc);
+
+    //Most likely writable right away, only what doesn't go out now waits for EPOLLOUT
+    if (nc->send_mbuf.len > 0 && nc->sock != INVALID_SOCKET && !(nc->flags & (MG_F_CONNECTING | MG_F_CLOSE_IMMEDIATELY)))
+    {
+        //What its MG_EV_SEND handler queues waits for EPOLLOUT too, rather than recursing through refresh
+        struct mg_connection *previous = data->current;
+        data->current = nc;
+        mg_if_can_send_cb(nc);
+        data->current = previous;
+    }
+
+    updateInterest(nc);
+}
+
+static void sendPending(EpollData *data)
+{
+    std::vector<struct mg_connection *> pending;
+    pending.swap(data->pendingSends);
+
+    for (auto nc: pending)
+    {
+        sendQueued(nc);
+    }
+
+    //Queued meanwhile by MG_EV_SEND handlers: epoll reports them writable on the next pass, that keeps
+    //a connection which always has more to send from starving the others
+    pending.clear();
+    pending.swap(data->pendingSends);
+
+    for (auto nc: pending)
+    {
+        updateInterest(nc);
+    }
+}
+
+static void epollInit(struct mg_iface *iface)
+{
+    mg_default_iface_vtable.init(iface);
+
+    EpollData *data = new EpollData();
+    data->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    data->wakeupFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    data->events.resize(MAX_EVENTS);
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = &sWakeupTag;
+    epoll_ctl(data->epollFd, EPOLL_CTL_ADD, data->wakeupFd, &event);
+
+    iface->data = data;
+}
+
+static void epollFree(struct mg_iface *iface)
+{
+    EpollData *data = static_cast<EpollData *>(iface->data);
+
+    if (data)
+    {
+        close(data->wakeupFd);
+        close(data->epollFd);
+        delete data;
+        iface->data = NULL;
+    }
+
+    mg_default_iface_vtable.free(iface);
+}
+
+static void epollAddConnection(struct mg_connection *nc)
+{
+    mg_default_iface_vtable.add_conn(nc);
+    updateInterest(nc);
+}
+
+static void epollRemoveConnection(struct mg_connection *nc)
+{
+    forget(nc);
+    forgetPendingSend(nc);
+    mg_default_iface_vtable.remove_conn(nc);
+}
+
+static void epollDestroyConnection(struct mg_connection *nc)
+{
+    //The socket is closed here, so it must leave the epoll set first
+    forget(nc);
+    forgetPendingSend(nc);
+    mg_default_iface_vtable.destroy_conn(nc);
+}
+
+static void epollSetSocket(struct mg_connection *nc, sock_t sock)
+{
+    forget(nc);
+    mg_default_iface_vtable.sock_set(nc, sock);
+    updateInterest(nc);
+}
+
+static void handleControlSocket(struct mg_mgr *manager)
+{
+    //What mongoose does for mg_broadcast: acknowledge the message, then call it for every connection
+    struct ControlMessage message;
+    int length = (int) recv(manager->ctl[1], (char *) &message, sizeof(message), 0);
+    size_t acknowledged = send(manager->ctl[1], message.message, 1, 0);
+    (void) acknowledged;
+
+    if (length >= (int) sizeof(message.callback) && message.callback != NULL)
+    {
+        for (struct mg_connection *nc = mg_next(manager, NULL); nc != NULL; nc = mg_next(manager, nc))
+        {
+            message.callback(nc, MG_EV_POLL, message.message, nc->user_data);
+        }
+    }
+}
+
+static void acceptConnections(struct mg_connection *listener)
+{
+    for (int i = 0; i < MAX_ACCEPTS; i++)
+    {
+        union socket_address sa;
+        socklen_t length = sizeof(sa);
+        int sock = accept4(listener->sock, &sa.sa, &length, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (sock < 0)
+        {
+            //EAGAIN once the backlog is empty, or another worker took the connection
+            break;
+        }
+
+        struct mg_connection *nc = mg_if_accept_new_conn(listener);
+
+        if (nc == NULL)
+        {
+            close(sock);
+            break;
+        }
+
+        nc->iface->vtable->sock_set(nc, sock);
+        mg_if_accept_tcp_cb(nc, &sa, length);
+    }
+}
+
+static void handleConnection(struct mg_connection *nc, uint32_t events)
+{
+    if (nc->flags & MG_F_LISTENING)
+    {
+        acceptConnections(nc);
+        return;
+    }
+
+    if (nc->flags & MG_F_CONNECTING)
+    {
+        if (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))
+        {
+            int error = 0;
+            socklen_t length = sizeof(error);
+            getsockopt(nc->sock, SOL_SOCKET, SO_ERROR, &error, &length);
+            mg_if_connect_cb(nc, error);
+        }
+    }
+    else
+    {
+        if (events & EPOLLERR)
+        {
+            nc->flags |= MG_F_CLOSE_IMMEDIATELY;
+            return;
+        }
+
+        if (events & (EPOLLIN | EPOLLHUP))
+        {
+            if (nc->recv_mbuf.len < nc->recv_mbuf_limit)
+            {
+                mg_if_can_recv_cb(nc);
+            }
+            else if (events & EPOLLHUP)
+            {
+                //Paused, but the peer is gone: nothing would ever read the hang up
+                nc->flags |= MG_F_CLOSE_IMMEDIATELY;
+                return;
+            }
+        }
+
+        if (events & EPOLLOUT)
+        {
+            mg_if_can_send_cb(nc);
+        }
+    }
+
+    //Whatever the handlers just queued is most likely writable right away, skip a round trip through epoll
+    if (nc->send_mbuf.len > 0 && !(nc->flags & (MG_F_CONNECTING | MG_F_CLOSE_IMMEDIATELY)) && !(events & EPOLLOUT))
+    {
+        mg_if_can_send_cb(nc);
+    }
+
+    updateInterest(nc);
+}
+
+static time_t epollPoll(struct mg_iface *iface, int timeoutMs)
+{
+    struct mg_mgr *manager = iface->mgr;
+    EpollData *data = static_cast<EpollData *>(iface->data);
+    double now = mg_time();
+
+    if (!data->isControlRegistered && manager->ctl[1] != INVALID_SOCKET)
+    {
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = &sControlTag;
+        epoll_ctl(data->epollFd, EPOLL_CTL_ADD, manager->ctl[1], &event);
+        data->isControlRegistered = true;
+    }
+
+    if (data->nextSweep - now < timeoutMs / 1000.0)
+    {
+        timeoutMs = data->nextSweep > now ? (int) ((data->nextSweep - now) * 1000) + 1 : 0;
+    }
+
+    int count = epoll_wait(data->epollFd, data->events.data(), (int) data->events.size(), timeoutMs);
+    now = mg_time();
+    data->isPolling = true;
+
+    for (int i = 0; i < count; i++)
+    {
+        struct epoll_event& event = data->events[i];
+
+        if (event.data.ptr == &sWakeupTag)
+        {
+            uint64_t value;
+            ssize_t drained = read(data->wakeupFd, &value, sizeof(value));
+            (void) drained;
+        }
+        else if (event.data.ptr == &sControlTag)
+        {
+            handleControlSocket(manager);
+        }
+        else
+        {
+            data->current = static_cast<struct mg_connection *>(event.data.ptr);
+            handleConnection(data->current, event.events);
+            data->current = NULL;
+        }
+    }
+
+    if (now >= data->nextSweep)
+    {
+        //Timers, MG_EV_POLL, and anything whose interest changed without an event (eg. resumed reads)
+        for (struct mg_connection *nc = mg_next(manager, NULL); nc != NULL; nc = mg_next(manager, nc))
+        {
+            mg_if_poll(nc, now);
+            updateInterest(nc);
+        }
+
+        data->nextSweep = now + SWEEP_INTERVAL;
+    }
+
+    //Queued by the handlers on connections other than their own (eg. a proxied response), or by timers
+    sendPending(data);
+    data->isPolling = false;
+
+    return (time_t) now;
+}
+
+namespace Mongoose
+{
+const struct mg_iface_vtable *EpollInterface::vtable()
+{
+    static const struct mg_iface_vtable vtable = []
+    {
+        //Sockets are still created, read and written the mongoose way, only the polling is replaced
+        struct mg_iface_vtable result = mg_default_iface_vtable;
+        result.init = epollInit;
+        result.free = epollFree;
+        result.add_conn = epollAddConnection;
+        result.remove_conn = epollRemoveConnection;
+        result.destroy_conn = epollDestroyConnection;
+        result.sock_set = epollSetSocket;
+        result.poll = epollPoll;
+        return result;
+    }();
+
+    sVtable = &vtable;
+    return &vtable;
+}
+
+bool EpollInterface::wakeup(struct mg_mgr *manager)
+{
+    if (manager->num_ifaces == 0 || manager->ifaces[0]->vtable != sVtable || manager->ifaces[0]->data == NULL)
+    {
+        return false;
+    }
+
+    uint64_t value = 1;
+    ssize_t written = write(static_cast<EpollData *>(manager->ifaces[0]->data)->wakeupFd, &value, sizeof(value));
+    (void) written;
+    return true;
+}
+
+void EpollInterface::refresh(struct mg_connection *connection)
+{
+    if (sVtable == NULL || connection->iface == NULL || connection->iface->vtable != sVtable)
+    {
+        return;
+    }
+
+    EpollData *data = epollData(connection);
+
+    if (data == NULL)
+    {
+        return;
+    }
+
+    if (connection == data->current)
+    {
+        //Its own handlers are running: their caller sends and updates the interest once they returned
+        return;
+    }
+
+    if (data->isPolling)
+    {
+        //Handlers are running: don't call into another connection's from under them
+        if (data->pendingSends.empty() || data->pendingSends.back() != connection)
+        {
+            data->pendingSends.push_back(connection);
+        }
+    }
+    else
+    {
+        sendQueued(connection);
+    }
+}
+}
+
+#endif
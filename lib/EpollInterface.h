@@ -0,0 +1,43 @@
+#ifndef _MONGOOSE_EPOLL_INTERFACE_H
+#define _MONGOOSE_EPOLL_INTERFACE_H
+
+struct mg_connection;
+struct mg_iface_vtable;
+struct mg_mgr;
+
+/**
+ * A mongoose network interface polling its sockets with epoll instead of select (Linux only).
+ *
+ * There is no FD_SETSIZE limit, and an idle connection costs nothing per poll: only the sockets that
+ * are ready are looked at. Idle connections still get their MG_EV_POLL and timers, once per second.
+ * Select it with Server::setEventBackend(Server::EpollBackend).
+ */
+namespace Mongoose
+{
+class EpollInterface
+{
+public:
+    /**
+     * @brief vtable
+     * @return the interface, to be used as mg_mgr_init_opts::main_iface
+     */
+    static const struct mg_iface_vtable *vtable();
+
+    /**
+     * @brief wakeup - makes mg_mgr_poll return, without going through mg_broadcast, so it neither
+     * blocks the caller nor calls anything for every connection
+     * @return false if manager doesn't use this interface
+     */
+    static bool wakeup(struct mg_mgr *manager);
+
+    /**
+     * @brief refresh - brings what epoll waits for on connection up to date, and writes what is queued on it.
+     * mg_send only appends to the send buffer: call this on the event loop thread after queueing data, or
+     * resuming reads, anywhere else than in the connection's own event handler. From the handlers, the
+     * write happens once they return. Does nothing if connection doesn't use this interface.
+     */
+    static void refresh(struct mg_connection *connection);
+};
+}
+
+#endif
@@ -0,0 +1,255 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <sstream>
+
+#include "EventSourceHub.h"
+#include "Request.h"
+#include "Response.h"
+
+namespace Mongoose
+{
+EventSourceHub::EventSourceHub(size_t historySize, int heartbeatInterval):
+    mLastEventId(0),
+    mHistorySize(historySize),
+    mSubscriberQueueLimit(1024*1024),
+    mHeartbeatInterval(heartbeatInterval),
+    mIsStopping(false)
+{
+    mHeartbeatThread = std::thread(&EventSourceHub::runHeartbeats, this);
+}
+
+EventSourceHub::~EventSourceHub()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mIsStopping = true;
+    }
+
+    mHeartbeatCondition.notify_all();
+    mHeartbeatThread.join();
+}
+
+bool EventSourceHub::subscribe(const std::shared_ptr<Request> &request, const std::shared_ptr<Response> &response, const std::string &channel)
+{
+    if (!response->eventStream() && !response->startEventStream())
+    {
+        return false;
+    }
+
+    auto queue = response->eventStream();
+    queue->setMaxQueuedBytes(subscriberQueueLimit());
+
+    std::string lastEventId = request->getHeaderValue("Last-Event-ID");
+    std::vector<SharedFrame> missed;
+
+    //Frames are queued holding mPublishMutex only: mMutex is never held while waking the event loop up,
+    //and the replay can't interleave with a concurrent publish
+    std::lock_guard<std::mutex> publishLock(mPublishMutex);
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        Channel& subscribed = mChannels[channel];
+
+        if (lastEventId.size() > 0)
+        {
+            uint64_t last = strtoull(lastEventId.c_str(), NULL, 10);
+
+            for (const auto& event: subscribed.history)
+            {
+                if (event.id > last)
+                {
+                    missed.push_back(event.frame);
+                }
+            }
+        }
+
+        if (std::find(subscribed.subscribers.begin(), subscribed.subscribers.end(), queue) == subscribed.subscribers.end())
+        {
+            subscribed.subscribers.push_back(queue);
+        }
+    }
+
+    for (const auto& frame: missed)
+    {
+        queue->push(frame);
+    }
+
+    return true;
+}
+
+void EventSourceHub::unsubscribe(const std::shared_ptr<Response> &response, const std::string &channel)
+{
+    auto queue = response->eventStream();
+
+    if (queue)
+    {
+        drop(channel, std::vector<std::shared_ptr<FrameQueue>>(1, queue));
+    }
+}
+
+uint64_t EventSourceHub::publish(const std::string &channel, const std::string &data, const std::string &event)
+{
+    std::vector<std::shared_ptr<FrameQueue>> subscribers;
+    std::vector<std::shared_ptr<FrameQueue>> gone;
+    std::lock_guard<std::mutex> publishLock(mPublishMutex);
+    uint64_t id;
+    SharedFrame frame;
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        id = ++mLastEventId;
+        frame = formatEvent(id, data, event);
+        Channel& published = mChannels[channel];
+
+        Event entry = {id, frame};
+        published.history.push_back(entry);
+        while (published.history.size() > mHistorySize)
+        {
+            published.history.pop_front();
+        }
+
+        subscribers = published.subscribers;
+    }
+
+    for (const auto& subscriber: subscribers)
+    {
+        if (!subscriber->push(frame))
+        {
+            //Gone or too slow
+            gone.push_back(subscriber);
+        }
+    }
+
+    drop(channel, gone);
+    return id;
+}
+
+void EventSourceHub::heartbeat()
+{
+    static const SharedFrame comment = std::make_shared<std::string>(":\n\n");
+    std::map<std::string, std::vector<std::shared_ptr<FrameQueue>>> subscribers;
+    std::lock_guard<std::mutex> publishLock(mPublishMutex);
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        for (const auto& channel: mChannels)
+        {
+            subscribers[channel.first] = channel.second.subscribers;
+        }
+    }
+
+    for (const auto& channel: subscribers)
+    {
+        std::vector<std::shared_ptr<FrameQueue>> gone;
+
+        for (const auto& subscriber: channel.second)
+        {
+            if (!subscriber->push(comment))
+            {
+                gone.push_back(subscriber);
+            }
+        }
+
+        drop(channel.first, gone);
+    }
+}
+
+void EventSourceHub::drop(const std::string &channel, const std::vector<std::shared_ptr<FrameQueue>> &queues)
+{
+    if (queues.empty())
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto it = mChannels.find(channel);
+
+    if (it != mChannels.end())
+    {
+        auto& subscribers = it->second.subscribers;
+
+        for (const auto& queue: queues)
+        {
+            subscribers.erase(std::remove(subscribers.begin(), subscribers.end(), queue), subscribers.end());
+        }
+    }
+}
+
+void EventSourceHub::runHeartbeats()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    while (!mIsStopping)
+    {
+        int interval = mHeartbeatInterval > 0 ? mHeartbeatInterval : 1;
+        mHeartbeatCondition.wait_for(lock, std::chrono::seconds(interval));
+
+        if (!mIsStopping && mHeartbeatInterval > 0)
+        {
+            lock.unlock();
+            heartbeat();
+            lock.lock();
+        }
+    }
+}
+
+size_t EventSourceHub::subscriberCount(const std::string &channel) const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto it = mChannels.find(channel);
+    return it != mChannels.end() ? it->second.subscribers.size() : 0;
+}
+
+int EventSourceHub::heartbeatInterval() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mHeartbeatInterval;
+}
+
+void EventSourceHub::setHeartbeatInterval(int seconds)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mHeartbeatInterval = seconds;
+    }
+
+    mHeartbeatCondition.notify_all();
+}
+
+size_t EventSourceHub::subscriberQueueLimit() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mSubscriberQueueLimit;
+}
+
+void EventSourceHub::setSubscriberQueueLimit(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mSubscriberQueueLimit = bytes;
+}
+
+SharedFrame EventSourceHub::formatEvent(uint64_t id, const std::string &data, const std::string &event)
+{
+    std::ostringstream frame;
+    frame << "id: " << id << "\n";
+
+    if (event.size() > 0)
+    {
+        frame << "event: " << event << "\n";
+    }
+
+    //Every line of the data gets its own data field
+    size_t begin = 0;
+    do
+    {
+        size_t end = data.find('\n', begin);
+        frame << "data: " << data.substr(begin, end == std::string::npos ? std::string::npos : end - begin) << "\n";
+        begin = end == std::string::npos ? end : end + 1;
+    } while (begin != std::string::npos);
+
+    frame << "\n";
+    return std::make_shared<std::string>(frame.str());
+}
+}
@@ -0,0 +1,102 @@
+#ifndef _MONGOOSE_EVENT_SOURCE_HUB_H
+#define _MONGOOSE_EVENT_SOURCE_HUB_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "FrameQueue.h"
+
+/**
+ * Channel based server sent events (EventSource) broadcasting.
+ *
+ * Published events are formatted once and the same buffer is queued to every subscriber of the channel.
+ * The last few events of every channel are kept, so that reconnecting browsers sending a Last-Event-ID
+ * get what they missed. Idle streams get a heartbeat comment so that proxies don't time them out.
+ */
+namespace Mongoose
+{
+class Request;
+class Response;
+class EventSourceHub
+{
+public:
+    /**
+     * @param historySize - how many events per channel are kept for Last-Event-ID replays
+     * @param heartbeatInterval - seconds between heartbeats, 0 disables them
+     */
+    EventSourceHub(size_t historySize = 256, int heartbeatInterval = 15);
+    virtual ~EventSourceHub();
+
+    /**
+     * @brief subscribe - starts the event stream on response if needed, and subscribes it to channel.
+     * Events newer than the request's Last-Event-ID header are replayed first.
+     * @return false if the response was already sent
+     */
+    bool subscribe(const std::shared_ptr<Request>& request, const std::shared_ptr<Response>& response, const std::string& channel);
+    void unsubscribe(const std::shared_ptr<Response>& response, const std::string& channel);
+
+    /**
+     * @brief publish - sends an event to every subscriber of channel, can be called from any thread
+     * @param data - the event data, may span several lines
+     * @param event - the event type, empty for the default "message" type
+     * @return the id of the event
+     */
+    uint64_t publish(const std::string& channel, const std::string& data, const std::string& event = "");
+
+    /**
+     * @brief heartbeat - sends a comment to every subscriber, done every heartbeatInterval() seconds
+     */
+    void heartbeat();
+
+    size_t subscriberCount(const std::string& channel) const;
+
+    int heartbeatInterval() const;
+    void setHeartbeatInterval(int seconds);
+
+    /**
+     * @brief subscriberQueueLimit / setSubscriberQueueLimit - how many bytes may be queued for a subscriber
+     * before it is considered too slow and disconnected
+     */
+    size_t subscriberQueueLimit() const;
+    void setSubscriberQueueLimit(size_t bytes);
+
+    static SharedFrame formatEvent(uint64_t id, const std::string& data, const std::string& event);
+
+private:
+    struct Event
+    {
+        uint64_t id;
+        SharedFrame frame;
+    };
+
+    struct Channel
+    {
+        std::deque<Event> history;
+        std::vector<std::shared_ptr<FrameQueue>> subscribers;
+    };
+
+    void runHeartbeats();
+    void drop(const std::string& channel, const std::vector<std::shared_ptr<FrameQueue>>& queues);
+
+    mutable std::mutex mMutex;
+    std::mutex mPublishMutex;
+    std::map<std::string, Channel> mChannels;
+    uint64_t mLastEventId;
+    size_t mHistorySize;
+    size_t mSubscriberQueueLimit;
+
+    int mHeartbeatInterval;
+    bool mIsStopping;
+    std::condition_variable mHeartbeatCondition;
+    std::thread mHeartbeatThread;
+};
+}
+
+#endif
@@ -0,0 +1,174 @@
+#include <algorithm>
+#include <mongoose.h>
+
+#ifdef __linux__
+#include "EpollInterface.h"
+#endif
+#include "FrameQueue.h"
+#include "Server.h"
+
+namespace Mongoose
+{
+FrameQueue::FrameQueue(struct mg_connection *connection, Server *server, size_t maxQueuedBytes):
+    mFrontOffset(0),
+    mQueuedBytes(0),
+    mMaxQueuedBytes(maxQueuedBytes),
+    mSendBufferLimit(64*1024),
+    mIsClosing(false),
+    mIsEvicted(false),
+    mIsValid(true),
+    mIsFlushScheduled(false),
+    mConnection(connection),
+    mServer(server)
+{
+}
+
+bool FrameQueue::push(const SharedFrame &frame)
+{
+    bool result = true;
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        if (!mIsValid || mIsClosing || mIsEvicted)
+        {
+            return false;
+        }
+
+        if (mQueuedBytes + frame->size() > mMaxQueuedBytes)
+        {
+            //Slow consumer: drop what it has queued and disconnect it on the next flush
+            mIsEvicted = true;
+            mFrames.clear();
+            mQueuedBytes = 0;
+            result = false;
+        }
+        else
+        {
+            mFrames.push_back(frame);
+            mQueuedBytes += frame->size();
+        }
+    }
+
+    scheduleFlush();
+    return result;
+}
+
+void FrameQueue::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mIsClosing = true;
+    }
+
+    scheduleFlush();
+}
+
+void FrameQueue::scheduleFlush()
+{
+    if (!mIsFlushScheduled.exchange(true))
+    {
+        mServer->scheduleFlush(shared_from_this());
+    }
+}
+
+void FrameQueue::flush()
+{
+    mIsFlushScheduled = false;
+
+    if (!queueFrames())
+    {
+        return;
+    }
+
+#ifdef __linux__
+    //Unlocked: writing calls the MG_EV_SEND handler, which flushes again
+    EpollInterface::refresh(mConnection);
+#endif
+}
+
+bool FrameQueue::queueFrames()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    if (!mIsValid)
+    {
+        return false;
+    }
+
+    if (mIsEvicted)
+    {
+        mConnection->flags |= MG_F_CLOSE_IMMEDIATELY;
+        return false;
+    }
+
+    while (!mFrames.empty() && mConnection->send_mbuf.len < mSendBufferLimit)
+    {
+        const SharedFrame& frame = mFrames.front();
+        size_t length = std::min(frame->size() - mFrontOffset, mSendBufferLimit - mConnection->send_mbuf.len);
+
+        mg_send(mConnection, frame->data() + mFrontOffset, (int) length);
+        mFrontOffset += length;
+        mQueuedBytes -= length;
+
+        if (mFrontOffset == frame->size())
+        {
+            mFrames.pop_front();
+            mFrontOffset = 0;
+        }
+    }
+
+    if (mFrames.empty() && mIsClosing)
+    {
+        mConnection->flags |= MG_F_SEND_AND_CLOSE;
+    }
+
+    return true;
+}
+
+bool FrameQueue::isValid() const
+{
+    return mIsValid;
+}
+
+void FrameQueue::setIsValid(bool value)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mIsValid = value;
+}
+
+size_t FrameQueue::queuedBytes() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mQueuedBytes;
+}
+
+size_t FrameQueue::maxQueuedBytes() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mMaxQueuedBytes;
+}
+
+void FrameQueue::setMaxQueuedBytes(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mMaxQueuedBytes = bytes;
+}
+
+size_t FrameQueue::sendBufferLimit() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mSendBufferLimit;
+}
+
+void FrameQueue::setSendBufferLimit(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mSendBufferLimit = bytes;
+}
+
+struct mg_connection *FrameQueue::connection() const
+{
+    return mConnection;
+}
+}
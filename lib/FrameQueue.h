@@ -0,0 +1,86 @@
+#ifndef _MONGOOSE_FRAME_QUEUE_H
+#define _MONGOOSE_FRAME_QUEUE_H
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+
+struct mg_connection;
+
+/**
+ * A queue of already encoded frames (websocket frames, server sent events...) waiting to be written to
+ * one long lived connection.
+ *
+ * Frames are shared, refcounted buffers: a message broadcast to many connections is encoded once and
+ * queued by reference everywhere. They are only copied into the connection's send buffer as it drains,
+ * so a slow client holds references rather than copies. A client whose queue grows beyond
+ * maxQueuedBytes() is considered too slow and disconnected.
+ */
+namespace Mongoose
+{
+class Server;
+
+typedef std::shared_ptr<const std::string> SharedFrame;
+
+class FrameQueue: public std::enable_shared_from_this<FrameQueue>
+{
+public:
+    FrameQueue(struct mg_connection *connection, Server *server, size_t maxQueuedBytes = 1024*1024);
+
+    /**
+     * @brief push - queues a frame for sending, can be called from any thread
+     * @return false if the connection is gone, or was just evicted for being too slow
+     */
+    bool push(const SharedFrame& frame);
+
+    /**
+     * @brief close - closes the connection once the frames queued so far are sent. Can be called from any thread
+     */
+    void close();
+
+    /**
+     * @brief flush - moves queued frames into the connection's send buffer, up to sendBufferLimit() bytes,
+     * and has them written.
+     * Must only be called from the thread polling the server, Server does that.
+     */
+    void flush();
+
+    bool isValid() const;
+    void setIsValid(bool value);
+
+    size_t queuedBytes() const;
+
+    size_t maxQueuedBytes() const;
+    void setMaxQueuedBytes(size_t bytes);
+
+    /**
+     * @brief sendBufferLimit - how many bytes may sit in the connection's send buffer before
+     * flushing stops and waits for the socket to drain
+     */
+    size_t sendBufferLimit() const;
+    void setSendBufferLimit(size_t bytes);
+
+    struct mg_connection* connection() const;
+
+private:
+    void scheduleFlush();
+    bool queueFrames();
+
+    mutable std::mutex mMutex;
+    std::deque<SharedFrame> mFrames;
+    size_t mFrontOffset;
+    size_t mQueuedBytes;
+    size_t mMaxQueuedBytes;
+    size_t mSendBufferLimit;
+    bool mIsClosing;
+    bool mIsEvicted;
+    std::atomic_bool mIsValid;
+    std::atomic_bool mIsFlushScheduled;
+    struct mg_connection *mConnection;
+    Server *mServer;
+};
+}
+
+#endif
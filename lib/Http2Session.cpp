@@ -0,0 +1,904 @@
+#include <algorithm>
+#include <cstring>
+#include <mongoose.h>
+#include <nghttp2/nghttp2.h>
+
+#ifdef __linux__
+#include "EpollInterface.h"
+#endif
+#include "Http2Session.h"
+#include "Request.h"
+#include "Response.h"
+#include "Server.h"
+
+//The client connection preface, RFC 7540 3.5
+static const char PREFACE[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+static const size_t PREFACE_SIZE = sizeof(PREFACE) - 1;
+
+//Past this much waiting in the connection's send buffer, frames are held back until the socket drains
+static const size_t SEND_BUFFER_LIMIT = 256*1024;
+
+static bool equalsIgnoreCase(const std::string& name, const char *other)
+{
+    return name.size() == strlen(other) && mg_ncasecmp(name.c_str(), other, name.size()) == 0;
+}
+
+//Headers about the HTTP/1 connection, which have no meaning (and are forbidden) in HTTP/2
+static bool isConnectionHeader(const std::string& name)
+{
+    return equalsIgnoreCase(name, "Connection") || equalsIgnoreCase(name, "Keep-Alive")
+           || equalsIgnoreCase(name, "Proxy-Connection") || equalsIgnoreCase(name, "Transfer-Encoding")
+           || equalsIgnoreCase(name, "Upgrade") || equalsIgnoreCase(name, "HTTP2-Settings");
+}
+
+namespace Mongoose
+{
+struct Http2Callbacks
+{
+    static int onBeginHeaders(nghttp2_session *session, const nghttp2_frame *frame, void *userData)
+    {
+        Http2Session *self = static_cast<Http2Session *>(userData);
+
+        if (frame->hd.type == NGHTTP2_HEADERS && frame->headers.cat == NGHTTP2_HCAT_REQUEST)
+        {
+            self->mStreams[frame->hd.stream_id] = Http2Session::Stream();
+        }
+
+        return 0;
+    }
+
+    static int onHeader(nghttp2_session *session, const nghttp2_frame *frame, const uint8_t *name, size_t nameLength,
+                        const uint8_t *value, size_t valueLength, uint8_t flags, void *userData)
+    {
+        Http2Session *self = static_cast<Http2Session *>(userData);
+
+        if (frame->hd.type != NGHTTP2_HEADERS || frame->headers.cat != NGHTTP2_HCAT_REQUEST)
+        {
+            //Trailers aren't handed over, there is nowhere to put them in a Request
+            return 0;
+        }
+
+        auto stream = self->mStreams.find(frame->hd.stream_id);
+        if (stream == self->mStreams.end())
+        {
+            return 0;
+        }
+
+        std::string key((const char *) name, nameLength);
+        std::string content((const char *) value, valueLength);
+
+        if (key == ":method")
+        {
+            stream->second.method = content;
+        }
+        else if (key == ":path")
+        {
+            stream->second.path = content;
+        }
+        else if (key == ":authority")
+        {
+            stream->second.authority = content;
+        }
+        else if (key[0] != ':' && stream->second.headers.size() < MG_MAX_HTTP_HEADERS - 2)
+        {
+            //Room is kept for Host, see headersReceived
+            stream->second.headers.push_back(std::make_pair(key, content));
+        }
+
+        return 0;
+    }
+
+    static int onFrameReceived(nghttp2_session *session, const nghttp2_frame *frame, void *userData)
+    {
+        Http2Session *self = static_cast<Http2Session *>(userData);
+        int32_t streamId = frame->hd.stream_id;
+
+        if (frame->hd.type != NGHTTP2_HEADERS && frame->hd.type != NGHTTP2_DATA)
+        {
+            return 0;
+        }
+
+        if (self->mStreams.find(streamId) == self->mStreams.end())
+        {
+            return 0;
+        }
+
+        if (frame->hd.type == NGHTTP2_HEADERS && frame->headers.cat == NGHTTP2_HCAT_REQUEST)
+        {
+            self->headersReceived(streamId, self->mStreams[streamId]);
+        }
+
+        auto stream = self->mStreams.find(streamId);
+        if (stream != self->mStreams.end() && (frame->hd.flags & NGHTTP2_FLAG_END_STREAM))
+        {
+            self->requestReceived(streamId, stream->second);
+        }
+
+        return 0;
+    }
+
+    static int onDataChunk(nghttp2_session *session, uint8_t flags, int32_t streamId, const uint8_t *data,
+                           size_t length, void *userData)
+    {
+        Http2Session *self = static_cast<Http2Session *>(userData);
+        auto stream = self->mStreams.find(streamId);
+
+        if (stream == self->mStreams.end() || stream->second.isRejected)
+        {
+            return 0;
+        }
+
+        Http2Session::Stream& current = stream->second;
+
+        if (current.handler)
+        {
+            bool result;
+
+            try
+            {
+                result = current.handler(current.request, current.response, (const char *) data, length);
+            }
+            catch(...)
+            {
+                result = false;
+            }
+
+            if (!result)
+            {
+                if (current.response->isValid())
+                {
+                    current.response->sendError("Server error trying to handle the request body");
+                }
+
+                //The rest of the body is dropped
+                current.isRejected = true;
+            }
+        }
+        else if ((current.bodySizeLimit > 0 && current.body.size() + length > current.bodySizeLimit)
+                 || (self->mServer->memoryLimit() > 0 && current.body.size() + length > self->mServer->memoryLimit()))
+        {
+            self->respond(streamId, current, 413, "");
+            current.body.clear();
+        }
+        else
+        {
+            current.body.append((const char *) data, length);
+        }
+
+        return 0;
+    }
+
+    static int onStreamClose(nghttp2_session *session, int32_t streamId, uint32_t errorCode, void *userData)
+    {
+        Http2Session *self = static_cast<Http2Session *>(userData);
+        auto stream = self->mStreams.find(streamId);
+
+        if (stream != self->mStreams.end())
+        {
+            if (stream->second.request)
+            {
+                stream->second.request->setIsValid(false);
+            }
+
+            if (stream->second.response)
+            {
+                //Any later send() fails, eg. when the client cancelled the stream
+                stream->second.response->setIsValid(false);
+            }
+
+            self->mClosedStreams.push_back(std::move(stream->second));
+            self->mStreams.erase(stream);
+        }
+
+        return 0;
+    }
+
+    static ssize_t onSend(nghttp2_session *session, const uint8_t *data, size_t length, int flags, void *userData)
+    {
+        Http2Session *self = static_cast<Http2Session *>(userData);
+
+        if (self->mConnection->send_mbuf.len >= SEND_BUFFER_LIMIT)
+        {
+            //Resumed by onSent()
+            return NGHTTP2_ERR_WOULDBLOCK;
+        }
+
+        mg_send(self->mConnection, data, (int) length);
+        return (ssize_t) length;
+    }
+
+    static ssize_t onReadBody(nghttp2_session *session, int32_t streamId, uint8_t *buffer, size_t length,
+                              uint32_t *dataFlags, nghttp2_data_source *source, void *userData)
+    {
+        Http2Session *self = static_cast<Http2Session *>(userData);
+        auto stream = self->mStreams.find(streamId);
+
+        if (stream == self->mStreams.end())
+        {
+            return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+        }
+
+        Http2Session::Stream& current = stream->second;
+        size_t size = std::min(length, current.output.size() - current.outputOffset);
+        memcpy(buffer, current.output.data() + current.outputOffset, size);
+        current.outputOffset += size;
+
+        if (current.outputOffset == current.output.size())
+        {
+            current.output.clear();
+            current.outputOffset = 0;
+        }
+        else if (current.outputOffset > 64*1024 && current.outputOffset * 2 > current.output.size())
+        {
+            current.output.erase(0, current.outputOffset);
+            current.outputOffset = 0;
+        }
+
+        if (size > 0)
+        {
+            //Its producer may write more, once nghttp2 is done with the session
+            self->mDrainedStreams.push_back(streamId);
+        }
+
+        if (current.output.empty() && current.isOutputEnded)
+        {
+            *dataFlags |= NGHTTP2_DATA_FLAG_EOF;
+            return (ssize_t) size;
+        }
+
+        if (size == 0)
+        {
+            //Resumed by submitData()
+            current.isOutputDeferred = true;
+            return NGHTTP2_ERR_DEFERRED;
+        }
+
+        return (ssize_t) size;
+    }
+};
+
+Http2Session::Http2Session(Server *server, struct mg_connection *connection):
+    mServer(server),
+    mConnection(connection),
+    mSession(nullptr),
+    mIsBusy(false),
+    mIsClosed(false)
+{
+}
+
+Http2Session::~Http2Session()
+{
+    if (mSession)
+    {
+        nghttp2_session_del(mSession);
+    }
+}
+
+bool Http2Session::isPreface(const char *data, size_t size)
+{
+    //"PRI " already tells it apart from any HTTP/1 request
+    return size >= 4 && memcmp(data, PREFACE, std::min(size, PREFACE_SIZE)) == 0;
+}
+
+bool Http2Session::isUpgrade(struct http_message *message)
+{
+    struct mg_str *upgrade = mg_get_http_header(message, "Upgrade");
+
+    if (upgrade == NULL || mg_get_http_header(message, "HTTP2-Settings") == NULL)
+    {
+        return false;
+    }
+
+    //A list of protocols, h2c has to be one of them
+    std::string protocols(upgrade->p, upgrade->len);
+    std::transform(protocols.begin(), protocols.end(), protocols.begin(), ::tolower);
+    size_t position = 0;
+
+    while ((position = protocols.find("h2c", position)) != std::string::npos)
+    {
+        bool isStart = position == 0 || protocols[position - 1] == ' ' || protocols[position - 1] == ',';
+        bool isEnd = position + 3 == protocols.size() || protocols[position + 3] == ' ' || protocols[position + 3] == ',';
+
+        if (isStart && isEnd)
+        {
+            return true;
+        }
+
+        position += 3;
+    }
+
+    return false;
+}
+
+bool Http2Session::createSession()
+{
+    nghttp2_session_callbacks *callbacks;
+
+    if (nghttp2_session_callbacks_new(&callbacks) != 0)
+    {
+        return false;
+    }
+
+    nghttp2_session_callbacks_set_send_callback(callbacks, Http2Callbacks::onSend);
+    nghttp2_session_callbacks_set_on_begin_headers_callback(callbacks, Http2Callbacks::onBeginHeaders);
+    nghttp2_session_callbacks_set_on_header_callback(callbacks, Http2Callbacks::onHeader);
+    nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks, Http2Callbacks::onFrameReceived);
+    nghttp2_session_callbacks_set_on_data_chunk_recv_callback(callbacks, Http2Callbacks::onDataChunk);
+    nghttp2_session_callbacks_set_on_stream_close_callback(callbacks, Http2Callbacks::onStreamClose);
+
+    int result = nghttp2_session_server_new(&mSession, callbacks, this);
+    nghttp2_session_callbacks_del(callbacks);
+
+    if (result != 0)
+    {
+        mSession = nullptr;
+        return false;
+    }
+
+    nghttp2_settings_entry settings[] = {
+        { NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS, mServer->http2MaxConcurrentStreams() },
+        { NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE, mServer->http2InitialWindowSize() }
+    };
+
+    return nghttp2_submit_settings(mSession, NGHTTP2_FLAG_NONE, settings, sizeof(settings) / sizeof(settings[0])) == 0;
+}
+
+bool Http2Session::start()
+{
+    return createSession();
+}
+
+bool Http2Session::upgrade(struct http_message *message)
+{
+    //HTTP2-Settings is the client's SETTINGS payload, in base64url
+    struct mg_str *header = mg_get_http_header(message, "HTTP2-Settings");
+    std::string encoded(header->p, header->len);
+    std::replace(encoded.begin(), encoded.end(), '-', '+');
+    std::replace(encoded.begin(), encoded.end(), '_', '/');
+    while (encoded.size() % 4 != 0)
+    {
+        encoded += '=';
+    }
+
+    std::string payload(encoded.size(), '\0');
+    int length = 0;
+    cs_base64_decode((const unsigned char *) encoded.data(), (int) encoded.size(), &payload[0], &length);
+    payload.resize(length);
+
+    if (!createSession())
+    {
+        return false;
+    }
+
+    bool isHead = mg_vcmp(&message->method, "HEAD") == 0;
+    if (nghttp2_session_upgrade2(mSession, (const uint8_t *) payload.data(), payload.size(), isHead, nullptr) != 0)
+    {
+        nghttp2_session_del(mSession);
+        mSession = nullptr;
+        return false;
+    }
+
+    mg_printf(mConnection, "%s", "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n");
+
+    //The request that asked for the upgrade is answered on stream 1. It went through the checks as HTTP/1 already.
+    Stream& stream = mStreams[1];
+    stream.method = std::string(message->method.p, message->method.len);
+    stream.path = std::string(message->uri.p, message->uri.len);
+    if (message->query_string.len > 0)
+    {
+        stream.path += "?" + std::string(message->query_string.p, message->query_string.len);
+    }
+
+    for (int i = 0; i < MG_MAX_HTTP_HEADERS && message->header_names[i].len > 0; i++)
+    {
+        std::string name(message->header_names[i].p, message->header_names[i].len);
+
+        if (equalsIgnoreCase(name, "Host"))
+        {
+            stream.authority = std::string(message->header_values[i].p, message->header_values[i].len);
+        }
+        else if (!isConnectionHeader(name) && stream.headers.size() < MG_MAX_HTTP_HEADERS - 2)
+        {
+            stream.headers.push_back(std::make_pair(name, std::string(message->header_values[i].p, message->header_values[i].len)));
+        }
+    }
+
+    mIsBusy = true;
+    routeStream(1, stream);
+    auto upgraded = mStreams.find(1);
+    if (upgraded != mStreams.end())
+    {
+        requestReceived(1, upgraded->second);
+    }
+    mIsBusy = false;
+
+    flush();
+    return true;
+}
+
+void Http2Session::receive(const char *data, size_t size)
+{
+    if (!mSession)
+    {
+        return;
+    }
+
+    mClosedStreams.clear();
+
+    mIsBusy = true;
+    ssize_t result = nghttp2_session_mem_recv(mSession, (const uint8_t *) data, size);
+    mIsBusy = false;
+
+    flush();
+    notifyDrained();
+
+    if (result < 0)
+    {
+        //A fatal protocol error: nghttp2 queued a GOAWAY, which flush() sent
+        mConnection->flags |= MG_F_SEND_AND_CLOSE;
+    }
+}
+
+void Http2Session::onSent()
+{
+    mClosedStreams.clear();
+    flush();
+    notifyDrained();
+}
+
+void Http2Session::notifyWritable()
+{
+    //The callbacks may close streams, don't walk the map while they run
+    std::vector<std::shared_ptr<Response>> responses;
+
+    for (const auto& stream: mStreams)
+    {
+        if (stream.second.response)
+        {
+            responses.push_back(stream.second.response);
+        }
+    }
+
+    for (const auto& response: responses)
+    {
+        response->notifyWritable();
+    }
+}
+
+void Http2Session::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(mSubmissionsMutex);
+        mIsClosed = true;
+        mSubmissions.clear();
+    }
+
+    for (auto& stream: mStreams)
+    {
+        if (stream.second.request)
+        {
+            stream.second.request->setIsValid(false);
+        }
+
+        if (stream.second.response)
+        {
+            stream.second.response->setIsValid(false);
+        }
+    }
+
+    mStreams.clear();
+    mClosedStreams.clear();
+}
+
+void Http2Session::headersReceived(int32_t streamId, Stream &stream)
+{
+    bool hasHost = false;
+    for (const auto& header: stream.headers)
+    {
+        hasHost = hasHost || equalsIgnoreCase(header.first, "Host");
+    }
+
+    if (!hasHost && !stream.authority.empty())
+    {
+        stream.headers.push_back(std::make_pair(std::string("host"), stream.authority));
+    }
+
+    //The same checks an HTTP/1 request goes through
+    struct http_message message;
+    buildMessage(stream, &message);
+
+    if (mServer->requiresBasicAuthentication() && !mServer->authenticate(mConnection, &message))
+    {
+        std::map<std::string, std::string> headers;
+        headers["WWW-Authenticate"] = "Basic realm=\"" + mServer->mAuthDomain + "\"";
+        respond(streamId, stream, 401, "", headers);
+        return;
+    }
+
+    //Coprocessors answer rejected requests on the connection, as HTTP/1: what they write is turned into a response
+    size_t offset = mConnection->send_mbuf.len;
+    unsigned long flags = mConnection->flags;
+
+    if (!mServer->preRequest(mConnection, &message))
+    {
+        respondCaptured(streamId, stream, offset, flags);
+        return;
+    }
+
+    routeStream(streamId, stream);
+}
+
+void Http2Session::routeStream(int32_t streamId, Stream &stream)
+{
+    std::string url = stream.path.substr(0, stream.path.find('?'));
+
+    if (!mServer->handles(stream.method, url))
+    {
+        //Static files are only served over HTTP/1, mongoose writes them straight to the connection
+        respond(streamId, stream, 404, "Not found\n");
+        return;
+    }
+
+    stream.bodySizeLimit = mServer->routeBodySizeLimit(stream.method, url);
+
+    size_t memoryLimit = mServer->memoryLimit();
+
+    for (const auto& header: stream.headers)
+    {
+        if (!equalsIgnoreCase(header.first, "Content-Length"))
+        {
+            continue;
+        }
+
+        size_t length = strtoull(header.second.c_str(), NULL, 10);
+
+        if ((stream.bodySizeLimit > 0 && length > stream.bodySizeLimit) || (memoryLimit > 0 && length > memoryLimit))
+        {
+            respond(streamId, stream, 413, "");
+            return;
+        }
+
+        if (memoryLimit > 0 && length > 0 && mServer->memoryUsage() + length > memoryLimit)
+        {
+            //Like HTTP/1 requests, see Server::admitRequest: the body wouldn't fit in the budget right now
+            std::map<std::string, std::string> headers = {{"Retry-After", "1"}};
+            respond(streamId, stream, 503, "", headers);
+            return;
+        }
+    }
+
+    BodyChunkHandler handler;
+    if (mServer->handlesBodyChunks(stream.method, url, &handler))
+    {
+        //The handler gets the request right away, and its body as it arrives
+        struct http_message message;
+        buildMessage(stream, &message);
+
+        stream.handler = handler;
+        stream.request = mServer->createRequest(mConnection, &message);
+        stream.response = mServer->createResponse(mConnection, stream.request);
+        stream.response->setHttp2Stream(shared_from_this(), streamId);
+    }
+}
+
+void Http2Session::requestReceived(int32_t streamId, Stream &stream)
+{
+    if (stream.isRejected)
+    {
+        return;
+    }
+
+    if (!stream.handler)
+    {
+        struct http_message message;
+        buildMessage(stream, &message);
+        message.body = mg_mk_str_n(stream.body.data(), stream.body.size());
+
+        stream.request = mServer->createRequest(mConnection, &message);
+        stream.response = mServer->createResponse(mConnection, stream.request);
+        stream.response->setHttp2Stream(shared_from_this(), streamId);
+        stream.body.clear();
+    }
+
+    //The stream may close while the request is handled
+    auto request = stream.request;
+    auto response = stream.response;
+    mServer->handleRequest(request, response);
+}
+
+void Http2Session::buildMessage(Stream &stream, struct http_message *message)
+{
+    memset(message, 0, sizeof(*message));
+
+    size_t query = stream.path.find('?');
+    message->method = mg_mk_str_n(stream.method.data(), stream.method.size());
+    message->uri = mg_mk_str_n(stream.path.data(), query == std::string::npos ? stream.path.size() : query);
+    message->proto = mg_mk_str("HTTP/2.0");
+
+    if (query != std::string::npos)
+    {
+        message->query_string = mg_mk_str_n(stream.path.data() + query + 1, stream.path.size() - query - 1);
+    }
+
+    for (size_t i = 0; i < stream.headers.size() && i + 1 < MG_MAX_HTTP_HEADERS; i++)
+    {
+        message->header_names[i] = mg_mk_str_n(stream.headers[i].first.data(), stream.headers[i].first.size());
+        message->header_values[i] = mg_mk_str_n(stream.headers[i].second.data(), stream.headers[i].second.size());
+    }
+}
+
+void Http2Session::respond(int32_t streamId, Stream &stream, int code, const std::string &body,
+                           const std::map<std::string, std::string> &headers)
+{
+    std::map<std::string, std::string> all = headers;
+    all["Content-Length"] = std::to_string(body.size());
+    if (!body.empty())
+    {
+        all["Content-Type"] = "text/plain";
+    }
+
+    stream.isRejected = true;
+    submitHeaders(streamId, code, all, body.empty());
+
+    if (!body.empty())
+    {
+        submitData(streamId, body.data(), body.size(), true);
+    }
+}
+
+void Http2Session::respondCaptured(int32_t streamId, Stream &stream, size_t offset, unsigned long flags)
+{
+    std::string written(mConnection->send_mbuf.buf + offset, mConnection->send_mbuf.len - offset);
+
+    //None of it goes out as is, nor does the connection close
+    mConnection->send_mbuf.len = offset;
+    mConnection->flags = flags;
+
+    struct http_message reply;
+    std::map<std::string, std::string> headers;
+    int headersLength = mg_parse_http(written.data(), (int) written.size(), &reply, 0);
+
+    if (headersLength <= 0 || reply.resp_code == 0)
+    {
+        respond(streamId, stream, 403, "");
+        return;
+    }
+
+    for (int i = 0; i < MG_MAX_HTTP_HEADERS && reply.header_names[i].len > 0; i++)
+    {
+        std::string name(reply.header_names[i].p, reply.header_names[i].len);
+
+        if (!equalsIgnoreCase(name, "Content-Length") && !equalsIgnoreCase(name, "Content-Type"))
+        {
+            headers[name] = std::string(reply.header_values[i].p, reply.header_values[i].len);
+        }
+    }
+
+    respond(streamId, stream, reply.resp_code, written.substr(headersLength), headers);
+}
+
+bool Http2Session::submitHeaders(int32_t streamId, int code, const std::map<std::string, std::string> &headers, bool endStream)
+{
+    if (!isEventLoopThread())
+    {
+        Submission submission = { streamId, true, code, headers, std::string(), endStream };
+        return post(submission);
+    }
+
+    //What other threads submitted before goes first
+    runSubmissions();
+    return writeHeaders(streamId, code, headers, endStream);
+}
+
+bool Http2Session::submitData(int32_t streamId, const char *data, size_t size, bool endStream)
+{
+    if (!isEventLoopThread())
+    {
+        Submission submission = { streamId, false, 0, std::map<std::string, std::string>(), std::string(data, size), endStream };
+        return post(submission);
+    }
+
+    runSubmissions();
+    return writeData(streamId, data, size, endStream);
+}
+
+bool Http2Session::isEventLoopThread() const
+{
+    return mServer->isEventLoopThread();
+}
+
+bool Http2Session::post(Submission &submission)
+{
+    bool wasEmpty;
+    {
+        std::lock_guard<std::mutex> lock(mSubmissionsMutex);
+
+        if (mIsClosed)
+        {
+            return false;
+        }
+
+        wasEmpty = mSubmissions.empty();
+        mSubmissions.push_back(std::move(submission));
+    }
+
+    if (wasEmpty)
+    {
+        mServer->scheduleSubmissions(shared_from_this());
+    }
+
+    return true;
+}
+
+void Http2Session::runSubmissions()
+{
+    std::vector<Submission> submissions;
+    {
+        std::lock_guard<std::mutex> lock(mSubmissionsMutex);
+        submissions.swap(mSubmissions);
+    }
+
+    for (const auto& submission: submissions)
+    {
+        if (submission.isHeaders)
+        {
+            writeHeaders(submission.streamId, submission.code, submission.headers, submission.endStream);
+        }
+        else
+        {
+            writeData(submission.streamId, submission.data.data(), submission.data.size(), submission.endStream);
+        }
+    }
+}
+
+bool Http2Session::writeHeaders(int32_t streamId, int code, const std::map<std::string, std::string> &headers, bool endStream)
+{
+    auto stream = mStreams.find(streamId);
+
+    if (!mSession || stream == mStreams.end() || stream->second.isAnswered)
+    {
+        return false;
+    }
+
+    Stream& current = stream->second;
+    current.isAnswered = true;
+
+    if (current.method == "HEAD" || code == 204 || code == 304)
+    {
+        //Never any body
+        endStream = true;
+    }
+
+    //HTTP/2 header names are lower case. nghttp2 copies them, they only have to live until it returns.
+    std::string status = std::to_string(code);
+    std::vector<std::string> names;
+    std::vector<nghttp2_nv> fields;
+    names.reserve(headers.size());
+    fields.reserve(headers.size() + 1);
+
+    fields.push_back({ (uint8_t *) ":status", (uint8_t *) status.data(), 7, status.size(), NGHTTP2_NV_FLAG_NONE });
+
+    for (const auto& header: headers)
+    {
+        if (isConnectionHeader(header.first))
+        {
+            continue;
+        }
+
+        names.push_back(header.first);
+        std::transform(names.back().begin(), names.back().end(), names.back().begin(), ::tolower);
+        fields.push_back({ (uint8_t *) names.back().data(), (uint8_t *) header.second.data(),
+                           names.back().size(), header.second.size(), NGHTTP2_NV_FLAG_NONE });
+    }
+
+    nghttp2_data_provider provider;
+    provider.source.ptr = nullptr;
+    provider.read_callback = Http2Callbacks::onReadBody;
+
+    current.isOutputEnded = endStream;
+    int result = nghttp2_submit_response(mSession, streamId, fields.data(), fields.size(), endStream ? nullptr : &provider);
+
+    flush();
+    return result == 0;
+}
+
+bool Http2Session::writeData(int32_t streamId, const char *data, size_t size, bool endStream)
+{
+    auto stream = mStreams.find(streamId);
+
+    if (stream == mStreams.end() || !stream->second.isAnswered)
+    {
+        return false;
+    }
+
+    Stream& current = stream->second;
+
+    if (current.isOutputEnded)
+    {
+        //The body of a HEAD request (or a 304...) is silently dropped
+        return current.method == "HEAD" && current.output.empty();
+    }
+
+    if (size > 0)
+    {
+        current.output.append(data, size);
+    }
+    current.isOutputEnded = endStream;
+
+    if (current.isOutputDeferred)
+    {
+        current.isOutputDeferred = false;
+        nghttp2_session_resume_data(mSession, streamId);
+    }
+
+    flush();
+    return true;
+}
+
+size_t Http2Session::bufferedBytes(int32_t streamId) const
+{
+    auto stream = mStreams.find(streamId);
+    return stream == mStreams.end() ? 0 : stream->second.output.size() - stream->second.outputOffset;
+}
+
+size_t Http2Session::memoryUsage() const
+{
+    size_t usage = 0;
+
+    //No more streams than SETTINGS_MAX_CONCURRENT_STREAMS
+    for (const auto& stream: mStreams)
+    {
+        usage += stream.second.body.size() + stream.second.output.size() - stream.second.outputOffset;
+    }
+
+    return usage;
+}
+
+void Http2Session::flush()
+{
+    //nghttp2 must not be reentered from its callbacks: whatever they queue goes out once they returned
+    if (mIsBusy || !mSession)
+    {
+        return;
+    }
+
+    mIsBusy = true;
+    int result = nghttp2_session_send(mSession);
+    mIsBusy = false;
+
+    if (result != 0 || (!nghttp2_session_want_read(mSession) && !nghttp2_session_want_write(mSession)))
+    {
+        //A fatal error, or the session is over (eg. both sides sent GOAWAY)
+        mConnection->flags |= MG_F_SEND_AND_CLOSE;
+    }
+
+#ifdef __linux__
+    //onSend only queued the frames: streams are answered outside of the connection's own events too
+    EpollInterface::refresh(mConnection);
+#endif
+}
+
+void Http2Session::notifyDrained()
+{
+    //A stream sends many frames in a row
+    std::sort(mDrainedStreams.begin(), mDrainedStreams.end());
+    mDrainedStreams.erase(std::unique(mDrainedStreams.begin(), mDrainedStreams.end()), mDrainedStreams.end());
+
+    std::vector<std::shared_ptr<Response>> drained;
+    for (int32_t streamId: mDrainedStreams)
+    {
+        auto stream = mStreams.find(streamId);
+
+        if (stream != mStreams.end() && stream->second.response)
+        {
+            drained.push_back(stream->second.response);
+        }
+    }
+    mDrainedStreams.clear();
+
+    for (const auto& response: drained)
+    {
+        response->notifyWritable();
+    }
+}
+}
@@ -0,0 +1,174 @@
+#ifndef _MONGOOSE_HTTP2_SESSION_H
+#define _MONGOOSE_HTTP2_SESSION_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Controller.h"
+
+struct http_message;
+struct mg_connection;
+typedef struct nghttp2_session nghttp2_session;
+
+/**
+ * An HTTP/2 cleartext (h2c) connection, built on nghttp2.
+ *
+ * Every stream is handed to the controllers as a regular Request/Response pair: handlers don't need to know
+ * which protocol a request came through. Many requests are multiplexed on the one connection, which stays open.
+ *
+ * Response bodies are only framed as fast as the client's per-stream (and connection) flow control windows allow.
+ * What a handler writes ahead of that waits in its stream, and counts against the Response's watermarks:
+ * a slow stream holds its own producer back (see Response::onWritable) without stalling the others.
+ *
+ * Owned by the Server, everything happens on the thread polling it. Responses may still be answered from any
+ * thread: what they submit from elsewhere is queued, and handed to nghttp2 by that thread, in order.
+ */
+namespace Mongoose
+{
+class Request;
+class Response;
+class Server;
+class Http2Session: public std::enable_shared_from_this<Http2Session>
+{
+public:
+    Http2Session(Server *server, struct mg_connection *connection);
+    virtual ~Http2Session();
+
+    /**
+     * @brief isPreface - whether a connection starts with the HTTP/2 client preface ("prior knowledge")
+     * @param size - may be shorter than the preface, only what arrived so far is compared
+     */
+    static bool isPreface(const char *data, size_t size);
+
+    /**
+     * @brief isUpgrade
+     * @return true if message asks to switch to h2c (Upgrade: h2c and HTTP2-Settings)
+     */
+    static bool isUpgrade(struct http_message *message);
+
+    /**
+     * @brief start - starts a connection that opened with the client preface
+     */
+    bool start();
+
+    /**
+     * @brief upgrade - switches an HTTP/1.1 connection to h2c: answers 101 Switching Protocols,
+     * and serves message as stream 1
+     * @return false if the HTTP2-Settings header is invalid, nothing was sent then
+     */
+    bool upgrade(struct http_message *message);
+
+    /**
+     * @brief receive - hands what arrived on the connection over
+     */
+    void receive(const char *data, size_t size);
+
+    /**
+     * @brief onSent - the connection sent some, frames held back may go now
+     */
+    void onSent();
+
+    /**
+     * @brief notifyWritable - runs the onWritable callbacks of the responses whose streams have room again
+     */
+    void notifyWritable();
+
+    /**
+     * @brief close - the connection is closing: the requests and responses of the streams still open are invalidated
+     */
+    void close();
+
+    //What Response sends through, see Response::setHttp2Stream. From another thread than the event loop's,
+    //submissions are queued and true only means the session was still open.
+    bool submitHeaders(int32_t streamId, int code, const std::map<std::string, std::string>& headers, bool endStream);
+    bool submitData(int32_t streamId, const char *data, size_t size, bool endStream);
+    size_t bufferedBytes(int32_t streamId) const;
+    bool isEventLoopThread() const;
+
+    /**
+     * @brief memoryUsage - the request bodies being received and the response bodies waiting for the flow control
+     * windows, Server counts them against its memory budget
+     */
+    size_t memoryUsage() const;
+
+    /**
+     * @brief runSubmissions - hands what was submitted from other threads over to nghttp2, Server does that
+     */
+    void runSubmissions();
+
+private:
+    struct Stream
+    {
+        std::string method;
+        std::string path;
+        std::string authority;
+        std::vector<std::pair<std::string, std::string>> headers;
+
+        std::shared_ptr<Request> request;
+        std::shared_ptr<Response> response;
+        BodyChunkHandler handler;   //Set for routes that stream request bodies
+        std::string body;           //Else, the body as it arrives
+        size_t bodySizeLimit{0};
+        bool isAnswered{false};     //The response headers went out, or were queued
+        bool isRejected{false};     //Answered before the request was complete, the rest of it is dropped
+
+        //The response body waiting for the flow control windows to open
+        std::string output;
+        size_t outputOffset{0};
+        bool isOutputEnded{false};
+        bool isOutputDeferred{false};
+    };
+
+    //Headers or data submitted from another thread
+    struct Submission
+    {
+        int32_t streamId;
+        bool isHeaders;
+        int code;
+        std::map<std::string, std::string> headers;
+        std::string data;
+        bool endStream;
+    };
+
+    //The nghttp2 callbacks, they need its types
+    friend struct Http2Callbacks;
+
+    bool post(Submission& submission);
+    bool writeHeaders(int32_t streamId, int code, const std::map<std::string, std::string>& headers, bool endStream);
+    bool writeData(int32_t streamId, const char *data, size_t size, bool endStream);
+
+    bool createSession();
+    void headersReceived(int32_t streamId, Stream& stream);
+    void routeStream(int32_t streamId, Stream& stream);
+    void requestReceived(int32_t streamId, Stream& stream);
+    void buildMessage(Stream& stream, struct http_message *message);
+    void respond(int32_t streamId, Stream& stream, int code, const std::string& body,
+                 const std::map<std::string, std::string>& headers = std::map<std::string, std::string>());
+    void respondCaptured(int32_t streamId, Stream& stream, size_t offset, unsigned long flags);
+    void flush();
+
+    //Runs the onWritable callbacks of the streams flush() sent from, never from within a Response's own write()
+    void notifyDrained();
+
+    Server *mServer;
+    struct mg_connection *mConnection;
+    nghttp2_session *mSession;
+    std::map<int32_t, Stream> mStreams;
+
+    //Streams closed while their response may still be on the stack, released on the next event
+    std::vector<Stream> mClosedStreams;
+    std::vector<int32_t> mDrainedStreams;
+    bool mIsBusy;
+
+    std::mutex mSubmissionsMutex;
+    std::vector<Submission> mSubmissions;
+    bool mIsClosed;
+};
+}
+
+#endif
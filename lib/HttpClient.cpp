@@ -0,0 +1,808 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <mongoose.h>
+
+#ifdef __linux__
+#include "EpollInterface.h"
+#endif
+#include "HttpClient.h"
+#include "Server.h"
+
+//Responses whose headers don't fit in this are refused
+static const size_t MAX_HEADERS_SIZE = 64*1024;
+
+static bool equalsIgnoreCase(const std::string& a, const char *b)
+{
+    size_t length = strlen(b);
+    return a.size() == length && mg_ncasecmp(a.c_str(), b, length) == 0;
+}
+
+static bool containsIgnoreCase(const std::string& value, const char *token)
+{
+    std::string lower(value);
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    return lower.find(token) != std::string::npos;
+}
+
+namespace Mongoose
+{
+std::string HttpClient::Reply::header(const std::string &name) const
+{
+    for (const auto& header: headers)
+    {
+        if (equalsIgnoreCase(header.first, name.c_str()))
+        {
+            return header.second;
+        }
+    }
+
+    return "";
+}
+
+HttpClient::HttpClient(Server *server):
+    mServer(server)
+{
+}
+
+HttpClient::~HttpClient()
+{
+    for (const auto& connection: mConnections)
+    {
+        //Detached, so that closing them doesn't call back into a client that is gone
+        connection.first->user_data = nullptr;
+        connection.first->flags |= MG_F_CLOSE_IMMEDIATELY;
+    }
+}
+
+bool HttpClient::request(const std::string &upstream, const std::shared_ptr<Call> &call)
+{
+    if (!mServer->manager())
+    {
+        return false;
+    }
+
+    call->mIsDone = false;
+    call->mIsRetried = false;
+    call->mReply = Reply();
+    mUpstreams[upstream].queue.push_back(call);
+    dispatch(upstream);
+    return true;
+}
+
+std::shared_ptr<HttpClient::Call> HttpClient::get(const std::string &upstream, const std::string &path,
+                                                  const std::function<void(const Reply&, const std::string&)> &onComplete)
+{
+    auto call = std::make_shared<Call>();
+    call->path = path;
+    call->onComplete = onComplete;
+
+    return request(upstream, call) ? call : nullptr;
+}
+
+void HttpClient::cancel(const std::shared_ptr<Call> &call)
+{
+    if (call->mIsDone)
+    {
+        return;
+    }
+
+    //A queued call is skipped by dispatch, one that was sent takes its connection down with it
+    call->mIsDone = true;
+
+    if (call->mConnection)
+    {
+        auto connection = mConnections.find(call->mConnection);
+
+        if (connection != mConnections.end())
+        {
+            connection->second.isReusable = false;
+        }
+
+        call->mConnection->flags |= MG_F_CLOSE_IMMEDIATELY;
+        call->mConnection = nullptr;
+    }
+}
+
+void HttpClient::setPaused(const std::shared_ptr<Call> &call, bool paused)
+{
+    if (call->mIsDone || !call->mConnection)
+    {
+        return;
+    }
+
+    struct mg_connection *c = call->mConnection;
+    auto connection = mConnections.find(c);
+
+    if (connection == mConnections.end() || connection->second.isPaused == paused)
+    {
+        return;
+    }
+
+    connection->second.isPaused = paused;
+    c->recv_mbuf_limit = paused ? 0 : ~0;
+    //The upstream isn't slow while it is held back, the request timeout starts over on resume
+    resetTimer(c, connection->second);
+
+    if (!paused)
+    {
+        //What arrived before the pause is still waiting in the receive buffer
+        processReceived(c);
+    }
+}
+
+void HttpClient::dispatch(const std::string &name)
+{
+    Upstream& upstream = mUpstreams[name];
+
+    while (!upstream.queue.empty())
+    {
+        auto call = upstream.queue.front();
+
+        if (call->mIsDone)
+        {
+            upstream.queue.pop_front();
+            continue;
+        }
+
+        //An idle connection first, else one the call can be pipelined on, else a new one
+        struct mg_connection *target = nullptr;
+        size_t targetCalls = mPipelineDepth;
+
+        for (auto c: upstream.connections)
+        {
+            const Connection& connection = mConnections[c];
+
+            if (!connection.isReusable || connection.isPaused || (c->flags & (MG_F_CLOSE_IMMEDIATELY | MG_F_SEND_AND_CLOSE)))
+            {
+                continue;
+            }
+
+            if (connection.calls.empty())
+            {
+                target = c;
+                break;
+            }
+
+            if (connection.calls.size() < targetCalls && isIdempotent(*call) && isIdempotent(*connection.calls.back()))
+            {
+                target = c;
+                targetCalls = connection.calls.size();
+            }
+        }
+
+        if (target && !mConnections[target].calls.empty() && upstream.connections.size() < mMaxConnections)
+        {
+            //Pipelining only makes sense once no more connections can be opened
+            target = nullptr;
+        }
+
+        std::string error;
+
+        if (!target && upstream.connections.size() < mMaxConnections)
+        {
+            target = connect(name, error);
+
+            if (!target)
+            {
+                upstream.queue.pop_front();
+                call->mIsDone = true;
+
+                if (call->onComplete)
+                {
+                    call->onComplete(call->mReply, error);
+                }
+                continue;
+            }
+        }
+
+        if (!target)
+        {
+            break;
+        }
+
+        upstream.queue.pop_front();
+        send(target, mConnections[target], call);
+    }
+}
+
+struct mg_connection *HttpClient::connect(const std::string &upstream, std::string &error)
+{
+    struct mg_mgr *manager = mServer->manager();
+
+    if (!manager)
+    {
+        error = "The server is not running";
+        return nullptr;
+    }
+
+    const char *connectError = NULL;
+    struct mg_connect_opts options;
+    memset(&options, 0, sizeof(options));
+    options.user_data = this;
+    options.error_string = &connectError;
+
+    struct mg_connection *c = mg_connect_opt(manager, upstream.c_str(), ev_handler, this, options);
+
+    if (!c)
+    {
+        error = std::string("Unable to connect to ") + upstream + (connectError ? std::string(": ") + connectError : "");
+        return nullptr;
+    }
+
+    Connection& connection = mConnections[c];
+    connection.upstream = upstream;
+    mUpstreams[upstream].connections.push_back(c);
+    resetTimer(c, connection);
+    return c;
+}
+
+void HttpClient::send(struct mg_connection *c, Connection &connection, const std::shared_ptr<Call> &call)
+{
+    std::string host = connection.upstream;
+    size_t scheme = host.find("://");
+    if (scheme != std::string::npos)
+    {
+        host = host.substr(scheme + 3);
+    }
+
+    std::string head = call->method + " " + (call->path.empty() ? "/" : call->path) + " HTTP/1.1\r\n";
+    bool hasHost = false;
+    bool hasLength = false;
+
+    for (const auto& header: call->headers)
+    {
+        hasHost = hasHost || equalsIgnoreCase(header.first, "Host");
+        hasLength = hasLength || equalsIgnoreCase(header.first, "Content-Length");
+        head += header.first + ": " + header.second + "\r\n";
+    }
+
+    if (!hasHost)
+    {
+        head += "Host: " + host + "\r\n";
+    }
+
+    if (!hasLength && (!call->body.empty() || call->method == "POST" || call->method == "PUT" || call->method == "PATCH"))
+    {
+        head += "Content-Length: " + std::to_string(call->body.size()) + "\r\n";
+    }
+
+    head += "\r\n";
+
+    //Until the connection is established, mongoose keeps this in the send buffer
+    mg_send(c, head.data(), (int) head.size());
+    if (!call->body.empty())
+    {
+        mg_send(c, call->body.data(), (int) call->body.size());
+    }
+
+    call->mConnection = c;
+    call->mHasResponse = false;
+    connection.calls.push_back(call);
+
+    if (connection.calls.size() == 1 && connection.isConnected)
+    {
+        //From the idle timeout to the request timeout
+        resetTimer(c, connection);
+    }
+
+#ifdef __linux__
+    //A kept alive connection is written right away, not on its next event
+    EpollInterface::refresh(c);
+#endif
+}
+
+void HttpClient::processReceived(struct mg_connection *c)
+{
+    auto found = mConnections.find(c);
+    if (found == mConnections.end())
+    {
+        return;
+    }
+
+    Connection& connection = found->second;
+
+    while (!connection.isPaused && !(c->flags & MG_F_CLOSE_IMMEDIATELY) && c->recv_mbuf.len > 0)
+    {
+        if (connection.calls.empty())
+        {
+            //Nothing was asked for, whatever this is the connection can't be trusted anymore
+            mbuf_remove(&c->recv_mbuf, c->recv_mbuf.len);
+            connection.isReusable = false;
+            c->flags |= MG_F_CLOSE_IMMEDIATELY;
+            break;
+        }
+
+        if (!connection.hasHeaders && !parseHeaders(c, connection))
+        {
+            break;
+        }
+
+        if (connection.hasHeaders && !parseBody(c, connection))
+        {
+            break;
+        }
+    }
+
+    //A response without a body can be complete without any data left to look at
+    while (!connection.isPaused && !(c->flags & MG_F_CLOSE_IMMEDIATELY) && connection.hasHeaders
+           && (connection.bodyMode == NoBody || (connection.bodyMode == LengthBody && connection.remaining == 0)))
+    {
+        complete(c, connection);
+    }
+}
+
+bool HttpClient::parseHeaders(struct mg_connection *c, Connection &connection)
+{
+    struct http_message message;
+    int length = mg_parse_http(c->recv_mbuf.buf, (int) c->recv_mbuf.len, &message, 0);
+
+    if (length == 0)
+    {
+        if (c->recv_mbuf.len > MAX_HEADERS_SIZE)
+        {
+            fail(c, connection, "The response headers are too large");
+        }
+
+        return false;
+    }
+
+    if (length < 0)
+    {
+        fail(c, connection, "Malformed response");
+        return false;
+    }
+
+    if (message.resp_code >= 100 && message.resp_code < 200)
+    {
+        //Interim responses (100 Continue...) only precede the real one
+        mbuf_remove(&c->recv_mbuf, length);
+        return true;
+    }
+
+    auto call = connection.calls.front();
+    Reply& reply = call->mReply;
+    reply.code = message.resp_code;
+    reply.reason.assign(message.resp_status_msg.p, message.resp_status_msg.len);
+    reply.headers.clear();
+
+    for (int i = 0; i < MG_MAX_HTTP_HEADERS && message.header_names[i].len > 0; i++)
+    {
+        reply.headers.push_back(std::make_pair(std::string(message.header_names[i].p, message.header_names[i].len),
+                                               std::string(message.header_values[i].p, message.header_values[i].len)));
+    }
+
+    std::string contentLength = reply.header("Content-Length");
+    std::string connectionHeader = reply.header("Connection");
+
+    if (call->method == "HEAD" || reply.code == 204 || reply.code == 304)
+    {
+        connection.bodyMode = NoBody;
+    }
+    else if (containsIgnoreCase(reply.header("Transfer-Encoding"), "chunked"))
+    {
+        connection.bodyMode = ChunkedBody;
+        connection.chunkState = ChunkSize;
+    }
+    else if (!contentLength.empty())
+    {
+        connection.bodyMode = LengthBody;
+        connection.remaining = strtoull(contentLength.c_str(), NULL, 10);
+    }
+    else
+    {
+        connection.bodyMode = CloseBody;
+        connection.isReusable = false;
+    }
+
+    if (containsIgnoreCase(connectionHeader, "close")
+        || (mg_vcmp(&message.proto, "HTTP/1.0") == 0 && !containsIgnoreCase(connectionHeader, "keep-alive")))
+    {
+        connection.isReusable = false;
+    }
+
+    mbuf_remove(&c->recv_mbuf, length);
+    connection.hasHeaders = true;
+    call->mHasResponse = true;
+
+    if (!call->mIsDone && call->onHeaders)
+    {
+        call->onHeaders(reply);
+    }
+
+    return true;
+}
+
+bool HttpClient::parseBody(struct mg_connection *c, Connection &connection)
+{
+    struct mbuf *received = &c->recv_mbuf;
+
+    switch (connection.bodyMode)
+    {
+    case NoBody:
+        complete(c, connection);
+        return true;
+    case LengthBody:
+    {
+        size_t size = std::min(received->len, connection.remaining);
+
+        if (size > 0 && !deliver(c, connection, received->buf, size))
+        {
+            return false;
+        }
+
+        mbuf_remove(received, size);
+        connection.remaining -= size;
+
+        if (connection.remaining == 0)
+        {
+            complete(c, connection);
+            return true;
+        }
+
+        return false;
+    }
+    case CloseBody:
+    {
+        size_t size = received->len;
+
+        if (deliver(c, connection, received->buf, size))
+        {
+            mbuf_remove(received, size);
+        }
+
+        //Complete once the connection closes, see onClose
+        return false;
+    }
+    case ChunkedBody:
+        while (received->len > 0 && !connection.isPaused && !(c->flags & MG_F_CLOSE_IMMEDIATELY))
+        {
+            if (connection.chunkState == ChunkData)
+            {
+                size_t size = std::min(received->len, connection.remaining);
+
+                if (!deliver(c, connection, received->buf, size))
+                {
+                    return false;
+                }
+
+                mbuf_remove(received, size);
+                connection.remaining -= size;
+
+                if (connection.remaining == 0)
+                {
+                    connection.chunkState = ChunkDataEnd;
+                }
+                continue;
+            }
+
+            if (connection.chunkState == ChunkDataEnd)
+            {
+                if (received->len < 2)
+                {
+                    return false;
+                }
+
+                mbuf_remove(received, 2);
+                connection.chunkState = ChunkSize;
+                continue;
+            }
+
+            //The chunk size and trailer lines
+            char *end = (char *) memchr(received->buf, '\n', received->len);
+
+            if (!end)
+            {
+                if (received->len > MAX_HEADERS_SIZE)
+                {
+                    fail(c, connection, "Malformed chunked response");
+                }
+
+                return false;
+            }
+
+            size_t lineLength = end - received->buf + 1;
+
+            if (connection.chunkState == ChunkSize)
+            {
+                connection.remaining = strtoull(std::string(received->buf, lineLength).c_str(), NULL, 16);
+                connection.chunkState = connection.remaining > 0 ? ChunkData : ChunkTrailer;
+                mbuf_remove(received, lineLength);
+            }
+            else
+            {
+                bool isLastLine = lineLength <= 2;
+                mbuf_remove(received, lineLength);
+
+                if (isLastLine)
+                {
+                    complete(c, connection);
+                    return true;
+                }
+            }
+        }
+
+        return false;
+    }
+
+    return false;
+}
+
+bool HttpClient::deliver(struct mg_connection *c, Connection &connection, const char *data, size_t size)
+{
+    auto call = connection.calls.front();
+
+    if (call->mIsDone)
+    {
+        return false;
+    }
+
+    if (!call->onData)
+    {
+        call->mReply.body.append(data, size);
+        return true;
+    }
+
+    bool result;
+
+    try
+    {
+        result = call->onData(data, size);
+    }
+    catch(...)
+    {
+        result = false;
+    }
+
+    if (!result)
+    {
+        //Aborted: the rest of this response is of no use, the calls pipelined behind it are retried elsewhere
+        call->mIsDone = true;
+        call->mConnection = nullptr;
+        connection.calls.pop_front();
+        connection.isReusable = false;
+        c->flags |= MG_F_CLOSE_IMMEDIATELY;
+    }
+
+    return result;
+}
+
+void HttpClient::complete(struct mg_connection *c, Connection &connection)
+{
+    auto call = connection.calls.front();
+    connection.calls.pop_front();
+    connection.hasHeaders = false;
+    connection.completedCalls++;
+
+    if (!connection.isReusable)
+    {
+        c->flags |= MG_F_SEND_AND_CLOSE;
+    }
+
+    resetTimer(c, connection);
+
+    bool wasDone = call->mIsDone;
+    call->mIsDone = true;
+    call->mConnection = nullptr;
+
+    if (!wasDone && call->onComplete)
+    {
+        call->onComplete(call->mReply, "");
+    }
+
+    dispatch(connection.upstream);
+}
+
+void HttpClient::fail(struct mg_connection *c, Connection &connection, const std::string &error)
+{
+    std::deque<std::shared_ptr<Call>> calls;
+    calls.swap(connection.calls);
+    connection.isReusable = false;
+    c->flags |= MG_F_CLOSE_IMMEDIATELY;
+
+    for (const auto& call: calls)
+    {
+        if (!call->mIsDone)
+        {
+            call->mIsDone = true;
+            call->mConnection = nullptr;
+
+            if (call->onComplete)
+            {
+                call->onComplete(call->mReply, error);
+            }
+        }
+    }
+}
+
+void HttpClient::onClose(struct mg_connection *c)
+{
+    auto found = mConnections.find(c);
+    if (found == mConnections.end())
+    {
+        return;
+    }
+
+    Connection connection = std::move(found->second);
+    mConnections.erase(found);
+
+    Upstream& upstream = mUpstreams[connection.upstream];
+    upstream.connections.erase(std::remove(upstream.connections.begin(), upstream.connections.end(), c), upstream.connections.end());
+
+    std::vector<std::shared_ptr<Call>> retries;
+    bool isFirst = true;
+
+    for (const auto& call: connection.calls)
+    {
+        if (call->mIsDone)
+        {
+            continue;
+        }
+
+        call->mConnection = nullptr;
+
+        if (isFirst && connection.hasHeaders && connection.bodyMode == CloseBody)
+        {
+            //This body was meant to end with the connection
+            call->mIsDone = true;
+            if (call->onComplete)
+            {
+                call->onComplete(call->mReply, "");
+            }
+        }
+        else if (!call->mHasResponse && !call->mIsRetried && isIdempotent(*call))
+        {
+            //Typically a keep-alive connection the upstream closed just as it was reused: try once more
+            call->mIsRetried = true;
+            retries.push_back(call);
+        }
+        else
+        {
+            call->mIsDone = true;
+            if (call->onComplete)
+            {
+                call->onComplete(call->mReply, call->mHasResponse ? "The connection closed before the response was complete"
+                                                                  : "The connection closed before a response arrived");
+            }
+        }
+
+        isFirst = false;
+    }
+
+    upstream.queue.insert(upstream.queue.begin(), retries.begin(), retries.end());
+    dispatch(connection.upstream);
+}
+
+void HttpClient::resetTimer(struct mg_connection *c, const Connection &connection)
+{
+    if (connection.isPaused)
+    {
+        mg_set_timer(c, 0);
+        return;
+    }
+
+    int timeout = !connection.isConnected ? mConnectTimeout : (connection.calls.empty() ? mIdleTimeout : mRequestTimeout);
+    mg_set_timer(c, timeout > 0 ? mg_time() + timeout / 1000.0 : 0);
+}
+
+bool HttpClient::isIdempotent(const Call &call)
+{
+    return call.method == "GET" || call.method == "HEAD" || call.method == "OPTIONS"
+        || call.method == "PUT" || call.method == "DELETE";
+}
+
+void HttpClient::ev_handler(struct mg_connection *c, int ev, void *p, void *ud)
+{
+    HttpClient *client = (HttpClient *) ud;
+
+    if (!client)
+    {
+        return;
+    }
+
+    auto found = client->mConnections.find(c);
+    if (found == client->mConnections.end())
+    {
+        return;
+    }
+
+    Connection& connection = found->second;
+
+    switch (ev)
+    {
+    case MG_EV_CONNECT:
+    {
+        int status = *(int *) p;
+
+        if (status != 0)
+        {
+            client->fail(c, connection, std::string("Unable to connect to ") + connection.upstream + ": " + strerror(status));
+            break;
+        }
+
+        connection.isConnected = true;
+        client->resetTimer(c, connection);
+        break;
+    }
+    case MG_EV_RECV:
+        client->resetTimer(c, connection);
+        client->processReceived(c);
+        break;
+    case MG_EV_TIMER:
+        if (!connection.isConnected)
+        {
+            client->fail(c, connection, std::string("Timed out connecting to ") + connection.upstream);
+        }
+        else if (!connection.calls.empty())
+        {
+            client->fail(c, connection, std::string("Timed out waiting for ") + connection.upstream);
+        }
+        else
+        {
+            //Idle for too long
+            c->flags |= MG_F_CLOSE_IMMEDIATELY;
+        }
+        break;
+    case MG_EV_CLOSE:
+        client->onClose(c);
+        break;
+    default:
+        break;
+    }
+}
+
+size_t HttpClient::maxConnections() const
+{
+    return mMaxConnections;
+}
+
+void HttpClient::setMaxConnections(size_t connections)
+{
+    mMaxConnections = connections > 0 ? connections : 1;
+}
+
+size_t HttpClient::pipelineDepth() const
+{
+    return mPipelineDepth;
+}
+
+void HttpClient::setPipelineDepth(size_t depth)
+{
+    mPipelineDepth = depth > 0 ? depth : 1;
+}
+
+int HttpClient::connectTimeout() const
+{
+    return mConnectTimeout;
+}
+
+void HttpClient::setConnectTimeout(int milliseconds)
+{
+    mConnectTimeout = milliseconds;
+}
+
+int HttpClient::requestTimeout() const
+{
+    return mRequestTimeout;
+}
+
+void HttpClient::setRequestTimeout(int milliseconds)
+{
+    mRequestTimeout = milliseconds;
+}
+
+int HttpClient::idleTimeout() const
+{
+    return mIdleTimeout;
+}
+
+void HttpClient::setIdleTimeout(int milliseconds)
+{
+    mIdleTimeout = milliseconds;
+}
+
+size_t HttpClient::connectionCount() const
+{
+    return mConnections.size();
+}
+}
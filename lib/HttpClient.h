@@ -0,0 +1,239 @@
+#ifndef _MONGOOSE_HTTP_CLIENT_H
+#define _MONGOOSE_HTTP_CLIENT_H
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+struct mg_connection;
+
+/**
+ * An asynchronous HTTP/1.1 client running on a Server's event loop.
+ *
+ * Requests never block: they are queued per upstream ("host:port") and sent over a small pool of
+ * keep-alive connections, which are reused (and, if enabled, pipelined) from one request to the next.
+ * Responses are parsed as they arrive and their bodies can be handed over piece by piece,
+ * so a large upstream response never has to be held in memory.
+ *
+ * Everything, callbacks included, happens on the thread polling the server: handlers can call request()
+ * directly and answer their own Response from the callbacks.
+ */
+namespace Mongoose
+{
+class Server;
+class HttpClient
+{
+public:
+    /**
+     * The status line and headers of an upstream response
+     */
+    struct Reply
+    {
+        int code{0};
+        std::string reason;
+        std::vector<std::pair<std::string, std::string>> headers;
+        std::string body;   //Only filled when the call has no onData handler
+
+        /**
+         * @brief header - header names are matched case insensitively
+         * @return the value of the first header called name, empty if there isn't one
+         */
+        std::string header(const std::string& name) const;
+    };
+
+    /**
+     * A request and the callbacks it is answered through
+     */
+    class Call
+    {
+    public:
+        std::string method{"GET"};
+        std::string path{"/"};  //The path and query string
+        std::vector<std::pair<std::string, std::string>> headers;
+        std::string body;
+
+        /**
+         * @brief onHeaders - optional, called once the status line and headers of the response arrived
+         */
+        std::function<void(const Reply& reply)> onHeaders;
+
+        /**
+         * @brief onData - optional, called with every piece of the (de-chunked) response body as it arrives.
+         * Return false to abort the call, its connection is closed and onComplete isn't called.
+         * Without it, the body is gathered in Reply::body.
+         */
+        std::function<bool(const char *data, size_t size)> onData;
+
+        /**
+         * @brief onComplete - called once the whole response arrived, or the call failed
+         * @param error - empty on success, else what went wrong. reply holds whatever arrived.
+         */
+        std::function<void(const Reply& reply, const std::string& error)> onComplete;
+
+        const Reply& reply() const { return mReply; }
+
+        /**
+         * @brief isDone
+         * @return true once onComplete was called, or the call was aborted or cancelled
+         */
+        bool isDone() const { return mIsDone; }
+
+    private:
+        friend class HttpClient;
+
+        Reply mReply;
+        struct mg_connection *mConnection{nullptr};
+        bool mIsDone{false};
+        bool mIsRetried{false};
+        bool mHasResponse{false};
+    };
+
+    /**
+     * @param server - the server whose event loop the client runs on. It must be started before requests are made.
+     */
+    explicit HttpClient(Server *server);
+
+    /**
+     * Closes all the connections, calls still pending are dropped without their callbacks
+     */
+    virtual ~HttpClient();
+
+    /**
+     * @brief request - queues a call to upstream. It is sent as soon as a connection to upstream is free.
+     * Must be called from the thread polling the server.
+     * @param upstream - "host:port"
+     * @return false if the server isn't running, onComplete is then not called
+     */
+    bool request(const std::string& upstream, const std::shared_ptr<Call>& call);
+
+    /**
+     * @brief get - a GET request whose whole body is delivered to onComplete
+     */
+    std::shared_ptr<Call> get(const std::string& upstream, const std::string& path,
+                              const std::function<void(const Reply& reply, const std::string& error)>& onComplete);
+
+    /**
+     * @brief cancel - drops a call: it isn't sent if it is still queued, else its connection is closed.
+     * None of its callbacks is called anymore.
+     */
+    void cancel(const std::shared_ptr<Call>& call);
+
+    /**
+     * @brief setPaused - stops (or resumes) reading the response of call, so that a consumer that can't keep up
+     * (eg. a slow client of a proxied response) holds the upstream back instead of piling its data up in memory.
+     * The request timeout doesn't run while the call is paused, it starts over once it is resumed.
+     */
+    void setPaused(const std::shared_ptr<Call>& call, bool paused);
+
+    /**
+     * @brief maxConnections / setMaxConnections - the most connections opened to a single upstream.
+     * Calls past that wait for one of them to be free.
+     */
+    size_t maxConnections() const;
+    void setMaxConnections(size_t connections);
+
+    /**
+     * @brief pipelineDepth / setPipelineDepth - how many idempotent calls (GET, HEAD, OPTIONS, PUT, DELETE) may be
+     * sent on a connection before the response to the first one arrived, once maxConnections() are open.
+     * 1, the default, disables pipelining.
+     */
+    size_t pipelineDepth() const;
+    void setPipelineDepth(size_t depth);
+
+    /**
+     * @brief connectTimeout / setConnectTimeout - how long (in milliseconds) connecting to an upstream may take
+     */
+    int connectTimeout() const;
+    void setConnectTimeout(int milliseconds);
+
+    /**
+     * @brief requestTimeout / setRequestTimeout - how long (in milliseconds) an upstream may stay silent
+     * while a call waits on it. The call then fails and the connection is closed.
+     */
+    int requestTimeout() const;
+    void setRequestTimeout(int milliseconds);
+
+    /**
+     * @brief idleTimeout / setIdleTimeout - how long (in milliseconds) an unused connection is kept open
+     */
+    int idleTimeout() const;
+    void setIdleTimeout(int milliseconds);
+
+    /**
+     * @brief connectionCount
+     * @return the number of open upstream connections
+     */
+    size_t connectionCount() const;
+
+private:
+    static void ev_handler(struct mg_connection *c, int ev, void *p, void* ud);
+
+    enum BodyMode
+    {
+        NoBody,
+        LengthBody,     //Content-Length
+        ChunkedBody,    //Transfer-Encoding: chunked
+        CloseBody       //Neither, the body ends when the connection closes
+    };
+
+    enum ChunkState
+    {
+        ChunkSize,
+        ChunkData,
+        ChunkDataEnd,
+        ChunkTrailer
+    };
+
+    struct Connection
+    {
+        std::string upstream;
+        std::deque<std::shared_ptr<Call>> calls;    //Sent, waiting for their response: the first one is being received
+        bool isConnected{false};
+        bool isReusable{true};
+        bool isPaused{false};
+        size_t completedCalls{0};
+
+        //The response being received
+        bool hasHeaders{false};
+        BodyMode bodyMode{NoBody};
+        size_t remaining{0};
+        ChunkState chunkState{ChunkSize};
+    };
+
+    struct Upstream
+    {
+        std::deque<std::shared_ptr<Call>> queue;
+        std::vector<struct mg_connection *> connections;
+    };
+
+    void dispatch(const std::string& upstream);
+    struct mg_connection *connect(const std::string& upstream, std::string& error);
+    void send(struct mg_connection *c, Connection& connection, const std::shared_ptr<Call>& call);
+    void processReceived(struct mg_connection *c);
+    bool parseHeaders(struct mg_connection *c, Connection& connection);
+    bool parseBody(struct mg_connection *c, Connection& connection);
+    bool deliver(struct mg_connection *c, Connection& connection, const char *data, size_t size);
+    void complete(struct mg_connection *c, Connection& connection);
+    void fail(struct mg_connection *c, Connection& connection, const std::string& error);
+    void onClose(struct mg_connection *c);
+    void resetTimer(struct mg_connection *c, const Connection& connection);
+
+    static bool isIdempotent(const Call& call);
+
+    Server *mServer;
+    std::map<std::string, Upstream> mUpstreams;
+    std::unordered_map<struct mg_connection *, Connection> mConnections;
+    size_t mMaxConnections{8};
+    size_t mPipelineDepth{1};
+    int mConnectTimeout{5000};
+    int mRequestTimeout{30000};
+    int mIdleTimeout{60000};
+};
+}
+
+#endif
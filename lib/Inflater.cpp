@@ -0,0 +1,141 @@
+#include <algorithm>
+#include <cctype>
+#include <zlib.h>
+
+#include "Inflater.h"
+
+static const size_t RATIO_ALLOWANCE = 1024*1024;
+
+static std::string lowercase(std::string value)
+{
+    std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+    return value;
+}
+
+namespace Mongoose
+{
+bool Inflater::isSupported(const std::string &encoding)
+{
+    std::string name = lowercase(encoding);
+    return name == "gzip" || name == "x-gzip" || name == "deflate";
+}
+
+Inflater::Inflater(const std::string &encoding, size_t maxSize, size_t maxRatio):
+    mStream(new z_stream()),
+    mIsGzip(lowercase(encoding) != "deflate"),
+    mIsRawDeflate(false),
+    mIsFinished(false),
+    mHasFailed(false),
+    mIsTooLarge(false),
+    mMaxSize(maxSize),
+    mMaxRatio(maxRatio),
+    mBytesIn(0),
+    mBytesOut(0)
+{
+    //+16: gzip framing. deflate is meant to be zlib framed, raw deflate is tried if that fails
+    mHasFailed = inflateInit2(mStream, mIsGzip ? 15 + 16 : 15) != Z_OK;
+}
+
+Inflater::~Inflater()
+{
+    inflateEnd(mStream);
+    delete mStream;
+}
+
+bool Inflater::reset(int windowBits)
+{
+    inflateEnd(mStream);
+    *mStream = z_stream();
+    return inflateInit2(mStream, windowBits) == Z_OK;
+}
+
+bool Inflater::inflate(const char *data, size_t size, std::string &output)
+{
+    if (mHasFailed)
+    {
+        return false;
+    }
+
+    char buffer[16384];
+    bool isBufferFull = false;
+    mStream->next_in = (Bytef *) data;
+    mStream->avail_in = (uInt) size;
+
+    while (!mIsFinished && (mStream->avail_in > 0 || isBufferFull))
+    {
+        mStream->next_out = (Bytef *) buffer;
+        mStream->avail_out = sizeof(buffer);
+
+        uInt available = mStream->avail_in;
+        int result = ::inflate(mStream, Z_NO_FLUSH);
+
+        if (result == Z_DATA_ERROR && !mIsGzip && !mIsRawDeflate && mBytesOut == 0 && mBytesIn == 0)
+        {
+            //Plenty of clients send "deflate" without the zlib header
+            mIsRawDeflate = true;
+
+            if (!reset(-15))
+            {
+                mHasFailed = true;
+                return false;
+            }
+
+            mStream->next_in = (Bytef *) data;
+            mStream->avail_in = (uInt) size;
+            continue;
+        }
+
+        if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR)
+        {
+            mHasFailed = true;
+            return false;
+        }
+
+        size_t produced = sizeof(buffer) - mStream->avail_out;
+        mBytesIn += available - mStream->avail_in;
+        mBytesOut += produced;
+
+        if ((mMaxSize > 0 && mBytesOut > mMaxSize)
+            || (mMaxRatio > 0 && mBytesOut > RATIO_ALLOWANCE && mBytesOut / mMaxRatio > mBytesIn))
+        {
+            mHasFailed = true;
+            mIsTooLarge = true;
+            return false;
+        }
+
+        output.append(buffer, produced);
+        mIsFinished = result == Z_STREAM_END;
+
+        //zlib may still hold output after a full buffer, even with all of the input consumed
+        isBufferFull = mStream->avail_out == 0;
+
+        if (result == Z_BUF_ERROR && produced == 0)
+        {
+            //Needs more input than is available
+            break;
+        }
+    }
+
+    return true;
+}
+
+bool Inflater::isFinished() const
+{
+    return mIsFinished;
+}
+
+bool Inflater::isTooLarge() const
+{
+    return mIsTooLarge;
+}
+
+size_t Inflater::bytesIn() const
+{
+    return mBytesIn;
+}
+
+size_t Inflater::bytesOut() const
+{
+    return mBytesOut;
+}
+}
@@ -0,0 +1,77 @@
+#ifndef _MONGOOSE_INFLATER_H
+#define _MONGOOSE_INFLATER_H
+
+#include <cstddef>
+#include <string>
+
+/**
+ * Incrementally decompresses a gzip or deflate encoded request body (Content-Encoding), piece by piece as it
+ * arrives. Output is capped both in size and in ratio to the input, so a small decompression bomb
+ * is stopped before it allocates much.
+ *
+ * Only built with HAS_ZLIB. Not thread safe, but not tied to any thread either.
+ */
+typedef struct z_stream_s z_stream;
+
+namespace Mongoose
+{
+class Inflater
+{
+public:
+    /**
+     * @brief isSupported
+     * @param encoding - the value of a Content-Encoding header
+     * @return true for the encodings Inflater decodes: gzip, x-gzip and deflate
+     */
+    static bool isSupported(const std::string& encoding);
+
+    /**
+     * @param encoding - a supported Content-Encoding
+     * @param maxSize - the most bytes the body may decompress to, 0 for no limit
+     * @param maxRatio - the most bytes each compressed byte may decompress to, past the first megabyte. 0 for no limit
+     */
+    Inflater(const std::string& encoding, size_t maxSize, size_t maxRatio = 100);
+    ~Inflater();
+
+    Inflater(const Inflater&) = delete;
+    Inflater& operator=(const Inflater&) = delete;
+
+    /**
+     * @brief inflate - decompresses the next piece of the body
+     * @param output - the decompressed data is appended to it
+     * @return false if the data is corrupt or goes over the limits, see isTooLarge(). Once false, it stays false.
+     */
+    bool inflate(const char *data, size_t size, std::string& output);
+
+    /**
+     * @brief isFinished
+     * @return true once the end of the compressed stream was seen, anything after it is ignored
+     */
+    bool isFinished() const;
+
+    /**
+     * @brief isTooLarge
+     * @return true if inflate() failed because of the limits rather than corrupt data
+     */
+    bool isTooLarge() const;
+
+    size_t bytesIn() const;
+    size_t bytesOut() const;
+
+private:
+    bool reset(int windowBits);
+
+    z_stream *mStream;
+    bool mIsGzip;
+    bool mIsRawDeflate;
+    bool mIsFinished;
+    bool mHasFailed;
+    bool mIsTooLarge;
+    size_t mMaxSize;
+    size_t mMaxRatio;
+    size_t mBytesIn;
+    size_t mBytesOut;
+};
+}
+
+#endif
@@ -0,0 +1,315 @@
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#ifndef WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#else
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#endif
+
+#include "IpAccessControlList.h"
+
+static const int IPV4_ROOT = 0;
+static const int IPV6_ROOT = 1;
+
+static const uint8_t IPV4_MAPPED_PREFIX[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+
+static std::string trim(const std::string& value)
+{
+    size_t begin = value.find_first_not_of(" \t\r\n");
+    size_t end = value.find_last_not_of(" \t\r\n");
+    return begin == std::string::npos ? "" : value.substr(begin, end - begin + 1);
+}
+
+/**
+ * Parses IPv4 networks the way mongoose does, allowing trailing octets to be left out: "192.168/16"
+ */
+static bool parseIpv4(const std::string& address, uint8_t *result)
+{
+    int octets = 0;
+    const char *p = address.c_str();
+    memset(result, 0, 4);
+
+    while (*p)
+    {
+        char *end = NULL;
+        long octet = strtol(p, &end, 10);
+
+        if (end == p || octet < 0 || octet > 255 || octets == 4)
+        {
+            return false;
+        }
+
+        result[octets++] = (uint8_t) octet;
+        p = end;
+
+        if (*p == '.')
+        {
+            p++;
+        }
+        else if (*p != '\0')
+        {
+            return false;
+        }
+    }
+
+    return octets > 0;
+}
+
+namespace Mongoose
+{
+IpAccessControlList::IpAccessControlList(bool allowByDefault):
+    mAllowByDefault(allowByDefault),
+    mLastRuleWins(false),
+    mRules(0)
+{
+    //Two roots, one trie per address family
+    Node root = {{0, 0}, None, 0};
+    mNodes.push_back(root);
+    mNodes.push_back(root);
+}
+
+std::shared_ptr<IpAccessControlList> IpAccessControlList::fromString(const std::string &acl)
+{
+    auto list = std::make_shared<IpAccessControlList>(true);
+    std::istringstream stream(acl);
+    std::string rule;
+    list->mLastRuleWins = true;
+
+    while (std::getline(stream, rule, ','))
+    {
+        rule = trim(rule);
+
+        if (rule.empty())
+        {
+            continue;
+        }
+
+        if ((rule[0] != '+' && rule[0] != '-') || !list->addRule(rule.substr(1), rule[0] == '+'))
+        {
+            return nullptr;
+        }
+
+        //Like mongoose, even a list of deny rules only lets through what it allows
+        list->setAllowByDefault(false);
+    }
+
+    return list;
+}
+
+std::shared_ptr<IpAccessControlList> IpAccessControlList::fromFile(const std::string &path, bool allow)
+{
+    auto list = std::make_shared<IpAccessControlList>(!allow);
+
+    if (!list->addRules(path, allow))
+    {
+        return nullptr;
+    }
+
+    return list;
+}
+
+bool IpAccessControlList::addRule(const std::string &network, bool allow)
+{
+    std::string address = network;
+    int prefixLength = -1;
+    size_t slash = network.find('/');
+
+    if (slash != std::string::npos)
+    {
+        char *end = NULL;
+        address = network.substr(0, slash);
+        prefixLength = (int) strtol(network.c_str() + slash + 1, &end, 10);
+
+        if (end == network.c_str() + slash + 1 || *end != '\0' || prefixLength < 0)
+        {
+            return false;
+        }
+    }
+
+    uint8_t bytes[16];
+
+    if (address.find(':') != std::string::npos)
+    {
+        if (inet_pton(AF_INET6, address.c_str(), bytes) != 1)
+        {
+            return false;
+        }
+
+        prefixLength = prefixLength < 0 ? 128 : prefixLength;
+        if (prefixLength > 128)
+        {
+            return false;
+        }
+
+        //IPv4 mapped networks are stored with the IPv4 ones, that is where lookups find them
+        if (prefixLength >= 96 && memcmp(bytes, IPV4_MAPPED_PREFIX, sizeof(IPV4_MAPPED_PREFIX)) == 0)
+        {
+            insert(IPV4_ROOT, bytes + 12, prefixLength - 96, allow);
+        }
+        else
+        {
+            insert(IPV6_ROOT, bytes, prefixLength, allow);
+        }
+    }
+    else
+    {
+        if (!parseIpv4(address, bytes))
+        {
+            return false;
+        }
+
+        prefixLength = prefixLength < 0 ? 32 : prefixLength;
+        if (prefixLength > 32)
+        {
+            return false;
+        }
+
+        insert(IPV4_ROOT, bytes, prefixLength, allow);
+    }
+
+    mRules++;
+    return true;
+}
+
+bool IpAccessControlList::addRules(const std::string &path, bool allow)
+{
+    std::ifstream in(path);
+    std::string line;
+
+    if (!in.good())
+    {
+        return false;
+    }
+
+    while (std::getline(in, line))
+    {
+        line = trim(line);
+
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+
+        if (!addRule(line, allow))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void IpAccessControlList::insert(int root, const uint8_t *address, int prefixLength, bool allow)
+{
+    uint32_t node = root;
+
+    for (int i = 0; i < prefixLength; i++)
+    {
+        int bit = (address[i / 8] >> (7 - i % 8)) & 1;
+
+        if (mNodes[node].children[bit] == 0)
+        {
+            Node child = {{0, 0}, None, 0};
+            mNodes[node].children[bit] = mNodes.size();
+            mNodes.push_back(child);
+        }
+
+        node = mNodes[node].children[bit];
+    }
+
+    mNodes[node].verdict = allow ? Allow : Deny;
+    mNodes[node].rule = (uint32_t) mRules + 1;
+}
+
+bool IpAccessControlList::lookup(int root, const uint8_t *address, int length) const
+{
+    Verdict verdict = mNodes[root].verdict;
+    uint32_t rule = mNodes[root].rule;
+    uint32_t node = root;
+
+    for (int i = 0; i < length; i++)
+    {
+        node = mNodes[node].children[(address[i / 8] >> (7 - i % 8)) & 1];
+
+        if (node == 0)
+        {
+            break;
+        }
+
+        //Every matching network is on the path: the deepest one, or the one added last
+        if (mNodes[node].verdict != None && (!mLastRuleWins || mNodes[node].rule > rule))
+        {
+            verdict = mNodes[node].verdict;
+            rule = mNodes[node].rule;
+        }
+    }
+
+    return verdict == None ? mAllowByDefault : verdict == Allow;
+}
+
+bool IpAccessControlList::isAllowed(const struct sockaddr *address) const
+{
+    if (address->sa_family == AF_INET)
+    {
+        const struct sockaddr_in *ipv4 = (const struct sockaddr_in *) address;
+        return lookup(IPV4_ROOT, (const uint8_t *) &ipv4->sin_addr, 32);
+    }
+    else if (address->sa_family == AF_INET6)
+    {
+        const uint8_t *bytes = (const uint8_t *) &((const struct sockaddr_in6 *) address)->sin6_addr;
+
+        if (memcmp(bytes, IPV4_MAPPED_PREFIX, sizeof(IPV4_MAPPED_PREFIX)) == 0)
+        {
+            return lookup(IPV4_ROOT, bytes + 12, 32);
+        }
+
+        return lookup(IPV6_ROOT, bytes, 128);
+    }
+
+    //Non IP (eg. local) sockets aren't subject to the list
+    return true;
+}
+
+bool IpAccessControlList::isAllowed(const std::string &address) const
+{
+    struct sockaddr_in6 ipv6;
+    struct sockaddr_in ipv4;
+    memset(&ipv6, 0, sizeof(ipv6));
+    memset(&ipv4, 0, sizeof(ipv4));
+
+    if (inet_pton(AF_INET, address.c_str(), &ipv4.sin_addr) == 1)
+    {
+        ipv4.sin_family = AF_INET;
+        return isAllowed((const struct sockaddr *) &ipv4);
+    }
+
+    if (inet_pton(AF_INET6, address.c_str(), &ipv6.sin6_addr) == 1)
+    {
+        ipv6.sin6_family = AF_INET6;
+        return isAllowed((const struct sockaddr *) &ipv6);
+    }
+
+    return false;
+}
+
+bool IpAccessControlList::allowByDefault() const
+{
+    return mAllowByDefault;
+}
+
+void IpAccessControlList::setAllowByDefault(bool value)
+{
+    mAllowByDefault = value;
+}
+
+size_t IpAccessControlList::size() const
+{
+    return mRules;
+}
+}
@@ -0,0 +1,90 @@
+#ifndef _MONGOOSE_IP_ACCESS_CONTROL_LIST_H
+#define _MONGOOSE_IP_ACCESS_CONTROL_LIST_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct sockaddr;
+
+/**
+ * A compiled list of allowed/denied IPv4 and IPv6 networks.
+ * Addresses are looked up in a binary prefix trie. The longest matching network decides, except for lists
+ * compiled by fromString, which keep the mongoose semantics.
+ * A list is never modified once it is handed to a Server, build a new one and swap it in instead.
+ */
+namespace Mongoose
+{
+class IpAccessControlList
+{
+public:
+    explicit IpAccessControlList(bool allowByDefault = true);
+
+    /**
+     * @brief fromString - compiles a list in the mongoose ip_acl format, eg. "-0.0.0.0/0,+192.168/16"
+     * It means what it means to mongoose: the last rule matching an address decides, whatever the length
+     * of its network, and addresses matching no rule are denied as soon as the list has any rule.
+     * @return the compiled list, or nullptr if any of the rules are malformed
+     */
+    static std::shared_ptr<IpAccessControlList> fromString(const std::string& acl);
+
+    /**
+     * @brief fromFile - compiles a list of networks, one per line, all either allowed or denied.
+     * Empty lines and lines starting with '#' are ignored. Useful for large blocklists.
+     * @return the compiled list, or nullptr if the file couldn't be read or has a malformed line
+     */
+    static std::shared_ptr<IpAccessControlList> fromFile(const std::string& path, bool allow = false);
+
+    /**
+     * @brief addRule - adds a network to the list
+     * @param network - something like "10.0.0.0/8", "192.168.1.1", "2001:db8::/32"
+     * @param allow - whether addresses in the network are allowed or denied
+     * @return false if network couldn't be parsed
+     */
+    bool addRule(const std::string& network, bool allow);
+
+    /**
+     * @brief addRules - adds all the rules from a file, see fromFile
+     * @return false if the file couldn't be read or has a malformed line
+     */
+    bool addRules(const std::string& path, bool allow);
+
+    bool isAllowed(const struct sockaddr *address) const;
+    bool isAllowed(const std::string& address) const;
+
+    bool allowByDefault() const;
+    void setAllowByDefault(bool value);
+
+    /**
+     * @brief size
+     * @return the number of rules in the list
+     */
+    size_t size() const;
+
+private:
+    enum Verdict : uint8_t
+    {
+        None,
+        Allow,
+        Deny
+    };
+
+    struct Node
+    {
+        uint32_t children[2];
+        Verdict verdict;
+        uint32_t rule;      //The position of the rule the verdict comes from, for mLastRuleWins
+    };
+
+    void insert(int root, const uint8_t *address, int prefixLength, bool allow);
+    bool lookup(int root, const uint8_t *address, int length) const;
+
+    std::vector<Node> mNodes;
+    bool mAllowByDefault;
+    bool mLastRuleWins;
+    size_t mRules;
+};
+}
+
+#endif
@@ -0,0 +1,783 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "JsonView.h"
+
+static const uint64_t ONES = 0x0101010101010101ULL;
+static const uint64_t HIGH_BITS = 0x8080808080808080ULL;
+
+static inline bool hasZeroByte(uint64_t word)
+{
+    return ((word - ONES) & ~word & HIGH_BITS) != 0;
+}
+
+/**
+ * Whether the 8 bytes are anything but plain ascii string content:
+ * a quote, a backslash, a control character or a byte of a multi byte utf-8 sequence.
+ */
+static inline bool isSpecial(uint64_t word)
+{
+    return (word & HIGH_BITS) != 0
+           || ((word - ONES * 0x20) & HIGH_BITS) != 0
+           || hasZeroByte(word ^ (ONES * '"'))
+           || hasZeroByte(word ^ (ONES * '\\'));
+}
+
+static inline bool isWhitespace(char c)
+{
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+static inline bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static inline int hexValue(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static inline unsigned readHex4(const char *s)
+{
+    return (hexValue(s[0]) << 12) | (hexValue(s[1]) << 8) | (hexValue(s[2]) << 4) | hexValue(s[3]);
+}
+
+static void appendUtf8(std::string& out, unsigned codepoint)
+{
+    if (codepoint < 0x80)
+    {
+        out.push_back((char)codepoint);
+    }
+    else if (codepoint < 0x800)
+    {
+        out.push_back((char)(0xc0 | (codepoint >> 6)));
+        out.push_back((char)(0x80 | (codepoint & 0x3f)));
+    }
+    else if (codepoint < 0x10000)
+    {
+        out.push_back((char)(0xe0 | (codepoint >> 12)));
+        out.push_back((char)(0x80 | ((codepoint >> 6) & 0x3f)));
+        out.push_back((char)(0x80 | (codepoint & 0x3f)));
+    }
+    else
+    {
+        out.push_back((char)(0xf0 | (codepoint >> 18)));
+        out.push_back((char)(0x80 | ((codepoint >> 12) & 0x3f)));
+        out.push_back((char)(0x80 | ((codepoint >> 6) & 0x3f)));
+        out.push_back((char)(0x80 | (codepoint & 0x3f)));
+    }
+}
+
+/**
+ * Decodes the (already validated) string content between begin and end, excluding the quotes
+ */
+static void unescape(const char *s, size_t begin, size_t end, std::string& out)
+{
+    out.clear();
+    size_t run = begin;
+
+    for (size_t i = begin; i < end;)
+    {
+        if (s[i] != '\\')
+        {
+            i++;
+            continue;
+        }
+
+        out.append(s + run, i - run);
+        char c = s[i + 1];
+        i += 2;
+
+        switch (c)
+        {
+            case 'b': out.push_back('\b'); break;
+            case 'f': out.push_back('\f'); break;
+            case 'n': out.push_back('\n'); break;
+            case 'r': out.push_back('\r'); break;
+            case 't': out.push_back('\t'); break;
+            case 'u':
+            {
+                unsigned codepoint = readHex4(s + i);
+                i += 4;
+
+                if (codepoint >= 0xd800 && codepoint < 0xdc00 && i + 6 <= end && s[i] == '\\' && s[i + 1] == 'u')
+                {
+                    unsigned low = readHex4(s + i + 2);
+                    if (low >= 0xdc00 && low < 0xe000)
+                    {
+                        codepoint = 0x10000 + ((codepoint - 0xd800) << 10) + (low - 0xdc00);
+                        i += 6;
+                    }
+                }
+
+                appendUtf8(out, codepoint);
+                break;
+            }
+            default: out.push_back(c); break;
+        }
+
+        run = i;
+    }
+
+    out.append(s + run, end - run);
+}
+
+namespace Mongoose
+{
+JsonDocument::JsonDocument(const std::string &text):
+    JsonDocument(text.data(), text.size())
+{
+}
+
+JsonDocument::JsonDocument(const char *data, size_t size):
+    mData(data),
+    mSize(size),
+    mIsValid(false),
+    mErrorOffset(0)
+{
+    mIsValid = index();
+}
+
+bool JsonDocument::isValid() const
+{
+    return mIsValid;
+}
+
+size_t JsonDocument::errorOffset() const
+{
+    return mErrorOffset;
+}
+
+JsonView JsonDocument::root() const
+{
+    if (!mIsValid)
+    {
+        return JsonView();
+    }
+
+    JsonView document(this, 0, mSize);
+    size_t begin = document.skipWhitespace(0);
+    return JsonView(this, begin, document.valueEnd(begin));
+}
+
+bool JsonDocument::scanString(size_t &i) const
+{
+    const char *s = mData;
+    i++;
+
+    while (true)
+    {
+        //Plain ascii runs, the vast majority of most strings, are validated 8 bytes at a time
+        uint64_t word;
+        while (i + sizeof(word) <= mSize)
+        {
+            memcpy(&word, s + i, sizeof(word));
+            if (isSpecial(word))
+            {
+                break;
+            }
+            i += sizeof(word);
+        }
+
+        if (i >= mSize)
+        {
+            return false;
+        }
+
+        unsigned char c = (unsigned char)s[i];
+
+        if (c == '"')
+        {
+            i++;
+            return true;
+        }
+        else if (c == '\\')
+        {
+            if (i + 1 >= mSize)
+            {
+                return false;
+            }
+
+            char escaped = s[i + 1];
+            if (escaped == 'u')
+            {
+                if (i + 6 > mSize || hexValue(s[i + 2]) < 0 || hexValue(s[i + 3]) < 0
+                    || hexValue(s[i + 4]) < 0 || hexValue(s[i + 5]) < 0)
+                {
+                    return false;
+                }
+                i += 6;
+            }
+            else if (strchr("\"\\/bfnrt", escaped) != NULL && escaped != '\0')
+            {
+                i += 2;
+            }
+            else
+            {
+                return false;
+            }
+        }
+        else if (c < 0x20)
+        {
+            return false;
+        }
+        else if (c < 0x80)
+        {
+            i++;
+        }
+        else
+        {
+            //A multi byte utf-8 sequence: no overlong forms, no surrogates, nothing above U+10FFFF
+            size_t length;
+            unsigned char low = 0x80;
+            unsigned char high = 0xbf;
+
+            if (c >= 0xc2 && c <= 0xdf) length = 2;
+            else if (c == 0xe0) { length = 3; low = 0xa0; }
+            else if (c == 0xed) { length = 3; high = 0x9f; }
+            else if (c >= 0xe1 && c <= 0xef) length = 3;
+            else if (c == 0xf0) { length = 4; low = 0x90; }
+            else if (c == 0xf4) { length = 4; high = 0x8f; }
+            else if (c >= 0xf1 && c <= 0xf3) length = 4;
+            else return false;
+
+            if (i + length > mSize)
+            {
+                return false;
+            }
+
+            unsigned char second = (unsigned char)s[i + 1];
+            if (second < low || second > high)
+            {
+                return false;
+            }
+
+            for (size_t j = 2; j < length; j++)
+            {
+                if (((unsigned char)s[i + j] & 0xc0) != 0x80)
+                {
+                    return false;
+                }
+            }
+
+            i += length;
+        }
+    }
+}
+
+bool JsonDocument::scanNumber(size_t &i) const
+{
+    const char *s = mData;
+
+    if (i < mSize && s[i] == '-')
+    {
+        i++;
+    }
+
+    if (i >= mSize || !isDigit(s[i]))
+    {
+        return false;
+    }
+
+    if (s[i] == '0')
+    {
+        i++;
+    }
+    else
+    {
+        while (i < mSize && isDigit(s[i])) i++;
+    }
+
+    if (i < mSize && s[i] == '.')
+    {
+        i++;
+        if (i >= mSize || !isDigit(s[i]))
+        {
+            return false;
+        }
+        while (i < mSize && isDigit(s[i])) i++;
+    }
+
+    if (i < mSize && (s[i] == 'e' || s[i] == 'E'))
+    {
+        i++;
+        if (i < mSize && (s[i] == '+' || s[i] == '-'))
+        {
+            i++;
+        }
+        if (i >= mSize || !isDigit(s[i]))
+        {
+            return false;
+        }
+        while (i < mSize && isDigit(s[i])) i++;
+    }
+
+    return true;
+}
+
+bool JsonDocument::index()
+{
+    enum State
+    {
+        ExpectValue,
+        ExpectKey,
+        AfterValue
+    };
+
+    //The nesting stack is only needed while indexing, keep reusing the same one on each thread
+    static thread_local std::vector<size_t> open;
+    open.clear();
+    mContainers.clear();
+
+    const char *s = mData;
+    size_t i = 0;
+    State state = ExpectValue;
+
+    while (true)
+    {
+        while (i < mSize && isWhitespace(s[i])) i++;
+
+        if (state == AfterValue && open.empty())
+        {
+            //Only whitespace may follow the top level value
+            mErrorOffset = i;
+            return i == mSize;
+        }
+
+        if (i >= mSize)
+        {
+            mErrorOffset = i;
+            return false;
+        }
+
+        char c = s[i];
+
+        if (state == ExpectKey)
+        {
+            if (c != '"' || !scanString(i))
+            {
+                mErrorOffset = i;
+                return false;
+            }
+
+            while (i < mSize && isWhitespace(s[i])) i++;
+
+            if (i >= mSize || s[i] != ':')
+            {
+                mErrorOffset = i;
+                return false;
+            }
+
+            i++;
+            state = ExpectValue;
+        }
+        else if (state == ExpectValue)
+        {
+            bool valid = true;
+
+            if (c == '{' || c == '[')
+            {
+                mContainers.push_back(std::make_pair(i, (size_t)0));
+                open.push_back(mContainers.size() - 1);
+                i++;
+
+                while (i < mSize && isWhitespace(s[i])) i++;
+
+                if (i < mSize && s[i] == (c == '{' ? '}' : ']'))
+                {
+                    mContainers.back().second = i++;
+                    open.pop_back();
+                    state = AfterValue;
+                }
+                else
+                {
+                    state = c == '{' ? ExpectKey : ExpectValue;
+                }
+
+                continue;
+            }
+            else if (c == '"')
+            {
+                valid = scanString(i);
+            }
+            else if (c == '-' || isDigit(c))
+            {
+                valid = scanNumber(i);
+            }
+            else if (c == 't' || c == 'f' || c == 'n')
+            {
+                const char *literal = c == 't' ? "true" : (c == 'f' ? "false" : "null");
+                size_t length = strlen(literal);
+                valid = i + length <= mSize && memcmp(s + i, literal, length) == 0;
+                i += length;
+            }
+            else
+            {
+                valid = false;
+            }
+
+            if (!valid)
+            {
+                mErrorOffset = i;
+                return false;
+            }
+
+            state = AfterValue;
+        }
+        else
+        {
+            std::pair<size_t, size_t>& container = mContainers[open.back()];
+            bool isObject = s[container.first] == '{';
+
+            if (c == ',')
+            {
+                i++;
+                state = isObject ? ExpectKey : ExpectValue;
+            }
+            else if (c == (isObject ? '}' : ']'))
+            {
+                container.second = i++;
+                open.pop_back();
+            }
+            else
+            {
+                mErrorOffset = i;
+                return false;
+            }
+        }
+    }
+}
+
+size_t JsonDocument::containerEnd(size_t begin) const
+{
+    auto container = std::lower_bound(mContainers.begin(), mContainers.end(), std::make_pair(begin, (size_t)0));
+    return container->second + 1;
+}
+
+JsonView::JsonView():
+    mDocument(nullptr),
+    mBegin(0),
+    mEnd(0)
+{
+}
+
+JsonView::JsonView(const JsonDocument *document, size_t begin, size_t end):
+    mDocument(document),
+    mBegin(begin),
+    mEnd(end)
+{
+}
+
+JsonView::Type JsonView::type() const
+{
+    if (mDocument == nullptr || mBegin >= mEnd)
+    {
+        return Invalid;
+    }
+
+    switch (mDocument->mData[mBegin])
+    {
+        case '{': return Object;
+        case '[': return Array;
+        case '"': return String;
+        case 't':
+        case 'f': return Bool;
+        case 'n': return Null;
+        default: return Number;
+    }
+}
+
+size_t JsonView::skipWhitespace(size_t i) const
+{
+    const char *s = mDocument->mData;
+    while (i < mEnd && isWhitespace(s[i])) i++;
+    return i;
+}
+
+size_t JsonView::valueEnd(size_t begin) const
+{
+    const char *s = mDocument->mData;
+    char c = s[begin];
+
+    if (c == '{' || c == '[')
+    {
+        return mDocument->containerEnd(begin);
+    }
+    else if (c == '"')
+    {
+        //The document is valid, so the first quote that isn't escaped closes the string
+        size_t i = begin + 1;
+        while (true)
+        {
+            const char *quote = (const char*)memchr(s + i, '"', mEnd - i);
+            size_t backslashes = 0;
+            i = quote - s;
+
+            while (s[i - 1 - backslashes] == '\\') backslashes++;
+
+            if (backslashes % 2 == 0)
+            {
+                return i + 1;
+            }
+
+            i++;
+        }
+    }
+    else
+    {
+        size_t i = begin;
+        while (i < mEnd && !isWhitespace(s[i]) && s[i] != ',' && s[i] != '}' && s[i] != ']') i++;
+        return i;
+    }
+}
+
+bool JsonView::keyEquals(size_t begin, size_t end, const char *key, size_t length) const
+{
+    const char *s = mDocument->mData + begin + 1;
+    size_t rawLength = end - begin - 2;
+
+    if (memchr(s, '\\', rawLength) == NULL)
+    {
+        return rawLength == length && memcmp(s, key, length) == 0;
+    }
+
+    //Escaped keys are rare, decode them into a scratch buffer that is reused on each thread
+    static thread_local std::string scratch;
+    unescape(mDocument->mData, begin + 1, end - 1, scratch);
+    return scratch.size() == length && memcmp(scratch.data(), key, length) == 0;
+}
+
+JsonView JsonView::member(const char *key, size_t length) const
+{
+    if (type() != Object)
+    {
+        return JsonView();
+    }
+
+    const char *s = mDocument->mData;
+    size_t i = skipWhitespace(mBegin + 1);
+
+    while (i < mEnd && s[i] == '"')
+    {
+        size_t keyEnd = valueEnd(i);
+        bool found = keyEquals(i, keyEnd, key, length);
+
+        i = skipWhitespace(keyEnd) + 1;
+        i = skipWhitespace(i);
+        size_t end = valueEnd(i);
+
+        if (found)
+        {
+            return JsonView(mDocument, i, end);
+        }
+
+        i = skipWhitespace(end);
+        if (s[i] == ',')
+        {
+            i = skipWhitespace(i + 1);
+        }
+    }
+
+    return JsonView();
+}
+
+JsonView JsonView::operator[](const std::string &key) const
+{
+    return member(key.data(), key.size());
+}
+
+JsonView JsonView::operator[](const char *key) const
+{
+    return member(key, strlen(key));
+}
+
+JsonView JsonView::operator[](size_t index) const
+{
+    if (type() != Array)
+    {
+        return JsonView();
+    }
+
+    const char *s = mDocument->mData;
+    size_t i = skipWhitespace(mBegin + 1);
+
+    while (i < mEnd && s[i] != ']')
+    {
+        size_t end = valueEnd(i);
+
+        if (index-- == 0)
+        {
+            return JsonView(mDocument, i, end);
+        }
+
+        i = skipWhitespace(end);
+        if (s[i] == ',')
+        {
+            i = skipWhitespace(i + 1);
+        }
+    }
+
+    return JsonView();
+}
+
+bool JsonView::has(const std::string &key) const
+{
+    return member(key.data(), key.size()).isValid();
+}
+
+size_t JsonView::size() const
+{
+    Type t = type();
+
+    if (t == Array)
+    {
+        return elements().size();
+    }
+    else if (t == Object)
+    {
+        return members().size();
+    }
+
+    return 0;
+}
+
+std::vector<JsonView> JsonView::elements() const
+{
+    std::vector<JsonView> result;
+
+    if (type() != Array)
+    {
+        return result;
+    }
+
+    const char *s = mDocument->mData;
+    size_t i = skipWhitespace(mBegin + 1);
+
+    while (i < mEnd && s[i] != ']')
+    {
+        size_t end = valueEnd(i);
+        result.push_back(JsonView(mDocument, i, end));
+
+        i = skipWhitespace(end);
+        if (s[i] == ',')
+        {
+            i = skipWhitespace(i + 1);
+        }
+    }
+
+    return result;
+}
+
+std::vector<std::pair<std::string, JsonView>> JsonView::members() const
+{
+    std::vector<std::pair<std::string, JsonView>> result;
+
+    if (type() != Object)
+    {
+        return result;
+    }
+
+    const char *s = mDocument->mData;
+    size_t i = skipWhitespace(mBegin + 1);
+
+    while (i < mEnd && s[i] == '"')
+    {
+        size_t keyEnd = valueEnd(i);
+        std::string key;
+        unescape(s, i + 1, keyEnd - 1, key);
+
+        i = skipWhitespace(keyEnd) + 1;
+        i = skipWhitespace(i);
+        size_t end = valueEnd(i);
+        result.push_back(std::make_pair(key, JsonView(mDocument, i, end)));
+
+        i = skipWhitespace(end);
+        if (s[i] == ',')
+        {
+            i = skipWhitespace(i + 1);
+        }
+    }
+
+    return result;
+}
+
+std::string JsonView::asString(const std::string &fallback) const
+{
+    if (type() != String)
+    {
+        return fallback;
+    }
+
+    std::string result;
+    unescape(mDocument->mData, mBegin + 1, mEnd - 1, result);
+    return result;
+}
+
+double JsonView::asDouble(double fallback) const
+{
+    if (type() != Number)
+    {
+        return fallback;
+    }
+
+    //The text isn't necessarily nul terminated, numbers are short enough to copy
+    std::string number(mDocument->mData + mBegin, mEnd - mBegin);
+    return strtod(number.c_str(), NULL);
+}
+
+int64_t JsonView::asInt(int64_t fallback) const
+{
+    if (type() != Number)
+    {
+        return fallback;
+    }
+
+    const char *s = mDocument->mData;
+    size_t i = mBegin;
+    bool negative = s[i] == '-';
+    uint64_t value = 0;
+
+    if (negative)
+    {
+        i++;
+    }
+
+    while (i < mEnd && isDigit(s[i]) && value < 922337203685477580ULL)
+    {
+        value = value * 10 + (s[i++] - '0');
+    }
+
+    //Fractions, exponents and huge values
+    if (i < mEnd)
+    {
+        return (int64_t)asDouble(fallback);
+    }
+
+    return negative ? -(int64_t)value : (int64_t)value;
+}
+
+bool JsonView::asBool(bool fallback) const
+{
+    if (type() != Bool)
+    {
+        return fallback;
+    }
+
+    return mDocument->mData[mBegin] == 't';
+}
+
+std::string JsonView::raw() const
+{
+    if (mDocument == nullptr)
+    {
+        return std::string();
+    }
+
+    return std::string(mDocument->mData + mBegin, mEnd - mBegin);
+}
+}
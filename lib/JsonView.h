@@ -0,0 +1,130 @@
+#ifndef _MONGOOSE_JSON_VIEW_H
+#define _MONGOOSE_JSON_VIEW_H
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Lazy, in place JSON reading.
+ *
+ * A JsonDocument validates its text in a single pass and indexes where every object and array ends,
+ * nothing else is allocated. JsonViews then point into the text: looking a member up skips over the
+ * values in between without decoding them, and only the values that are actually read are converted.
+ */
+namespace Mongoose
+{
+class JsonView;
+class JsonDocument
+{
+public:
+    /**
+     * @brief Parses text, which is not copied and has to outlive the document and its views
+     */
+    explicit JsonDocument(const std::string& text);
+    JsonDocument(const char *data, size_t size);
+
+    bool isValid() const;
+
+    /**
+     * @brief errorOffset
+     * @return where the text stopped being valid JSON, when isValid() is false
+     */
+    size_t errorOffset() const;
+
+    /**
+     * @brief root
+     * @return the top level value, an invalid view if the document isn't valid
+     */
+    JsonView root() const;
+
+private:
+    friend class JsonView;
+
+    bool index();
+    bool scanString(size_t& i) const;
+    bool scanNumber(size_t& i) const;
+    size_t containerEnd(size_t begin) const;
+
+    const char *mData;
+    size_t mSize;
+    bool mIsValid;
+    size_t mErrorOffset;
+
+    //(offset of the opening bracket, offset of the closing one) of every object/array, in document order
+    std::vector<std::pair<size_t, size_t>> mContainers;
+};
+
+class JsonView
+{
+public:
+    enum Type
+    {
+        Invalid,    //Missing members, out of range elements, type mismatches...
+        Null,
+        Bool,
+        Number,
+        String,
+        Array,
+        Object
+    };
+
+    JsonView();
+
+    Type type() const;
+    bool isValid() const { return type() != Invalid; }
+    bool isNull() const { return type() == Null; }
+    bool isBool() const { return type() == Bool; }
+    bool isNumber() const { return type() == Number; }
+    bool isString() const { return type() == String; }
+    bool isArray() const { return type() == Array; }
+    bool isObject() const { return type() == Object; }
+
+    /**
+     * @brief operator [] - an object member or array element, an invalid view if there is no such thing
+     */
+    JsonView operator[](const std::string& key) const;
+    JsonView operator[](const char *key) const;
+    JsonView operator[](size_t index) const;
+    bool has(const std::string& key) const;
+
+    /**
+     * @brief size
+     * @return the number of elements of an array or members of an object
+     */
+    size_t size() const;
+
+    /**
+     * Prefer these to indexing when going through everything, indexing starts over from the beginning
+     */
+    std::vector<JsonView> elements() const;
+    std::vector<std::pair<std::string, JsonView>> members() const;
+
+    std::string asString(const std::string& fallback = "") const;
+    double asDouble(double fallback = 0) const;
+    int64_t asInt(int64_t fallback = 0) const;
+    bool asBool(bool fallback = false) const;
+
+    /**
+     * @brief raw
+     * @return the JSON text of the value, as is
+     */
+    std::string raw() const;
+
+private:
+    friend class JsonDocument;
+    JsonView(const JsonDocument *document, size_t begin, size_t end);
+
+    size_t skipWhitespace(size_t i) const;
+    size_t valueEnd(size_t begin) const;
+    bool keyEquals(size_t begin, size_t end, const char *key, size_t length) const;
+    JsonView member(const char *key, size_t length) const;
+
+    const JsonDocument *mDocument;
+    size_t mBegin;
+    size_t mEnd;
+};
+}
+
+#endif
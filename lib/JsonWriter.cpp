@@ -0,0 +1,401 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "JsonWriter.h"
+#include "Response.h"
+
+static const char DIGIT_PAIRS[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static const uint64_t ONES = 0x0101010101010101ULL;
+static const uint64_t HIGH_BITS = 0x8080808080808080ULL;
+
+static inline bool hasZeroByte(uint64_t word)
+{
+    return ((word - ONES) & ~word & HIGH_BITS) != 0;
+}
+
+/**
+ * Whether any of the 8 bytes has to be escaped: a control character, a quote or a backslash.
+ * Testing a word at a time lets plain text, the vast majority, be copied in bulk.
+ */
+static inline bool needsEscaping(uint64_t word)
+{
+    //Bytes >= 0x80 (utf-8 sequences) are masked out of the "less than 0x20" test
+    bool control = ((word - ONES * 0x20) & ~word & HIGH_BITS) != 0;
+    return control || hasZeroByte(word ^ (ONES * '"')) || hasZeroByte(word ^ (ONES * '\\'));
+}
+
+namespace Mongoose
+{
+JsonWriter::JsonWriter(const std::shared_ptr<Response> &response, size_t bufferSize):
+    mResponse(response),
+    mOutput(&mBuffer),
+    mBufferSize(bufferSize > 0 ? bufferSize : 1),
+    mAfterKey(false),
+    mIsValid(response && response->isValid()),
+    mIsEnded(false)
+{
+    mBuffer.reserve(mBufferSize + 64);
+
+    if (mIsValid && !response->hasHeader("Content-Type"))
+    {
+        response->setHeader("Content-Type", "application/json");
+    }
+}
+
+JsonWriter::JsonWriter(std::string &output):
+    mOutput(&output),
+    mBufferSize(std::string::npos),
+    mAfterKey(false),
+    mIsValid(true),
+    mIsEnded(false)
+{
+}
+
+JsonWriter::~JsonWriter()
+{
+    end();
+}
+
+void JsonWriter::separate()
+{
+    if (mAfterKey)
+    {
+        mAfterKey = false;
+    }
+    else if (!mHasMembers.empty())
+    {
+        if (mHasMembers.back())
+        {
+            append(',');
+        }
+
+        mHasMembers.back() = true;
+    }
+}
+
+JsonWriter &JsonWriter::beginObject()
+{
+    separate();
+    append('{');
+    mHasMembers.push_back(false);
+    return *this;
+}
+
+JsonWriter &JsonWriter::endObject()
+{
+    append('}');
+    if (!mHasMembers.empty())
+    {
+        mHasMembers.pop_back();
+    }
+    return *this;
+}
+
+JsonWriter &JsonWriter::beginArray()
+{
+    separate();
+    append('[');
+    mHasMembers.push_back(false);
+    return *this;
+}
+
+JsonWriter &JsonWriter::endArray()
+{
+    append(']');
+    if (!mHasMembers.empty())
+    {
+        mHasMembers.pop_back();
+    }
+    return *this;
+}
+
+JsonWriter &JsonWriter::key(const char *name, size_t length)
+{
+    separate();
+    writeString(name, length);
+    append(':');
+    mAfterKey = true;
+    return *this;
+}
+
+JsonWriter &JsonWriter::key(const char *name)
+{
+    return key(name, strlen(name));
+}
+
+JsonWriter &JsonWriter::key(const std::string &name)
+{
+    return key(name.data(), name.size());
+}
+
+JsonWriter &JsonWriter::value(const char *data, size_t length)
+{
+    separate();
+    writeString(data, length);
+    return *this;
+}
+
+JsonWriter &JsonWriter::value(const char *data)
+{
+    if (data == NULL)
+    {
+        return null();
+    }
+
+    return value(data, strlen(data));
+}
+
+JsonWriter &JsonWriter::value(const std::string &data)
+{
+    return value(data.data(), data.size());
+}
+
+JsonWriter &JsonWriter::value(bool data)
+{
+    separate();
+    if (data)
+    {
+        append("true", 4);
+    }
+    else
+    {
+        append("false", 5);
+    }
+    return *this;
+}
+
+JsonWriter &JsonWriter::value(int data)
+{
+    separate();
+    writeSigned(data);
+    return *this;
+}
+
+JsonWriter &JsonWriter::value(unsigned int data)
+{
+    separate();
+    writeUnsigned(data);
+    return *this;
+}
+
+JsonWriter &JsonWriter::value(long data)
+{
+    separate();
+    writeSigned(data);
+    return *this;
+}
+
+JsonWriter &JsonWriter::value(unsigned long data)
+{
+    separate();
+    writeUnsigned(data);
+    return *this;
+}
+
+JsonWriter &JsonWriter::value(long long data)
+{
+    separate();
+    writeSigned(data);
+    return *this;
+}
+
+JsonWriter &JsonWriter::value(unsigned long long data)
+{
+    separate();
+    writeUnsigned(data);
+    return *this;
+}
+
+JsonWriter &JsonWriter::value(double data)
+{
+    if (!std::isfinite(data))
+    {
+        return null();
+    }
+
+    separate();
+
+    //Whole numbers are common and way cheaper to print as integers
+    if (data == std::floor(data) && std::fabs(data) < 9007199254740992.0)
+    {
+        writeSigned((int64_t)data);
+        return *this;
+    }
+
+    //The shortest of the usual precisions that reads back as the same double
+    char buffer[32];
+    int length = snprintf(buffer, sizeof(buffer), "%.15g", data);
+    if (strtod(buffer, NULL) != data)
+    {
+        length = snprintf(buffer, sizeof(buffer), "%.17g", data);
+    }
+
+    append(buffer, length);
+    return *this;
+}
+
+JsonWriter &JsonWriter::null()
+{
+    separate();
+    append("null", 4);
+    return *this;
+}
+
+JsonWriter &JsonWriter::raw(const std::string &json)
+{
+    separate();
+    append(json.data(), json.size());
+    return *this;
+}
+
+void JsonWriter::writeUnsigned(uint64_t data)
+{
+    char buffer[20];
+    char *end = buffer + sizeof(buffer);
+    char *p = end;
+
+    while (data >= 100)
+    {
+        unsigned pair = (unsigned)(data % 100) * 2;
+        data /= 100;
+        *--p = DIGIT_PAIRS[pair + 1];
+        *--p = DIGIT_PAIRS[pair];
+    }
+
+    if (data >= 10)
+    {
+        unsigned pair = (unsigned)data * 2;
+        *--p = DIGIT_PAIRS[pair + 1];
+        *--p = DIGIT_PAIRS[pair];
+    }
+    else
+    {
+        *--p = (char)('0' + data);
+    }
+
+    append(p, end - p);
+}
+
+void JsonWriter::writeSigned(int64_t data)
+{
+    if (data < 0)
+    {
+        append('-');
+        //Negating as unsigned so INT64_MIN doesn't overflow
+        writeUnsigned(0 - (uint64_t)data);
+    }
+    else
+    {
+        writeUnsigned((uint64_t)data);
+    }
+}
+
+void JsonWriter::writeString(const char *data, size_t length)
+{
+    static const char HEX[] = "0123456789abcdef";
+
+    append('"');
+    size_t start = 0;
+    size_t i = 0;
+
+    while (i < length)
+    {
+        //Skip over runs of bytes that need no escaping, 8 at a time
+        uint64_t word;
+        while (i + sizeof(word) <= length)
+        {
+            memcpy(&word, data + i, sizeof(word));
+            if (needsEscaping(word))
+            {
+                break;
+            }
+            i += sizeof(word);
+        }
+
+        if (i >= length)
+        {
+            break;
+        }
+
+        unsigned char c = (unsigned char)data[i];
+        if (c >= 0x20 && c != '"' && c != '\\')
+        {
+            i++;
+            continue;
+        }
+
+        append(data + start, i - start);
+
+        switch (c)
+        {
+            case '"': append("\\\"", 2); break;
+            case '\\': append("\\\\", 2); break;
+            case '\n': append("\\n", 2); break;
+            case '\r': append("\\r", 2); break;
+            case '\t': append("\\t", 2); break;
+            case '\b': append("\\b", 2); break;
+            case '\f': append("\\f", 2); break;
+            default:
+            {
+                char escaped[6] = {'\\', 'u', '0', '0', HEX[c >> 4], HEX[c & 0xf]};
+                append(escaped, sizeof(escaped));
+            }
+        }
+
+        start = ++i;
+    }
+
+    append(data + start, length - start);
+    append('"');
+}
+
+bool JsonWriter::flush()
+{
+    if (mResponse && mIsValid && !mBuffer.empty())
+    {
+        mIsValid = mResponse->write(mBuffer.data(), mBuffer.size());
+    }
+
+    if (mResponse)
+    {
+        mBuffer.clear();
+    }
+
+    return mIsValid;
+}
+
+bool JsonWriter::end()
+{
+    if (mIsEnded)
+    {
+        return mIsValid;
+    }
+
+    mIsEnded = true;
+
+    if (flush() && mResponse)
+    {
+        mIsValid = mResponse->end();
+    }
+
+    return mIsValid;
+}
+
+bool JsonWriter::isValid() const
+{
+    return mIsValid;
+}
+}
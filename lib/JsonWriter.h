@@ -0,0 +1,122 @@
+#ifndef _MONGOOSE_JSON_WRITER_H
+#define _MONGOOSE_JSON_WRITER_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * A streaming (SAX style) JSON writer.
+ *
+ * Values are serialized as they are written, into a small buffer that is flushed straight to the
+ * response whenever it fills up, so large documents are never built in memory, neither as a DOM nor
+ * as a string. Commas and nesting are taken care of:
+ *
+ *     JsonWriter json(response);
+ *     json.beginObject().key("items").beginArray();
+ *     for (const auto& item: items)
+ *         json.beginObject().key("id").value(item.id).key("name").value(item.name).endObject();
+ *     json.endArray().endObject().end();
+ */
+namespace Mongoose
+{
+class Response;
+class JsonWriter
+{
+public:
+    /**
+     * @brief Writes to a response, as application/json unless another Content-Type was set
+     * @param bufferSize - how much is buffered before being handed to the connection
+     */
+    explicit JsonWriter(const std::shared_ptr<Response>& response, size_t bufferSize = 16384);
+
+    /**
+     * @brief Appends to a string instead, e.g. to build a websocket message or an event
+     */
+    explicit JsonWriter(std::string& output);
+
+    /**
+     * Finishes the response, if end() wasn't called
+     */
+    ~JsonWriter();
+
+    JsonWriter& beginObject();
+    JsonWriter& endObject();
+    JsonWriter& beginArray();
+    JsonWriter& endArray();
+
+    JsonWriter& key(const char *name, size_t length);
+    JsonWriter& key(const char *name);
+    JsonWriter& key(const std::string& name);
+
+    JsonWriter& value(const char *data, size_t length);
+    JsonWriter& value(const char *data);
+    JsonWriter& value(const std::string& data);
+    JsonWriter& value(bool data);
+    JsonWriter& value(int data);
+    JsonWriter& value(unsigned int data);
+    JsonWriter& value(long data);
+    JsonWriter& value(unsigned long data);
+    JsonWriter& value(long long data);
+    JsonWriter& value(unsigned long long data);
+    //NaN and infinities have no JSON representation and are written as null
+    JsonWriter& value(double data);
+    JsonWriter& null();
+
+    /**
+     * @brief raw - writes an already serialized JSON value as is
+     */
+    JsonWriter& raw(const std::string& json);
+
+    /**
+     * @brief flush - hands the buffered output to the response
+     * @return false if the connection is gone, there is no point in writing more
+     */
+    bool flush();
+
+    /**
+     * @brief end - flushes and finishes the response
+     */
+    bool end();
+
+    bool isValid() const;
+
+private:
+    void separate();
+    void writeString(const char *data, size_t length);
+    void writeUnsigned(uint64_t data);
+    void writeSigned(int64_t data);
+
+    inline void append(const char *data, size_t length)
+    {
+        mOutput->append(data, length);
+        if (mOutput->size() >= mBufferSize)
+        {
+            flush();
+        }
+    }
+
+    inline void append(char c)
+    {
+        mOutput->push_back(c);
+        if (mOutput->size() >= mBufferSize)
+        {
+            flush();
+        }
+    }
+
+    std::shared_ptr<Response> mResponse;
+    std::string mBuffer;
+    std::string *mOutput;
+    size_t mBufferSize;
+
+    //One entry per open object/array: whether it already has a member, i.e. the next one needs a comma
+    std::vector<bool> mHasMembers;
+    bool mAfterKey;
+    bool mIsValid;
+    bool mIsEnded;
+};
+}
+
+#endif
@@ -0,0 +1,206 @@
+#ifndef _MONGOOSE_PIPELINE_H
+#define _MONGOOSE_PIPELINE_H
+
+#include <cstddef>
+#include <memory>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "AbstractRequestCoprocessor.h"
+#include "Controller.h"
+
+/**
+ * A middleware chain fixed at compile time.
+ *
+ * Pipeline<A, B, C> holds its stages by value and runs them around the handler as nested calls:
+ * A::preProcess, B::preProcess, C::preProcess, the handler, C::postProcess, B::postProcess, A::postProcess.
+ * There is no virtual call nor shared_ptr copy between the stages, the compiler sees (and inlines) the whole chain.
+ *
+ * A stage is any class with the two (non virtual) methods of PipelineStage. A stage whose preProcess returned
+ * false stops the chain: the stages after it and the handler are skipped. The postProcess of every stage whose
+ * preProcess was called always runs, even if a later stage or the handler throws (the exception then goes on).
+ *
+ * Installed on a Server (see Server::setPipeline), a pipeline wraps the requests of every controller.
+ */
+namespace Mongoose
+{
+/**
+ * A stage that does nothing, to derive stages that only need one of the methods from
+ */
+struct PipelineStage
+{
+    /**
+     * @return false to stop the chain, the request is then answered with an error unless the stage answered it
+     */
+    bool preProcess(const std::shared_ptr<Request>& /*request*/, const std::shared_ptr<Response>& /*response*/)
+    {
+        return true;
+    }
+
+    /**
+     * Must not throw: it may be running because an exception is unwinding the chain
+     */
+    void postProcess(const std::shared_ptr<Request>& /*request*/, const std::shared_ptr<Response>& /*response*/)
+    {
+    }
+};
+
+/**
+ * Runs an AbstractRequestCoprocessor as a stage, so that existing coprocessors (eg. Sessions) fit in a pipeline
+ */
+class CoprocessorStage
+{
+public:
+    explicit CoprocessorStage(AbstractRequestCoprocessor *coprocessor):
+        mCoprocessor(coprocessor)
+    {
+    }
+
+    bool preProcess(const std::shared_ptr<Request>& request, const std::shared_ptr<Response>& response)
+    {
+        return mCoprocessor->preProcess(request, response);
+    }
+
+    void postProcess(const std::shared_ptr<Request>& request, const std::shared_ptr<Response>& response)
+    {
+        mCoprocessor->postProcess(request, response);
+    }
+
+private:
+    AbstractRequestCoprocessor *mCoprocessor;
+};
+
+/**
+ * What a Server knows of its pipeline: the only virtual call a request goes through to enter it
+ */
+class AbstractPipeline
+{
+public:
+    virtual ~AbstractPipeline() {}
+
+    /**
+     * @brief handle - runs the chain around controller->handleRequest()
+     */
+    virtual bool handle(const std::shared_ptr<Request>& request, const std::shared_ptr<Response>& response,
+                        Controller *controller) = 0;
+};
+
+namespace Internal
+{
+//Calls the postProcess of a stage when going out of scope, however that happens
+template<typename Stage>
+class PostProcessGuard
+{
+public:
+    PostProcessGuard(Stage& stage, const std::shared_ptr<Request>& request, const std::shared_ptr<Response>& response):
+        mStage(stage),
+        mRequest(request),
+        mResponse(response)
+    {
+    }
+
+    ~PostProcessGuard()
+    {
+        try
+        {
+            mStage.postProcess(mRequest, mResponse);
+        }
+        catch(...)
+        {
+            //Throwing out of a destructor, possibly during unwinding, would terminate the program
+        }
+    }
+
+private:
+    Stage& mStage;
+    const std::shared_ptr<Request>& mRequest;
+    const std::shared_ptr<Response>& mResponse;
+};
+
+//Stage index and on, then the handler
+template<size_t index, size_t count>
+struct PipelineStep
+{
+    template<typename Stages, typename Handler>
+    static bool run(Stages& stages, const std::shared_ptr<Request>& request, const std::shared_ptr<Response>& response,
+                    Handler& handler)
+    {
+        auto& stage = std::get<index>(stages);
+        PostProcessGuard<typename std::remove_reference<decltype(stage)>::type> guard(stage, request, response);
+
+        if (!stage.preProcess(request, response))
+        {
+            return false;
+        }
+
+        return PipelineStep<index + 1, count>::run(stages, request, response, handler);
+    }
+};
+
+template<size_t count>
+struct PipelineStep<count, count>
+{
+    template<typename Stages, typename Handler>
+    static bool run(Stages&, const std::shared_ptr<Request>& request, const std::shared_ptr<Response>& response,
+                    Handler& handler)
+    {
+        return handler(request, response);
+    }
+};
+}
+
+template<typename... Stages>
+class Pipeline: public AbstractPipeline
+{
+public:
+    explicit Pipeline(Stages... stages):
+        mStages(std::move(stages)...)
+    {
+    }
+
+    /**
+     * @brief run - runs the chain around handler, without going through AbstractPipeline
+     * @param handler - anything callable as bool(request, response)
+     * @return false if a stage stopped the chain, else what handler returned
+     */
+    template<typename Handler>
+    bool run(const std::shared_ptr<Request>& request, const std::shared_ptr<Response>& response, Handler&& handler)
+    {
+        return Internal::PipelineStep<0, sizeof...(Stages)>::run(mStages, request, response, handler);
+    }
+
+    bool handle(const std::shared_ptr<Request>& request, const std::shared_ptr<Response>& response,
+                Controller *controller) override
+    {
+        auto handler = [controller](const std::shared_ptr<Request>& request, const std::shared_ptr<Response>& response) {
+            return controller->handleRequest(request, response);
+        };
+
+        return run(request, response, handler);
+    }
+
+    /**
+     * @brief stage - the stage at index, eg. to read what it gathered
+     */
+    template<size_t index>
+    typename std::tuple_element<index, std::tuple<Stages...>>::type& stage()
+    {
+        return std::get<index>(mStages);
+    }
+
+private:
+    std::tuple<Stages...> mStages;
+};
+
+/**
+ * @brief makePipeline - a Pipeline of the given stages, their types deduced
+ */
+template<typename... Stages>
+Pipeline<Stages...> makePipeline(Stages... stages)
+{
+    return Pipeline<Stages...>(std::move(stages)...);
+}
+}
+
+#endif
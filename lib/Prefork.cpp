@@ -0,0 +1,409 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "Prefork.h"
+#include "Server.h"
+#include "Utils.h"
+
+//A worker exiting sooner than this after being forked is considered to have crashed on start-up
+static const int STARTUP_GRACE_MS = 5000;
+static const int MIN_RESPAWN_DELAY_MS = 100;
+static const int MAX_RESPAWN_DELAY_MS = 30000;
+//Start-up crashes in a row after which the master gives up
+static const int MAX_STARTUP_CRASHES = 10;
+
+static volatile sig_atomic_t sReload = 0;
+static volatile sig_atomic_t sTerminate = 0;
+
+static void handleSignal(int signal)
+{
+    if (signal == SIGHUP)
+    {
+        sReload = 1;
+    }
+    else
+    {
+        sTerminate = 1;
+    }
+}
+
+static void installHandler(int signal, void (*handler)(int))
+{
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handler;
+    sigemptyset(&action.sa_mask);
+    sigaction(signal, &action, NULL);
+}
+
+namespace Mongoose
+{
+Prefork::Prefork(Server *server, int workers):
+    mServer(server),
+    mWorkers(workers > 0 ? workers : 1),
+    mDrainTimeout(30),
+    mGeneration(0),
+    mStartupCrashes(0)
+{
+}
+
+Prefork::~Prefork()
+{
+    closeListeners();
+}
+
+void Prefork::closeListeners()
+{
+    for (int listener: mListeners)
+    {
+        close(listener);
+    }
+
+    for (int listener: mTlsListeners)
+    {
+        close(listener);
+    }
+
+    mListeners.clear();
+    mTlsListeners.clear();
+}
+
+int Prefork::bindListener(const std::string &address) const
+{
+    //Accepts the same forms as Server: "8080", ":8080", "0.0.0.0:8080", "[::]:8080", "unix:/run/app.sock"
+    if (address.compare(0, 5, "unix:") == 0)
+    {
+        return Server::bindUnixSocket(address, mServer->unixSocketPermissions());
+    }
+
+    std::string host;
+    std::string port = address;
+    size_t colon = address.rfind(':');
+
+    if (colon != std::string::npos)
+    {
+        host = address.substr(0, colon);
+        port = address.substr(colon + 1);
+
+        if (host.size() > 1 && host[0] == '[' && host[host.size() - 1] == ']')
+        {
+            host = host.substr(1, host.size() - 2);
+        }
+    }
+
+    struct addrinfo hints;
+    struct addrinfo *addresses = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = host.empty() ? AF_INET : AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    if (getaddrinfo(host.empty() ? NULL : host.c_str(), port.c_str(), &hints, &addresses) != 0)
+    {
+        return -1;
+    }
+
+    int listener = -1;
+
+    for (struct addrinfo *a = addresses; a != NULL && listener < 0; a = a->ai_next)
+    {
+        listener = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+
+        if (listener < 0)
+        {
+            continue;
+        }
+
+        int on = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+        if (bind(listener, a->ai_addr, a->ai_addrlen) != 0 || listen(listener, SOMAXCONN) != 0)
+        {
+            close(listener);
+            listener = -1;
+        }
+    }
+
+    freeaddrinfo(addresses);
+
+    if (listener >= 0)
+    {
+        //Workers accept concurrently, a connection taken by another worker must not block the others
+        fcntl(listener, F_SETFL, fcntl(listener, F_GETFL, 0) | O_NONBLOCK);
+    }
+
+    return listener;
+}
+
+bool Prefork::bindListeners(const std::vector<std::string> &addresses, std::vector<int> &listeners)
+{
+    for (const auto& address: addresses)
+    {
+        int listener = bindListener(address);
+
+        if (listener < 0)
+        {
+            std::cerr << "Error, unable to bind " << address << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+
+        listeners.push_back(listener);
+    }
+
+    return true;
+}
+
+int Prefork::run()
+{
+    std::vector<std::string> addresses = mServer->bindAddresses();
+    bool isBound = bindListeners(addresses, mListeners);
+
+#ifdef HAS_OPENSSL
+    //Bound the same way, the workers start TLS on them
+    std::vector<std::string> tlsAddresses = mServer->tlsBindAddresses();
+    isBound = isBound && bindListeners(tlsAddresses, mTlsListeners);
+    addresses.insert(addresses.end(), tlsAddresses.begin(), tlsAddresses.end());
+#endif
+
+    if (!isBound)
+    {
+        closeListeners();
+        return EXIT_FAILURE;
+    }
+
+    installHandler(SIGHUP, handleSignal);
+    installHandler(SIGINT, handleSignal);
+    installHandler(SIGTERM, handleSignal);
+
+    spawn();
+    int result = EXIT_SUCCESS;
+
+    while (!sTerminate)
+    {
+        if (sReload)
+        {
+            sReload = 0;
+
+            if (mReloadHandler)
+            {
+                mReloadHandler();
+            }
+
+            //Bring the new generation up first, so there is no moment without workers accepting
+            int oldGeneration = mGeneration;
+            mGeneration++;
+            spawn();
+            signalWorkers(oldGeneration, SIGTERM);
+        }
+
+        int status;
+        pid_t pid;
+
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+        {
+            auto child = mChildren.find(pid);
+
+            if (child != mChildren.end())
+            {
+                Worker worker = child->second;
+                mChildren.erase(child);
+
+                if (worker.generation == mGeneration && !workerExited(pid, worker))
+                {
+                    std::cerr << "Error, workers keep crashing on start-up, giving up" << std::endl;
+                    sTerminate = 1;
+                    result = EXIT_FAILURE;
+                }
+            }
+        }
+
+        if (!sTerminate && Clock::now() >= mNextSpawn)
+        {
+            spawn();
+        }
+
+        Utils::sleep(100);
+    }
+
+    for (auto& child: mChildren)
+    {
+        kill(child.first, SIGTERM);
+    }
+
+    while (!mChildren.empty())
+    {
+        pid_t pid = waitpid(-1, NULL, 0);
+
+        if (pid < 0 && errno != EINTR)
+        {
+            break;
+        }
+
+        mChildren.erase(pid);
+    }
+
+    closeListeners();
+
+    for (const auto& address: addresses)
+    {
+        if (address.compare(0, 5, "unix:") == 0 && address.size() > 5 && address[5] != '@')
+        {
+            unlink(address.c_str() + 5);
+        }
+    }
+
+    return result;
+}
+
+bool Prefork::workerExited(pid_t pid, const Worker &worker)
+{
+    Clock::time_point now = Clock::now();
+
+    if (now - worker.started >= std::chrono::milliseconds(STARTUP_GRACE_MS))
+    {
+        //It was up and running for a while, so whatever killed it, a fresh one is likely to work
+        mStartupCrashes = 0;
+        mNextSpawn = now;
+        std::cerr << "Worker " << pid << " exited unexpectedly, restarting it" << std::endl;
+        return true;
+    }
+
+    if (++mStartupCrashes >= MAX_STARTUP_CRASHES)
+    {
+        return false;
+    }
+
+    //Don't spin forking workers which die right away, back off exponentially
+    int delay = MIN_RESPAWN_DELAY_MS << std::min(mStartupCrashes - 1, 16);
+    delay = std::min(delay, MAX_RESPAWN_DELAY_MS);
+    mNextSpawn = now + std::chrono::milliseconds(delay);
+    std::cerr << "Worker " << pid << " crashed on start-up, restarting it in " << delay << " ms" << std::endl;
+    return true;
+}
+
+void Prefork::spawn()
+{
+    int running = 0;
+
+    for (const auto& child: mChildren)
+    {
+        if (child.second.generation == mGeneration)
+        {
+            running++;
+        }
+    }
+
+    for (; running < mWorkers; running++)
+    {
+        pid_t pid = fork();
+
+        if (pid == 0)
+        {
+            runWorker();
+        }
+        else if (pid > 0)
+        {
+            Worker worker = {mGeneration, Clock::now()};
+            mChildren[pid] = worker;
+        }
+        else
+        {
+            std::cerr << "Error, unable to fork a worker: " << strerror(errno) << std::endl;
+            break;
+        }
+    }
+}
+
+void Prefork::runWorker()
+{
+    installHandler(SIGHUP, SIG_IGN);
+    //Ctrl-C reaches the whole process group, let the master decide what to do about it
+    installHandler(SIGINT, SIG_IGN);
+    installHandler(SIGTERM, handleSignal);
+    sReload = 0;
+    sTerminate = 0;
+
+    if (mWorkerStartHandler)
+    {
+        mWorkerStartHandler();
+    }
+
+    mServer->setListeningSockets(mListeners);
+#ifdef HAS_OPENSSL
+    mServer->setTlsListeningSockets(mTlsListeners);
+#endif
+
+    if (!mServer->start())
+    {
+        _exit(EXIT_FAILURE);
+    }
+
+    while (!sTerminate)
+    {
+        mServer->poll(1000);
+    }
+
+    //Drain: let in flight requests finish, but accept no new ones
+    mServer->stopListening();
+    int deadline = Utils::getTime() + mDrainTimeout;
+
+    while (mServer->connectionCount() > 0 && Utils::getTime() < deadline)
+    {
+        mServer->poll(100);
+    }
+
+    mServer->stop();
+    _exit(EXIT_SUCCESS);
+}
+
+void Prefork::signalWorkers(int generation, int signal)
+{
+    for (const auto& child: mChildren)
+    {
+        if (child.second.generation == generation)
+        {
+            kill(child.first, signal);
+        }
+    }
+}
+
+int Prefork::workers() const
+{
+    return mWorkers;
+}
+
+void Prefork::setWorkers(int workers)
+{
+    mWorkers = workers > 0 ? workers : 1;
+}
+
+int Prefork::drainTimeout() const
+{
+    return mDrainTimeout;
+}
+
+void Prefork::setDrainTimeout(int seconds)
+{
+    mDrainTimeout = seconds;
+}
+
+void Prefork::setReloadHandler(const std::function<void()> &handler)
+{
+    mReloadHandler = handler;
+}
+
+void Prefork::setWorkerStartHandler(const std::function<void()> &handler)
+{
+    mWorkerStartHandler = handler;
+}
+}
@@ -0,0 +1,98 @@
+#ifndef _MONGOOSE_PREFORK_H
+#define _MONGOOSE_PREFORK_H
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+/**
+ * Runs a Server in several worker processes sharing the same listening sockets (POSIX only).
+ *
+ * The master process binds all of the server's bind addresses, TLS ones included, once and forks the workers,
+ * each of which starts and polls its own copy of the Server. Workers that die are restarted, with an
+ * exponential backoff while they keep dying right after they start. If they never manage to stay up, run() gives up.
+ * SIGHUP starts a new generation of workers and gracefully drains the old one:
+ * old workers stop accepting, finish the requests they have in flight and exit.
+ * SIGINT/SIGTERM drain all workers and stop the master.
+ */
+namespace Mongoose
+{
+class Server;
+class Prefork
+{
+public:
+    /**
+     * @brief Constructs the Prefork supervisor
+     * @param server - the server run by every worker. Register controllers etc. before calling run()
+     * @param workers - the number of worker processes
+     */
+    explicit Prefork(Server *server, int workers = 4);
+    virtual ~Prefork();
+
+    /**
+     * @brief run - binds the listener, forks the workers and supervises them until SIGINT/SIGTERM.
+     * Only returns in the master process, workers exit when they are done draining.
+     * @return EXIT_SUCCESS, or EXIT_FAILURE if the listener could not be bound or the workers kept crashing
+     * on start-up
+     */
+    int run();
+
+    int workers() const;
+    void setWorkers(int workers);
+
+    /**
+     * @brief drainTimeout - how long (in seconds) a draining worker waits for in flight requests
+     * before exiting anyway
+     */
+    int drainTimeout() const;
+    void setDrainTimeout(int seconds);
+
+    /**
+     * @brief setReloadHandler - called in the master on SIGHUP, before the new generation of workers is
+     * forked. Reload configuration here, the new workers inherit whatever the master has.
+     */
+    void setReloadHandler(const std::function<void()>& handler);
+
+    /**
+     * @brief setWorkerStartHandler - called in every worker process right after it is forked,
+     * before the server is started. Useful to reopen per process resources.
+     */
+    void setWorkerStartHandler(const std::function<void()>& handler);
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Worker
+    {
+        int generation;
+        Clock::time_point started;
+    };
+
+    int bindListener(const std::string& address) const;
+    bool bindListeners(const std::vector<std::string>& addresses, std::vector<int>& listeners);
+    void closeListeners();
+
+    void spawn();
+    void runWorker();
+    void signalWorkers(int generation, int signal);
+    bool workerExited(pid_t pid, const Worker& worker);
+
+    Server *mServer;
+    int mWorkers;
+    int mDrainTimeout;
+    std::vector<int> mListeners;
+    std::vector<int> mTlsListeners;
+    int mGeneration;
+    std::map<pid_t, Worker> mChildren;
+    int mStartupCrashes;
+    Clock::time_point mNextSpawn;
+    std::function<void()> mReloadHandler;
+    std::function<void()> mWorkerStartHandler;
+};
+}
+
+#endif
@@ -0,0 +1,204 @@
+#include <cstring>
+#include <mongoose.h>
+
+#include "HttpClient.h"
+#include "ProxyController.h"
+#include "Request.h"
+#include "Response.h"
+
+static bool equalsIgnoreCase(const std::string& name, const char *header)
+{
+    return name.size() == strlen(header) && mg_ncasecmp(name.c_str(), header, name.size()) == 0;
+}
+
+namespace Mongoose
+{
+    ProxyController::ProxyController(HttpClient *client, Server *server):
+        Controller(server),
+        mClient(client)
+    {
+    }
+
+    ProxyController::~ProxyController()
+    {
+    }
+
+    void ProxyController::addUpstream(const std::string &prefix, const std::string &upstream, bool stripPrefix)
+    {
+        Route route;
+        route.upstream = upstream;
+        route.stripPrefix = stripPrefix;
+        mUpstreams[mPrefix + prefix] = route;
+    }
+
+    void ProxyController::removeUpstream(const std::string &prefix)
+    {
+        mUpstreams.erase(mPrefix + prefix);
+    }
+
+    const ProxyController::Route *ProxyController::route(const std::string &url, std::string *path) const
+    {
+        //Prefixes of url sort right before it, the closest ones first
+        auto candidate = mUpstreams.upper_bound(url);
+
+        while (candidate != mUpstreams.begin())
+        {
+            --candidate;
+
+            if (url.compare(0, candidate->first.size(), candidate->first) == 0)
+            {
+                if (path)
+                {
+                    *path = candidate->second.stripPrefix ? url.substr(candidate->first.size()) : url;
+
+                    if (path->empty() || (*path)[0] != '/')
+                    {
+                        *path = "/" + *path;
+                    }
+                }
+
+                return &candidate->second;
+            }
+        }
+
+        return nullptr;
+    }
+
+    bool ProxyController::handles(const std::string &method, const std::string &url) const
+    {
+        return route(url) != nullptr || Controller::handles(method, url);
+    }
+
+    bool ProxyController::process(const std::shared_ptr<Request> &request, const std::shared_ptr<Response> &response)
+    {
+        std::string path;
+        const Route *upstream = route(request->url(), &path);
+
+        if (!upstream)
+        {
+            return Controller::process(request, response);
+        }
+
+        auto call = std::make_shared<HttpClient::Call>();
+        call->method = request->method();
+        call->path = path;
+        call->body = request->body();
+
+        std::string query = request->queryString();
+        if (!query.empty())
+        {
+            call->path += "?" + query;
+        }
+
+        for (const auto& header: request->headers())
+        {
+            //The client sets Host and Content-Length for the upstream
+            if (!isHopByHopHeader(header.first) && !equalsIgnoreCase(header.first, "Host")
+                && !equalsIgnoreCase(header.first, "Content-Length"))
+            {
+                call->headers.push_back(header);
+            }
+        }
+
+        if (request->hasHeader("Host"))
+        {
+            call->headers.push_back(std::make_pair(std::string("X-Forwarded-Host"), request->getHeaderValue("Host")));
+        }
+
+        HttpClient *client = mClient;
+        //The call holds on to the response until it is done, not the other way around
+        std::weak_ptr<HttpClient::Call> weakCall = call;
+
+        call->onHeaders = [client, weakCall, response](const HttpClient::Reply& reply) {
+            if (!response->isValid())
+            {
+                return;
+            }
+
+            response->setCode(reply.code);
+
+            for (const auto& header: reply.headers)
+            {
+                if (!isHopByHopHeader(header.first))
+                {
+                    response->setHeader(header.first, header.second);
+                }
+            }
+
+            response->sendHeaders();
+
+            //Picks the upstream back up once the client caught up, see onData
+            response->onWritable([client, weakCall]() {
+                auto call = weakCall.lock();
+
+                if (call)
+                {
+                    client->setPaused(call, false);
+                }
+            });
+        };
+
+        call->onData = [client, weakCall, response](const char *data, size_t size) {
+            if (!response->isValid() || !response->write(data, size))
+            {
+                //The client is gone, so is the point of reading on
+                return false;
+            }
+
+            if (!response->isWritable())
+            {
+                auto call = weakCall.lock();
+
+                if (call)
+                {
+                    client->setPaused(call, true);
+                }
+            }
+
+            return true;
+        };
+
+        call->onComplete = [response](const HttpClient::Reply& reply, const std::string& error) {
+            if (!response->isValid())
+            {
+                return;
+            }
+
+            if (!error.empty() && reply.code == 0)
+            {
+                response->setHeader("Content-Type", "text/plain");
+                response->send(502, "Bad Gateway: " + error + "\n");
+            }
+            else
+            {
+                //Closing the connection also tells the client a response cut short by an error is incomplete
+                response->end();
+            }
+        };
+
+        if (!mClient->request(upstream->upstream, call))
+        {
+            return response->send(503, "Service Unavailable\n");
+        }
+
+        return true;
+    }
+
+    bool ProxyController::isHopByHopHeader(const std::string &name)
+    {
+        static const char *headers[] = {
+            "Connection", "Keep-Alive", "Proxy-Authenticate", "Proxy-Authorization", "Proxy-Connection",
+            "TE", "Trailer", "Transfer-Encoding", "Upgrade"
+        };
+
+        for (const char *header: headers)
+        {
+            if (equalsIgnoreCase(name, header))
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+}
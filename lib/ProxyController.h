@@ -0,0 +1,65 @@
+#ifndef _MONGOOSE_PROXY_CONTROLLER_H
+#define _MONGOOSE_PROXY_CONTROLLER_H
+
+#include <map>
+#include <memory>
+#include <string>
+
+#include "Controller.h"
+
+/**
+ * A reverse proxy: forwards the requests under a url prefix to an upstream server through an HttpClient,
+ * and streams the upstream responses back as they arrive. A client reading slower than the upstream answers
+ * holds the upstream back (see Response::onWritable, HttpClient::setPaused) rather than having the response
+ * pile up in memory.
+ */
+namespace Mongoose
+{
+    class HttpClient;
+    class ProxyController: public Controller
+    {
+        public:
+            /**
+             * @param client - the client upstream requests go through, usually running on the same server
+             */
+            ProxyController(HttpClient *client, Server *server = nullptr);
+            virtual ~ProxyController();
+
+            /**
+             * @brief addUpstream - forwards every request whose url starts with prefix to upstream
+             * @param prefix - like "/api/", the longest matching prefix wins
+             * @param upstream - "host:port"
+             * @param stripPrefix - true to remove prefix from the url before forwarding it
+             */
+            void addUpstream(const std::string& prefix, const std::string& upstream, bool stripPrefix = false);
+            void removeUpstream(const std::string& prefix);
+
+            bool handles(const std::string& method, const std::string& url) const override;
+            bool process(const std::shared_ptr<Request>& request, const std::shared_ptr<Response>& response) override;
+
+            /**
+             * @brief isHopByHopHeader
+             * @return true for the headers that only apply to a single connection, which aren't forwarded
+             */
+            static bool isHopByHopHeader(const std::string& name);
+
+        protected:
+            struct Route
+            {
+                std::string upstream;
+                bool stripPrefix;
+            };
+
+            /**
+             * @brief route
+             * @param path - if not null, set to the path to forward url to
+             * @return the route with the longest prefix of url, nullptr if there is none
+             */
+            const Route* route(const std::string& url, std::string *path = nullptr) const;
+
+            HttpClient *mClient;
+            std::map<std::string, Route> mUpstreams;
+    };
+}
+
+#endif
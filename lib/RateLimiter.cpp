@@ -0,0 +1,183 @@
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <sstream>
+#include <mongoose.h>
+
+#include "RateLimiter.h"
+
+static const size_t SHARD_COUNT = 64;
+static const size_t WAYS = 8;
+static const int64_t MICRO_TOKENS = 1000000;
+
+static inline uint64_t mix(uint64_t hash, uint64_t value)
+{
+    //splitmix64 finalizer
+    hash ^= value + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+    return hash ^ (hash >> 31);
+}
+
+static inline uint64_t hashBytes(uint64_t hash, const char *data, size_t length)
+{
+    uint64_t word;
+
+    while (length >= sizeof(word))
+    {
+        memcpy(&word, data, sizeof(word));
+        hash = mix(hash, word);
+        data += sizeof(word);
+        length -= sizeof(word);
+    }
+
+    word = 0;
+    memcpy(&word, data, length);
+    return mix(hash, word ^ length);
+}
+
+static inline int64_t now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+namespace Mongoose
+{
+    RateLimiter::RateLimiter(double requestsPerSecond, double burst, KeyMode mode, size_t capacity, Controller *controller, Server *server):
+        AbstractRequestCoprocessor(controller, server),
+        mRequestsPerSecond(requestsPerSecond > 0 ? requestsPerSecond : 1),
+        mBurst(burst >= 1 ? burst : 1),
+        mKeyMode(mode),
+        mRejectedRequests(0)
+    {
+        mMaxTokens = (int64_t)(mBurst * MICRO_TOKENS);
+        mNanosecondsPerToken = (int64_t)(1e9 / mRequestsPerSecond);
+        if (mNanosecondsPerToken < 1)
+        {
+            mNanosecondsPerToken = 1;
+        }
+
+        mSetsPerShard = capacity / (SHARD_COUNT * WAYS);
+        if (mSetsPerShard == 0)
+        {
+            mSetsPerShard = 1;
+        }
+
+        size_t bucketsPerShard = mSetsPerShard * WAYS;
+        mBuckets.reset(new Bucket[SHARD_COUNT * bucketsPerShard]());
+        mShards.reset(new Shard[SHARD_COUNT]);
+
+        for (size_t i = 0; i < SHARD_COUNT; i++)
+        {
+            mShards[i].buckets = mBuckets.get() + i * bucketsPerShard;
+        }
+
+        //The rejection never changes, so build it once
+        std::ostringstream rejection;
+        rejection << "HTTP/1.0 429 Too Many Requests\r\n"
+                  << "Retry-After: " << (int)std::ceil(1.0 / mRequestsPerSecond) << "\r\n"
+                  << "Content-Length: 0\r\n\r\n";
+        mRejection = rejection.str();
+    }
+
+    RateLimiter::~RateLimiter()
+    {
+    }
+
+    RateLimiter::Bucket* RateLimiter::find(Shard &shard, uint64_t key, int64_t now)
+    {
+        Bucket *set = shard.buckets + ((key / SHARD_COUNT) % mSetsPerShard) * WAYS;
+        Bucket *victim = set;
+
+        for (size_t i = 0; i < WAYS; i++)
+        {
+            if (set[i].key == key)
+            {
+                return &set[i];
+            }
+
+            //Empty slots have lastRefill == 0, so they are always picked before live ones
+            if (set[i].lastRefill < victim->lastRefill)
+            {
+                victim = &set[i];
+            }
+        }
+
+        victim->key = key;
+        victim->tokens = mMaxTokens;
+        victim->lastRefill = now;
+        return victim;
+    }
+
+    bool RateLimiter::allow(uint64_t key)
+    {
+        key = key ? key : 1;
+        int64_t timestamp = now();
+        Shard& shard = mShards[key % SHARD_COUNT];
+
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        Bucket *bucket = find(shard, key, timestamp);
+
+        int64_t elapsed = timestamp - bucket->lastRefill;
+        int64_t refillTime = (mMaxTokens / MICRO_TOKENS + 1) * mNanosecondsPerToken;
+        if (elapsed > refillTime)
+        {
+            elapsed = refillTime;
+        }
+
+        //Whole tokens first: elapsed * MICRO_TOKENS alone overflows at low rates or with large bursts
+        bucket->tokens += (elapsed / mNanosecondsPerToken) * MICRO_TOKENS
+                          + (int64_t)((double)(elapsed % mNanosecondsPerToken) * MICRO_TOKENS / mNanosecondsPerToken);
+        if (bucket->tokens > mMaxTokens)
+        {
+            bucket->tokens = mMaxTokens;
+        }
+        bucket->lastRefill = timestamp;
+
+        if (bucket->tokens < MICRO_TOKENS)
+        {
+            return false;
+        }
+
+        bucket->tokens -= MICRO_TOKENS;
+        return true;
+    }
+
+    bool RateLimiter::preRequest(struct mg_connection *connection, struct http_message *message)
+    {
+#ifdef AF_UNIX
+        if (connection->sa.sa.sa_family == AF_UNIX)
+        {
+            //Every unix socket client would share one bucket
+            return true;
+        }
+#endif
+
+        uint64_t key = connection->sa.sa.sa_family;
+
+        if (connection->sa.sa.sa_family == AF_INET6)
+        {
+            key = hashBytes(key, (const char*)&connection->sa.sin6.sin6_addr, sizeof(connection->sa.sin6.sin6_addr));
+        }
+        else
+        {
+            key = mix(key, connection->sa.sin.sin_addr.s_addr);
+        }
+
+        if (mKeyMode == PerClientAndRoute)
+        {
+            key = hashBytes(key, message->method.p, message->method.len);
+            key = hashBytes(key, message->uri.p, message->uri.len);
+        }
+
+        if (allow(key))
+        {
+            return true;
+        }
+
+        mRejectedRequests++;
+        mg_send(connection, mRejection.data(), (int)mRejection.size());
+        connection->flags |= MG_F_SEND_AND_CLOSE;
+        return false;
+    }
+}
@@ -0,0 +1,97 @@
+#ifndef _MONGOOSE_RATE_LIMITER_H
+#define _MONGOOSE_RATE_LIMITER_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "AbstractRequestCoprocessor.h"
+
+/**
+ * A token bucket rate limiter, keyed on the client address (and optionally the route).
+ * Clients connected through unix sockets aren't limited: they have no address to tell them apart,
+ * and are usually a local reverse proxy relaying everybody.
+ */
+namespace Mongoose
+{
+    class RateLimiter: public AbstractRequestCoprocessor
+    {
+        public:
+            enum KeyMode
+            {
+                PerClient,          //One bucket per client ip address
+                PerClientAndRoute   //One bucket per client ip address + http method + url
+            };
+
+            /**
+             * @brief Constructs the RateLimiter. Register it with Server::registerCoprocessor so that
+             * it runs on the raw connection, before any Request/Response is allocated.
+             * @param requestsPerSecond - the sustained rate each bucket is refilled at
+             * @param burst - the maximum number of tokens a bucket can hold
+             * @param mode - what a bucket is keyed on
+             * @param capacity - the number of buckets tracked. Memory is allocated once, up front.
+             * When the table is full, the least recently seen bucket of a set is evicted.
+             */
+            RateLimiter(double requestsPerSecond = 10,
+                        double burst = 20,
+                        KeyMode mode = PerClient,
+                        size_t capacity = 65536,
+                        Controller *controller = nullptr,
+                        Server *server = nullptr);
+            virtual ~RateLimiter();
+
+            bool preRequest(struct mg_connection *connection, struct http_message *message) override;
+
+            /**
+             * @brief allow - takes a token from the bucket of key
+             * @param key - a hash of whatever the caller wants to rate limit on
+             * @return true if a token was available
+             */
+            bool allow(uint64_t key);
+
+            /**
+             * @brief rejectedRequests
+             * @return the number of requests rejected so far
+             */
+            uint64_t rejectedRequests() const { return mRejectedRequests; }
+
+            double requestsPerSecond() const { return mRequestsPerSecond; }
+            double burst() const { return mBurst; }
+            KeyMode keyMode() const { return mKeyMode; }
+
+        private:
+            struct Bucket
+            {
+                uint64_t key;
+                int64_t tokens;         //In micro tokens
+                int64_t lastRefill;     //In nanoseconds
+            };
+
+            struct Shard
+            {
+                std::mutex mutex;
+                Bucket *buckets;
+                char padding[64];       //Keeps two shard mutexes off the same cache line
+            };
+
+            Bucket* find(Shard& shard, uint64_t key, int64_t now);
+
+            double mRequestsPerSecond;
+            double mBurst;
+            KeyMode mKeyMode;
+
+            int64_t mMaxTokens;
+            int64_t mNanosecondsPerToken;
+            size_t mSetsPerShard;
+
+            std::unique_ptr<Shard[]> mShards;
+            std::unique_ptr<Bucket[]> mBuckets;
+
+            std::string mRejection;
+            std::atomic<uint64_t> mRejectedRequests;
+    };
+}
+
+#endif
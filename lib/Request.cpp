@@ -6,9 +6,13 @@
 #include <mongoose.h>
 #include <yuarel.h>
 
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 #include "Request.h"
 
-static const int MAX_QUERY_STRING_LENGTH = 32768;
 static const int MAX_QUERY_STRING_ITEMS = 200;
 
 static int lowercase(const char *s) {
@@ -96,84 +100,170 @@ static int mg_get_cookie(const char *cookie_header, const char *var_name,
   return len;
 }
 
+//Files created with O_TMPFILE have no name, they are reached through their descriptor
+static bool isAnonymousFile(const std::string& path)
+{
+    return path.compare(0, 14, "/proc/self/fd/") == 0;
+}
+
 namespace Mongoose
 {
+    bool Request::MultipartEntity::linkTo(const std::string &path) const
+    {
+#ifdef WIN32
+        //No hard links to rely on, the file is moved instead
+        return rename(filePath.c_str(), path.c_str()) == 0;
+#else
+        if (isAnonymousFile(filePath))
+        {
+            return linkat(AT_FDCWD, filePath.c_str(), AT_FDCWD, path.c_str(), AT_SYMLINK_FOLLOW) == 0;
+        }
+
+        return link(filePath.c_str(), path.c_str()) == 0;
+#endif
+    }
+
     Request::Request(struct mg_connection *connection, http_message *message, bool isMultipart):
+        mArena(mInlineBuffer, sizeof(mInlineBuffer)),
         mIsValid(true),
         mIsMultipartRequest(isMultipart),
+#ifdef ENABLE_REGEX_URL
+        mMatchCount(0),
+#endif
+        mHeaders(ArenaAllocator<Field>(mArena)),
+        mVariables(ArenaAllocator<Field>(mArena)),
         mConnection(connection)
     {
-        mMethod = std::string(message->method.p, message->method.len);
-        mUrl = std::string(message->uri.p, message->uri.len);
-        mQuerystring = std::string(message->query_string.p, message->query_string.len);
+        //Everything the request keeps is copied into the arena: mongoose reuses its buffer once we return
+        mMethod = copy(message->method.p, message->method.len);
+        mUrl = copy(message->uri.p, message->uri.len);
+        mQuerystring = copy(message->query_string.p, message->query_string.len);
+        mBody.data = "";
+        mBody.size = 0;
+
+        int headerCount = 0;
+        while (headerCount < MG_MAX_HTTP_HEADERS && message->header_names[headerCount].len != 0)
+        {
+            headerCount++;
+        }
 
-        for(int i = 0; i < MG_MAX_HTTP_HEADERS && message->header_names[i].len != 0; i++)
+        mHeaders.reserve(headerCount);
+        for (int i = 0; i < headerCount; i++)
         {
-            mHeaders[message->header_names[i].p] = message->header_values[i].p;
+            mHeaders.push_back(Field(copy(message->header_names[i].p, message->header_names[i].len),
+                                     copy(message->header_values[i].p, message->header_values[i].len)));
         }
 
         if(!mIsMultipartRequest)
         {
-            mBody = std::string(message->body.p, message->body.len);
-            std::string data;
+            mBody = copy(message->body.p, message->body.len);
 
             if (mMethod == "GET")
             {
-                data = mQuerystring;
+                parseVariables(mQuerystring);
             }
             else if (mMethod == "POST")
             {
-                data = mBody;
+                parseVariables(mBody);
             }
             else
             {
                 //Nothing to do.
             }
+        }
+    }
+
+    Request::Slice Request::copy(const char *data, size_t size)
+    {
+        Slice slice;
+        slice.data = mArena.copy(data, size);
+        slice.size = size;
+        return slice;
+    }
+
+    void Request::parseVariables(const Slice &data)
+    {
+        if (data.size == 0)
+        {
+            return;
+        }
+
+        //yuarel splits the string in place, so it gets a copy of its own
+        char *querystring = mArena.copy(data.data, data.size);
 
-            char querystring[MAX_QUERY_STRING_LENGTH] = {0};
-            strncpy(querystring, data.c_str(), MAX_QUERY_STRING_LENGTH);
+        //TODO: Replace yuarel with https://github.com/bartgrantham/qs_parse
+        struct yuarel_param params[MAX_QUERY_STRING_ITEMS];
+        int count = yuarel_parse_query(querystring, '&', params, MAX_QUERY_STRING_ITEMS);
 
-            //TODO: Replace yuarel with https://github.com/bartgrantham/qs_parse
-            struct yuarel_param params[MAX_QUERY_STRING_ITEMS];
-            int count = yuarel_parse_query(querystring, '&', params, MAX_QUERY_STRING_ITEMS);
-            for(int i = 0; i < count; i++)
+        mVariables.reserve(mVariables.size() + (count > 0 ? count : 0));
+        for(int i = 0; i < count; i++)
+        {
+            Slice key = { params[i].key, strlen(params[i].key) };
+            Slice value = { "", 0 };
+
+            if (params[i].val != NULL)
             {
-                struct yuarel_param p = params[i];
-                int keyLen = strnlen(p.key, data.size());
-                int valLen = strnlen(p.val, data.size() - keyLen);
-                std::string key = std::string(p.key, keyLen);
-                std::string value = std::string(p.val, valLen);
-                mVariables[key] = value;
+                value.data = params[i].val;
+                value.size = strlen(params[i].val);
             }
-        }
 
-        //FIXME: Parse cookies, and improve Cookie handling code with another actual Cookie class
+            mVariables.push_back(Field(key, value));
+        }
     }
 
     Request::~Request()
     {
         for (const auto& entity : mMultipartEntities)
         {
-            //Remove all the temporary files created for this request
-            if (entity.filePath.size() > 0)
+            //Remove all the temporary files created for this request, anonymous ones go away on close
+            if (entity.filePath.size() > 0 && !isAnonymousFile(entity.filePath))
             {
                 remove(entity.filePath.c_str());
             }
+
+            if (entity.fd >= 0)
+            {
+#ifdef WIN32
+                _close(entity.fd);
+#else
+                close(entity.fd);
+#endif
+            }
         }
     }
 
+    const Request::Field *Request::findVariable(const std::string &key) const
+    {
+        //The last occurrence wins, like it would when filling a map
+        for (auto variable = mVariables.rbegin(); variable != mVariables.rend(); ++variable)
+        {
+            if (variable->first == key)
+            {
+                return &*variable;
+            }
+        }
+
+        return NULL;
+    }
+
     bool Request::hasVariable(const std::string &key) const
     {
-        return mVariables.find(key) != mVariables.end();
+        return findVariable(key) != NULL;
     }
 
     std::string Request::getVariable(const std::string &key, const std::string &fallback) const
     {
-        std::string result = fallback;
+        const Field *variable = findVariable(key);
+        return variable ? variable->second.str() : fallback;
+    }
 
-        if (hasVariable(key))
+    std::map<std::string, std::string> Request::variables() const
+    {
+        std::map<std::string, std::string> result;
+
+        for (const auto& variable : mVariables)
         {
-            result = mVariables.at(key);
+            result[variable.first.str()] = variable.second.str();
         }
 
         return result;
@@ -181,73 +271,79 @@ namespace Mongoose
 
 
 #ifdef ENABLE_REGEX_URL
-    smatch Request::getMatches()
+    std::string Request::getMatch(size_t index) const
+    {
+        if (index >= mMatchCount)
+        {
+            return std::string();
+        }
+
+        size_t offset = mMatches[index][0];
+        size_t length = mMatches[index][1];
+        size_t urlOffset = mMethod.size + 1;
+
+        if (offset >= urlOffset)
+        {
+            return mUrl.str().substr(offset - urlOffset, length);
+        }
+
+        return (mMethod.str() + ":" + mUrl.str()).substr(offset, length);
+    }
+
+    size_t Request::matchCount() const
+    {
+        return mMatchCount;
+    }
+
+    void Request::setMatchCount(size_t count)
     {
-        return matches;
+        mMatchCount = count < MAX_URL_MATCHES ? count : MAX_URL_MATCHES;
     }
 
-    bool Request::match(string pattern)
+    void Request::setMatch(size_t index, size_t offset, size_t length)
     {
-        key = method + ":" + url;
-        return regex_match(key, matches, regex(pattern));
+        if (index < MAX_URL_MATCHES)
+        {
+            mMatches[index][0] = offset;
+            mMatches[index][1] = length;
+        }
     }
 #endif
 
 
     bool Request::hasCookie(const std::string &key) const
     {
-        int i;
         char dummy[10];
+        const Field *cookies = findHeader("Cookie");
 
-        for (auto header: mHeaders)
-        {
-            if (header.first.find("Cookie") != std::string::npos)
-            {
-                if (mg_get_cookie(header.second.c_str(), key.c_str(), dummy, sizeof(dummy)) != -1)
-                {
-                    return true;
-                }
-            }
-        }
-
-        return false;
+        return cookies != NULL && mg_get_cookie(cookies->second.data, key.c_str(), dummy, sizeof(dummy)) != -1;
     }
 
     std::string Request::getCookie(const std::string &key, const std::string &fallback) const
     {
         std::string output;
-        int i;
         int size = 1024;
         int ret;
-        char *buffer = new char[size];
+        char *buffer;
         char dummy[10];
-        const char *place = NULL;
+        const Field *cookies = findHeader("Cookie");
 
-        for (auto header: mHeaders)
-        {
-            if (header.first.find("Cookie") != std::string::npos)
-            {
-                if (mg_get_cookie(header.second.c_str(), key.c_str(), dummy, sizeof(dummy)) != -1)
-                {
-                    place = header.second.c_str();
-                    break;
-                }
-            }
-        }
-
-        if (place == NULL) {
+        if (cookies == NULL || mg_get_cookie(cookies->second.data, key.c_str(), dummy, sizeof(dummy)) == -1) {
             return fallback;
         }
 
+        const char *place = cookies->second.data;
+        buffer = new char[size];
+
         do {
             ret = mg_get_cookie(place, key.c_str(), buffer, size);
 
-            if (ret == -2) {
+            if (ret == -3) {
                 size *= 2;
                 delete[] buffer;
                 buffer = new char[size];
             }
-        } while (ret == -2);
+        } while (ret == -3);
 
         output = std::string(buffer);
         delete[] buffer;
@@ -255,41 +351,90 @@ namespace Mongoose
         return output;
     }
 
+    const Request::Field *Request::findHeader(const std::string &key) const
+    {
+        for (const auto& header : mHeaders)
+        {
+            if (header.first.size == key.size() && mg_strncasecmp(header.first.data, key.c_str(), key.size()) == 0)
+            {
+                return &header;
+            }
+        }
+
+        return NULL;
+    }
+
     bool Request::hasHeader(const std::string &key) const
     {
-        return mHeaders.find(key) != mHeaders.end();
+        return findHeader(key) != NULL;
     }
 
     std::string Request::getHeaderValue(const std::string& key) const
     {
-      std::string result;
-
-      if (hasHeader(key))
-      {
-          result = mHeaders.at(key);
-      }
-
-      return result;
+        const Field *header = findHeader(key);
+        return header ? header->second.str() : std::string();
     }
 
     std::map<std::string, std::string> Request::headers() const
     {
-        return mHeaders;
+        std::map<std::string, std::string> result;
+
+        for (const auto& header : mHeaders)
+        {
+            result[header.first.str()] = header.second.str();
+        }
+
+        return result;
     }
 
     std::string Request::url() const
     {
-        return mUrl;
+        return mUrl.str();
+    }
+
+    std::string Request::queryString() const
+    {
+        return mQuerystring.str();
     }
 
     std::string Request::method() const
     {
-        return mMethod;
+        return mMethod.str();
     }
 
     std::string Request::body() const
     {
-        return mBody;
+        return mBody.str();
+    }
+
+    JsonView Request::json() const
+    {
+        std::call_once(mJsonParsed, [this]
+        {
+            mJson.reset(new JsonDocument(mBody.data, mBody.size));
+        });
+
+        return mJson->root();
+    }
+
+    std::string Request::username() const
+    {
+        return mUsername;
+    }
+
+    void Request::setUsername(const std::string &username)
+    {
+        mUsername = username;
+    }
+
+    Request::PeerCredentials Request::peerCredentials() const
+    {
+        return mPeerCredentials;
+    }
+
+    void Request::setPeerCredentials(const PeerCredentials &credentials)
+    {
+        mPeerCredentials = credentials;
     }
 
     bool Request::isValid() const
@@ -319,10 +464,25 @@ namespace Mongoose
         //For easier access
         for (const auto& entity : entities)
         {
-            mVariables[entity.variableName] = entity.filePath.size() > 0
-                                              ? entity.filePath
-                                              : entity.variableData;
+            const std::string& value = entity.filePath.size() > 0 ? entity.filePath : entity.variableData;
+            mVariables.push_back(Field(copy(entity.variableName.data(), entity.variableName.size()),
+                                       copy(value.data(), value.size())));
+        }
+    }
+
+    void Request::setBody(const std::string &body)
+    {
+        mBody = copy(body.data(), body.size());
+
+        if (mMethod == "POST")
+        {
+            parseVariables(mBody);
         }
     }
 
+    Arena &Request::arena()
+    {
+        return mArena;
+    }
+
 }
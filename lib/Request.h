@@ -3,11 +3,13 @@
 
 #include <atomic>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
-#ifdef ENABLE_REGEX_URL
-#include <regex>
-#endif
+
+#include "Arena.h"
+#include "JsonView.h"
 
 struct mg_connection;
 struct http_message;
@@ -26,8 +28,28 @@ public:
     {
         std::string variableName;
         std::string variableData;
-        std::string fileName;
-        std::string filePath;
+        std::string fileName;       //The name the client gave the file
+        std::string filePath;       //Where the uploaded file can be read, for as long as the request lives
+        int fd{-1};                 //The uploaded file, open for reading and writing until the request goes away
+
+        /**
+         * @brief linkTo - keeps the uploaded file, by giving it a name, without copying it.
+         * Otherwise the file is deleted along with the request.
+         * @param path - the new name, on the same filesystem as Server::tmpDir()
+         * @return false on failure, see errno
+         */
+        bool linkTo(const std::string& path) const;
+    };
+
+    /**
+     * The credentials of the process on the other end of a unix domain socket connection
+     */
+    struct PeerCredentials
+    {
+        bool isValid{false};
+        int pid{0};
+        unsigned int uid{0};
+        unsigned int gid{0};
     };
 
     Request(struct mg_connection *connection, struct http_message* message, bool isMultipart = false);
@@ -35,46 +57,128 @@ public:
 
     bool hasVariable(const std::string& key) const;
     std::string getVariable(const std::string& key, const std::string& fallback = "") const;
-    std::map<std::string, std::string> variables() const { return mVariables; }
+    std::map<std::string, std::string> variables() const;
 
     bool hasCookie(const std::string& key) const;
     std::string getCookie(const std::string& key, const std::string& fallback = "") const;
     std::map<std::string, std::string> cookies() const;
 
+    /**
+     * Header names are matched case insensitively
+     */
     bool hasHeader(const std::string& key) const;
     std::string getHeaderValue(const std::string& key) const;
     std::map<std::string, std::string> headers() const;
 
     std::string url() const;
+
+    /**
+     * @brief queryString
+     * @return what follows the '?' of the url, as it was sent
+     */
+    std::string queryString() const;
     std::string method() const;
     std::string body() const;
 
+    /**
+     * @brief json - the body, parsed as JSON in place the first time it is asked for.
+     * Only the values that are actually read get decoded. The views point into the request,
+     * they must not outlive it.
+     * @return the top level value, an invalid view if the body isn't valid JSON
+     */
+    JsonView json() const;
+
+    /**
+     * @brief username
+     * @return the user that authenticated this request through http basic authentication, if any
+     */
+    std::string username() const;
+    void setUsername(const std::string& username);
+
+    /**
+     * @brief peerCredentials
+     * @return the pid/uid/gid of the client, when it connected through a unix domain socket (Linux only)
+     */
+    PeerCredentials peerCredentials() const;
+    void setPeerCredentials(const PeerCredentials& credentials);
+
 #ifdef ENABLE_REGEX_URL
-    smatch getMatches();
-    bool match(string pattern);
+    /**
+     * @brief getMatch - a group captured by the regex of the route this request was dispatched to.
+     * Group 0 is the whole "METHOD:url" routes are matched against, captures start at 1.
+     * Only the offsets are kept until a group is asked for.
+     */
+    std::string getMatch(size_t index) const;
+    size_t matchCount() const;
+    void setMatchCount(size_t count);
+    void setMatch(size_t index, size_t offset, size_t length);
+
+    static const size_t MAX_URL_MATCHES = 16;
 #endif
     bool isValid() const;
     void setIsValid(bool value);
 
+    /**
+     * @brief arena - scratch memory for the handler, released in one go along with the request.
+     * The request's own strings live there too. Not thread safe: only use it from the thread handling the request.
+     */
+    Arena& arena();
+
     bool isMultipartRequest() const;
     std::vector<MultipartEntity> multipartEntities() const;
     void setMultipartEntities(const std::vector<MultipartEntity>& entities);
 
+    /**
+     * @brief setBody - replaces the body the request was created with, eg. once a compressed one is decoded.
+     * The variables of a POST request are parsed from it.
+     */
+    void setBody(const std::string& body);
+
 private:
 
+    //A piece of text owned by mArena, always nul terminated
+    struct Slice
+    {
+        const char *data;
+        size_t size;
+
+        std::string str() const { return std::string(data, size); }
+        bool operator==(const std::string& other) const { return other.size() == size && other.compare(0, size, data, size) == 0; }
+    };
+
+    typedef std::pair<Slice, Slice> Field;
+    typedef std::vector<Field, ArenaAllocator<Field>> Fields;
+
+    Slice copy(const char *data, size_t size);
+    const Field *findHeader(const std::string& key) const;
+    const Field *findVariable(const std::string& key) const;
+    void parseVariables(const Slice& data);
+
+    //Requests are allocated in one piece, so whatever fits here costs no allocation at all
+    char mInlineBuffer[2048];
+    Arena mArena;
+
     std::atomic_bool mIsValid;
     bool mIsMultipartRequest;
-    std::string mMethod;
-    std::string mUrl;
-    std::string mQuerystring;
-    std::string mBody;
+    Slice mMethod;
+    Slice mUrl;
+    Slice mQuerystring;
+    Slice mBody;
+    mutable std::once_flag mJsonParsed;
+    mutable std::unique_ptr<JsonDocument> mJson;
+    std::string mUsername;
+    PeerCredentials mPeerCredentials;
+
+#ifdef ENABLE_REGEX_URL
+    size_t mMatchCount;
+    size_t mMatches[MAX_URL_MATCHES][2];
+#endif
 
-    std::map<std::string, std::string> mHeaders;
-    std::map<std::string, std::string> mCookies;
+    Fields mHeaders;
 
     //For multipart form uploads
     std::vector<MultipartEntity> mMultipartEntities;
-    std::map<std::string, std::string> mVariables;
+    Fields mVariables;
     struct mg_connection *mConnection;
 };
 }
@@ -1,16 +1,36 @@
+#include <cstdio>
 #include <fstream>
+#include <iterator>
 #include <sstream>
 #include <mongoose.h>
 
+#ifdef __linux__
+#include "EpollInterface.h"
+#endif
+#include "FrameQueue.h"
+#ifdef HAS_NGHTTP2
+#include "Http2Session.h"
+#endif
 #include "Response.h"
+#include "Server.h"
+#include "Utils.h"
 
 
 namespace Mongoose
 {
-    Response::Response(mg_connection *connection):
+    Response::Response(mg_connection *connection, Server *server):
         mCode(HTTP_OK),
         mConnection(connection),
-        mIsValid(true)
+        mServer(server),
+        mIsValid(true),
+        mHeadersSent(false),
+        mAutomaticETag(false),
+        mBufferedBytes(0),
+        mLowWatermark(64*1024),
+        mHighWatermark(1024*1024)
+#ifdef HAS_NGHTTP2
+        , mHttp2Stream(0)
+#endif
     {
     }
             
@@ -77,6 +97,28 @@ namespace Mongoose
         if (!mIsValid)
             return false;
 
+        //A streamed response has its headers out already, the body is just the last bit of it
+        if (mHeadersSent)
+        {
+            return write(mBody) && end();
+        }
+
+        if (mCode == HTTP_OK)
+        {
+            if (mAutomaticETag && mHeaders.find("ETag") == mHeaders.end())
+            {
+                char etag[24];
+                snprintf(etag, sizeof(etag), "\"%016llx\"", (unsigned long long) Utils::hash64(mBody.data(), mBody.size()));
+                mHeaders["ETag"] = etag;
+            }
+
+            auto etag = mHeaders.find("ETag");
+            if (!mIfNoneMatch.empty() && etag != mHeaders.end() && matchesETag(mIfNoneMatch, etag->second))
+            {
+                return sendNotModified();
+            }
+        }
+
         if (mHeaders.find("Content-Type") == mHeaders.end())
         {
             mHeaders["Content-Type"] = "text/plain";
@@ -89,15 +131,33 @@ namespace Mongoose
             setHeader("Content-Length", length.str());
         }
 
+#ifdef HAS_NGHTTP2
+        if (mHttp2Stream != 0)
+        {
+            //The stream ends with the body, the connection stays open for the others
+            auto session = mHttp2Session.lock();
+            mIsValid = false;
+
+            return session && session->submitHeaders(mHttp2Stream, mCode, mHeaders, mBody.empty())
+                   && (mBody.empty() || session->submitData(mHttp2Stream, mBody.data(), mBody.size(), true));
+        }
+#endif
+
         std::string headers = headerString();
 
-        if(mIsValid)
+        bool isValid = mIsValid;
+        if(isValid)
         {
-            mg_printf(mConnection, "%s", headers.c_str());
-            mg_printf(mConnection, "%s", mBody.c_str());
+            mg_send(mConnection, headers.data(), (int)headers.size());
+            mg_send(mConnection, mBody.data(), (int)mBody.size());
         }
         mConnection->flags |= MG_F_SEND_AND_CLOSE;
         mIsValid = false;
+
+        if (isValid)
+        {
+            flushConnection();
+        }
         return true;
     }
 
@@ -140,6 +200,17 @@ namespace Mongoose
         if (!in.good() || !mIsValid)
             return false;
 
+#ifdef HAS_NGHTTP2
+        if (mHttp2Stream != 0)
+        {
+            //Framed like any other body
+            in.seekg(0);
+            mBody.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+            mHeaders["Content-Type"] = type;
+            return send();
+        }
+#endif
+
         //TODO: make type optional
         char buf[2048];
         size_t n;
@@ -161,6 +232,7 @@ namespace Mongoose
         fclose(fp);
         mConnection->flags |= MG_F_SEND_AND_CLOSE;
         mIsValid = false;
+        flushConnection();
         return true;
     }
 
@@ -180,11 +252,22 @@ namespace Mongoose
     {
         bool result = false;
 
+#ifdef HAS_NGHTTP2
+        if (mIsValid && mHttp2Stream != 0)
+        {
+            setCode(permanent? 301 : 302);
+            mHeaders["Location"] = url;
+            mBody.clear();
+            return send();
+        }
+#endif
+
         if (mIsValid)
         {
             mg_http_send_redirect(mConnection, (permanent? 301 : 302),  mg_mk_str(url.c_str()), mg_mk_str(NULL));
             mConnection->flags |= MG_F_SEND_AND_CLOSE;
             mIsValid = false;
+            flushConnection();
             result = true;
         }
 
@@ -205,6 +288,303 @@ namespace Mongoose
     }
 #endif
 
+    bool Response::hasAutomaticETag() const
+    {
+        return mAutomaticETag;
+    }
+
+    void Response::setAutomaticETag(bool enabled)
+    {
+        mAutomaticETag = enabled;
+    }
+
+    std::string Response::ifNoneMatch() const
+    {
+        return mIfNoneMatch;
+    }
+
+    void Response::setIfNoneMatch(const std::string &value)
+    {
+        mIfNoneMatch = value;
+    }
+
+    bool Response::notModified(const std::string &etag)
+    {
+        if (!mIsValid || mHeadersSent)
+            return false;
+
+        bool isQuoted = !etag.empty() && (etag[0] == '"' || etag.compare(0, 2, "W/") == 0);
+        mHeaders["ETag"] = isQuoted ? etag : "\"" + etag + "\"";
+
+        if (mIfNoneMatch.empty() || !matchesETag(mIfNoneMatch, mHeaders["ETag"]))
+        {
+            return false;
+        }
+
+        return sendNotModified();
+    }
+
+    bool Response::matchesETag(const std::string &ifNoneMatch, const std::string &etag)
+    {
+        //Weak comparison: W/"x" and "x" match
+        size_t start = etag.compare(0, 2, "W/") == 0 ? 2 : 0;
+        std::string opaque = etag.substr(start);
+        size_t position = 0;
+
+        while (position < ifNoneMatch.size())
+        {
+            char c = ifNoneMatch[position];
+
+            if (c == ' ' || c == '\t' || c == ',')
+            {
+                position++;
+            }
+            else if (c == '*')
+            {
+                return true;
+            }
+            else
+            {
+                if (ifNoneMatch.compare(position, 2, "W/") == 0)
+                {
+                    position += 2;
+                }
+
+                size_t tagEnd = position;
+                if (tagEnd < ifNoneMatch.size() && ifNoneMatch[tagEnd] == '"')
+                {
+                    //Commas may appear inside the quotes
+                    tagEnd = ifNoneMatch.find('"', tagEnd + 1);
+                    tagEnd = tagEnd == std::string::npos ? ifNoneMatch.size() : tagEnd + 1;
+                }
+                else
+                {
+                    tagEnd = ifNoneMatch.find(',', tagEnd);
+                    tagEnd = tagEnd == std::string::npos ? ifNoneMatch.size() : tagEnd;
+                }
+
+                if (ifNoneMatch.compare(position, tagEnd - position, opaque) == 0)
+                {
+                    return true;
+                }
+
+                position = tagEnd;
+            }
+        }
+
+        return false;
+    }
+
+    bool Response::sendNotModified()
+    {
+        //No body, and only the headers that would describe the same (cached) representation
+        static const char *kept[] = { "Cache-Control", "Content-Location", "Date", "ETag", "Expires", "Vary" };
+
+#ifdef HAS_NGHTTP2
+        if (mHttp2Stream != 0)
+        {
+            std::map<std::string, std::string> headers;
+            for (const char *name: kept)
+            {
+                auto header = mHeaders.find(name);
+
+                if (header != mHeaders.end())
+                {
+                    headers.insert(*header);
+                }
+            }
+
+            auto session = mHttp2Session.lock();
+            mCode = HTTP_NOT_MODIFIED;
+            mIsValid = false;
+            return session && session->submitHeaders(mHttp2Stream, HTTP_NOT_MODIFIED, headers, true);
+        }
+#endif
+
+        std::ostringstream data;
+        data << "HTTP/1.0 " << HTTP_NOT_MODIFIED << "\r\n";
+
+        for (const char *name: kept)
+        {
+            auto header = mHeaders.find(name);
+
+            if (header != mHeaders.end())
+            {
+                data << header->first << ": " << header->second << "\r\n";
+            }
+        }
+
+        data << "\r\n";
+
+        std::string headers = data.str();
+        mg_send(mConnection, headers.data(), (int)headers.size());
+        mConnection->flags |= MG_F_SEND_AND_CLOSE;
+        mCode = HTTP_NOT_MODIFIED;
+        mIsValid = false;
+        flushConnection();
+        return true;
+    }
+
+    bool Response::sendHeaders()
+    {
+        if (!mIsValid)
+            return false;
+
+        if (!mHeadersSent)
+        {
+            if (mHeaders.find("Content-Type") == mHeaders.end())
+            {
+                mHeaders["Content-Type"] = "text/plain";
+            }
+
+#ifdef HAS_NGHTTP2
+            if (mHttp2Stream != 0)
+            {
+                //No Content-Length needed, the end of the stream marks the end of the body
+                auto session = mHttp2Session.lock();
+                mHeadersSent = true;
+                return session && session->submitHeaders(mHttp2Stream, mCode, mHeaders, false);
+            }
+#endif
+
+            std::string headers = headerString();
+            mg_send(mConnection, headers.data(), (int)headers.size());
+            mHeadersSent = true;
+
+            if (mServer)
+            {
+                //Keeps bufferedBytes() in step with the socket as it drains
+                mServer->watchWritable(mConnection);
+            }
+
+            flushConnection();
+        }
+
+        return true;
+    }
+
+    bool Response::write(const char *data, size_t size)
+    {
+        if (!sendHeaders())
+            return false;
+
+#ifdef HAS_NGHTTP2
+        if (mHttp2Stream != 0)
+        {
+            auto session = mHttp2Session.lock();
+            bool result = session && session->submitData(mHttp2Stream, data, size, false);
+
+            //From another thread the stream can't be looked at, notifyWritable catches up as it drains
+            if (session && !session->isEventLoopThread())
+            {
+                mBufferedBytes += size;
+            }
+            else
+            {
+                mBufferedBytes = pendingBytes();
+            }
+            return result;
+        }
+#endif
+
+        if (size > 0)
+        {
+            mg_send(mConnection, data, (int)size);
+            mBufferedBytes += size;
+            flushConnection();
+        }
+
+        return true;
+    }
+
+    bool Response::write(const std::string &data)
+    {
+        return write(data.data(), data.size());
+    }
+
+    bool Response::end()
+    {
+        if (!sendHeaders())
+            return false;
+
+#ifdef HAS_NGHTTP2
+        if (mHttp2Stream != 0)
+        {
+            auto session = mHttp2Session.lock();
+            mIsValid = false;
+            return session && session->submitData(mHttp2Stream, nullptr, 0, true);
+        }
+#endif
+
+        mConnection->flags |= MG_F_SEND_AND_CLOSE;
+        mIsValid = false;
+        return true;
+    }
+
+    void Response::onWritable(const std::function<void()> &callback)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mStreamMutex);
+
+            if (!mIsValid)
+            {
+                return;
+            }
+
+            mWritableCallback = callback;
+        }
+
+        if (callback && mServer)
+        {
+            mServer->watchWritable(mConnection);
+        }
+    }
+
+    bool Response::isWritable() const
+    {
+        return mIsValid && mBufferedBytes < mHighWatermark;
+    }
+
+    size_t Response::bufferedBytes() const
+    {
+        return mBufferedBytes;
+    }
+
+    void Response::setSendBufferWatermarks(size_t low, size_t high)
+    {
+        mHighWatermark = high > 0 ? high : 1;
+        mLowWatermark = low < mHighWatermark ? low : mHighWatermark - 1;
+    }
+
+    size_t Response::lowWatermark() const
+    {
+        return mLowWatermark;
+    }
+
+    size_t Response::highWatermark() const
+    {
+        return mHighWatermark;
+    }
+
+    void Response::notifyWritable()
+    {
+        std::function<void()> callback;
+        {
+            std::lock_guard<std::mutex> lock(mStreamMutex);
+            mBufferedBytes = pendingBytes();
+
+            if (!mIsValid || !mWritableCallback || mBufferedBytes > mLowWatermark)
+            {
+                return;
+            }
+
+            //Called outside of the lock, the callback is free to write, end or unregister itself
+            callback = mWritableCallback;
+        }
+
+        callback();
+    }
+
     bool Response::isValid() const
     {
         return mIsValid;
@@ -212,7 +592,86 @@ namespace Mongoose
 
     void Response::setIsValid(bool value)
     {
+        std::function<void()> callback;
+        std::lock_guard<std::mutex> lock(mStreamMutex);
         mIsValid = value;
+
+        if (!value && mEventStream)
+        {
+            mEventStream->setIsValid(false);
+        }
+
+        if (!value)
+        {
+            //Let go of whatever the producer captured, it won't be called anymore
+            callback.swap(mWritableCallback);
+        }
+    }
+
+    bool Response::startEventStream()
+    {
+        std::lock_guard<std::mutex> lock(mStreamMutex);
+
+        if (!mIsValid || mServer == nullptr)
+        {
+            return false;
+        }
+
+#ifdef HAS_NGHTTP2
+        if (mHttp2Stream != 0)
+        {
+            //The FrameQueue writes to the connection itself, which is shared by the streams
+            return false;
+        }
+#endif
+
+        mHeaders["Content-Type"] = "text/event-stream";
+        mHeaders["Cache-Control"] = "no-cache";
+        mHeaders.erase("Content-Length");
+
+        //The headers go through the queue too, so they can't overtake or be overtaken by events
+        mEventStream = std::make_shared<FrameQueue>(mConnection, mServer);
+        mEventStream->push(std::make_shared<std::string>(headerString()));
+
+        //The connection now belongs to the stream, nothing else may be sent on it
+        mIsValid = false;
+        return true;
+    }
+
+    std::shared_ptr<FrameQueue> Response::eventStream() const
+    {
+        std::lock_guard<std::mutex> lock(mStreamMutex);
+        return mEventStream;
+    }
+
+#ifdef HAS_NGHTTP2
+    void Response::setHttp2Stream(const std::shared_ptr<Http2Session> &session, int32_t streamId)
+    {
+        mHttp2Session = session;
+        mHttp2Stream = streamId;
+    }
+#endif
+
+    size_t Response::pendingBytes() const
+    {
+#ifdef HAS_NGHTTP2
+        if (mHttp2Stream != 0)
+        {
+            //Only what this stream holds: the others don't slow it down
+            auto session = mHttp2Session.lock();
+            return session ? session->bufferedBytes(mHttp2Stream) : 0;
+        }
+#endif
+
+        return mConnection->send_mbuf.len;
+    }
+
+    void Response::flushConnection()
+    {
+#ifdef __linux__
+        //Responses are often written outside of their connection's own events (eg. from onWritable)
+        EpollInterface::refresh(mConnection);
+#endif
     }
 
     std::string Response::headerString() const
@@ -2,16 +2,21 @@
 #define _MONGOOSE_RESPONSE_H
 
 #include <atomic>
+#include <cstdint>
+#include <functional>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <string>
 
-struct mg_connection;;
+struct mg_connection;
 
 #ifdef HAS_JSON11
 #include <json11.hpp>
 #endif
 
 #define HTTP_OK 200
+#define HTTP_NOT_MODIFIED 304
 #define HTTP_NOT_FOUND 404
 #define HTTP_FORBIDDEN 403
 #define HTTP_SERVER_ERROR 500
@@ -21,10 +26,13 @@ struct mg_connection;;
  */
 namespace Mongoose
 {
+class FrameQueue;
+class Http2Session;
+class Server;
 class Response
 {
 public:
-    explicit Response(struct mg_connection *connection);
+    explicit Response(struct mg_connection *connection, Server *server = nullptr);
     ~Response();
 
     bool hasHeader(const std::string& key) const;
@@ -56,18 +64,147 @@ public:
     bool sendJson(const json11::Json &body);
 #endif
 
+    /**
+     * @brief hasAutomaticETag / setAutomaticETag - send() tags a 200 response with a strong ETag (a hash of
+     * its body) unless it has one already. See Server::setAutomaticETags to turn it on for every response.
+     */
+    bool hasAutomaticETag() const;
+    void setAutomaticETag(bool enabled);
+
+    /**
+     * @brief ifNoneMatch / setIfNoneMatch - the entity tags of the copies the client has (its If-None-Match header),
+     * set by the Server for GET and HEAD requests. send() answers a 200 response whose ETag is one of them with
+     * 304 Not Modified instead of the body.
+     */
+    std::string ifNoneMatch() const;
+    void setIfNoneMatch(const std::string& value);
+
+    /**
+     * @brief notModified - for handlers that know the version of what they answer before generating it:
+     * sets the ETag and, if the client has that version already, answers 304 Not Modified right away.
+     * @param etag - a version or entity tag, like v42, "v42" or W/"v42"
+     * @return true if the 304 was sent, the body needs not be generated
+     */
+    bool notModified(const std::string& etag);
+
+    /**
+     * @brief matchesETag - the weak comparison of If-None-Match
+     * @param ifNoneMatch - "*" or a list of entity tags
+     * @return true if etag is in the list
+     */
+    static bool matchesETag(const std::string& ifNoneMatch, const std::string& etag);
+
+    /**
+     * @brief sendHeaders - starts a streamed response: the status line and headers are sent right away
+     * and the body is then written with write() and finished with end().
+     * Without a Content-Length header, the end of the body is marked by closing the connection.
+     * @return false if the response was already sent
+     */
+    bool sendHeaders();
+
+    /**
+     * @brief write - appends data to a streamed response, sending the headers first if needed
+     * @return false if the response was already finished or the connection closed
+     */
+    bool write(const char *data, size_t size);
+    bool write(const std::string& data);
+
+    /**
+     * @brief end - finishes a streamed response and closes the connection once everything is sent
+     */
+    bool end();
+
+    /**
+     * @brief startEventStream - turns this response into a server sent events (text/event-stream) stream:
+     * the headers are sent and the connection is kept open. Events are then written through eventStream(),
+     * usually by an EventSourceHub. Can be called from any thread.
+     * @return false if the response was already sent
+     */
+    bool startEventStream();
+
+    /**
+     * @brief eventStream
+     * @return the queue events are written to, or nullptr if startEventStream wasn't called
+     */
+    std::shared_ptr<FrameQueue> eventStream() const;
+
+    /**
+     * @brief onWritable - lets a producer write a streamed response only as fast as the client reads it.
+     * The callback runs on the event loop thread, right away and then every time the connection's send
+     * buffer drains under the low watermark, until the response ends or the connection closes.
+     * It should write() until isWritable() turns false, and return. Can be called from any thread.
+     * @param callback - an empty function stops the notifications
+     */
+    void onWritable(const std::function<void()>& callback);
+
+    /**
+     * @brief isWritable
+     * @return true while fewer than the high watermark bytes are waiting to be sent
+     */
+    bool isWritable() const;
+
+    /**
+     * @brief bufferedBytes
+     * @return roughly how many bytes are waiting in the connection's send buffer
+     */
+    size_t bufferedBytes() const;
+
+    /**
+     * @brief setSendBufferWatermarks - isWritable() turns false once the send buffer holds high bytes,
+     * and the onWritable callback runs again once it drains under low bytes
+     */
+    void setSendBufferWatermarks(size_t low, size_t high);
+    size_t lowWatermark() const;
+    size_t highWatermark() const;
+
+    /**
+     * @brief notifyWritable - runs the onWritable callback if the send buffer is under the low watermark.
+     * Must only be called from the thread polling the server, Server does that.
+     */
+    void notifyWritable();
+
     bool isValid() const;
     void setIsValid(bool value);
 
+#ifdef HAS_NGHTTP2
+    /**
+     * @brief setHttp2Stream - the response goes out on an HTTP/2 stream instead of the connection.
+     * Set by Http2Session, handlers don't need to know.
+     */
+    void setHttp2Stream(const std::shared_ptr<Http2Session>& session, int32_t streamId);
+#endif
+
 private:
 
     std::string headerString() const;
+    bool sendNotModified();
+    size_t pendingBytes() const;
+    void flushConnection();
 
     int mCode;
     std::map<std::string, std::string> mHeaders;
     std::string mBody;
     struct mg_connection *mConnection;
+    Server *mServer;
     std::atomic_bool mIsValid;
+    bool mHeadersSent;
+    bool mAutomaticETag;
+    std::string mIfNoneMatch;
+
+    //Guards the event stream against the connection closing while it is being started
+    mutable std::mutex mStreamMutex;
+    std::shared_ptr<FrameQueue> mEventStream;
+
+    //Backpressure for streamed responses, mBufferedBytes mirrors the send buffer for other threads
+    std::function<void()> mWritableCallback;
+    std::atomic<size_t> mBufferedBytes;
+    size_t mLowWatermark;
+    size_t mHighWatermark;
+
+#ifdef HAS_NGHTTP2
+    std::weak_ptr<Http2Session> mHttp2Session;
+    int32_t mHttp2Stream;
+#endif
 };
 }
 
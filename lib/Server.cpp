@@ -1,28 +1,103 @@
 #include <string>
 #include <iostream>
 #include <algorithm>
+#include <chrono>
+
+#include <errno.h>
+#include <stddef.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
 
 #include <mongoose.h>
 
+#include "AbstractRequestCoprocessor.h"
 #include "Controller.h"
+#ifdef __linux__
+#include "EpollInterface.h"
+#endif
+#include "FrameQueue.h"
+#ifdef HAS_OPENSSL
+#include "TlsContext.h"
+#endif
+#ifdef HAS_NGHTTP2
+#include "Http2Session.h"
+#endif
+#ifdef HAS_ZLIB
+#include "Inflater.h"
+#endif
+#include "IpAccessControlList.h"
+#include "Pipeline.h"
 #include "Request.h"
 #include "Response.h"
 #include "Server.h"
+#include "UploadWriter.h"
 #include "Utils.h"
 
 using namespace std;
 using namespace Mongoose;
 
+//Set on connections that have a FrameQueue, so that their events skip the lookup otherwise
+#define MG_F_FRAME_QUEUE MG_F_USER_1
+//Set on connections whose Response wants to know when the send buffer drains
+#define MG_F_WATCH_WRITABLE MG_F_USER_2
+//MG_F_USER_3 to MG_F_USER_5 tell why reads are paused, see Utils::pauseReads
+
+
+static int64_t currentMicroseconds()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+#ifndef WIN32
+static bool setUnixSocketAddress(const std::string& path, struct sockaddr_un *address)
+{
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+
+    if (path.size() >= sizeof(address->sun_path))
+    {
+        return false;
+    }
+
+    memcpy(address->sun_path, path.data(), path.size());
+    return true;
+}
+
+/**
+ * Tells a socket file another process still listens on from one left behind: only the latter refuses connections
+ */
+static bool isUnixSocketListening(const struct sockaddr_un& address, socklen_t length)
+{
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (probe < 0)
+    {
+        return true;
+    }
+
+    bool isListening = connect(probe, (const struct sockaddr *) &address, length) == 0 || errno != ECONNREFUSED;
+    close(probe);
+    return isListening;
+}
+#endif
 
 namespace Mongoose
 {
 
 struct MultipartData
 {
-    FILE *currentFilePointer{nullptr};
+    std::shared_ptr<UploadFile> currentFile;
     size_t currentEntityBytesWritten{0};
+    size_t contentLength{0};
     std::string currentVariableData;
     std::vector<Request::MultipartEntity> multipartEntities;
+    std::vector<std::shared_ptr<UploadFile>> files;     //One per entity, null for plain variables
 };
 
 void sendErrorNow(struct mg_connection* c, int errorCode, const char* errorString)
@@ -31,7 +106,35 @@ void sendErrorNow(struct mg_connection* c, int errorCode, const char* errorStrin
     c->flags |= MG_F_SEND_AND_CLOSE;
 }
 
-static struct mg_serve_http_opts sHttpOptions = {0};
+//Drops a header from a parsed request, eg. one that no longer describes the body
+static void removeHeader(struct http_message *message, const char *name)
+{
+    for (int i = 0; i < MG_MAX_HTTP_HEADERS && message->header_names[i].len > 0; i++)
+    {
+        if (mg_vcasecmp(&message->header_names[i], name) == 0)
+        {
+            for (int j = i; j + 1 < MG_MAX_HTTP_HEADERS; j++)
+            {
+                message->header_names[j] = message->header_names[j + 1];
+                message->header_values[j] = message->header_values[j + 1];
+            }
+
+            message->header_names[MG_MAX_HTTP_HEADERS - 1] = mg_mk_str(NULL);
+            message->header_values[MG_MAX_HTTP_HEADERS - 1] = mg_mk_str(NULL);
+            i--;
+        }
+    }
+}
+
+void requestAuthentication(struct mg_connection* c, const std::string& domain)
+{
+    mg_printf(c,
+              "HTTP/1.0 401 Unauthorized\r\n"
+              "WWW-Authenticate: Basic realm=\"%s\"\r\n"
+              "Content-Length: 0\r\n\r\n",
+              domain.c_str());
+    c->flags |= MG_F_SEND_AND_CLOSE;
+}
 
 /**
  * @brief Server::ev_handler
@@ -42,49 +145,263 @@ static struct mg_serve_http_opts sHttpOptions = {0};
  */
 void Server::ev_handler(struct mg_connection *c, int ev, void *p, void *ud)
 {
-    Server  *server = static_cast<Server*>(c->mgr->user_data);
-    assert(server);
+    //Every connection carries the Server that accepted it, several servers may share one mg_mgr
+    Server  *server = static_cast<Server*>(ud);
+
+    if (server == nullptr)
+    {
+        //The server was stopped, this connection is only waiting to be closed
+        return;
+    }
+
+    handleEvent(server, c, ev, p);
+
+    //What the event changed in the connection's buffers. MG_EV_POLL changes nothing, and comes for every
+    //connection on every poll: data queued from elsewhere is counted on the MG_EV_SEND that follows.
+    if (ev != MG_EV_POLL && ev != MG_EV_CLOSE && c->user_data == server && !(c->flags & MG_F_LISTENING))
+    {
+        server->accountMemory(c);
+    }
+}
+
+void Server::handleEvent(Server *server, struct mg_connection *c, int ev, void *p)
+{
+
+    if (ev == MG_EV_HTTP_REQUEST && !server->mBodyStreams.empty()
+        && server->mBodyStreams.find(c) != server->mBodyStreams.end())
+    {
+        //The last chunk of a streamed body arrived, the request was checked when it started
+        server->finishBodyStream(c);
+        return;
+    }
+
+    if (ev == MG_EV_HTTP_REQUEST && (c->flags & MG_F_SEND_AND_CLOSE))
+    {
+        //The connection was answered already, eg. a streamed body was aborted: nothing more is handled on it
+        return;
+    }
+
+    if (ev == MG_EV_HTTP_REQUEST
+        || ev == MG_EV_HTTP_MULTIPART_REQUEST
+        || ev == MG_EV_WEBSOCKET_HANDSHAKE_REQUEST)
+    {
+        //The body is received, from now on it is accounted for by the buffers holding it
+        server->mBodyReservations.erase(c);
+        server->beginAccessLog(c, (struct http_message *) p);
+
+        if (!server->preRequest(c, (struct http_message *) p))
+        {
+            c->flags |= MG_F_SEND_AND_CLOSE;
+            server->noteAccessLogStatus(c);
+            return;
+        }
+    }
+    else if ((ev == MG_EV_HTTP_CHUNK
+              || ev == MG_EV_HTTP_PART_BEGIN
+              || ev == MG_EV_HTTP_PART_DATA
+              || ev == MG_EV_HTTP_PART_END
+              || ev == MG_EV_HTTP_MULTIPART_REQUEST_END)
+             && (c->flags & MG_F_SEND_AND_CLOSE))
+    {
+        //The request was already answered (rejected), drain the rest of it silently
+        return;
+    }
 
     if (server->requiresBasicAuthentication())
     {
-        if(ev == MG_EV_HTTP_REQUEST
-           || ev == MG_EV_HTTP_MULTIPART_REQUEST
-           || ev == MG_EV_HTTP_PART_BEGIN
-           || ev == MG_EV_HTTP_PART_DATA
-           || ev == MG_EV_HTTP_PART_END
-           || ev == MG_EV_HTTP_MULTIPART_REQUEST_END)
-        {
-            char username[256] = {0};
-            char password[256] = {0};
-            if (mg_get_http_basic_auth((struct http_message *) p,
-                                       username, 256,
-                                       password, 256) < 0
-                || server->basicAuthUsername() != username
-                || server->basicAuthPassword() != password)
-            {
-                mg_printf(c,
-                          "HTTP/1.0 401 Unauthorized\r\n"
-                          "WWW-Authenticate: Basic realm=\"%s\"\r\n"
-                          "Content-Length: 0\r\n\r\n",
-                          server->authDomain().c_str());
-                c->flags |= MG_F_SEND_AND_CLOSE;
-                return;
-            }
+        bool authenticated = true;
+
+        if (ev == MG_EV_HTTP_REQUEST
+            || ev == MG_EV_HTTP_MULTIPART_REQUEST
+            || ev == MG_EV_WEBSOCKET_HANDSHAKE_REQUEST)
+        {
+            authenticated = server->authenticate(c, (struct http_message *) p);
+        }
+        else if (ev == MG_EV_HTTP_PART_BEGIN
+                 || ev == MG_EV_HTTP_PART_DATA
+                 || ev == MG_EV_HTTP_PART_END
+                 || ev == MG_EV_HTTP_MULTIPART_REQUEST_END)
+        {
+            //Multipart events carry no headers, the connection was authenticated at MG_EV_HTTP_MULTIPART_REQUEST
+            authenticated = server->mAuthenticatedUsers.find(c) != server->mAuthenticatedUsers.end();
+        }
+
+        if (!authenticated)
+        {
+            requestAuthentication(c, server->mAuthDomain);
+            server->noteAccessLogStatus(c);
+            return;
         }
     }
 
     switch (ev)
     {
+    case MG_EV_ACCEPT:
+    {
+        auto acl = server->compiledIpAccessControlList();
+
+        if (acl && !acl->isAllowed(&c->sa.sa))
+        {
+            c->flags |= MG_F_CLOSE_IMMEDIATELY;
+        }
+        else if (server->mIsMemoryPaused)
+        {
+            Utils::pauseReads(c, Utils::MemoryPause);
+        }
+
+        break;
+    }
+    case MG_EV_RECV:
+    {
+#ifdef HAS_NGHTTP2
+        if (!server->mHttp2Sessions.empty())
+        {
+            auto session = server->mHttp2Sessions.find(c);
+
+            if (session != server->mHttp2Sessions.end())
+            {
+                //Frames, mongoose doesn't parse anything on this connection anymore
+                auto current = session->second;
+                current->receive(c->recv_mbuf.buf, c->recv_mbuf.len);
+                mbuf_remove(&c->recv_mbuf, c->recv_mbuf.len);
+                break;
+            }
+        }
+#endif
+
+        if (!server->mBodyStreams.empty())
+        {
+            auto stream = server->mBodyStreams.find(c);
+
+            if (stream != server->mBodyStreams.end() && stream->second.remaining != (size_t) ~0)
+            {
+                //Hand the body over as it comes, mongoose never gets to buffer it
+                size_t length = std::min(c->recv_mbuf.len, stream->second.remaining);
+                server->feedBodyStream(c, c->recv_mbuf.buf, length);
+                mbuf_remove(&c->recv_mbuf, length);
+            }
+
+            if (server->mBodyStreams.find(c) != server->mBodyStreams.end())
+            {
+                break;
+            }
+        }
+
+#ifdef HAS_NGHTTP2
+        if (server->mHttp2Enabled && Http2Session::isPreface(c->recv_mbuf.buf, c->recv_mbuf.len))
+        {
+            //HTTP/2 with prior knowledge: the connection is taken away from mongoose's HTTP/1 parser
+            auto session = std::make_shared<Http2Session>(server, c);
+
+            if (session->start())
+            {
+                server->mHttp2Sessions[c] = session;
+                c->proto_handler = NULL;
+                session->receive(c->recv_mbuf.buf, c->recv_mbuf.len);
+                mbuf_remove(&c->recv_mbuf, c->recv_mbuf.len);
+                break;
+            }
+        }
+#endif
+
+#ifdef HAS_ZLIB
+        if (!server->mInflaters.empty() && server->mInflaters.find(c) != server->mInflaters.end())
+        {
+            //A compressed multipart body is inflated in the receive buffer, before mongoose parses the parts
+            server->inflateReceived(c, c->recv_mbuf.len - *(int *) p);
+        }
+#endif
+
+        //mongoose hasn't parsed what was just received yet: a body that won't fit is rejected before it is buffered,
+        //a body a route wants streamed, or that has to be decompressed, is taken over before it is buffered at all
+        server->admitRequest(c);
+
+        if (c->flags & MG_F_SEND_AND_CLOSE)
+        {
+            //Already answered, whatever else arrives is dropped rather than parsed
+            mbuf_remove(&c->recv_mbuf, c->recv_mbuf.len);
+        }
+        break;
+    }
+    case MG_EV_HTTP_CHUNK:
+    {
+        //mongoose only decodes chunked bodies piece by piece, others are streamed from MG_EV_RECV
+        struct http_message *hm = (struct http_message *) p;
+        BodyChunkHandler handler;
+        auto stream = server->mBodyStreams.find(c);
+
+        //Chunked bodies announce no length, their limit is checked as they arrive
+        size_t received = stream != server->mBodyStreams.end() ? stream->second.received + hm->body.len : hm->body.len;
+        size_t limit = server->routeBodySizeLimit(std::string(hm->method.p, hm->method.len), std::string(hm->uri.p, hm->uri.len));
+
+        if (limit > 0 && received > limit)
+        {
+            if (stream != server->mBodyStreams.end())
+            {
+                server->mBodyStreams.erase(stream);
+            }
+
+            sendErrorNow(c, 413, "Requested Entity Too Large");
+            c->recv_mbuf_limit = 0;
+            break;
+        }
+
+        if (stream == server->mBodyStreams.end())
+        {
+            std::string method(hm->method.p, hm->method.len);
+            std::string url(hm->uri.p, hm->uri.len);
+            std::shared_ptr<Inflater> inflater = server->createInflater(hm, limit);
+
+            //Compressed bodies are decompressed as they arrive even when the route wants them buffered
+            if ((!server->handlesBodyChunks(method, url, &handler) && !inflater)
+                || !server->startBodyStream(c, hm, handler, (size_t) ~0, inflater))
+            {
+                break;
+            }
+        }
+
+        server->feedBodyStream(c, hm->body.p, hm->body.len);
+        c->flags |= MG_F_DELETE_CHUNK;
+        break;
+    }
     case MG_EV_HTTP_REQUEST:
     {
         struct http_message *hm = (struct http_message *) p;
-        c->user_data = NULL;
+
+#ifdef HAS_NGHTTP2
+        if (server->mHttp2Enabled && hm->body.len == 0 && Http2Session::isUpgrade(hm))
+        {
+            //Upgrade: h2c. The request is answered over HTTP/2, on stream 1.
+            auto session = std::make_shared<Http2Session>(server, c);
+            server->mHttp2Sessions[c] = session;
+
+            if (session->upgrade(hm))
+            {
+                //The client may follow the request with its preface right away: mongoose must not parse that as HTTP/1
+                const char *end = hm->message.p + hm->message.len;
+                const char *received = c->recv_mbuf.buf + c->recv_mbuf.len;
+
+                if (end >= c->recv_mbuf.buf && end < received)
+                {
+                    session->receive(end, received - end);
+                    c->recv_mbuf.len = end - c->recv_mbuf.buf;
+                }
+
+                c->proto_handler = NULL;
+                server->noteAccessLogStatus(c);
+                break;
+            }
+
+            //Not a valid upgrade request, it is served as HTTP/1
+            server->mHttp2Sessions.erase(c);
+        }
+#endif
 
         //If server handles this request , let it.
         if (server->handles(std::string(hm->method.p, hm->method.len), std::string(hm->uri.p, hm->uri.len)))
         {
-            auto request = std::make_shared<Request>(c, hm);
-            auto response = std::make_shared<Response>(c);
+            auto request = server->createRequest(c, hm);
+            auto response = server->createResponse(c, request);
 
             server->mCurrentRequests[c] = request;
             server->mCurrentResponses[c] = response;
@@ -93,9 +410,10 @@ void Server::ev_handler(struct mg_connection *c, int ev, void *p, void *ud)
         else
         {
             //Else, simply let mongoose handle it - like a normal http server
-            mg_serve_http(c, (struct http_message *) p, sHttpOptions);
+            mg_serve_http(c, (struct http_message *) p, *server->mHttpOptions);
         }
 
+        server->noteAccessLogStatus(c);
         break;
     }
     case MG_EV_HTTP_MULTIPART_REQUEST:
@@ -106,19 +424,34 @@ void Server::ev_handler(struct mg_connection *c, int ev, void *p, void *ud)
         {
             //Create a request/response pair now, because hm won't be available when we get
             //MG_EV_HTTP_MULTIPART_REQUEST
-            auto request = std::make_shared<Request>(c, hm, true);
-            auto response = std::make_shared<Response>(c);
+            struct http_message headers = *hm;
+            if (server->mInflaters.find(c) != server->mInflaters.end())
+            {
+                //The parts are decompressed already
+                removeHeader(&headers, "Content-Encoding");
+                removeHeader(&headers, "Content-Length");
+            }
+
+            auto request = server->createRequest(c, &headers, true);
+            auto response = server->createResponse(c, request);
+
             server->mCurrentRequests[c] = request;
             server->mCurrentResponses[c] = response;
 
-            c->user_data = new MultipartData();
+            MultipartData *data = new MultipartData();
+            struct mg_str *contentLength = mg_get_http_header(hm, "Content-Length");
+            if (contentLength != NULL)
+            {
+                data->contentLength = strtoul(std::string(contentLength->p, contentLength->len).c_str(), NULL, 10);
+            }
+
+            server->mMultipartData[c] = data;
         }
         else
         {
             mg_printf(c, "%s",
                       "HTTP/1.0 404 Path not found\r\n"
                       "Content-Length: 0\r\n\r\n");
-            c->user_data = NULL;
             c->flags |= MG_F_SEND_AND_CLOSE;
             return;
         }
@@ -128,7 +461,7 @@ void Server::ev_handler(struct mg_connection *c, int ev, void *p, void *ud)
     case MG_EV_HTTP_PART_BEGIN:
     {
         struct mg_http_multipart_part *mp = (struct mg_http_multipart_part *) p;
-        struct MultipartData *data = (MultipartData*)c->user_data;
+        struct MultipartData *data = server->multipartData(c);
 
         if (data != NULL)
         {
@@ -137,14 +470,9 @@ void Server::ev_handler(struct mg_connection *c, int ev, void *p, void *ud)
 
             if (std::string(mp->file_name).size() > 0)
             {
-                std::string tmpFile = server->tmpDir() + "/" + Utils::sanitizeFilename(mp->file_name);
-                data->currentFilePointer = fopen(tmpFile.c_str(), "wb");
-                if (data->currentFilePointer == NULL)
-                {
-                    sendErrorNow(c, 500, "Failed to open a file");
-                    delete data;
-                    return;
-                }
+                //The whole body is an upper bound of the file size, reserve that much disk up front
+                size_t preallocate = std::min(data->contentLength, server->uploadSizeLimit());
+                data->currentFile = server->uploadWriter()->open(server->tmpDir(), preallocate);
             }
         }
         else
@@ -158,7 +486,7 @@ void Server::ev_handler(struct mg_connection *c, int ev, void *p, void *ud)
     case MG_EV_HTTP_PART_DATA:
     {
         struct mg_http_multipart_part *mp = (struct mg_http_multipart_part *) p;
-        struct MultipartData *data = (MultipartData*)c->user_data;
+        struct MultipartData *data = server->multipartData(c);
 
         if (data  != NULL)
         {
@@ -171,11 +499,19 @@ void Server::ev_handler(struct mg_connection *c, int ev, void *p, void *ud)
             //If the uploaded data is a file, write it to a file.
             if (std::string(mp->file_name).size() > 0)
             {
-                if (fwrite(mp->data.p, 1, mp->data.len, data->currentFilePointer) != mp->data.len)
+                if (data->currentFile->hasFailed())
                 {
                     sendErrorNow(c, 500, "Failed to write a file");
                     return;
                 }
+
+                server->mUploadWriter->write(data->currentFile, mp->data.p, mp->data.len);
+
+                //The disk is slower than the network: stop reading until the writer catches up
+                if (server->mUploadWriter->queuedBytes() > server->mUploadBufferLimit)
+                {
+                    server->pauseUpload(c);
+                }
             }
             else
             {
@@ -196,7 +532,7 @@ void Server::ev_handler(struct mg_connection *c, int ev, void *p, void *ud)
     case MG_EV_HTTP_PART_END:
     {
         struct mg_http_multipart_part *mp = (struct mg_http_multipart_part *) p;
-        struct MultipartData *data = (MultipartData*)c->user_data;
+        struct MultipartData *data = server->multipartData(c);
 
         if (data != NULL)
         {
@@ -207,12 +543,14 @@ void Server::ev_handler(struct mg_connection *c, int ev, void *p, void *ud)
 
             if (std::string(mp->file_name).size() > 0)
             {
-                entity.filePath = server->tmpDir() + "/" + Utils::sanitizeFilename(entity.fileName);
-                fclose(data->currentFilePointer);
+                server->mUploadWriter->finish(data->currentFile);
+                data->files.push_back(data->currentFile);
+                data->currentFile.reset();
             }
             else
             {
                 entity.variableData = data->currentVariableData;
+                data->files.push_back(nullptr);
             }
         }
         else
@@ -227,28 +565,38 @@ void Server::ev_handler(struct mg_connection *c, int ev, void *p, void *ud)
     case MG_EV_HTTP_MULTIPART_REQUEST_END:
     {
         struct mg_http_multipart_part *mp = (struct mg_http_multipart_part *) p;
-        struct MultipartData *data = (MultipartData*)c->user_data;
+        struct MultipartData *data = server->multipartData(c);
+        bool isTruncated = false;
 
-        if (data != NULL)
+#ifdef HAS_ZLIB
+        auto inflater = server->mInflaters.find(c);
+        if (inflater != server->mInflaters.end())
         {
-            auto request = server->mCurrentRequests[c];
-            auto response = server->mCurrentResponses[c];
-            assert(request);
-            assert(response);
+            //The parts may all be there while the compressed data they came from is cut short
+            isTruncated = !inflater->second->isFinished();
+
+            if (isTruncated && data != NULL && mp->status == 0)
+            {
+                server->rejectEncodedBody(c, *inflater->second);
+            }
+
+            server->mInflaters.erase(inflater);
+        }
+#endif
 
+        if (data != NULL)
+        {
             //Argument: mg_http_multipart_part, var_name and file_name are NULL,
             //status = 0 means request was properly closed, < 0 means connection was terminated
-            if (mp->status == 0
-                && server->handles(request->method(), request->url()))
+            if (mp->status == 0 && !isTruncated)
             {
-                request->setMultipartEntities(data->multipartEntities);
-                server->handleRequest(request, response);
+                //The request is handled once the files are on disk, see dispatchUploads
+                server->mPendingUploads.push_back(c);
+                server->dispatchUploads();
             }
-
-            if (data != NULL)
+            else
             {
-                delete data;
-                c->user_data = NULL;
+                server->freeMultipartData(c);
             }
         }
         else
@@ -258,20 +606,110 @@ void Server::ev_handler(struct mg_connection *c, int ev, void *p, void *ud)
         }
         break;
     }
-    case MG_EV_CLOSE:
+    case MG_EV_WEBSOCKET_HANDSHAKE_REQUEST:
+    {
+        struct http_message *hm = (struct http_message *) p;
+        WebSocketHandler handler;
+
+        if (server->handlesWebSocket(std::string(hm->uri.p, hm->uri.len), &handler))
+        {
+            auto queue = std::make_shared<FrameQueue>(c, server, server->mWebSocketQueueLimit);
+            WebSocketConnection& connection = server->mWebSockets[c];
+            connection.socket = std::make_shared<WebSocket>(server->createRequest(c, hm), queue);
+            connection.handler = handler;
+
+            server->mFrameQueues[c] = queue;
+            c->flags |= MG_F_FRAME_QUEUE;
+        }
+        else
+        {
+            sendErrorNow(c, 404, "Path not found");
+        }
+
+        break;
+    }
+    case MG_EV_WEBSOCKET_HANDSHAKE_DONE:
+    {
+        auto it = server->mWebSockets.find(c);
+
+        if (it != server->mWebSockets.end() && it->second.handler.onOpen)
+        {
+            it->second.handler.onOpen(it->second.socket);
+        }
+
+        break;
+    }
+    case MG_EV_WEBSOCKET_FRAME:
     {
-        if (server->mCurrentRequests.find(c) != server->mCurrentRequests.end())
+        struct websocket_message *wm = (struct websocket_message *) p;
+        auto it = server->mWebSockets.find(c);
+
+        if (it != server->mWebSockets.end() && it->second.handler.onMessage)
+        {
+            it->second.handler.onMessage(it->second.socket,
+                                         std::string((const char *) wm->data, wm->size),
+                                         (wm->flags & 0x0f) == WEBSOCKET_OP_BINARY);
+        }
+
+        break;
+    }
+    case MG_EV_SEND:
+    {
+        if (server->mAccessLog)
+        {
+            auto pending = server->mAccessLogRecords.find(c);
+
+            if (pending != server->mAccessLogRecords.end())
+            {
+                //Up to the last byte written, not to the next request of a keep-alive connection
+                AccessLog::Record& record = pending->second.record;
+                record.bytesSent += *(int *) p;
+                record.duration = (uint32_t) std::max((int64_t) 0, currentMicroseconds() - record.timestamp);
+            }
+        }
+
+        if (c->flags & MG_F_FRAME_QUEUE)
+        {
+            //The socket drained some, write more of what is queued
+            auto it = server->mFrameQueues.find(c);
+
+            if (it != server->mFrameQueues.end())
+            {
+                it->second->flush();
+            }
+        }
+
+#ifdef HAS_NGHTTP2
+        if (!server->mHttp2Sessions.empty())
         {
-            server->mCurrentRequests[c]->setIsValid(false);
-            server->mCurrentRequests.erase(c);
+            auto session = server->mHttp2Sessions.find(c);
+
+            if (session != server->mHttp2Sessions.end())
+            {
+                //Frames held back while the send buffer was full may go now
+                auto current = session->second;
+                current->onSent();
+            }
         }
+#endif
 
-        if (server->mCurrentResponses.find(c) != server->mCurrentResponses.end())
+        if (c->flags & MG_F_WATCH_WRITABLE)
         {
-            //To make sure any current mCurrentResponse.send() will fail
-            server->mCurrentResponses[c]->setIsValid(false);
-            server->mCurrentResponses.erase(c);
+            auto it = server->mCurrentResponses.find(c);
+
+            if (it != server->mCurrentResponses.end())
+            {
+                //The callback may end the response, keep it alive until it returns
+                auto response = it->second;
+                response->notifyWritable();
+            }
         }
+
+        break;
+    }
+    case MG_EV_CLOSE:
+    {
+        server->onClose(c);
         break;
     }
     }
@@ -279,10 +717,10 @@ void Server::ev_handler(struct mg_connection *c, int ev, void *p, void *ud)
 
 Server::Server(const char *address, const char *documentRoot):
     mIsRunning(false),
+    mHttpOptions(new mg_serve_http_opts()),
     mUploadSizeLimit(1024*1024*100),
     mTmpDir("/tmp")
 {
-    memset(&sHttpOptions, 0, sizeof(sHttpOptions));
     setBindAddress(address);
     setDocumentRoot(documentRoot);
     setIndexFiles("index.html");
@@ -292,59 +730,1332 @@ Server::Server(const char *address, const char *documentRoot):
 Server::~Server()
 {
     stop();
+    mUploadWriter.reset();
 }
 
-bool Server::start()
+bool Server::start(Server *host)
 {
-
     if (!mIsRunning)
     {
-        mManager = new (struct mg_mgr);
-        mg_mgr_init(mManager, this);
+        std::unique_lock<std::mutex> wakeupLock(mWakeupMutex);
+
+        if (host && host != this)
+        {
+            if (!host->isRunning())
+            {
+                std::cerr << "Error, unable to start server: the host server is not running" << std::endl;
+                return false;
+            }
+
+            mManager = host->mManager;
+            mOwnsManager = false;
+            mHost = host;
+            host->mGuests.push_back(this);
+        }
+        else
+        {
+            mManager = new (struct mg_mgr);
+
+#ifdef __linux__
+            if (mEventBackend == EpollBackend)
+            {
+                struct mg_mgr_init_opts options;
+                memset(&options, 0, sizeof(options));
+                options.main_iface = EpollInterface::vtable();
+                mg_mgr_init_opt(mManager, this, options);
+            }
+            else
+#endif
+            {
+                mg_mgr_init(mManager, this);
+            }
+            mOwnsManager = true;
+
+            if (!openWakeupSocket())
+            {
+                std::cerr << "Error, unable to create the event loop's wake up socket" << std::endl;
+                mg_mgr_free(mManager);
+                delete mManager;
+                mManager = nullptr;
+                return false;
+            }
+        }
 
+        wakeupLock.unlock();
         mRequests = 0;
         mStartTime = Utils::getTime();
+        mIsRunning = true;
+
+        if (mListeningSockets.size() > 0)
+        {
+            for (int socket: mListeningSockets)
+            {
+                mIsRunning = mIsRunning && addListener(adoptListeningSocket(socket));
+            }
+        }
+        else
+        {
+            for (const auto& address: bindAddresses())
+            {
+                mIsRunning = mIsRunning && addListener(bind(address));
+            }
+        }
 
-        mConnection = mg_bind(mManager,
-                              mBindAddress.c_str(),
-                              ev_handler,
-                              this);
+#ifdef HAS_OPENSSL
+        bool isAdopted = mListeningSockets.size() > 0;
 
-        if (mConnection)
+        if (isAdopted && mTlsListeningSockets.size() != mTlsBindAddresses.size())
         {
-            mg_set_protocol_http_websocket(mConnection);
-            mIsRunning = true;
+            //Coming up without some of the configured listeners would go unnoticed
+            std::cerr << "Error, no listening sockets were given for the TLS bind addresses" << std::endl;
+            mIsRunning = false;
         }
-    }
 
-    if (mConnection == nullptr)
-    {
-        mg_mgr_free(mManager);
-        mIsRunning = false;
-        delete mManager;
-        mManager = nullptr;
-        std::cerr << "Error, unable to start server" << std::endl;
-    }
+        for (size_t i = 0; i < mTlsBindAddresses.size() && mIsRunning; i++)
+        {
+            const auto& tls = mTlsBindAddresses[i];
+            struct mg_connection *listener = isAdopted ? adoptListeningSocket(mTlsListeningSockets[i]) : bind(tls.first);
 
-    return mIsRunning;
-}
+            if (listener)
+            {
+                //Handshakes finished on TlsContext's workers are picked up by flushPending
+                tls.second->listen(listener, [this] { wakeup(); });
+            }
 
-void Server::poll(int duration)
-{
-    if (mIsRunning)
+            mIsRunning = addListener(listener);
+        }
+#endif
+
+        if (!mIsRunning)
+        {
+            mIsRunning = true;
+            stop();
+            std::cerr << "Error, unable to start server" << std::endl;
+        }
+    }
+
+    return mIsRunning;
+}
+
+struct mg_connection *Server::bind(const string &address)
+{
+    if (address.compare(0, 5, "unix:") == 0)
+    {
+        int socket = bindUnixSocket(address, mUnixSocketPermissions);
+
+        if (socket < 0)
+        {
+            std::cerr << "Error, unable to bind " << address << ": " << strerror(errno) << std::endl;
+            return nullptr;
+        }
+
+        if (address.size() > 5 && address[5] != '@')
+        {
+            mUnixSocketPaths.push_back(address.substr(5));
+        }
+
+        return adoptListeningSocket(socket);
+    }
+
+    return mg_bind(mManager, address.c_str(), ev_handler, this);
+}
+
+struct mg_connection *Server::adoptListeningSocket(int socket)
+{
+    struct mg_connection *listener = mg_add_sock(mManager, socket, ev_handler, this);
+
+    if (listener)
+    {
+        listener->flags |= MG_F_LISTENING;
+    }
+
+    return listener;
+}
+
+int Server::bindUnixSocket(const string &address, int permissions)
+{
+#ifndef WIN32
+    std::string path = address.compare(0, 5, "unix:") == 0 ? address.substr(5) : address;
+    struct sockaddr_un unixAddress;
+
+    if (path.empty() || !setUnixSocketAddress(path, &unixAddress))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    socklen_t length = offsetof(struct sockaddr_un, sun_path) + path.size();
+    int socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (socket < 0)
+    {
+        return -1;
+    }
+
+    //A leading '@' means a Linux abstract socket: no file, and no permissions to set
+    if (path[0] == '@')
+    {
+        unixAddress.sun_path[0] = '\0';
+
+        if (::bind(socket, (struct sockaddr *) &unixAddress, length) != 0 || listen(socket, SOMAXCONN) != 0)
+        {
+            int error = errno;
+            close(socket);
+            errno = error;
+            return -1;
+        }
+
+        fcntl(socket, F_SETFL, fcntl(socket, F_GETFL, 0) | O_NONBLOCK);
+        return socket;
+    }
+
+    //Only the socket left over by a previous run is replaced: never a regular file, nor a running server's socket
+    struct stat status;
+    if (lstat(path.c_str(), &status) == 0 && (!S_ISSOCK(status.st_mode) || isUnixSocketListening(unixAddress, length)))
+    {
+        close(socket);
+        errno = EADDRINUSE;
+        return -1;
+    }
+
+    //bind() creates the file with the umask's permissions. It is created in a private directory instead,
+    //and only moved into place once it has its own: nobody can connect to it in the meantime
+    size_t slash = path.rfind('/');
+    std::string directory = (slash == std::string::npos ? std::string(".") : path.substr(0, slash)) + "/.sockXXXXXX";
+    std::vector<char> name(directory.begin(), directory.end());
+    name.push_back('\0');
+
+    if (mkdtemp(name.data()) == NULL)
+    {
+        int error = errno;
+        close(socket);
+        errno = error;
+        return -1;
+    }
+
+    std::string temporary = std::string(name.data()) + "/s";
+    struct sockaddr_un temporaryAddress;
+    bool isBound = false;
+
+    if (!setUnixSocketAddress(temporary, &temporaryAddress))
+    {
+        errno = ENAMETOOLONG;
+    }
+    else if (::bind(socket, (struct sockaddr *) &temporaryAddress,
+                    offsetof(struct sockaddr_un, sun_path) + temporary.size()) == 0)
+    {
+        isBound = chmod(temporary.c_str(), permissions) == 0
+                  && listen(socket, SOMAXCONN) == 0
+                  && rename(temporary.c_str(), path.c_str()) == 0;
+    }
+
+    int error = errno;
+    unlink(temporary.c_str());
+    rmdir(name.data());
+
+    if (!isBound)
+    {
+        close(socket);
+        errno = error;
+        return -1;
+    }
+
+    fcntl(socket, F_SETFL, fcntl(socket, F_GETFL, 0) | O_NONBLOCK);
+    return socket;
+#else
+    return -1;
+#endif
+}
+
+std::shared_ptr<Request> Server::createRequest(struct mg_connection *connection, struct http_message *message, bool isMultipart)
+{
+    auto request = std::make_shared<Request>(connection, message, isMultipart);
+
+    auto user = mAuthenticatedUsers.find(connection);
+    if (user != mAuthenticatedUsers.end())
+    {
+        request->setUsername(user->second.username);
+    }
+
+#ifdef SO_PEERCRED
+    if (connection->sa.sa.sa_family == AF_UNIX)
+    {
+        struct ucred credentials;
+        socklen_t length = sizeof(credentials);
+
+        if (getsockopt(connection->sock, SOL_SOCKET, SO_PEERCRED, &credentials, &length) == 0)
+        {
+            Request::PeerCredentials peer;
+            peer.isValid = true;
+            peer.pid = credentials.pid;
+            peer.uid = credentials.uid;
+            peer.gid = credentials.gid;
+            request->setPeerCredentials(peer);
+        }
+    }
+#endif
+
+    return request;
+}
+
+std::shared_ptr<Response> Server::createResponse(struct mg_connection *connection, const std::shared_ptr<Request>& request)
+{
+    auto response = std::make_shared<Response>(connection, this);
+    response->setAutomaticETag(mAutomaticETags);
+
+    //Only safe methods may be answered with 304 Not Modified
+    std::string method = request->method();
+    if (method == "GET" || method == "HEAD")
+    {
+        response->setIfNoneMatch(request->getHeaderValue("If-None-Match"));
+    }
+
+    return response;
+}
+
+bool Server::addListener(struct mg_connection *listener)
+{
+    if (listener == nullptr)
+    {
+        return false;
+    }
+
+    mg_set_protocol_http_websocket(listener);
+    mListeners.push_back(listener);
+    return true;
+}
+
+void Server::poll(int duration)
+{
+    if (mIsRunning)
+    {
+        if (mHost)
+        {
+            mHost->poll(duration);
+            return;
+        }
+
+        mPollingThread = std::this_thread::get_id();
+        mg_mgr_poll(mManager, duration);
+        flushPending();
+    }
+}
+
+void Server::stop()
+{
+    if (mIsRunning)
+    {
+        if (mOwnsManager)
+        {
+            //Connections closed from here on (eg. by HttpClient) mustn't see a manager to open new ones on,
+            //and wakeup() mustn't write to what is about to be freed
+            struct mg_mgr *manager;
+            int wakeupSocket;
+            {
+                std::lock_guard<std::mutex> lock(mWakeupMutex);
+                manager = mManager;
+                wakeupSocket = mWakeupSocket.exchange(-1);
+                mManager = nullptr;
+            }
+
+            mg_mgr_free(manager);
+            delete manager;
+
+            if (wakeupSocket >= 0)
+            {
+                closesocket(wakeupSocket);
+            }
+        }
+        else
+        {
+            //The event loop belongs to another server and keeps running:
+            //detach our connections from this server and have them closed on its next poll
+            for (struct mg_connection *c = mg_next(mManager, NULL); c != NULL; c = mg_next(mManager, c))
+            {
+                if (c->user_data == this)
+                {
+                    c->user_data = nullptr;
+                    c->flags |= MG_F_CLOSE_IMMEDIATELY;
+                    onClose(c);
+                }
+            }
+        }
+
+        if (mHost)
+        {
+            auto guest = std::find(mHost->mGuests.begin(), mHost->mGuests.end(), this);
+            if (guest != mHost->mGuests.end())
+            {
+                mHost->mGuests.erase(guest);
+            }
+        }
+
+        for (const auto& path: mUnixSocketPaths)
+        {
+            unlink(path.c_str());
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mWakeupMutex);
+            mHost = nullptr;
+            mManager = nullptr;
+        }
+
+        mUnixSocketPaths.clear();
+        mListeners.clear();
+        mIsRunning = false;
+    }
+}
+
+void Server::setListeningSockets(const std::vector<int>& sockets)
+{
+    mListeningSockets = sockets;
+}
+
+std::vector<int> Server::listeningSockets() const
+{
+    return mListeningSockets;
+}
+
+void Server::stopListening()
+{
+    for (auto listener: mListeners)
+    {
+        listener->flags |= MG_F_CLOSE_IMMEDIATELY;
+    }
+
+    mListeners.clear();
+}
+
+size_t Server::connectionCount() const
+{
+    size_t count = 0;
+
+    if (mIsRunning)
+    {
+        for (struct mg_connection *c = mg_next(mManager, NULL); c != NULL; c = mg_next(mManager, c))
+        {
+            if (c->user_data == this && !(c->flags & MG_F_LISTENING))
+            {
+                count++;
+            }
+        }
+    }
+
+    return count;
+}
+
+void Server::beginAccessLog(struct mg_connection *connection, struct http_message *message)
+{
+    if (!mAccessLog)
+    {
+        return;
+    }
+
+    //The previous request of a keep-alive connection is done
+    endAccessLog(connection);
+
+    PendingAccessLog& pending = mAccessLogRecords[connection];
+    AccessLog::Record& record = pending.record;
+    memset(&record, 0, sizeof(record));
+    pending.sendOffset = connection->send_mbuf.len;
+
+    record.timestamp = currentMicroseconds();
+    AccessLog::copy(record.method, message->method.p, message->method.len);
+    AccessLog::copy(record.url, message->uri.p, message->uri.len);
+    mg_conn_addr_to_str(connection, record.remote, sizeof(record.remote), MG_SOCK_STRINGIFY_IP | MG_SOCK_STRINGIFY_REMOTE);
+
+    size_t urlLength = message->uri.len;
+    if (message->query_string.len > 0)
+    {
+        urlLength += message->query_string.len + 1;
+
+        if (urlLength < sizeof(record.url))
+        {
+            record.url[message->uri.len] = '?';
+            memcpy(record.url + message->uri.len + 1, message->query_string.p, message->query_string.len);
+            record.url[urlLength] = '\0';
+        }
+    }
+    record.urlLength = (uint16_t) std::min(urlLength, (size_t) UINT16_MAX);
+}
+
+void Server::noteAccessLogStatus(struct mg_connection *connection)
+{
+    if (!mAccessLog)
+    {
+        return;
+    }
+
+    auto pending = mAccessLogRecords.find(connection);
+
+    if (pending != mAccessLogRecords.end() && pending->second.record.code == 0)
+    {
+        //Answered right away (a static file, a rejection...): the status line is still in the send buffer
+        const struct mbuf& sent = connection->send_mbuf;
+        size_t offset = pending->second.sendOffset;
+
+        if (sent.len >= offset + 12 && memcmp(sent.buf + offset, "HTTP/", 5) == 0)
+        {
+            pending->second.record.code = (uint16_t) atoi(sent.buf + offset + 9);
+        }
+    }
+}
+
+void Server::endAccessLog(struct mg_connection *connection)
+{
+    if (!mAccessLog)
+    {
+        return;
+    }
+
+    auto pending = mAccessLogRecords.find(connection);
+
+    if (pending == mAccessLogRecords.end())
+    {
+        return;
+    }
+
+    AccessLog::Record& record = pending->second.record;
+
+    if (record.code == 0)
+    {
+        auto response = mCurrentResponses.find(connection);
+
+        if (response != mCurrentResponses.end())
+        {
+            record.code = (uint16_t) response->second->code();
+        }
+        else if (connection->flags & MG_F_IS_WEBSOCKET)
+        {
+            record.code = 101;
+        }
+    }
+
+    if (record.duration == 0)
+    {
+        //Nothing was sent
+        record.duration = (uint32_t) std::max((int64_t) 0, currentMicroseconds() - record.timestamp);
+    }
+
+    mAccessLog->log(record);
+    mAccessLogRecords.erase(pending);
+}
+
+AccessLog *Server::accessLog() const
+{
+    return mAccessLog;
+}
+
+void Server::setAccessLog(AccessLog *log)
+{
+    mAccessLog = log;
+    mAccessLogRecords.clear();
+}
+
+struct mg_mgr *Server::manager() const
+{
+    return mIsRunning ? mManager : nullptr;
+}
+
+MultipartData *Server::multipartData(struct mg_connection *connection) const
+{
+    auto it = mMultipartData.find(connection);
+    return it != mMultipartData.end() ? it->second : nullptr;
+}
+
+void Server::freeMultipartData(struct mg_connection *connection)
+{
+    auto it = mMultipartData.find(connection);
+
+    if (it != mMultipartData.end())
+    {
+        //Files still being written are closed and deleted by the writer once it is done with them
+        delete it->second;
+        mMultipartData.erase(it);
+    }
+
+    mPendingUploads.erase(std::remove(mPendingUploads.begin(), mPendingUploads.end(), connection), mPendingUploads.end());
+    mPausedUploads.erase(std::remove(mPausedUploads.begin(), mPausedUploads.end(), connection), mPausedUploads.end());
+}
+
+UploadWriter *Server::uploadWriter()
+{
+    if (!mUploadWriter)
+    {
+        mUploadWriter.reset(new UploadWriter([this] { wakeup(); }));
+    }
+
+    return mUploadWriter.get();
+}
+
+void Server::pauseUpload(struct mg_connection *connection)
+{
+    if (std::find(mPausedUploads.begin(), mPausedUploads.end(), connection) == mPausedUploads.end())
+    {
+        Utils::pauseReads(connection, Utils::UploadPause);
+        mPausedUploads.push_back(connection);
+    }
+}
+
+void Server::dispatchUploads()
+{
+    if (mUploadWriter && !mPausedUploads.empty() && !mIsMemoryPaused
+        && mUploadWriter->queuedBytes() <= mUploadBufferLimit / 2)
+    {
+        for (auto connection: mPausedUploads)
+        {
+            Utils::resumeReads(connection, Utils::UploadPause);
+        }
+
+        mPausedUploads.clear();
+    }
+
+    for (size_t i = 0; i < mPendingUploads.size();)
+    {
+        struct mg_connection *c = mPendingUploads[i];
+        MultipartData *data = multipartData(c);
+        bool isDone = true;
+        bool hasFailed = false;
+
+        for (const auto& file: data->files)
+        {
+            isDone = isDone && (!file || file->isDone());
+            hasFailed = hasFailed || (file && file->hasFailed());
+        }
+
+        if (!isDone)
+        {
+            i++;
+            continue;
+        }
+
+        mPendingUploads.erase(mPendingUploads.begin() + i);
+        auto request = mCurrentRequests[c];
+        auto response = mCurrentResponses[c];
+        assert(request);
+        assert(response);
+
+        if (hasFailed)
+        {
+            sendErrorNow(c, 500, "Failed to write a file");
+        }
+        else if (handles(request->method(), request->url()))
+        {
+            for (size_t entity = 0; entity < data->files.size(); entity++)
+            {
+                if (data->files[entity])
+                {
+                    Request::MultipartEntity& multipartEntity = data->multipartEntities[entity];
+                    multipartEntity.fd = data->files[entity]->release(multipartEntity.filePath);
+                }
+            }
+
+            request->setMultipartEntities(data->multipartEntities);
+            handleRequest(request, response);
+        }
+
+        freeMultipartData(c);
+    }
+}
+
+bool Server::admitRequest(struct mg_connection *connection)
+{
+    if ((connection->flags & (MG_F_IS_WEBSOCKET | MG_F_SEND_AND_CLOSE))
+        || mBodyReservations.find(connection) != mBodyReservations.end()
+        || mMultipartData.find(connection) != mMultipartData.end())
+    {
+        return true;
+    }
+
+    struct http_message message;
+    int headerLength = mg_parse_http(connection->recv_mbuf.buf, (int) connection->recv_mbuf.len, &message, 1);
+
+    if (headerLength <= 0)
+    {
+        //The headers aren't all there yet, or it isn't http at all and mongoose will say so
+        return true;
+    }
+
+    size_t length = 0;
+    std::string method(message.method.p, message.method.len);
+    std::string url(message.uri.p, message.uri.len);
+    struct mg_str *contentType = mg_get_http_header(&message, "Content-Type");
+    struct mg_str *contentLength = mg_get_http_header(&message, "Content-Length");
+    struct mg_str *expect = mg_get_http_header(&message, "Expect");
+    size_t limit = routeBodySizeLimit(method, url);
+
+    if (contentLength != NULL)
+    {
+        length = strtoul(std::string(contentLength->p, contentLength->len).c_str(), NULL, 10);
+
+        if (limit > 0 && length > limit)
+        {
+            //Refused before the body is read, a client waiting on "Expect: 100-continue" won't even send it
+            sendErrorNow(connection, 413, "Requested Entity Too Large");
+            mbuf_remove(&connection->recv_mbuf, connection->recv_mbuf.len);
+            connection->recv_mbuf_limit = 0;
+            return false;
+        }
+    }
+
+    //Multipart bodies are streamed part by part and not buffered, their parts are accounted for as they arrive
+    bool isMultipart = contentType != NULL && contentType->len >= 19 && mg_ncasecmp(contentType->p, "multipart/form-data", 19) == 0;
+    std::shared_ptr<Inflater> inflater = createInflater(&message, limit);
+
+    if (isMultipart)
+    {
+        length = 0;
+
+#ifdef HAS_ZLIB
+        if (inflater)
+        {
+            mInflaters[connection] = inflater;
+
+            if (!inflateReceived(connection, headerLength))
+            {
+                return false;
+            }
+        }
+#endif
+    }
+
+    BodyChunkHandler handler;
+    if (contentLength != NULL && !isMultipart && (handlesBodyChunks(method, url, &handler) || inflater))
+    {
+        if (startBodyStream(connection, &message, handler, length, inflater))
+        {
+            if (expect != NULL && mg_vcasecmp(expect, "100-continue") == 0)
+            {
+                mg_printf(connection, "%s", "HTTP/1.1 100 Continue\r\n\r\n");
+            }
+
+            //The headers were consumed, the body follows
+            mbuf_remove(&connection->recv_mbuf, headerLength);
+            size_t received = std::min(connection->recv_mbuf.len, length);
+            feedBodyStream(connection, connection->recv_mbuf.buf, received);
+            mbuf_remove(&connection->recv_mbuf, received);
+            return true;
+        }
+
+        return false;
+    }
+
+    if (mMemoryLimit > 0 && length > mMemoryLimit)
+    {
+        sendErrorNow(connection, 413, "Requested Entity Too Large");
+    }
+    else if (mMemoryLimit > 0 && length > 0 && mMemoryUsage + length > mMemoryLimit)
+    {
+        mg_printf(connection, "%s",
+                  "HTTP/1.0 503 Service Unavailable\r\n"
+                  "Retry-After: 1\r\n"
+                  "Content-Length: 0\r\n\r\n");
+        connection->flags |= MG_F_SEND_AND_CLOSE;
+    }
+    else
+    {
+        mBodyReservations[connection] = length;
+        mMemoryUsage += length;
+
+        if (expect != NULL && mg_vcasecmp(expect, "100-continue") == 0 && (length > 0 || isMultipart))
+        {
+            //The body is welcome, don't keep the client waiting for its timeout to send it
+            mg_printf(connection, "%s", "HTTP/1.1 100 Continue\r\n\r\n");
+        }
+
+        return true;
+    }
+
+    //Nothing of the request is parsed, and nothing more of it is read
+    mbuf_remove(&connection->recv_mbuf, connection->recv_mbuf.len);
+    connection->recv_mbuf_limit = 0;
+    return false;
+}
+
+size_t Server::routeBodySizeLimit(const std::string &method, const std::string &url) const
+{
+    for (auto controller: mControllers)
+    {
+        if (controller->handles(method, url))
+        {
+            size_t limit;
+            return controller->bodySizeLimit(method, url, &limit) ? limit : mBodySizeLimit;
+        }
+    }
+
+    return mBodySizeLimit;
+}
+
+bool Server::startBodyStream(struct mg_connection *connection, struct http_message *message, const BodyChunkHandler &handler,
+                             size_t length, const std::shared_ptr<Inflater>& inflater)
+{
+    //The same checks MG_EV_HTTP_REQUEST goes through, as this request will never get there
+    beginAccessLog(connection, message);
+    bool isAllowed = preRequest(connection, message);
+
+    if (isAllowed && requiresBasicAuthentication() && !authenticate(connection, message))
+    {
+        requestAuthentication(connection, mAuthDomain);
+        isAllowed = false;
+    }
+
+    if (!isAllowed)
+    {
+        noteAccessLogStatus(connection);
+        connection->flags |= MG_F_SEND_AND_CLOSE;
+        mbuf_remove(&connection->recv_mbuf, connection->recv_mbuf.len);
+        connection->recv_mbuf_limit = 0;
+        return false;
+    }
+
+    //The request only gets the headers, the body goes to the handler
+    struct http_message headers = *message;
+    headers.body.len = 0;
+
+    if (inflater)
+    {
+        //Handlers only ever see the decompressed body
+        removeHeader(&headers, "Content-Encoding");
+        removeHeader(&headers, "Content-Length");
+    }
+
+    auto request = createRequest(connection, &headers);
+    mCurrentRequests[connection] = request;
+    mCurrentResponses[connection] = createResponse(connection, request);
+
+    BodyStream& stream = mBodyStreams[connection];
+    stream.handler = handler;
+    stream.inflater = inflater;
+    stream.remaining = length;
+    stream.received = 0;
+    stream.body.clear();
+    return true;
+}
+
+void Server::feedBodyStream(struct mg_connection *connection, const char *data, size_t size)
+{
+    auto stream = mBodyStreams.find(connection);
+
+    if (size > 0)
+    {
+        stream->second.received += size;
+
+        if (stream->second.remaining != (size_t) ~0)
+        {
+            stream->second.remaining -= size;
+        }
+
+#ifdef HAS_ZLIB
+        std::string inflated;
+
+        if (stream->second.inflater)
+        {
+            if (!stream->second.inflater->inflate(data, size, inflated))
+            {
+                rejectEncodedBody(connection, *stream->second.inflater);
+                mBodyStreams.erase(stream);
+                return;
+            }
+
+            data = inflated.data();
+            size = inflated.size();
+        }
+#endif
+
+        bool result = true;
+
+        if (!stream->second.handler)
+        {
+            //Not a streaming route: the body is only decompressed, and handed over once complete
+            stream->second.body.append(data, size);
+        }
+        else if (size > 0)
+        {
+            try
+            {
+                result = stream->second.handler(mCurrentRequests[connection], mCurrentResponses[connection], data, size);
+            }
+            catch(...)
+            {
+                result = false;
+            }
+        }
+
+        if (!result)
+        {
+            auto response = mCurrentResponses[connection];
+
+            if (response->isValid())
+            {
+                response->sendError("Server error trying to handle the request body");
+            }
+
+            //Whatever is left of the body is dropped along with the connection
+            mBodyStreams.erase(stream);
+            connection->flags |= MG_F_SEND_AND_CLOSE;
+            connection->recv_mbuf_limit = 0;
+            return;
+        }
+    }
+
+    //A body announced as empty is done right away, a chunked one once mongoose says so
+    if (stream->second.remaining == 0)
+    {
+        finishBodyStream(connection);
+    }
+}
+
+void Server::finishBodyStream(struct mg_connection *connection)
+{
+    auto stream = mBodyStreams.find(connection);
+
+#ifdef HAS_ZLIB
+    if (stream->second.inflater && !stream->second.inflater->isFinished())
+    {
+        //The body ended before the compressed data did: it is truncated, not complete
+        rejectEncodedBody(connection, *stream->second.inflater);
+        mBodyStreams.erase(stream);
+        return;
+    }
+#endif
+
+    auto request = mCurrentRequests[connection];
+    auto response = mCurrentResponses[connection];
+
+    if (!stream->second.handler)
+    {
+        request->setBody(stream->second.body);
+    }
+
+    mBodyStreams.erase(stream);
+    handleRequest(request, response);
+}
+
+std::shared_ptr<Inflater> Server::createInflater(struct http_message *message, size_t bodySizeLimit)
+{
+#ifdef HAS_ZLIB
+    struct mg_str *contentEncoding = mg_get_http_header(message, "Content-Encoding");
+
+    if (contentEncoding != NULL)
+    {
+        std::string encoding(contentEncoding->p, contentEncoding->len);
+
+        if (Inflater::isSupported(encoding))
+        {
+            //The body limit applies to what the body decompresses to as well
+            size_t limit = mInflateSizeLimit;
+            if (bodySizeLimit > 0 && (limit == 0 || bodySizeLimit < limit))
+            {
+                limit = bodySizeLimit;
+            }
+
+            return std::make_shared<Inflater>(encoding, limit, mInflateRatioLimit);
+        }
+    }
+#endif
+
+    return nullptr;
+}
+
+#ifdef HAS_ZLIB
+bool Server::inflateReceived(struct mg_connection *connection, size_t offset)
+{
+    auto inflater = mInflaters.find(connection);
+    std::string inflated;
+
+    if (!inflater->second->inflate(connection->recv_mbuf.buf + offset, connection->recv_mbuf.len - offset, inflated))
+    {
+        rejectEncodedBody(connection, *inflater->second);
+        mInflaters.erase(inflater);
+        return false;
+    }
+
+    //The compressed bytes are replaced with what they decompress to
+    connection->recv_mbuf.len = offset;
+    mbuf_append(&connection->recv_mbuf, inflated.data(), inflated.size());
+    return true;
+}
+
+void Server::rejectEncodedBody(struct mg_connection *connection, const Inflater &inflater)
+{
+    if (inflater.isTooLarge())
+    {
+        sendErrorNow(connection, 413, "Requested Entity Too Large");
+    }
+    else
+    {
+        sendErrorNow(connection, 400, "Bad Request");
+    }
+
+    mbuf_remove(&connection->recv_mbuf, connection->recv_mbuf.len);
+    connection->recv_mbuf_limit = 0;
+}
+#endif
+
+void Server::accountMemory(struct mg_connection *c)
+{
+    size_t received = c->recv_mbuf.len;
+    auto reservation = mBodyReservations.find(c);
+
+    if (reservation != mBodyReservations.end())
+    {
+        received = std::max(received, reservation->second);
+    }
+
+    size_t usage = received + c->send_mbuf.len;
+
+    if (!mMultipartData.empty())
+    {
+        auto data = mMultipartData.find(c);
+        usage += data != mMultipartData.end() ? data->second->currentVariableData.size() : 0;
+    }
+
+    if (!mBodyStreams.empty())
+    {
+        auto stream = mBodyStreams.find(c);
+        usage += stream != mBodyStreams.end() ? stream->second.body.size() : 0;
+    }
+
+#ifdef HAS_NGHTTP2
+    if (!mHttp2Sessions.empty())
+    {
+        //Its streams' bodies, nghttp2 keeps opening the flow control windows as they arrive
+        auto session = mHttp2Sessions.find(c);
+        usage += session != mHttp2Sessions.end() ? session->second->memoryUsage() : 0;
+    }
+#endif
+
+    //Only the difference with what was counted for it before, no pass over all the connections
+    size_t& accounted = mAccountedMemory[c];
+    mConnectionsMemory = mConnectionsMemory - accounted + usage;
+    accounted = usage;
+}
+
+void Server::governMemory()
+{
+    size_t usage = mConnectionsMemory + (mUploadWriter ? mUploadWriter->queuedBytes() : 0);
+    mMemoryUsage = usage;
+
+    if (mMemoryLimit == 0)
+    {
+        if (mIsMemoryPaused)
+        {
+            setReadsPaused(false);
+        }
+
+        return;
+    }
+
+    if (!mIsMemoryPaused && usage > mMemoryLimit)
+    {
+        setReadsPaused(true);
+    }
+    else if (mIsMemoryPaused && usage <= mMemoryLimit / 4 * 3)
+    {
+        setReadsPaused(false);
+    }
+}
+
+void Server::setReadsPaused(bool paused)
+{
+    mIsMemoryPaused = paused;
+
+    for (struct mg_connection *c = mg_next(mManager, NULL); c != NULL; c = mg_next(mManager, c))
+    {
+        if (c->user_data != this || (c->flags & MG_F_LISTENING))
+        {
+            continue;
+        }
+
+        if (paused)
+        {
+            //Bodies that were admitted may finish arriving, their memory is already accounted for
+            if (!(c->flags & MG_F_SEND_AND_CLOSE) && mBodyReservations.find(c) == mBodyReservations.end())
+            {
+                Utils::pauseReads(c, Utils::MemoryPause);
+            }
+        }
+        else if (Utils::isReadPaused(c, Utils::MemoryPause))
+        {
+            //Connections paused for other reasons (uploads, TLS handshakes) stay paused
+            Utils::resumeReads(c, Utils::MemoryPause);
+        }
+    }
+}
+
+void Server::onClose(struct mg_connection *c)
+{
+    auto accounted = mAccountedMemory.find(c);
+    if (accounted != mAccountedMemory.end())
+    {
+        mConnectionsMemory -= accounted->second;
+        mAccountedMemory.erase(accounted);
+    }
+
+    endAccessLog(c);
+
+    if (mCurrentRequests.find(c) != mCurrentRequests.end())
+    {
+        mCurrentRequests[c]->setIsValid(false);
+        mCurrentRequests.erase(c);
+    }
+
+    if (mCurrentResponses.find(c) != mCurrentResponses.end())
+    {
+        //To make sure any current mCurrentResponse.send() will fail
+        mCurrentResponses[c]->setIsValid(false);
+        mCurrentResponses.erase(c);
+    }
+
+#ifdef HAS_NGHTTP2
+    auto session = mHttp2Sessions.find(c);
+    if (session != mHttp2Sessions.end())
+    {
+        session->second->close();
+        mHttp2Sessions.erase(session);
+    }
+#endif
+
+    mAuthenticatedUsers.erase(c);
+    mBodyReservations.erase(c);
+    mBodyStreams.erase(c);
+    mInflaters.erase(c);
+    freeMultipartData(c);
+
+    if (c->flags & MG_F_FRAME_QUEUE)
+    {
+        auto queue = mFrameQueues.find(c);
+        if (queue != mFrameQueues.end())
+        {
+            queue->second->setIsValid(false);
+            mFrameQueues.erase(queue);
+        }
+
+        auto webSocket = mWebSockets.find(c);
+        if (webSocket != mWebSockets.end())
+        {
+            WebSocketConnection connection = webSocket->second;
+            mWebSockets.erase(webSocket);
+
+            if (connection.handler.onClose)
+            {
+                connection.handler.onClose(connection.socket);
+            }
+        }
+    }
+}
+
+void Server::scheduleFlush(const std::shared_ptr<FrameQueue> &queue)
+{
+    {
+        std::lock_guard<std::mutex> lock(mPendingFlushesMutex);
+        mPendingFlushes.push_back(queue);
+    }
+
+    wakeup();
+}
+
+void Server::watchWritable(struct mg_connection *connection)
+{
+    {
+        std::lock_guard<std::mutex> lock(mPendingFlushesMutex);
+        mPendingWritables.push_back(connection);
+    }
+
+    wakeup();
+}
+
+#ifdef HAS_NGHTTP2
+void Server::scheduleSubmissions(const std::shared_ptr<Http2Session> &session)
+{
+    {
+        std::lock_guard<std::mutex> lock(mPendingFlushesMutex);
+        mPendingSubmissions.push_back(session);
+    }
+
+    wakeup();
+}
+#endif
+
+bool Server::isEventLoopThread() const
+{
+    const Server *loop = mHost ? mHost : this;
+    return loop->mPollingThread.load() == std::this_thread::get_id();
+}
+
+void Server::wakeup()
+{
+    //On the event loop thread itself there is nothing to wake: Server::poll flushes before returning
+    if (isEventLoopThread())
+    {
+        return;
+    }
+
+    //Wake the event loop up, one wake up covers everything scheduled until it runs.
+    //This never waits for the loop (as mg_broadcast does): callers may hold locks the loop thread is waiting for.
+    if (!mIsWakeupPending.exchange(true))
+    {
+        //Only held by start() and stop() while they change the manager, never while polling.
+        //A guest uses its host's manager: the host's lock is the one keeping it alive
+        std::lock_guard<std::mutex> lock(mWakeupMutex);
+        Server *loop = mHost ? mHost : this;
+        std::unique_lock<std::mutex> loopLock;
+
+        if (loop != this)
+        {
+            loopLock = std::unique_lock<std::mutex>(loop->mWakeupMutex);
+        }
+
+        struct mg_mgr *manager = loop->mManager;
+
+        if (manager)
+        {
+#ifdef __linux__
+            if (EpollInterface::wakeup(manager))
+            {
+                return;
+            }
+#endif
+
+            int socket = loop->mWakeupSocket;
+            if (socket >= 0)
+            {
+                //Non blocking: if the socket is full, the loop has wake ups to read anyway
+                static const char wakeup = 0;
+                send(socket, &wakeup, sizeof(wakeup), 0);
+            }
+        }
+    }
+}
+
+void Server::wakeup_handler(struct mg_connection *c, int ev, void *p, void *ud)
+{
+    //Waking mg_mgr_poll up is all the bytes are for, Server::poll flushes once it returns
+    if (ev == MG_EV_RECV)
     {
-        mg_mgr_poll(mManager, duration);
+        mbuf_remove(&c->recv_mbuf, c->recv_mbuf.len);
     }
 }
 
-void Server::stop()
+bool Server::openWakeupSocket()
 {
-    if (mIsRunning)
+#ifdef __linux__
+    if (mEventBackend == EpollBackend)
     {
-        mg_mgr_free(mManager);
-        delete mManager;
-        mManager = nullptr;
-        mIsRunning = false;
+        //EpollInterface::wakeup writes to its eventfd
+        return true;
+    }
+#endif
+
+    sock_t sockets[2];
+    if (!mg_socketpair(sockets, SOCK_DGRAM))
+    {
+        return false;
+    }
+
+#ifndef WIN32
+    fcntl(sockets[0], F_SETFL, fcntl(sockets[0], F_GETFL, 0) | O_NONBLOCK);
+#else
+    unsigned long nonBlocking = 1;
+    ioctlsocket(sockets[0], FIONBIO, &nonBlocking);
+#endif
+
+    //No user_data: it isn't one of the server's connections. mongoose closes it with the manager
+    if (!mg_add_sock(mManager, sockets[1], wakeup_handler, nullptr))
+    {
+        closesocket(sockets[0]);
+        closesocket(sockets[1]);
+        return false;
+    }
+
+    mWakeupSocket = (int) sockets[0];
+    return true;
+}
+
+void Server::flushPending()
+{
+    std::vector<std::shared_ptr<FrameQueue>> pending;
+    std::vector<struct mg_connection *> writables;
+#ifdef HAS_NGHTTP2
+    std::vector<std::weak_ptr<Http2Session>> submissions;
+#endif
+
+    mIsWakeupPending = false;
+    {
+        std::lock_guard<std::mutex> lock(mPendingFlushesMutex);
+        pending.swap(mPendingFlushes);
+        writables.swap(mPendingWritables);
+#ifdef HAS_NGHTTP2
+        submissions.swap(mPendingSubmissions);
+#endif
+    }
+
+#ifdef HAS_NGHTTP2
+    //Responses of HTTP/2 streams answered from other threads
+    for (const auto& weakSession: submissions)
+    {
+        auto session = weakSession.lock();
+
+        if (session)
+        {
+            session->runSubmissions();
+        }
+    }
+#endif
+
+    for (const auto& queue: pending)
+    {
+        if (!queue->isValid())
+        {
+            continue;
+        }
+
+        //Queues started outside of the event loop (eg. Response::startEventStream) are adopted here
+        struct mg_connection *c = queue->connection();
+        if (!(c->flags & MG_F_FRAME_QUEUE))
+        {
+            mFrameQueues[c] = queue;
+            c->flags |= MG_F_FRAME_QUEUE;
+        }
+
+        queue->flush();
+    }
+
+    for (auto c: writables)
+    {
+        //The connection may have closed since, only the ones with a response are still around
+        auto response = mCurrentResponses.find(c);
+
+        if (response != mCurrentResponses.end())
+        {
+            c->flags |= MG_F_WATCH_WRITABLE;
+            auto watched = response->second;
+            watched->notifyWritable();
+        }
+#ifdef HAS_NGHTTP2
+        else if (mHttp2Sessions.find(c) != mHttp2Sessions.end())
+        {
+            //The responses of HTTP/2 streams are notified as their streams drain, see Http2Session
+            auto session = mHttp2Sessions[c];
+            session->notifyWritable();
+        }
+#endif
+    }
+
+#ifdef HAS_OPENSSL
+    for (const auto& tls: mTlsBindAddresses)
+    {
+        tls.second->resumeHandshakes(mManager);
+    }
+#endif
+
+    dispatchUploads();
+    governMemory();
+
+    for (auto guest: mGuests)
+    {
+        guest->flushPending();
     }
 }
 
@@ -365,6 +2076,77 @@ void Server::deregisterController(Controller *c)
     }
 }
 
+void Server::registerCoprocessor(AbstractRequestCoprocessor *coprocessor)
+{
+    if (std::find(mCoprocessors.begin(), mCoprocessors.end(), coprocessor) == mCoprocessors.end())
+    {
+        coprocessor->setServer(this);
+        mCoprocessors.push_back(coprocessor);
+    }
+}
+
+void Server::deregisterCoprocessor(AbstractRequestCoprocessor *coprocessor)
+{
+    auto it = std::find(mCoprocessors.begin(), mCoprocessors.end(), coprocessor);
+
+    if (it != mCoprocessors.end())
+    {
+        mCoprocessors.erase(it);
+    }
+}
+
+bool Server::preRequest(struct mg_connection *connection, struct http_message *message)
+{
+    for (auto coprocessor: mCoprocessors)
+    {
+        if (!coprocessor->preRequest(connection, message))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool Server::authenticate(struct mg_connection *connection, struct http_message *message)
+{
+    struct mg_str *authorization = mg_get_http_header(message, "Authorization");
+
+    if (authorization == NULL)
+    {
+        mAuthenticatedUsers.erase(connection);
+        return false;
+    }
+
+    //Keep-alive requests usually repeat the same header, so skip decoding and hashing it again,
+    //unless the users changed since (a removed user or an old password must not go on working)
+    uint64_t generation = mCredentials.generation();
+    auto cached = mAuthenticatedUsers.find(connection);
+    if (cached != mAuthenticatedUsers.end()
+        && cached->second.generation == generation
+        && cached->second.authorization.size() == authorization->len
+        && memcmp(cached->second.authorization.data(), authorization->p, authorization->len) == 0)
+    {
+        return true;
+    }
+
+    char username[256] = {0};
+    char password[256] = {0};
+
+    if (mg_get_http_basic_auth(message, username, sizeof(username), password, sizeof(password)) < 0
+        || !mCredentials.verify(username, password))
+    {
+        mAuthenticatedUsers.erase(connection);
+        return false;
+    }
+
+    AuthenticatedUser& user = mAuthenticatedUsers[connection];
+    user.authorization = std::string(authorization->p, authorization->len);
+    user.username = username;
+    user.generation = generation;
+    return true;
+}
+
 bool Server::handleRequest(const std::shared_ptr<Request> &request, const std::shared_ptr<Response> &response)
 {
     mRequests++;
@@ -377,7 +2159,8 @@ bool Server::handleRequest(const std::shared_ptr<Request> &request, const std::s
         {
             try
             {
-                result = controller->handleRequest(request, response);
+                result = mPipeline ? mPipeline->handle(request, response, controller)
+                                   : controller->handleRequest(request, response);
             }
             catch(...)
             {
@@ -395,6 +2178,63 @@ bool Server::handleRequest(const std::shared_ptr<Request> &request, const std::s
     return result;
 }
 
+bool Server::automaticETags() const
+{
+    return mAutomaticETags;
+}
+
+void Server::setAutomaticETags(bool enabled)
+{
+    mAutomaticETags = enabled;
+}
+
+AbstractPipeline *Server::pipeline() const
+{
+    return mPipeline;
+}
+
+void Server::setPipeline(AbstractPipeline *pipeline)
+{
+    mPipeline = pipeline;
+}
+
+bool Server::handlesBodyChunks(const string &method, const string &url, BodyChunkHandler *handler)
+{
+    for (auto controller: mControllers)
+    {
+        if (controller->handles(method, url))
+        {
+            //The first controller handling a route gets its requests, see handleRequest
+            return controller->handlesBodyChunks(method, url, handler);
+        }
+    }
+
+    return false;
+}
+
+bool Server::handlesWebSocket(const string &url, WebSocketHandler *handler)
+{
+    for (auto controller: mControllers)
+    {
+        if (controller->handlesWebSocket(url, handler))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+size_t Server::webSocketQueueLimit() const
+{
+    return mWebSocketQueueLimit;
+}
+
+void Server::setWebSocketQueueLimit(size_t bytes)
+{
+    mWebSocketQueueLimit = bytes;
+}
+
 bool Server::handles(const string &method, const string &url)
 {
     for (auto controller: mControllers)
@@ -428,6 +2268,71 @@ void Server::setUploadSizeLimit(size_t limit)
     mUploadSizeLimit = limit;
 }
 
+size_t Server::bodySizeLimit() const
+{
+    return mBodySizeLimit;
+}
+
+void Server::setBodySizeLimit(size_t bytes)
+{
+    mBodySizeLimit = bytes;
+}
+
+#ifdef HAS_ZLIB
+size_t Server::inflateSizeLimit() const
+{
+    return mInflateSizeLimit;
+}
+
+void Server::setInflateSizeLimit(size_t bytes)
+{
+    mInflateSizeLimit = bytes;
+}
+
+size_t Server::inflateRatioLimit() const
+{
+    return mInflateRatioLimit;
+}
+
+void Server::setInflateRatioLimit(size_t ratio)
+{
+    mInflateRatioLimit = ratio;
+}
+#endif
+
+#ifdef HAS_NGHTTP2
+bool Server::isHttp2Enabled() const
+{
+    return mHttp2Enabled;
+}
+
+void Server::setHttp2Enabled(bool enabled)
+{
+    mHttp2Enabled = enabled;
+}
+
+unsigned int Server::http2MaxConcurrentStreams() const
+{
+    return mHttp2MaxConcurrentStreams;
+}
+
+void Server::setHttp2MaxConcurrentStreams(unsigned int streams)
+{
+    mHttp2MaxConcurrentStreams = streams;
+}
+
+unsigned int Server::http2InitialWindowSize() const
+{
+    return mHttp2InitialWindowSize;
+}
+
+void Server::setHttp2InitialWindowSize(unsigned int bytes)
+{
+    //The protocol's limit
+    mHttp2InitialWindowSize = std::min(bytes, (unsigned int) 0x7fffffff);
+}
+#endif
+
 std::string Server::bindAddress() const
 {
     return mBindAddress;
@@ -446,7 +2351,7 @@ bool Server::directoryListingEnabled() const
 void Server::setDirectoryListingEnabled(bool value)
 {
     mEnableDirectoryListing = value? "yes" : "no";
-    sHttpOptions.enable_directory_listing = mEnableDirectoryListing.c_str();
+    mHttpOptions->enable_directory_listing = mEnableDirectoryListing.c_str();
 }
 
 string Server::documentRoot() const
@@ -457,7 +2362,7 @@ string Server::documentRoot() const
 void Server::setDocumentRoot(const string &root)
 {
     mDocumentRoot = root;
-    sHttpOptions.document_root = mDocumentRoot.c_str();
+    mHttpOptions->document_root = mDocumentRoot.c_str();
 }
 
 string Server::indexFiles() const
@@ -468,7 +2373,7 @@ string Server::indexFiles() const
 void Server::setIndexFiles(const string &files)
 {
     mIndexFiles = files;
-    sHttpOptions.index_files = mIndexFiles.c_str();
+    mHttpOptions->index_files = mIndexFiles.c_str();
 }
 
 string Server::authDomain() const
@@ -479,7 +2384,7 @@ string Server::authDomain() const
 void Server::setAuthDomain(const string &domain)
 {
     mAuthDomain = domain;
-    sHttpOptions.auth_domain = mAuthDomain.c_str();
+    mHttpOptions->auth_domain = mAuthDomain.c_str();
 }
 
 string Server::basicAuthUsername() const
@@ -489,7 +2394,14 @@ string Server::basicAuthUsername() const
 
 void Server::setBasicAuthUsername(const string &user)
 {
+    if (mIsBasicAuthUserAdded)
+    {
+        mCredentials.removeUser(mBasicAuthUsername);
+        mIsBasicAuthUserAdded = false;
+    }
+
     mBasicAuthUsername = user;
+    updateBasicAuthUser();
 }
 
 string Server::basicAuthPassword() const
@@ -500,11 +2412,57 @@ string Server::basicAuthPassword() const
 void Server::setBasicAuthPassword(const string &password)
 {
     mBasicAuthPassword = password;
+    updateBasicAuthUser();
+}
+
+void Server::updateBasicAuthUser()
+{
+    if (mBasicAuthUsername.size() > 0 && mBasicAuthPassword.size() > 0)
+    {
+        //A user of the same name added through addBasicAuthUser is left as it is
+        if (mIsBasicAuthUserAdded || !mCredentials.hasUser(mBasicAuthUsername))
+        {
+            mCredentials.addUser(mBasicAuthUsername, mBasicAuthPassword);
+            mIsBasicAuthUserAdded = true;
+        }
+    }
+    else if (mIsBasicAuthUserAdded)
+    {
+        //As before there was a table of users: an empty username or password turns this user off
+        mCredentials.removeUser(mBasicAuthUsername);
+        mIsBasicAuthUserAdded = false;
+    }
+}
+
+void Server::addBasicAuthUser(const string &user, const string &password)
+{
+    mCredentials.addUser(user, password);
+
+    if (user == mBasicAuthUsername)
+    {
+        //It is addBasicAuthUser's now, setBasicAuthUsername won't take it away
+        mIsBasicAuthUserAdded = false;
+    }
+}
+
+void Server::removeBasicAuthUser(const string &user)
+{
+    mCredentials.removeUser(user);
+
+    if (user == mBasicAuthUsername)
+    {
+        mIsBasicAuthUserAdded = false;
+    }
+}
+
+Credentials &Server::basicAuthCredentials()
+{
+    return mCredentials;
 }
 
 bool Server::requiresBasicAuthentication() const
 {
-    return mBasicAuthUsername.size() > 0 && mBasicAuthPassword.size() > 0;
+    return !mCredentials.isEmpty();
 }
 
 string Server::ipAccessControlList() const
@@ -512,10 +2470,70 @@ string Server::ipAccessControlList() const
     return mIpAccessControlList;
 }
 
-void Server::setIpAccessControlList(const string &acl)
+std::vector<std::string> Server::bindAddresses() const
+{
+    std::vector<std::string> addresses;
+    addresses.push_back(mBindAddress);
+    addresses.insert(addresses.end(), mExtraBindAddresses.begin(), mExtraBindAddresses.end());
+    return addresses;
+}
+
+void Server::addBindAddress(const string &address)
+{
+    mExtraBindAddresses.push_back(address);
+}
+
+#ifdef HAS_OPENSSL
+void Server::addTlsBindAddress(const string &address, TlsContext *context)
+{
+    mTlsBindAddresses.push_back(std::make_pair(address, context));
+}
+
+std::vector<std::string> Server::tlsBindAddresses() const
+{
+    std::vector<std::string> addresses;
+
+    for (const auto& tls: mTlsBindAddresses)
+    {
+        addresses.push_back(tls.first);
+    }
+
+    return addresses;
+}
+
+void Server::setTlsListeningSockets(const std::vector<int> &sockets)
+{
+    mTlsListeningSockets = sockets;
+}
+#endif
+
+bool Server::setIpAccessControlList(const string &acl)
 {
+    std::shared_ptr<const IpAccessControlList> compiled;
+
+    if (acl.size() > 0)
+    {
+        compiled = IpAccessControlList::fromString(acl);
+
+        if (!compiled)
+        {
+            return false;
+        }
+    }
+
     mIpAccessControlList = acl;
-    sHttpOptions.ip_acl = mIpAccessControlList.c_str();
+    setIpAccessControlList(compiled);
+    return true;
+}
+
+void Server::setIpAccessControlList(const std::shared_ptr<const IpAccessControlList> &acl)
+{
+    std::atomic_store(&mCompiledIpAccessControlList, acl);
+}
+
+std::shared_ptr<const IpAccessControlList> Server::compiledIpAccessControlList() const
+{
+    return std::atomic_load(&mCompiledIpAccessControlList);
 }
 
 string Server::hiddenFilePattern() const
@@ -526,7 +2544,7 @@ string Server::hiddenFilePattern() const
 void Server::setHiddenFilePattern(const string &pattern)
 {
     mHiddenFilePattern = pattern;
-    sHttpOptions.hidden_file_pattern = mHiddenFilePattern.c_str();
+    mHttpOptions->hidden_file_pattern = mHiddenFilePattern.c_str();
 }
 
 string Server::extraHeaders() const
@@ -539,6 +2557,16 @@ void Server::setExtraHeaders(const string &headers)
     mExtraHeaders = headers;
 }
 
+int Server::unixSocketPermissions() const
+{
+    return mUnixSocketPermissions;
+}
+
+void Server::setUnixSocketPermissions(int permissions)
+{
+    mUnixSocketPermissions = permissions;
+}
+
 string Server::tmpDir() const
 {
     return mTmpDir;
@@ -549,6 +2577,41 @@ void Server::setTmpDir(const string &tmpDir)
     mTmpDir = tmpDir;
 }
 
+Server::EventBackend Server::eventBackend() const
+{
+    return mEventBackend;
+}
+
+void Server::setEventBackend(EventBackend backend)
+{
+    mEventBackend = backend;
+}
+
+size_t Server::uploadBufferLimit() const
+{
+    return mUploadBufferLimit;
+}
+
+void Server::setUploadBufferLimit(size_t bytes)
+{
+    mUploadBufferLimit = bytes;
+}
+
+size_t Server::memoryLimit() const
+{
+    return mMemoryLimit;
+}
+
+void Server::setMemoryLimit(size_t bytes)
+{
+    mMemoryLimit = bytes;
+}
+
+size_t Server::memoryUsage() const
+{
+    return mMemoryUsage;
+}
+
 void Server::printStats()
 {
     int delta = Utils::getTime()-mStartTime;
@@ -556,6 +2619,14 @@ void Server::printStats()
     if (delta)
     {
         cout << "Requests: " << mRequests << ", Requests/s: " << (mRequests*1.0/delta) << endl;
+        cout << "Buffered bytes: " << mMemoryUsage;
+
+        if (mMemoryLimit > 0)
+        {
+            cout << " of " << mMemoryLimit;
+        }
+
+        cout << endl;
     }
 }
 }
@@ -1,28 +1,54 @@
 #ifndef _MONGOOSE_SERVER_H
 #define _MONGOOSE_SERVER_H
 
+#include <atomic>
 #include <iostream>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
+#include "AccessLog.h"
+#include "Controller.h"
+#include "Credentials.h"
+#include "WebSocket.h"
+
+struct http_message;
 struct mg_connection;
 struct mg_mgr;
+struct mg_serve_http_opts;
 
 /**
  * Wrapper for the Mongoose server
  */
 namespace Mongoose
 {
+class AbstractPipeline;
+class AbstractRequestCoprocessor;
 class Controller;
+class FrameQueue;
+class Http2Session;
+class Inflater;
+class IpAccessControlList;
+struct MultipartData;
 class Request;
 class Response;
+class TlsContext;
+class UploadWriter;
 class Server
 {
 public:
+    enum EventBackend
+    {
+        SelectBackend,  //mongoose's default, portable, limited to FD_SETSIZE connections
+        EpollBackend    //Linux only, scales to many mostly idle connections. Elsewhere, select is used.
+    };
+
     /**
      * @brief Constructs the Server
-     * @param bindAddress something like ":80", "0.0.0.0:80",  etc...
+     * @param bindAddress something like ":80", "0.0.0.0:80", "unix:/run/app.sock" etc...
      * @param documentRoot Path to serve files from.
      */
     Server(const char *bindAddress = ":8080", const char *documentRoot = "www");
@@ -36,9 +62,11 @@ public:
 
     /**
      * @brief start the server if it is already not started
+     * @param host - another, already running, server whose event loop this server should share.
+     * Polling the host then serves both. Stop such a server before its host.
      * @return true if the server is started
      */
-    bool start();
+    bool start(Server *host = nullptr);
 
     /**
      * @brief poll the server for incoming connections/requests for duration
@@ -51,6 +79,32 @@ public:
      */
     void stop();
 
+    /**
+     * @brief setListeningSockets - makes start() serve connections accepted on already bound, listening
+     * sockets instead of binding bindAddresses() itself. Used by Prefork to share listeners between workers.
+     * @param sockets - the listening sockets, or none to go back to binding bindAddresses()
+     */
+    void setListeningSockets(const std::vector<int>& sockets);
+    std::vector<int> listeningSockets() const;
+
+    /**
+     * @brief stopListening - stops accepting new connections, while still serving the already open ones
+     * for as long as the server is polled.
+     */
+    void stopListening();
+
+    /**
+     * @brief connectionCount
+     * @return the number of open client connections
+     */
+    size_t connectionCount() const;
+
+    /**
+     * @brief manager - the mongoose event loop the server runs on, for other connections to share (see HttpClient)
+     * @return nullptr while the server isn't running
+     */
+    struct mg_mgr *manager() const;
+
     /**
      * @brief registerController - add another controller that provides custom http routes
      */
@@ -62,6 +116,68 @@ public:
      */
     void deregisterController(Controller *c);
 
+    /**
+     * @brief registerCoprocessor - add a coprocessor that gets to see every incoming request
+     * through AbstractRequestCoprocessor::preRequest, before it is routed to a controller.
+     * @param coprocessor
+     */
+    void registerCoprocessor(AbstractRequestCoprocessor *coprocessor);
+
+    /**
+     * @brief deregisterCoprocessor - removes the coprocessor from all processing
+     * @param coprocessor
+     */
+    void deregisterCoprocessor(AbstractRequestCoprocessor *coprocessor);
+
+    /**
+     * @brief automaticETags / setAutomaticETags - tags the responses of controllers with an ETag hashed from
+     * their body, and answers 304 Not Modified to clients that have it already (see Response::setAutomaticETag).
+     * Off by default. Handlers can also call Response::notModified() to skip generating the body altogether.
+     */
+    bool automaticETags() const;
+    void setAutomaticETags(bool enabled);
+
+    /**
+     * @brief pipeline / setPipeline - a middleware chain every request routed to a controller runs through,
+     * see Pipeline. nullptr, the default, for none. The pipeline must outlive the server.
+     */
+    AbstractPipeline* pipeline() const;
+    void setPipeline(AbstractPipeline *pipeline);
+
+    /**
+     * @brief handlesWebSocket
+     * @param url
+     * @param handler - if not null, set to the callbacks of the controller accepting websockets on url
+     * @return true if a controller accepts websockets on url
+     */
+    bool handlesWebSocket(const std::string& url, WebSocketHandler *handler = nullptr);
+
+    /**
+     * @brief handlesBodyChunks
+     * @param handler - if not null, set to the body chunk handler of the route
+     * @return true if a controller streams the request bodies of method + url, see Controller::registerRoute
+     */
+    bool handlesBodyChunks(const std::string& method, const std::string& url, BodyChunkHandler *handler = nullptr);
+
+    /**
+     * @brief webSocketQueueLimit / setWebSocketQueueLimit - how many bytes may be queued for a websocket
+     * before its client is considered too slow and disconnected
+     */
+    size_t webSocketQueueLimit() const;
+    void setWebSocketQueueLimit(size_t bytes);
+
+    /**
+     * @brief scheduleFlush - asks the event loop to write out what is queued on a long lived connection.
+     * Can be called from any thread, FrameQueue does it whenever something is pushed.
+     */
+    void scheduleFlush(const std::shared_ptr<FrameQueue>& queue);
+
+    /**
+     * @brief watchWritable - asks the event loop to tell the connection's Response whenever its send buffer
+     * drains, see Response::onWritable. Can be called from any thread, Response does it.
+     */
+    void watchWritable(struct mg_connection *connection);
+
     /**
      * @brief printStats prints basic statistics about the server to stdout
      */
@@ -78,12 +194,116 @@ public:
     bool allowMultipleClients() const;
     void setAllowMultipleClients(bool value);
 
+    /**
+     * @brief uploadSizeLimit / setUploadSizeLimit - the largest part a multipart request may carry
+     */
     size_t uploadSizeLimit() const;
     void setUploadSizeLimit(size_t limit);
 
+    /**
+     * @brief bodySizeLimit / setBodySizeLimit - the largest request body accepted on routes without a limit of
+     * their own (see Controller::setBodySizeLimit). Requests announcing a larger Content-Length are answered
+     * with 413 before their body is read, chunked ones as soon as they go over. 0, the default, for no limit.
+     */
+    size_t bodySizeLimit() const;
+    void setBodySizeLimit(size_t bytes);
+
+#ifdef HAS_ZLIB
+    /**
+     * @brief inflateSizeLimit / setInflateSizeLimit - request bodies sent with "Content-Encoding: gzip" or
+     * "deflate" are decompressed as they arrive, handlers only ever see the decoded body. A body that decodes
+     * to more than this (or than the route's body size limit, whichever is lower) is answered with 413.
+     * 0 for no limit other than the route's.
+     */
+    size_t inflateSizeLimit() const;
+    void setInflateSizeLimit(size_t bytes);
+
+    /**
+     * @brief inflateRatioLimit / setInflateRatioLimit - the largest decompressed/compressed size ratio accepted
+     * once a body has decoded to more than 1MB, so a small "zip bomb" is refused before it adds up.
+     * 0, the default, for no limit: 100 is a reasonable value for most applications.
+     */
+    size_t inflateRatioLimit() const;
+    void setInflateRatioLimit(size_t ratio);
+#endif
+
+#ifdef HAS_NGHTTP2
+    /**
+     * @brief isHttp2Enabled / setHttp2Enabled - serves HTTP/2 cleartext (h2c) to the clients that ask for it,
+     * with prior knowledge (the connection opens with the HTTP/2 preface) or an "Upgrade: h2c" request.
+     * Every stream is a Request/Response pair to the controllers, as with HTTP/1. On by default.
+     */
+    bool isHttp2Enabled() const;
+    void setHttp2Enabled(bool enabled);
+
+    /**
+     * @brief http2MaxConcurrentStreams / setHttp2MaxConcurrentStreams - how many requests a client may have
+     * in flight on a single HTTP/2 connection
+     */
+    unsigned int http2MaxConcurrentStreams() const;
+    void setHttp2MaxConcurrentStreams(unsigned int streams);
+
+    /**
+     * @brief http2InitialWindowSize / setHttp2InitialWindowSize - how much of a request body a client may send
+     * on a stream ahead of the server reading it (HTTP/2 flow control)
+     */
+    unsigned int http2InitialWindowSize() const;
+    void setHttp2InitialWindowSize(unsigned int bytes);
+#endif
+
     std::string bindAddress() const;
     void setBindAddress(const std::string& address);
 
+    /**
+     * @brief addBindAddress - makes the server listen on another address too, in addition to bindAddress()
+     * @param address - something like ":8081", "127.0.0.1:8081", etc...
+     * Like bindAddress(), it can also be a unix domain socket: "unix:/run/app.sock",
+     * or a Linux abstract one: "unix:@app"
+     */
+    void addBindAddress(const std::string& address);
+
+#ifdef HAS_OPENSSL
+    /**
+     * @brief addTlsBindAddress - makes the server listen for TLS (HTTPS) connections on address too
+     * @param context - certificate and TLS settings, it must outlive the server. Several addresses may share one.
+     */
+    void addTlsBindAddress(const std::string& address, TlsContext *context);
+
+    /**
+     * @brief tlsBindAddresses
+     * @return the addresses the server listens on for TLS connections, in the order they were added
+     */
+    std::vector<std::string> tlsBindAddresses() const;
+
+    /**
+     * @brief setTlsListeningSockets - like setListeningSockets, for tlsBindAddresses(): one already bound,
+     * listening socket per address, in the same order. Used by Prefork.
+     */
+    void setTlsListeningSockets(const std::vector<int>& sockets);
+#endif
+
+    /**
+     * @brief bindAddresses
+     * @return all the addresses the server listens on in clear, bindAddress() first
+     */
+    std::vector<std::string> bindAddresses() const;
+
+    /**
+     * @brief unixSocketPermissions / setUnixSocketPermissions - the file mode given to unix domain
+     * sockets the server creates. Defaults to 0660: only the owner and its group may connect.
+     */
+    int unixSocketPermissions() const;
+    void setUnixSocketPermissions(int permissions);
+
+    /**
+     * @brief bindUnixSocket - creates a listening unix domain socket
+     * @param address - "unix:/path/to.sock", or "unix:@name" for a Linux abstract socket
+     * @param permissions - file mode of the socket, ignored for abstract sockets
+     * @return the non blocking, listening socket or -1 on error (see errno). A socket file left over by a
+     * previous run is replaced, but not one another process still listens on (EADDRINUSE)
+     */
+    static int bindUnixSocket(const std::string& address, int permissions = 0660);
+
     bool directoryListingEnabled() const;
     void setDirectoryListingEnabled(bool value);
 
@@ -102,10 +322,36 @@ public:
     std::string basicAuthPassword() const;
     void setBasicAuthPassword(const std::string& password);
 
+    /**
+     * @brief addBasicAuthUser - adds a user that may access the server through http basic authentication.
+     * Once at least one user is added, every request must authenticate.
+     */
+    void addBasicAuthUser(const std::string& user, const std::string& password);
+    void removeBasicAuthUser(const std::string& user);
+
+    /**
+     * @brief basicAuthCredentials
+     * @return the table of users allowed to access the server
+     */
+    Credentials& basicAuthCredentials();
+
     bool requiresBasicAuthentication() const;
 
+    /**
+     * @brief ipAccessControlList / setIpAccessControlList - the list of allowed/denied client networks,
+     * in the mongoose format: "-0.0.0.0/0,+192.168/16". It is checked as soon as a connection is accepted,
+     * so it applies to controller routes and static files alike.
+     */
     std::string ipAccessControlList() const;
-    void setIpAccessControlList(const std::string& acl);
+    bool setIpAccessControlList(const std::string& acl);
+
+    /**
+     * @brief setIpAccessControlList - replaces the access control list with a precompiled one.
+     * Safe to call from any thread while the server is polled, eg. to reload a blocklist.
+     * @param acl - the new list, or nullptr to allow everybody
+     */
+    void setIpAccessControlList(const std::shared_ptr<const IpAccessControlList>& acl);
+    std::shared_ptr<const IpAccessControlList> compiledIpAccessControlList() const;
 
     std::string hiddenFilePattern() const;
     void setHiddenFilePattern(const std::string& pattern);
@@ -113,38 +359,224 @@ public:
     std::string extraHeaders() const;
     void setExtraHeaders(const std::string& headers);
 
+    /**
+     * @brief eventBackend / setEventBackend - how the event loop waits for its sockets.
+     * Has to be set before start(), servers started on a host server use the host's.
+     */
+    EventBackend eventBackend() const;
+    void setEventBackend(EventBackend backend);
+
+    /**
+     * @brief tmpDir / setTmpDir - where uploaded files are written, each under its own unique name
+     */
     std::string tmpDir() const;
     void setTmpDir(const std::string& tmpDir);
 
+    /**
+     * @brief uploadBufferLimit / setUploadBufferLimit - how many bytes of uploads may wait in memory for
+     * the disk. Past that, uploading connections aren't read from until the writes catch up.
+     */
+    size_t uploadBufferLimit() const;
+    void setUploadBufferLimit(size_t bytes);
+
+    /**
+     * @brief memoryLimit / setMemoryLimit - a budget for the bytes buffered in memory across all connections:
+     * request bodies being received (HTTP/2 streams too), responses being sent, multipart variables and uploads
+     * waiting for the disk. Once it is exceeded, connections aren't read from until usage falls under 3/4 of it.
+     * Requests announcing a body that doesn't fit are rejected as soon as their headers arrive. 0, the default,
+     * disables the budget.
+     */
+    size_t memoryLimit() const;
+    void setMemoryLimit(size_t bytes);
+
+    /**
+     * @brief accessLog / setAccessLog - where every request is logged once it is answered (or its connection
+     * closes), nullptr, the default, for nowhere. The log must outlive the server.
+     */
+    AccessLog* accessLog() const;
+    void setAccessLog(AccessLog *log);
+
+    /**
+     * @brief memoryUsage
+     * @return the bytes buffered as of the last poll, counting the whole announced body of requests being received
+     */
+    size_t memoryUsage() const;
+
 private:
     static void ev_handler(struct mg_connection *c, int ev, void *p, void* ud);
+    static void handleEvent(Server *server, struct mg_connection *c, int ev, void *p);
 
     bool handleRequest(const std::shared_ptr<Request>& request, const std::shared_ptr<Response>& response);
+    bool preRequest(struct mg_connection *connection, struct http_message *message);
+    bool authenticate(struct mg_connection *connection, struct http_message *message);
+    struct mg_connection *bind(const std::string& address);
+    struct mg_connection *adoptListeningSocket(int socket);
+    bool addListener(struct mg_connection *listener);
+    std::shared_ptr<Request> createRequest(struct mg_connection *connection, struct http_message *message, bool isMultipart = false);
+    std::shared_ptr<Response> createResponse(struct mg_connection *connection, const std::shared_ptr<Request>& request);
+    MultipartData* multipartData(struct mg_connection *connection) const;
+    void freeMultipartData(struct mg_connection *connection);
+    UploadWriter *uploadWriter();
+    void pauseUpload(struct mg_connection *connection);
+    void dispatchUploads();
+    bool admitRequest(struct mg_connection *connection);
+    size_t routeBodySizeLimit(const std::string& method, const std::string& url) const;
+    bool startBodyStream(struct mg_connection *connection, struct http_message *message, const BodyChunkHandler& handler,
+                         size_t length, const std::shared_ptr<Inflater>& inflater = nullptr);
+    void feedBodyStream(struct mg_connection *connection, const char *data, size_t size);
+    void finishBodyStream(struct mg_connection *connection);
+    std::shared_ptr<Inflater> createInflater(struct http_message *message, size_t bodySizeLimit);
+#ifdef HAS_ZLIB
+    bool inflateReceived(struct mg_connection *connection, size_t offset);
+    void rejectEncodedBody(struct mg_connection *connection, const Inflater& inflater);
+#endif
+    void beginAccessLog(struct mg_connection *connection, struct http_message *message);
+    void noteAccessLogStatus(struct mg_connection *connection);
+    void endAccessLog(struct mg_connection *connection);
+    void accountMemory(struct mg_connection *connection);
+    void governMemory();
+    void setReadsPaused(bool paused);
+    void onClose(struct mg_connection *connection);
+    void flushPending();
+    void wakeup();
+    bool isEventLoopThread() const;
+#ifdef HAS_NGHTTP2
+    void scheduleSubmissions(const std::shared_ptr<Http2Session>& session);
+#endif
+    static void wakeup_handler(struct mg_connection *c, int ev, void *p, void* ud);
+    bool openWakeupSocket();
+    void updateBasicAuthUser();
 
     bool mIsRunning;
     struct mg_mgr *mManager{nullptr};
-    struct mg_connection *mConnection{nullptr};
+    bool mOwnsManager{true};
+    EventBackend mEventBackend{SelectBackend};
+    std::vector<struct mg_connection *> mListeners;
+    std::vector<int> mListeningSockets;
 
     //Internals
     std::map<struct mg_connection*, std::shared_ptr<Request>> mCurrentRequests;
     std::map<struct mg_connection*, std::shared_ptr<Response>> mCurrentResponses;
+    std::map<struct mg_connection*, MultipartData*> mMultipartData;
+
+    //Uploads are written by a background thread. Requests whose files aren't on disk yet wait in
+    //mPendingUploads, connections sending faster than the disk keeps up are paused in mPausedUploads.
+    std::unique_ptr<UploadWriter> mUploadWriter;
+    std::vector<struct mg_connection *> mPendingUploads;
+    std::vector<struct mg_connection *> mPausedUploads;
+    size_t mUploadBufferLimit{16*1024*1024};
+
+    //Requests whose body is handed to a route as it arrives, rather than buffered by mongoose.
+    //Compressed bodies go through here too: without a handler the decoded body is gathered in body.
+    struct BodyStream
+    {
+        BodyChunkHandler handler;
+        std::shared_ptr<Inflater> inflater;
+        size_t remaining;       //Bytes of the body still to come, or ~0 if it is chunked
+        size_t received;
+        std::string body;
+    };
+    std::unordered_map<struct mg_connection *, BodyStream> mBodyStreams;
+
+    //Compressed multipart bodies, decoded in the receive buffer before mongoose parses them
+    std::unordered_map<struct mg_connection *, std::shared_ptr<Inflater>> mInflaters;
+    size_t mInflateSizeLimit{100*1024*1024};
+    size_t mInflateRatioLimit{0};
+
+#ifdef HAS_NGHTTP2
+    //Connections switched to HTTP/2
+    friend class Http2Session;
+    std::unordered_map<struct mg_connection *, std::shared_ptr<Http2Session>> mHttp2Sessions;
+    bool mHttp2Enabled{true};
+    unsigned int mHttp2MaxConcurrentStreams{100};
+    unsigned int mHttp2InitialWindowSize{65535};
+#endif
+
+    //Requests being answered, logged once they are done
+    struct PendingAccessLog
+    {
+        AccessLog::Record record;
+        size_t sendOffset;      //Where the response starts in the send buffer
+    };
+    AccessLog *mAccessLog{nullptr};
+    std::unordered_map<struct mg_connection *, PendingAccessLog> mAccessLogRecords;
+
+    //The body sizes announced by requests whose headers arrived, counted against mMemoryLimit up front
+    std::unordered_map<struct mg_connection *, size_t> mBodyReservations;
+    size_t mMemoryLimit{0};
+    std::atomic<size_t> mMemoryUsage{0};
+    //What each connection's buffers held after its last event, and their total
+    std::unordered_map<struct mg_connection *, size_t> mAccountedMemory;
+    size_t mConnectionsMemory{0};
+    bool mIsMemoryPaused{false};
+
+    //Long lived connections
+    struct WebSocketConnection
+    {
+        std::shared_ptr<WebSocket> socket;
+        WebSocketHandler handler;
+    };
+    std::map<struct mg_connection*, WebSocketConnection> mWebSockets;
+    std::unordered_map<struct mg_connection*, std::shared_ptr<FrameQueue>> mFrameQueues;
+    size_t mWebSocketQueueLimit{1024*1024};
+
+    std::mutex mPendingFlushesMutex;
+    std::vector<std::shared_ptr<FrameQueue>> mPendingFlushes;
+    std::vector<struct mg_connection *> mPendingWritables;
+#ifdef HAS_NGHTTP2
+    std::vector<std::weak_ptr<Http2Session>> mPendingSubmissions;
+#endif
+    std::atomic_bool mIsWakeupPending{false};
+    std::atomic<int> mWakeupSocket{-1};     //What wakeup() writes to, when the loop doesn't poll with epoll
+    std::mutex mWakeupMutex;                //Keeps start() and stop() from changing mManager under wakeup()
+    std::atomic<std::thread::id> mPollingThread{std::thread::id()};
+
+    //Servers started on this server's event loop, and the server this one is started on
+    std::vector<Server *> mGuests;
+    Server *mHost{nullptr};
     std::vector<Controller *> mControllers;
+    std::vector<AbstractRequestCoprocessor *> mCoprocessors;
+    AbstractPipeline *mPipeline{nullptr};
+    bool mAutomaticETags{false};
+
+    //The Authorization header each connection last authenticated with, the user it belongs to,
+    //and the generation of mCredentials it was verified against
+    struct AuthenticatedUser
+    {
+        std::string authorization;
+        std::string username;
+        uint64_t generation;
+    };
+    std::map<struct mg_connection*, AuthenticatedUser> mAuthenticatedUsers;
 
     // Bind options
     std::string mBindAddress;
+    std::vector<std::string> mExtraBindAddresses;
+#ifdef HAS_OPENSSL
+    std::vector<std::pair<std::string, TlsContext *>> mTlsBindAddresses;
+    std::vector<int> mTlsListeningSockets;
+#endif
+    std::vector<std::string> mUnixSocketPaths;
+    int mUnixSocketPermissions{0660};
     bool mAllowMultipleClients;
 
     // Http Options
+    std::unique_ptr<struct mg_serve_http_opts> mHttpOptions;
     std::string mDocumentRoot;
     std::string mIndexFiles;
     std::string mEnableDirectoryListing;
     std::string mAuthDomain;
     std::string mBasicAuthUsername;
     std::string mBasicAuthPassword;
+    //The table has a user because of the two above, not because of addBasicAuthUser
+    bool mIsBasicAuthUserAdded{false};
+    Credentials mCredentials;
     std::string mIpAccessControlList;
+    std::shared_ptr<const IpAccessControlList> mCompiledIpAccessControlList;
     std::string mHiddenFilePattern;
     std::string mExtraHeaders;
     size_t mUploadSizeLimit;
+    size_t mBodySizeLimit{0};
 
     // Statistics
     int mRequests{0};
@@ -0,0 +1,647 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <mongoose.h>
+
+#ifdef __linux__
+#include "EpollInterface.h"
+#endif
+#include "TlsContext.h"
+#include "Utils.h"
+
+//Forward secret key exchange, AEAD ciphers. TLS 1.3 suites are all of that already.
+static const char DEFAULT_CIPHERS[] = "ECDHE+AESGCM:ECDHE+CHACHA20";
+static const char DEFAULT_GROUPS[] = "X25519:P-256";
+
+//Set on a listener by TlsContext::listen
+struct TlsListener
+{
+    Mongoose::TlsContext *context;
+    std::function<void()> wakeup;
+};
+
+static std::string lastError()
+{
+    char message[256];
+    ERR_error_string_n(ERR_get_error(), message, sizeof(message));
+    return message;
+}
+
+static enum mg_ssl_if_result sslResult(SSL *ssl, int result)
+{
+    switch (SSL_get_error(ssl, result))
+    {
+    case SSL_ERROR_WANT_READ:
+        return MG_SSL_WANT_READ;
+    case SSL_ERROR_WANT_WRITE:
+        return MG_SSL_WANT_WRITE;
+    default:
+        return MG_SSL_ERROR;
+    }
+}
+
+//Runs on the event loop or on a worker: the socket is non blocking, it only goes as far as what already arrived
+static enum mg_ssl_if_result handshakeStep(SSL *ssl)
+{
+    ERR_clear_error();
+    int result = SSL_do_handshake(ssl);
+    return result == 1 ? MG_SSL_OK : sslResult(ssl, result);
+}
+
+namespace Mongoose
+{
+struct TlsContext::Connection
+{
+    TlsContext *context;
+    struct mg_connection *connection;   //nullptr once mongoose let go of it
+    struct mg_mgr *manager;
+    std::function<void()> wakeup;
+    SSL *ssl;
+
+    //Handshakes on workers use their own descriptor: mongoose may close its own while a worker still uses it
+    int socket;
+    bool isOffloaded;
+    bool isHandshaking;
+    bool hasResult;
+    enum mg_ssl_if_result result;
+
+    ~Connection()
+    {
+        SSL_free(ssl);
+#ifndef WIN32
+        if (isOffloaded)
+        {
+            close(socket);
+        }
+#endif
+    }
+};
+
+//Mongoose's SSL interface, the mg_ssl_if_* functions below forward to it
+struct TlsInterface
+{
+    static enum mg_ssl_if_result accept(struct mg_connection *nc, struct mg_connection *lc)
+    {
+        TlsListener *listener = static_cast<TlsListener *>(lc->ssl_if_data);
+        if (listener == NULL)
+        {
+            return MG_SSL_ERROR;
+        }
+
+        TlsContext *context = listener->context;
+        SSL *ssl = SSL_new(context->mContext);
+        if (ssl == NULL)
+        {
+            return MG_SSL_ERROR;
+        }
+
+        TlsContext::Connection *connection = new TlsContext::Connection();
+        connection->context = context;
+        connection->connection = nc;
+        connection->manager = nc->mgr;
+        connection->wakeup = listener->wakeup;
+        connection->ssl = ssl;
+        connection->socket = (int) nc->sock;
+        connection->isOffloaded = false;
+        connection->isHandshaking = false;
+        connection->hasResult = false;
+        connection->result = MG_SSL_OK;
+
+#ifndef WIN32
+        if (context->handshakeThreads() > 0)
+        {
+            connection->socket = dup((int) nc->sock);
+            connection->isOffloaded = connection->socket >= 0;
+        }
+#endif
+
+        if (connection->socket < 0 || SSL_set_fd(ssl, connection->socket) != 1)
+        {
+            delete connection;
+            return MG_SSL_ERROR;
+        }
+
+        SSL_set_accept_state(ssl);
+        nc->ssl_if_data = connection;
+        return MG_SSL_OK;
+    }
+
+    static enum mg_ssl_if_result handshake(struct mg_connection *nc)
+    {
+        TlsContext::Connection *connection = static_cast<TlsContext::Connection *>(nc->ssl_if_data);
+        TlsContext *context = connection->context;
+        enum mg_ssl_if_result result;
+
+        if (connection->isOffloaded)
+        {
+            std::lock_guard<std::mutex> lock(context->mHandshakesMutex);
+
+            if (connection->isHandshaking)
+            {
+                return MG_SSL_WANT_READ;
+            }
+
+            if (!connection->hasResult)
+            {
+                //Nothing is read from the socket until the worker is done, see TlsContext::resumeHandshakes
+                Utils::pauseReads(nc, Utils::HandshakePause);
+                context->startHandshake(connection);
+                return MG_SSL_WANT_READ;
+            }
+
+            connection->hasResult = false;
+            result = connection->result;
+        }
+        else
+        {
+            result = handshakeStep(connection->ssl);
+        }
+
+        if (result == MG_SSL_OK)
+        {
+            context->mHandshakes++;
+
+            if (SSL_session_reused(connection->ssl))
+            {
+                context->mResumedHandshakes++;
+            }
+
+#ifdef BIO_get_ktls_send
+            if (BIO_get_ktls_send(SSL_get_wbio(connection->ssl)))
+            {
+                context->mKernelTlsConnections++;
+            }
+#endif
+        }
+
+        return result;
+    }
+
+    static int read(struct mg_connection *nc, void *buffer, size_t size)
+    {
+        TlsContext::Connection *connection = static_cast<TlsContext::Connection *>(nc->ssl_if_data);
+
+        ERR_clear_error();
+        int result = SSL_read(connection->ssl, buffer, (int) size);
+
+        if (result > 0)
+        {
+            return result;
+        }
+
+        if (SSL_get_error(connection->ssl, result) == SSL_ERROR_ZERO_RETURN)
+        {
+            //The client said goodbye (close_notify): what is left to send still goes out
+            nc->flags |= MG_F_SEND_AND_CLOSE;
+            return 0;
+        }
+
+        return sslResult(connection->ssl, result);
+    }
+
+    static int write(struct mg_connection *nc, const void *data, size_t size)
+    {
+        TlsContext::Connection *connection = static_cast<TlsContext::Connection *>(nc->ssl_if_data);
+
+        ERR_clear_error();
+        int result = SSL_write(connection->ssl, data, (int) size);
+        return result > 0 ? result : sslResult(connection->ssl, result);
+    }
+
+    static void closeNotify(struct mg_connection *nc)
+    {
+        TlsContext::Connection *connection = static_cast<TlsContext::Connection *>(nc->ssl_if_data);
+
+        if (connection && (nc->flags & MG_F_SSL_HANDSHAKE_DONE))
+        {
+            SSL_shutdown(connection->ssl);
+        }
+    }
+
+    static void free(struct mg_connection *nc)
+    {
+        if (nc->ssl_if_data == NULL)
+        {
+            return;
+        }
+
+        if (nc->flags & MG_F_LISTENING)
+        {
+            delete static_cast<TlsListener *>(nc->ssl_if_data);
+            nc->ssl_if_data = NULL;
+            return;
+        }
+
+        TlsContext::Connection *connection = static_cast<TlsContext::Connection *>(nc->ssl_if_data);
+        TlsContext *context = connection->context;
+        nc->ssl_if_data = NULL;
+
+        {
+            std::lock_guard<std::mutex> lock(context->mHandshakesMutex);
+            connection->connection = nullptr;
+
+            if (connection->isHandshaking)
+            {
+                //The worker frees it once done
+                return;
+            }
+
+            auto& finished = context->mFinishedHandshakes;
+            finished.erase(std::remove(finished.begin(), finished.end(), connection), finished.end());
+        }
+
+        delete connection;
+    }
+};
+
+TlsContext::TlsContext():
+    mContext(SSL_CTX_new(TLS_server_method())),
+    mIsKernelTls(false),
+    mHandshakes(0),
+    mResumedHandshakes(0),
+    mKernelTlsConnections(0),
+    mHandshakeThreads(0),
+    mIsStopping(false)
+{
+    SSL_CTX_set_min_proto_version(mContext, TLS1_2_VERSION);
+
+    long options = SSL_OP_CIPHER_SERVER_PREFERENCE | SSL_OP_NO_COMPRESSION;
+#ifdef SSL_OP_NO_RENEGOTIATION
+    options |= SSL_OP_NO_RENEGOTIATION;
+#endif
+    SSL_CTX_set_options(mContext, options);
+
+    //Mongoose writes from its send buffer, which moves and may be written partially
+    SSL_CTX_set_mode(mContext, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER
+                     | SSL_MODE_RELEASE_BUFFERS);
+
+    SSL_CTX_set_cipher_list(mContext, DEFAULT_CIPHERS);
+    SSL_CTX_set1_groups_list(mContext, DEFAULT_GROUPS);
+
+    //Resumption: tickets are on by default, the server side cache needs a context id
+    static const unsigned char sessionContext[] = "mongoose-cpp";
+    SSL_CTX_set_session_id_context(mContext, sessionContext, sizeof(sessionContext) - 1);
+    SSL_CTX_set_session_cache_mode(mContext, SSL_SESS_CACHE_SERVER);
+
+    SSL_CTX_set_tlsext_status_cb(mContext, onOcspStatus);
+    SSL_CTX_set_tlsext_status_arg(mContext, this);
+}
+
+TlsContext::~TlsContext()
+{
+    {
+        std::lock_guard<std::mutex> lock(mHandshakesMutex);
+        mIsStopping = true;
+    }
+
+    mHandshakesCondition.notify_all();
+
+    for (auto& thread: mThreads)
+    {
+        thread.join();
+    }
+
+    //Only connections mongoose already let go of may be left
+    for (Connection *connection: mQueuedHandshakes)
+    {
+        delete connection;
+    }
+
+    SSL_CTX_free(mContext);
+}
+
+bool TlsContext::loadCertificate(const std::string &certificateFile, const std::string &keyFile, std::string *error)
+{
+    ERR_clear_error();
+
+    if (SSL_CTX_use_certificate_chain_file(mContext, certificateFile.c_str()) != 1
+        || SSL_CTX_use_PrivateKey_file(mContext, keyFile.c_str(), SSL_FILETYPE_PEM) != 1
+        || SSL_CTX_check_private_key(mContext) != 1)
+    {
+        if (error)
+        {
+            *error = lastError();
+        }
+
+        return false;
+    }
+
+    return true;
+}
+
+bool TlsContext::setCipherList(const std::string &ciphers)
+{
+    return SSL_CTX_set_cipher_list(mContext, ciphers.c_str()) == 1;
+}
+
+bool TlsContext::setGroups(const std::string &groups)
+{
+    return SSL_CTX_set1_groups_list(mContext, groups.c_str()) == 1;
+}
+
+bool TlsContext::hasSessionTickets() const
+{
+    return (SSL_CTX_get_options(mContext) & SSL_OP_NO_TICKET) == 0;
+}
+
+void TlsContext::setSessionTickets(bool enabled)
+{
+    if (enabled)
+    {
+        SSL_CTX_clear_options(mContext, SSL_OP_NO_TICKET);
+    }
+    else
+    {
+        SSL_CTX_set_options(mContext, SSL_OP_NO_TICKET);
+    }
+}
+
+void TlsContext::setSessionCache(size_t size, long timeout)
+{
+    SSL_CTX_set_session_cache_mode(mContext, size > 0 ? SSL_SESS_CACHE_SERVER : SSL_SESS_CACHE_OFF);
+    SSL_CTX_sess_set_cache_size(mContext, (long) size);
+    SSL_CTX_set_timeout(mContext, timeout);
+}
+
+bool TlsContext::setOcspResponseFile(const std::string &path)
+{
+    {
+        std::lock_guard<std::mutex> lock(mOcspMutex);
+        mOcspPath = path;
+    }
+
+    return reloadOcspResponse();
+}
+
+bool TlsContext::reloadOcspResponse()
+{
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock(mOcspMutex);
+        path = mOcspPath;
+    }
+
+    std::ifstream in(path, std::ifstream::binary);
+    std::shared_ptr<const std::string> response;
+
+    if (in.good())
+    {
+        response = std::make_shared<const std::string>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    //Handshakes already stapling the previous response keep their copy
+    std::lock_guard<std::mutex> lock(mOcspMutex);
+    mOcspResponse = response && !response->empty() ? response : nullptr;
+    return mOcspResponse != nullptr;
+}
+
+int TlsContext::onOcspStatus(SSL *ssl, void *argument)
+{
+    TlsContext *self = static_cast<TlsContext *>(argument);
+    std::shared_ptr<const std::string> response;
+    {
+        std::lock_guard<std::mutex> lock(self->mOcspMutex);
+        response = self->mOcspResponse;
+    }
+
+    if (!response)
+    {
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+
+    //OpenSSL takes ownership of the copy
+    unsigned char *copy = static_cast<unsigned char *>(OPENSSL_malloc(response->size()));
+    if (copy == NULL)
+    {
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+
+    memcpy(copy, response->data(), response->size());
+    SSL_set_tlsext_status_ocsp_resp(ssl, copy, (long) response->size());
+    return SSL_TLSEXT_ERR_OK;
+}
+
+bool TlsContext::isKernelTls() const
+{
+    return mIsKernelTls;
+}
+
+bool TlsContext::setKernelTls(bool enabled)
+{
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+    if (enabled)
+    {
+        SSL_CTX_set_options(mContext, SSL_OP_ENABLE_KTLS);
+    }
+    else
+    {
+        SSL_CTX_clear_options(mContext, SSL_OP_ENABLE_KTLS);
+    }
+
+    mIsKernelTls = enabled;
+    return true;
+#else
+    mIsKernelTls = false;
+    return !enabled;
+#endif
+}
+
+int TlsContext::handshakeThreads() const
+{
+    std::lock_guard<std::mutex> lock(mHandshakesMutex);
+    return mHandshakeThreads;
+}
+
+void TlsContext::setHandshakeThreads(int threads)
+{
+    std::lock_guard<std::mutex> lock(mHandshakesMutex);
+    //Workers already started stay until the context is destroyed
+    mHandshakeThreads = threads > 0 ? threads : 0;
+}
+
+uint64_t TlsContext::handshakes() const
+{
+    return mHandshakes;
+}
+
+uint64_t TlsContext::resumedHandshakes() const
+{
+    return mResumedHandshakes;
+}
+
+uint64_t TlsContext::kernelTlsConnections() const
+{
+    return mKernelTlsConnections;
+}
+
+SSL_CTX *TlsContext::nativeHandle() const
+{
+    return mContext;
+}
+
+void TlsContext::listen(struct mg_connection *listener, const std::function<void()> &wakeup)
+{
+    TlsListener *data = new TlsListener();
+    data->context = this;
+    data->wakeup = wakeup;
+
+    listener->ssl_if_data = data;
+    listener->flags |= MG_F_SSL;
+}
+
+void TlsContext::startHandshake(Connection *connection)
+{
+    //mHandshakesMutex is held
+    connection->isHandshaking = true;
+    mQueuedHandshakes.push_back(connection);
+
+    if ((int) mThreads.size() < mHandshakeThreads)
+    {
+        mThreads.push_back(std::thread(&TlsContext::runHandshakes, this));
+    }
+
+    mHandshakesCondition.notify_one();
+}
+
+void TlsContext::runHandshakes()
+{
+    std::unique_lock<std::mutex> lock(mHandshakesMutex);
+
+    while (true)
+    {
+        mHandshakesCondition.wait(lock, [this] { return mIsStopping || !mQueuedHandshakes.empty(); });
+
+        if (mQueuedHandshakes.empty())
+        {
+            return;
+        }
+
+        Connection *connection = mQueuedHandshakes.front();
+        mQueuedHandshakes.pop_front();
+
+        enum mg_ssl_if_result result = MG_SSL_ERROR;
+
+        if (connection->connection)
+        {
+            //The expensive part: the key exchange and the signature
+            lock.unlock();
+            result = handshakeStep(connection->ssl);
+            lock.lock();
+        }
+
+        connection->isHandshaking = false;
+
+        if (!connection->connection)
+        {
+            lock.unlock();
+            delete connection;
+            lock.lock();
+            continue;
+        }
+
+        connection->result = result;
+        connection->hasResult = true;
+        mFinishedHandshakes.push_back(connection);
+        std::function<void()> wakeup = connection->wakeup;
+
+        lock.unlock();
+        if (wakeup)
+        {
+            wakeup();
+        }
+        lock.lock();
+    }
+}
+
+void TlsContext::resumeHandshakes(struct mg_mgr *manager)
+{
+    std::vector<Connection *> resumed;
+    {
+        std::lock_guard<std::mutex> lock(mHandshakesMutex);
+
+        if (mFinishedHandshakes.empty())
+        {
+            return;
+        }
+
+        auto others = std::partition(mFinishedHandshakes.begin(), mFinishedHandshakes.end(),
+                                     [manager](Connection *connection) { return connection->manager == manager; });
+        resumed.assign(mFinishedHandshakes.begin(), others);
+        mFinishedHandshakes.erase(mFinishedHandshakes.begin(), others);
+    }
+
+    //On the loop thread: none of these can be freed meanwhile
+    for (Connection *connection: resumed)
+    {
+        struct mg_connection *nc = connection->connection;
+        Utils::resumeReads(nc, Utils::HandshakePause);
+
+        //Mongoose picks the result up through mg_ssl_if_handshake, then reads what the client sent since
+        mg_if_can_recv_cb(nc);
+
+        if ((nc->flags & MG_F_SSL_HANDSHAKE_DONE) && nc->ssl_if_data == connection && SSL_has_pending(connection->ssl))
+        {
+            //Records the handshake read along, the socket won't tell about them
+            mg_if_can_recv_cb(nc);
+        }
+
+#ifdef __linux__
+        EpollInterface::refresh(nc);
+#endif
+    }
+}
+}
+
+void mg_ssl_if_init()
+{
+    OPENSSL_init_ssl(0, NULL);
+}
+
+enum mg_ssl_if_result mg_ssl_if_conn_init(struct mg_connection *nc, const struct mg_ssl_if_conn_params *params,
+                                          const char **err_msg)
+{
+    //Certificates aren't given through mg_bind_opts/mg_connect_opts here
+    if (err_msg)
+    {
+        *err_msg = "TLS is configured with Mongoose::TlsContext";
+    }
+
+    return MG_SSL_ERROR;
+}
+
+enum mg_ssl_if_result mg_ssl_if_conn_accept(struct mg_connection *nc, struct mg_connection *lc)
+{
+    return Mongoose::TlsInterface::accept(nc, lc);
+}
+
+enum mg_ssl_if_result mg_ssl_if_handshake(struct mg_connection *nc)
+{
+    return Mongoose::TlsInterface::handshake(nc);
+}
+
+int mg_ssl_if_read(struct mg_connection *nc, void *buf, size_t len)
+{
+    return Mongoose::TlsInterface::read(nc, buf, len);
+}
+
+int mg_ssl_if_write(struct mg_connection *nc, const void *data, size_t len)
+{
+    return Mongoose::TlsInterface::write(nc, data, len);
+}
+
+void mg_ssl_if_conn_close_notify(struct mg_connection *nc)
+{
+    Mongoose::TlsInterface::closeNotify(nc);
+}
+
+void mg_ssl_if_conn_free(struct mg_connection *nc)
+{
+    Mongoose::TlsInterface::free(nc);
+}
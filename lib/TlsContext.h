@@ -0,0 +1,160 @@
+#ifndef _MONGOOSE_TLS_CONTEXT_H
+#define _MONGOOSE_TLS_CONTEXT_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * The TLS configuration of one or more listeners (see Server::addTlsBindAddress), built on OpenSSL.
+ *
+ * It is mongoose's SSL interface (MG_ENABLE_SSL): mongoose still reads, writes and polls the sockets,
+ * TlsContext decides how connections are set up.
+ * - Key exchange is always ephemeral (ECDHE), and sessions are resumed from tickets or the server side cache,
+ *   which skips the expensive part of the handshake for returning clients.
+ * - An OCSP response read from a local file is stapled to the handshakes of the clients asking for one.
+ * - With kernel TLS, records are encrypted by the kernel once the handshake is over: sending costs no more
+ *   user space copies than it does in clear.
+ * - Handshakes can run on worker threads, so a burst of new clients doesn't stall the event loop.
+ *
+ * Must outlive the servers using it. Only built with HAS_OPENSSL.
+ */
+typedef struct ssl_ctx_st SSL_CTX;
+typedef struct ssl_st SSL;
+struct mg_connection;
+struct mg_mgr;
+
+namespace Mongoose
+{
+class TlsContext
+{
+public:
+    TlsContext();
+    ~TlsContext();
+
+    TlsContext(const TlsContext&) = delete;
+    TlsContext& operator=(const TlsContext&) = delete;
+
+    /**
+     * @brief loadCertificate
+     * @param certificateFile - PEM, the server's certificate followed by its intermediates
+     * @param keyFile - PEM, its private key
+     * @param error - set to OpenSSL's explanation if it fails
+     */
+    bool loadCertificate(const std::string& certificateFile, const std::string& keyFile, std::string *error = nullptr);
+
+    /**
+     * @brief setCipherList - the TLS 1.2 cipher suites, in OpenSSL's syntax. The default only allows ECDHE with AEAD.
+     */
+    bool setCipherList(const std::string& ciphers);
+
+    /**
+     * @brief setGroups - the curves offered for the key exchange, like "X25519:P-256" (the default)
+     */
+    bool setGroups(const std::string& groups);
+
+    /**
+     * @brief hasSessionTickets / setSessionTickets - lets clients resume sessions from a ticket they keep,
+     * which works across the processes of a prefork server if the context was created before forking. On by default.
+     */
+    bool hasSessionTickets() const;
+    void setSessionTickets(bool enabled);
+
+    /**
+     * @brief setSessionCache - the sessions kept server side, for the clients resuming without tickets
+     * @param size - 0 turns the cache off
+     * @param timeout - in seconds, also how long tickets stay valid
+     */
+    void setSessionCache(size_t size, long timeout = 7200);
+
+    /**
+     * @brief setOcspResponseFile - staples the (DER encoded) OCSP response in path to the handshakes.
+     * The file is read right away, refresh it with reloadOcspResponse() when it is renewed.
+     * @return false if it can't be read, nothing is stapled then
+     */
+    bool setOcspResponseFile(const std::string& path);
+
+    /**
+     * @brief reloadOcspResponse - reads the OCSP response file again. Can be called from any thread.
+     */
+    bool reloadOcspResponse();
+
+    /**
+     * @brief isKernelTls / setKernelTls - hands the record layer over to the kernel (Linux kTLS) after handshakes,
+     * when both OpenSSL and the kernel (tls module) support it. Connections go on in user space otherwise.
+     * @return false if this OpenSSL can't do it
+     */
+    bool isKernelTls() const;
+    bool setKernelTls(bool enabled);
+
+    /**
+     * @brief handshakeThreads / setHandshakeThreads - how many worker threads run the handshakes.
+     * 0 (the default) runs them on the event loop. A connection is paused while a worker runs its handshake,
+     * the others go on being served.
+     */
+    int handshakeThreads() const;
+    void setHandshakeThreads(int threads);
+
+    /**
+     * @brief handshakes / resumedHandshakes / kernelTlsConnections - counts since the context was created
+     */
+    uint64_t handshakes() const;
+    uint64_t resumedHandshakes() const;
+    uint64_t kernelTlsConnections() const;
+
+    /**
+     * @brief nativeHandle - the OpenSSL context, for settings TlsContext has no method for
+     */
+    SSL_CTX *nativeHandle() const;
+
+    /**
+     * @brief listen - makes listener accept TLS connections, Server::addTlsBindAddress does that
+     * @param wakeup - wakes the event loop listener is polled from up, for handshakes finished on a worker
+     */
+    void listen(struct mg_connection *listener, const std::function<void()>& wakeup);
+
+    /**
+     * @brief resumeHandshakes - goes on with the connections of manager whose handshake step a worker finished.
+     * Must be called from the thread polling manager, Server does that.
+     */
+    void resumeHandshakes(struct mg_mgr *manager);
+
+private:
+    struct Connection;
+
+    //Mongoose's SSL interface, see TlsContext.cpp
+    friend struct TlsInterface;
+
+    static int onOcspStatus(SSL *ssl, void *argument);
+    void runHandshakes();
+    void startHandshake(Connection *connection);
+
+    SSL_CTX *mContext;
+    std::atomic<bool> mIsKernelTls;
+    std::atomic<uint64_t> mHandshakes;
+    std::atomic<uint64_t> mResumedHandshakes;
+    std::atomic<uint64_t> mKernelTlsConnections;
+
+    std::string mOcspPath;
+    std::shared_ptr<const std::string> mOcspResponse;
+    mutable std::mutex mOcspMutex;
+
+    //Handshakes queued for, or finished by, the workers. A connection closed meanwhile is freed by whoever sees it last.
+    int mHandshakeThreads;
+    std::vector<std::thread> mThreads;
+    std::deque<Connection *> mQueuedHandshakes;
+    std::vector<Connection *> mFinishedHandshakes;
+    mutable std::mutex mHandshakesMutex;
+    std::condition_variable mHandshakesCondition;
+    bool mIsStopping;
+};
+}
+
+#endif
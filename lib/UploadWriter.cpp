@@ -0,0 +1,258 @@
+#include <cerrno>
+#include <cstdio>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "UploadWriter.h"
+
+namespace Mongoose
+{
+UploadFile::UploadFile(const std::string &directory, size_t preallocate):
+    mDirectory(directory),
+    mPreallocate(preallocate),
+    mSize(0),
+    mFd(-1),
+    mIsAnonymous(false),
+    mIsReleased(false),
+    mPendingJobs(0),
+    mIsFinished(false),
+    mHasFailed(false)
+{
+}
+
+UploadFile::~UploadFile()
+{
+    if (mFd >= 0 && !mIsReleased)
+    {
+#ifdef WIN32
+        _close(mFd);
+#else
+        close(mFd);
+#endif
+
+        if (!mIsAnonymous)
+        {
+            remove(mPath.c_str());
+        }
+    }
+}
+
+bool UploadFile::isDone() const
+{
+    return mIsFinished && mPendingJobs == 0;
+}
+
+bool UploadFile::hasFailed() const
+{
+    return mHasFailed;
+}
+
+size_t UploadFile::size() const
+{
+    return mSize;
+}
+
+int UploadFile::release(std::string &path)
+{
+    mIsReleased = true;
+    path = mPath;
+    return mFd;
+}
+
+UploadWriter::UploadWriter(const std::function<void()> &onProgress):
+    mOnProgress(onProgress),
+    mQueuedBytes(0),
+    mIsStopping(false)
+{
+    mThread = std::thread(&UploadWriter::run, this);
+}
+
+UploadWriter::~UploadWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mIsStopping = true;
+    }
+
+    mCondition.notify_all();
+    mThread.join();
+}
+
+std::shared_ptr<UploadFile> UploadWriter::open(const std::string &directory, size_t preallocate)
+{
+    std::shared_ptr<UploadFile> file(new UploadFile(directory, preallocate));
+    queue(Job{Open, file, std::string()});
+    return file;
+}
+
+void UploadWriter::write(const std::shared_ptr<UploadFile> &file, const char *data, size_t size)
+{
+    file->mSize += size;
+    mQueuedBytes += size;
+    queue(Job{Write, file, std::string(data, size)});
+}
+
+void UploadWriter::finish(const std::shared_ptr<UploadFile> &file)
+{
+    queue(Job{Finish, file, std::string()});
+}
+
+size_t UploadWriter::queuedBytes() const
+{
+    return mQueuedBytes;
+}
+
+void UploadWriter::queue(Job &&job)
+{
+    job.file->mPendingJobs++;
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mJobs.push_back(std::move(job));
+    }
+
+    mCondition.notify_one();
+}
+
+void UploadWriter::run()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    while (true)
+    {
+        mCondition.wait(lock, [this] { return mIsStopping || !mJobs.empty(); });
+
+        if (mJobs.empty())
+        {
+            //Only stop once everything queued is written
+            break;
+        }
+
+        Job job = std::move(mJobs.front());
+        mJobs.pop_front();
+        bool isQueueEmpty = mJobs.empty();
+        lock.unlock();
+
+        execute(job);
+        mQueuedBytes -= job.data.size();
+        bool isFileDone = --job.file->mPendingJobs == 0 && job.file->mIsFinished;
+
+        if (mOnProgress && (isFileDone || isQueueEmpty))
+        {
+            mOnProgress();
+        }
+
+        //The file may close here, outside of the lock
+        job.file.reset();
+        lock.lock();
+    }
+}
+
+void UploadWriter::execute(Job &job)
+{
+    UploadFile& file = *job.file;
+
+    if (file.mHasFailed && job.type != Finish)
+    {
+        return;
+    }
+
+    switch (job.type)
+    {
+    case Open:
+    {
+#if defined(O_TMPFILE) && defined(__linux__)
+        //Anonymous, so concurrent uploads can't clash and nothing is left behind if the server dies
+        file.mFd = ::open(file.mDirectory.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+
+        if (file.mFd >= 0)
+        {
+            file.mPath = "/proc/self/fd/" + std::to_string(file.mFd);
+            file.mIsAnonymous = true;
+        }
+#endif
+
+        if (file.mFd < 0)
+        {
+            std::string pattern = file.mDirectory + "/upload-XXXXXX";
+            std::vector<char> path(pattern.begin(), pattern.end());
+            path.push_back('\0');
+
+#ifdef WIN32
+            if (_mktemp_s(path.data(), path.size()) == 0)
+            {
+                file.mFd = _open(path.data(), _O_CREAT | _O_EXCL | _O_RDWR | _O_BINARY, _S_IREAD | _S_IWRITE);
+            }
+#else
+            file.mFd = mkstemp(path.data());
+#endif
+            file.mPath = path.data();
+        }
+
+        if (file.mFd < 0)
+        {
+            file.mHasFailed = true;
+            break;
+        }
+
+#if defined(__linux__) && defined(FALLOC_FL_KEEP_SIZE)
+        if (file.mPreallocate > 0)
+        {
+            //Best effort: not every filesystem supports it
+            fallocate(file.mFd, FALLOC_FL_KEEP_SIZE, 0, (off_t)file.mPreallocate);
+        }
+#endif
+        break;
+    }
+    case Write:
+    {
+        const char *data = job.data.data();
+        size_t remaining = job.data.size();
+
+        while (remaining > 0)
+        {
+#ifdef WIN32
+            int written = _write(file.mFd, data, (unsigned int)remaining);
+#else
+            ssize_t written = ::write(file.mFd, data, remaining);
+#endif
+            if (written < 0 && errno == EINTR)
+            {
+                continue;
+            }
+
+            if (written <= 0)
+            {
+                file.mHasFailed = true;
+                break;
+            }
+
+            data += written;
+            remaining -= written;
+        }
+        break;
+    }
+    case Finish:
+    {
+#if defined(__linux__) && defined(FALLOC_FL_KEEP_SIZE)
+        if (!file.mHasFailed && file.mPreallocate > file.mSize)
+        {
+            //Gives back the blocks reserved past the end of the file
+            ftruncate(file.mFd, (off_t)file.mSize);
+        }
+#endif
+        file.mIsFinished = true;
+        break;
+    }
+    }
+}
+}
@@ -0,0 +1,129 @@
+#ifndef _MONGOOSE_UPLOAD_WRITER_H
+#define _MONGOOSE_UPLOAD_WRITER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/**
+ * Writes uploaded files to disk on a background thread, so that a slow disk never stalls the event loop.
+ *
+ * Every file is created under its own unique name: on Linux as an anonymous O_TMPFILE that only gets
+ * a name if the handler links it somewhere (see Request::MultipartEntity::linkTo), elsewhere through mkstemp.
+ * Space for the expected size is reserved up front with fallocate when the filesystem supports it.
+ */
+namespace Mongoose
+{
+class UploadWriter;
+class UploadFile
+{
+public:
+    ~UploadFile();
+
+    /**
+     * @brief isDone
+     * @return true once the file is finished and everything queued for it is written
+     */
+    bool isDone() const;
+    bool hasFailed() const;
+
+    /**
+     * @brief size
+     * @return the number of bytes queued for the file so far
+     */
+    size_t size() const;
+
+    /**
+     * @brief release - hands the file over: it is no longer closed nor deleted when this object goes away
+     * @param path - set to a path the file can be opened with for as long as the descriptor is open
+     * @return the file descriptor, -1 if the file couldn't be created
+     */
+    int release(std::string& path);
+
+private:
+    friend class UploadWriter;
+    UploadFile(const std::string& directory, size_t preallocate);
+
+    std::string mDirectory;
+    size_t mPreallocate;
+    size_t mSize;
+
+    int mFd;
+    std::string mPath;
+    bool mIsAnonymous;
+    bool mIsReleased;
+
+    std::atomic<size_t> mPendingJobs;
+    std::atomic_bool mIsFinished;
+    std::atomic_bool mHasFailed;
+};
+
+class UploadWriter
+{
+public:
+    /**
+     * @param onProgress - called from the writer thread whenever a file is done or the queue runs empty,
+     * typically to wake the event loop up
+     */
+    explicit UploadWriter(const std::function<void()>& onProgress);
+    virtual ~UploadWriter();
+
+    /**
+     * @brief open - queues the creation of a new file
+     * @param directory - where the file is created
+     * @param preallocate - the expected size of the file, 0 if unknown
+     */
+    std::shared_ptr<UploadFile> open(const std::string& directory, size_t preallocate = 0);
+
+    /**
+     * @brief write - queues data to be appended to file, the data is copied
+     */
+    void write(const std::shared_ptr<UploadFile>& file, const char *data, size_t size);
+
+    /**
+     * @brief finish - queues the end of file: what was preallocated but not used is given back
+     */
+    void finish(const std::shared_ptr<UploadFile>& file);
+
+    /**
+     * @brief queuedBytes
+     * @return the number of bytes waiting to be written, across all files
+     */
+    size_t queuedBytes() const;
+
+private:
+    enum JobType
+    {
+        Open,
+        Write,
+        Finish
+    };
+
+    struct Job
+    {
+        JobType type;
+        std::shared_ptr<UploadFile> file;
+        std::string data;
+    };
+
+    void queue(Job&& job);
+    void run();
+    void execute(Job& job);
+
+    std::function<void()> mOnProgress;
+    std::atomic<size_t> mQueuedBytes;
+
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    std::deque<Job> mJobs;
+    bool mIsStopping;
+    std::thread mThread;
+};
+}
+
+#endif
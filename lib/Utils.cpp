@@ -1,6 +1,7 @@
 #include <iostream>
 #include <sstream>
 #include <ctype.h>
+#include <string.h>
 
 #ifndef WIN32
 #include <unistd.h>
@@ -11,11 +12,55 @@
 #include <sys/timeb.h>
 #endif
 
+#include <mongoose.h>
+
 #include "Utils.h"
 
+//One flag per Utils::ReadPause, the other user flags belong to Server
+static const unsigned long READ_PAUSE_FLAGS[] = { MG_F_USER_3, MG_F_USER_4, MG_F_USER_5 };
+static const unsigned long ALL_READ_PAUSE_FLAGS = MG_F_USER_3 | MG_F_USER_4 | MG_F_USER_5;
+
 static char charset[] = "abcdeghijklmnpqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
 #define CHARSET_SIZE (sizeof(charset)/sizeof(char))
 
+static const uint64_t PRIME64_1 = 11400714785074694791ULL;
+static const uint64_t PRIME64_2 = 14029467366897019727ULL;
+static const uint64_t PRIME64_3 = 1609587929392839161ULL;
+static const uint64_t PRIME64_4 = 9650029242287828579ULL;
+static const uint64_t PRIME64_5 = 2870177450012600261ULL;
+
+static inline uint64_t rotateLeft(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static inline uint64_t read64(const unsigned char *data)
+{
+    uint64_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static inline uint32_t read32(const unsigned char *data)
+{
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static inline uint64_t hashRound(uint64_t accumulator, uint64_t input)
+{
+    accumulator += input * PRIME64_2;
+    accumulator = rotateLeft(accumulator, 31);
+    return accumulator * PRIME64_1;
+}
+
+static inline uint64_t mergeRound(uint64_t accumulator, uint64_t value)
+{
+    accumulator ^= hashRound(0, value);
+    return accumulator * PRIME64_1 + PRIME64_4;
+}
+
 namespace Mongoose
 {
     std::string Utils::htmlEntities(const std::string& data)
@@ -99,4 +144,86 @@ namespace Mongoose
         return result;
     }
 
+    uint64_t Utils::hash64(const void *data, size_t size, uint64_t seed)
+    {
+        const unsigned char *position = (const unsigned char *) data;
+        const unsigned char *end = position + size;
+        uint64_t hash;
+
+        if (size >= 32)
+        {
+            uint64_t lane1 = seed + PRIME64_1 + PRIME64_2;
+            uint64_t lane2 = seed + PRIME64_2;
+            uint64_t lane3 = seed;
+            uint64_t lane4 = seed - PRIME64_1;
+
+            //The lanes don't depend on each other, the CPU runs them side by side
+            for (const unsigned char *limit = end - 32; position <= limit; position += 32)
+            {
+                lane1 = hashRound(lane1, read64(position));
+                lane2 = hashRound(lane2, read64(position + 8));
+                lane3 = hashRound(lane3, read64(position + 16));
+                lane4 = hashRound(lane4, read64(position + 24));
+            }
+
+            hash = rotateLeft(lane1, 1) + rotateLeft(lane2, 7) + rotateLeft(lane3, 12) + rotateLeft(lane4, 18);
+            hash = mergeRound(hash, lane1);
+            hash = mergeRound(hash, lane2);
+            hash = mergeRound(hash, lane3);
+            hash = mergeRound(hash, lane4);
+        }
+        else
+        {
+            hash = seed + PRIME64_5;
+        }
+
+        hash += (uint64_t) size;
+
+        for (; position + 8 <= end; position += 8)
+        {
+            hash ^= hashRound(0, read64(position));
+            hash = rotateLeft(hash, 27) * PRIME64_1 + PRIME64_4;
+        }
+
+        if (position + 4 <= end)
+        {
+            hash ^= (uint64_t) read32(position) * PRIME64_1;
+            hash = rotateLeft(hash, 23) * PRIME64_2 + PRIME64_3;
+            position += 4;
+        }
+
+        for (; position < end; position++)
+        {
+            hash ^= (*position) * PRIME64_5;
+            hash = rotateLeft(hash, 11) * PRIME64_1;
+        }
+
+        hash ^= hash >> 33;
+        hash *= PRIME64_2;
+        hash ^= hash >> 29;
+        hash *= PRIME64_3;
+        hash ^= hash >> 32;
+        return hash;
+    }
+
+    void Utils::pauseReads(struct mg_connection *connection, ReadPause reason)
+    {
+        connection->flags |= READ_PAUSE_FLAGS[reason];
+        connection->recv_mbuf_limit = 0;
+    }
+
+    void Utils::resumeReads(struct mg_connection *connection, ReadPause reason)
+    {
+        connection->flags &= ~READ_PAUSE_FLAGS[reason];
+
+        if (!(connection->flags & (ALL_READ_PAUSE_FLAGS | MG_F_SEND_AND_CLOSE | MG_F_CLOSE_IMMEDIATELY)))
+        {
+            connection->recv_mbuf_limit = ~0;
+        }
+    }
+
+    bool Utils::isReadPaused(struct mg_connection *connection, ReadPause reason)
+    {
+        return (connection->flags & READ_PAUSE_FLAGS[reason]) != 0;
+    }
 }
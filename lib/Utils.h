@@ -1,18 +1,45 @@
 #ifndef _MONGOOSE_UTILS_H
 #define _MONGOOSE_UTILS_H
 
+#include <cstddef>
+#include <cstdint>
 #include <iostream>
 
+struct mg_connection;
+
 namespace Mongoose
 {
     class Utils
     {
         public:
+            //Why a connection's reads are paused, see pauseReads
+            enum ReadPause
+            {
+                MemoryPause,        //Server::setMemoryLimit
+                UploadPause,        //The disk doesn't keep up with an upload
+                HandshakePause      //A TLS handshake runs on a worker thread
+            };
+
             static std::string htmlEntities(const std::string& data);
             static void sleep(int ms);
             static int getTime();
             static std::string randomAlphanumericString(int length = 30);
             static std::string sanitizeFilename(const std::string& filename);
+
+            /**
+             * @brief hash64 - a fast, non cryptographic 64 bits hash (XXH64). Four independent lanes
+             * digest 32 bytes per round, so it runs at memory speed on large inputs.
+             */
+            static uint64_t hash64(const void *data, size_t size, uint64_t seed = 0);
+
+            /**
+             * @brief pauseReads / resumeReads - stops and restarts reading from connection for one reason.
+             * Reads only resume once every reason they were paused for is gone, and never on a closing connection.
+             * Must be called from the thread polling connection.
+             */
+            static void pauseReads(struct mg_connection *connection, ReadPause reason);
+            static void resumeReads(struct mg_connection *connection, ReadPause reason);
+            static bool isReadPaused(struct mg_connection *connection, ReadPause reason);
     };
 }
 
@@ -0,0 +1,74 @@
+#include <mongoose.h>
+
+#include "Request.h"
+#include "WebSocket.h"
+
+namespace Mongoose
+{
+WebSocket::WebSocket(const std::shared_ptr<Request> &request, const std::shared_ptr<FrameQueue> &queue):
+    mRequest(request),
+    mQueue(queue)
+{
+}
+
+bool WebSocket::send(const std::string &message, bool binary)
+{
+    return sendFrame(encodeFrame(message.data(), message.size(), binary ? WEBSOCKET_OP_BINARY : WEBSOCKET_OP_TEXT));
+}
+
+bool WebSocket::sendFrame(const SharedFrame &frame)
+{
+    return mQueue->push(frame);
+}
+
+void WebSocket::close()
+{
+    static const SharedFrame closeFrame = encodeFrame(NULL, 0, WEBSOCKET_OP_CLOSE);
+    mQueue->push(closeFrame);
+    mQueue->close();
+}
+
+bool WebSocket::isValid() const
+{
+    return mQueue->isValid();
+}
+
+std::shared_ptr<Request> WebSocket::request() const
+{
+    return mRequest;
+}
+
+std::shared_ptr<FrameQueue> WebSocket::queue() const
+{
+    return mQueue;
+}
+
+SharedFrame WebSocket::encodeFrame(const char *data, size_t size, int opcode)
+{
+    std::string *frame = new std::string();
+    frame->reserve(size + 10);
+    frame->push_back((char)(0x80 | (opcode & 0x0f)));
+
+    if (size < 126)
+    {
+        frame->push_back((char) size);
+    }
+    else if (size < 65536)
+    {
+        frame->push_back((char) 126);
+        frame->push_back((char)(size >> 8));
+        frame->push_back((char)(size & 0xff));
+    }
+    else
+    {
+        frame->push_back((char) 127);
+        for (int shift = 56; shift >= 0; shift -= 8)
+        {
+            frame->push_back((char)(((uint64_t) size >> shift) & 0xff));
+        }
+    }
+
+    frame->append(data, size);
+    return SharedFrame(frame);
+}
+}
@@ -0,0 +1,81 @@
+#ifndef _MONGOOSE_WEBSOCKET_H
+#define _MONGOOSE_WEBSOCKET_H
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "FrameQueue.h"
+
+/**
+ * A websocket connection accepted on a route registered with Controller::registerWebSocketRoute
+ */
+namespace Mongoose
+{
+class Request;
+class WebSocket;
+
+typedef std::function<void(const std::shared_ptr<WebSocket>&)> WebSocketEventHandler;
+typedef std::function<void(const std::shared_ptr<WebSocket>&, const std::string&, bool)> WebSocketMessageHandler;
+
+struct WebSocketHandler
+{
+    /**
+     * @brief onOpen - called once the handshake completed
+     */
+    WebSocketEventHandler onOpen;
+
+    /**
+     * @brief onMessage - called for every complete message received, with the message and whether it is binary
+     */
+    WebSocketMessageHandler onMessage;
+
+    /**
+     * @brief onClose - called when the connection is closed, the websocket is invalid from then on
+     */
+    WebSocketEventHandler onClose;
+};
+
+class WebSocket
+{
+public:
+    WebSocket(const std::shared_ptr<Request>& request, const std::shared_ptr<FrameQueue>& queue);
+
+    /**
+     * @brief send - sends a message, can be called from any thread
+     * @return false if the connection is gone or too slow to keep up
+     */
+    bool send(const std::string& message, bool binary = false);
+
+    /**
+     * @brief sendFrame - sends a frame built with encodeFrame, without copying it
+     */
+    bool sendFrame(const SharedFrame& frame);
+
+    /**
+     * @brief close - closes the connection once everything sent so far has been written
+     */
+    void close();
+
+    bool isValid() const;
+
+    /**
+     * @brief request
+     * @return the handshake request, for its headers, cookies, username etc...
+     */
+    std::shared_ptr<Request> request() const;
+    std::shared_ptr<FrameQueue> queue() const;
+
+    /**
+     * @brief encodeFrame - encodes a whole (unmasked, server to client) websocket frame
+     * @param opcode - one of the WEBSOCKET_OP_* opcodes
+     */
+    static SharedFrame encodeFrame(const char *data, size_t size, int opcode);
+
+private:
+    std::shared_ptr<Request> mRequest;
+    std::shared_ptr<FrameQueue> mQueue;
+};
+}
+
+#endif
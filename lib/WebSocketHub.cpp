@@ -0,0 +1,120 @@
+#include <algorithm>
+#include <mongoose.h>
+
+#include "WebSocket.h"
+#include "WebSocketHub.h"
+
+namespace Mongoose
+{
+WebSocketHub::WebSocketHub()
+{
+}
+
+WebSocketHub::Subscribers &WebSocketHub::writableSubscribers(const std::string &topic)
+{
+    auto& subscribers = mTopics[topic];
+
+    if (!subscribers)
+    {
+        subscribers = std::make_shared<Subscribers>();
+    }
+    else if (subscribers.use_count() > 1)
+    {
+        //A publisher is going through this list, it keeps it as it was
+        subscribers = std::make_shared<Subscribers>(*subscribers);
+    }
+
+    return *subscribers;
+}
+
+void WebSocketHub::subscribe(const std::shared_ptr<WebSocket> &socket, const std::string &topic)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto& subscribers = writableSubscribers(topic);
+
+    if (std::find(subscribers.begin(), subscribers.end(), socket) == subscribers.end())
+    {
+        subscribers.push_back(socket);
+    }
+}
+
+void WebSocketHub::unsubscribe(const std::shared_ptr<WebSocket> &socket, const std::string &topic)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto it = mTopics.find(topic);
+
+    if (it != mTopics.end())
+    {
+        auto& subscribers = writableSubscribers(topic);
+        subscribers.erase(std::remove(subscribers.begin(), subscribers.end(), socket), subscribers.end());
+
+        if (subscribers.empty())
+        {
+            mTopics.erase(it);
+        }
+    }
+}
+
+size_t WebSocketHub::publish(const std::string &topic, const std::string &message, bool binary)
+{
+    SharedFrame frame = WebSocket::encodeFrame(message.data(), message.size(), binary ? WEBSOCKET_OP_BINARY : WEBSOCKET_OP_TEXT);
+    std::shared_ptr<const Subscribers> subscribers;
+    std::vector<std::shared_ptr<WebSocket>> gone;
+
+    //Keeps the messages of concurrent publishers in the same order on every subscriber
+    std::lock_guard<std::mutex> publishLock(mPublishMutex);
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto it = mTopics.find(topic);
+
+        if (it == mTopics.end())
+        {
+            return 0;
+        }
+
+        subscribers = it->second;
+    }
+
+    //Queued without holding mMutex, the event loop thread may be subscribing meanwhile
+    for (const auto& subscriber: *subscribers)
+    {
+        if (!subscriber->sendFrame(frame))
+        {
+            //Gone or too slow
+            gone.push_back(subscriber);
+        }
+    }
+
+    //Let go of the list first, or dropping the subscribers would copy it
+    size_t count = subscribers->size() - gone.size();
+    subscribers.reset();
+
+    for (const auto& subscriber: gone)
+    {
+        unsubscribe(subscriber, topic);
+    }
+
+    return count;
+}
+
+size_t WebSocketHub::subscriberCount(const std::string &topic) const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto it = mTopics.find(topic);
+    return it != mTopics.end() ? it->second->size() : 0;
+}
+
+std::vector<std::string> WebSocketHub::topics() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    std::vector<std::string> result;
+
+    for (const auto& topic: mTopics)
+    {
+        result.push_back(topic.first);
+    }
+
+    return result;
+}
+}
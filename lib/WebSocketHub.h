@@ -0,0 +1,47 @@
+#ifndef _MONGOOSE_WEBSOCKET_HUB_H
+#define _MONGOOSE_WEBSOCKET_HUB_H
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Topic based broadcasting to websockets.
+ * A published message is encoded into a frame once and that same frame is queued to every subscriber.
+ * Subscribers that disconnect, or are evicted for being too slow, are dropped from their topics.
+ */
+namespace Mongoose
+{
+class WebSocket;
+class WebSocketHub
+{
+public:
+    WebSocketHub();
+
+    void subscribe(const std::shared_ptr<WebSocket>& socket, const std::string& topic);
+    void unsubscribe(const std::shared_ptr<WebSocket>& socket, const std::string& topic);
+
+    /**
+     * @brief publish - sends a message to every subscriber of topic, can be called from any thread
+     * @return the number of subscribers the message was queued to
+     */
+    size_t publish(const std::string& topic, const std::string& message, bool binary = false);
+
+    size_t subscriberCount(const std::string& topic) const;
+    std::vector<std::string> topics() const;
+
+private:
+    typedef std::vector<std::shared_ptr<WebSocket>> Subscribers;
+
+    //Publishers share a topic's list instead of copying it: it is copied on write, only while one of them holds it
+    Subscribers& writableSubscribers(const std::string& topic);
+
+    mutable std::mutex mMutex;
+    std::mutex mPublishMutex;
+    std::map<std::string, std::shared_ptr<Subscribers>> mTopics;
+};
+}
+
+#endif